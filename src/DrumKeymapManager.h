@@ -1,27 +1,47 @@
 // DrumKeymapManager.h
 #pragma once
-#include <unordered_map>
+#include <array>
 #include <vector>
 #include <cstdint>
 
+// ドラムキット（GSのドラムマップ番号 mm = 1～15 をそのままキット番号として使う）
+#define DRUM_KIT_COUNT 16
+#define DRUM_KIT_DEFAULT 1   // ./pcm/ のキット（GS MAP1、CH10の初期値）
+
+// ドラムPCMの格納形式
+enum DrumPcmFormat : int32_t {
+    DRUM_PCM_FORMAT_RAW8 = 0,    // Raw Unsigned 8bit（PCMモード0）
+    DRUM_PCM_FORMAT_ADPCM4 = 1   // 4bit ADPCMブロック（PCMモード6、s3hs_core/lib/adpcm.cpp）
+};
+
 struct DrumSampleInfo {
     int32_t pcmIndex;
     int32_t sampleRate;
-    int32_t pcmLength;
+    int32_t pcmLength;   // バイト数（ADPCMではブロック列の長さ）
+    int32_t format;      // DrumPcmFormat
 };
 
 class DrumKeymapManager {
 public:
-    // ドラムチャンネルごとにノート→PCM情報を管理
-    void assignNoteToSample(uint8_t midiChannel, uint8_t noteNumber, int32_t pcmIndex, int32_t sampleRate, int32_t pcmLength);
-    DrumSampleInfo getSampleInfo(uint8_t midiChannel, uint8_t noteNumber) const;
+    DrumKeymapManager();
+
+    // キットごとにノート→PCM情報を管理（pcmIndex = -1で未割り当て）
+    void assignNoteToSample(uint8_t kit, uint8_t noteNumber, int32_t pcmIndex, int32_t sampleRate, int32_t pcmLength,
+                            int32_t format = DRUM_PCM_FORMAT_RAW8);
+    DrumSampleInfo getSampleInfo(uint8_t kit, uint8_t noteNumber) const {
+        return keymapTable[kit % DRUM_KIT_COUNT][noteNumber & 0x7F];
+    }
+    // そのキットにノートが無ければ（未ロード・未収録）デフォルトキットで鳴らす
+    uint8_t resolveKit(uint8_t kit, uint8_t noteNumber) const {
+        return keymapTable[kit % DRUM_KIT_COUNT][noteNumber & 0x7F].pcmIndex >= 0 ? kit % DRUM_KIT_COUNT : DRUM_KIT_DEFAULT;
+    }
     // ドラムサンプル再生トリガー
-    void triggerDrumSample(uint8_t midiChannel, uint8_t noteNumber, uint8_t velocity);
+    void triggerDrumSample(uint8_t kit, uint8_t noteNumber, uint8_t velocity);
 
     // GMドラム初期化
     void initializeGM();
 
 private:
-    // [midiChannel][noteNumber] = DrumSampleInfo
-    std::unordered_map<uint8_t, std::unordered_map<uint8_t, DrumSampleInfo>> keymapTable;
+    // [kit][noteNumber] = DrumSampleInfo
+    std::array<std::array<DrumSampleInfo, 128>, DRUM_KIT_COUNT> keymapTable;
 };
\ No newline at end of file
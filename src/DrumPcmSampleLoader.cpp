@@ -1,6 +1,10 @@
 // DrumPcmSampleLoader.cpp
 #include "DrumPcmSampleLoader.h"
 #include "DrumKeymapManager.h"
+#include "PcmRamAllocator.h"
+#include "DrumSampleStreamer.h"
+#include "TraceRecorder.h"
+#include "s3hs_core/lib/adpcm.cpp"
 #include <juce_audio_formats/juce_audio_formats.h>
 #include <filesystem>
 #include <fstream>
@@ -8,6 +12,11 @@
 #include <vector>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <thread>
 
 extern uint8_t* g_pcmRam;
 extern size_t g_pcmRamSize;
@@ -56,7 +65,37 @@ std::vector<uint8_t> DrumPcmSampleLoader::convertToRaw8bit(const std::vector<flo
     return out;
 }
 
+bool DrumPcmSampleLoader::decodeToRaw8bit(juce::AudioFormatManager& formatManager, const std::string& filePath,
+                                          std::vector<uint8_t>& out, uint32_t& outSampleRate) {
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(juce::File(filePath)));
+    if (!reader || reader->lengthInSamples <= 0 || reader->numChannels == 0) return false;
+
+    int numSamples = static_cast<int>(reader->lengthInSamples);
+    int numChannels = static_cast<int>(reader->numChannels);
+    juce::AudioBuffer<float> buffer(numChannels, numSamples);
+    reader->read(&buffer, 0, numSamples, 0, true, true);
+
+    // モノラル化（チャンネル平均）と8bit変換をまとめて行う（変換式はconvertToRaw8bit()と同じ）
+    out.resize(static_cast<size_t>(numSamples));
+    const float scale = 1.0f / static_cast<float>(numChannels);
+    for (int i = 0; i < numSamples; ++i) {
+        float sum = 0.0f;
+        for (int ch = 0; ch < numChannels; ++ch) {
+            sum += buffer.getReadPointer(ch)[i];
+        }
+        float clamped = std::min(std::max(sum * scale, -1.0f), 1.0f);
+        out[static_cast<size_t>(i)] = static_cast<uint8_t>((clamped + 1.0f) * 127.5f);
+    }
+    outSampleRate = static_cast<uint32_t>(reader->sampleRate);
+    return true;
+}
+
+std::vector<uint8_t> DrumPcmSampleLoader::encodeToAdpcm4(const std::vector<uint8_t>& raw8) {
+    return s3hs_adpcm_encode(raw8);
+}
+
 bool DrumPcmSampleLoader::loadSampleToRam(const std::string& filePath, uint32_t ramAddress, uint32_t& outSampleRate, uint32_t& outPcmSize) {
+    TRACE_SCOPE("loadSampleToRam");
     auto decoded = loadAndDecode(filePath);
     if (decoded.pcm.empty()) return false;
     auto raw8 = convertToRaw8bit(decoded.pcm);
@@ -67,25 +106,243 @@ bool DrumPcmSampleLoader::loadSampleToRam(const std::string& filePath, uint32_t
     return true;
 }
 
+// キャッシュファイルの構造（リトルエンディアン）
+// ヘッダ: "3HSD" <version:u32> <key:u64> <baseRamAddr:u32> <imageSize:u32> <entryCount:u32>
+// エントリ: { <note:u32> <ramAddr:u32> <sampleRate:u32> <length:u32> <format:u32> } x entryCount
+// イメージ: baseRamAddrからimageSizeバイト分のPCM RAMの内容
+struct DrumPcmCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t baseRamAddr;
+    uint32_t imageSize;
+    uint32_t entryCount;
+};
+struct DrumPcmCacheEntry {
+    uint32_t note;
+    uint32_t ramAddr;
+    uint32_t sampleRate;
+    uint32_t length;
+    uint32_t format;
+};
+
+struct DrumSampleFile {
+    int note;
+    std::string path;
+};
+
+static juce::File getDrumPcmCacheFile() {
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("3HSPlug").getChildFile(DRUM_PCM_CACHE_FILE_NAME);
+}
+
+// キャッシュキー: フォルダ・ファイル名・サイズ・更新日時のFNV-1aハッシュ
+static uint64_t computeDrumPcmCacheKey(const std::string& pcmPath, uint32_t baseRamAddr, uint32_t streamResidentBytes,
+                                       const std::vector<DrumSampleFile>& files) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    auto mix = [&h](const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= p[i];
+            h *= 0x100000001B3ull;
+        }
+    };
+    uint32_t version = DRUM_PCM_CACHE_VERSION;
+    mix(&version, sizeof(version));
+    uint32_t encodeAdpcm = DRUM_PCM_ENCODE_ADPCM;
+    mix(&encodeAdpcm, sizeof(encodeAdpcm));
+    mix(&baseRamAddr, sizeof(baseRamAddr));
+    mix(&streamResidentBytes, sizeof(streamResidentBytes));
+    mix(pcmPath.data(), pcmPath.size());
+    for (const auto& f : files) {
+        std::error_code ec;
+        uint64_t size = fs::file_size(f.path, ec);
+        int64_t mtime = fs::last_write_time(f.path, ec).time_since_epoch().count();
+        mix(&f.note, sizeof(f.note));
+        mix(&size, sizeof(size));
+        mix(&mtime, sizeof(mtime));
+    }
+    return h;
+}
+
+static bool loadDrumPcmCache(uint32_t baseRamAddr, uint64_t key, std::vector<DrumPcmCacheEntry>& entries) {
+    juce::File cacheFile = getDrumPcmCacheFile();
+    if (!cacheFile.existsAsFile()) return false;
+    juce::MemoryMappedFile mapped(cacheFile, juce::MemoryMappedFile::readOnly);
+    const uint8_t* data = static_cast<const uint8_t*>(mapped.getData());
+    size_t size = mapped.getSize();
+    if (data == nullptr || size < sizeof(DrumPcmCacheHeader)) return false;
+
+    DrumPcmCacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, "3HSD", 4) != 0 || header.version != DRUM_PCM_CACHE_VERSION ||
+        header.key != key || header.baseRamAddr != baseRamAddr) {
+        printf("[DrumPcmSampleLoader] Cache is stale, decoding samples\n");
+        return false;
+    }
+    size_t entriesSize = static_cast<size_t>(header.entryCount) * sizeof(DrumPcmCacheEntry);
+    if (size < sizeof(header) + entriesSize + header.imageSize ||
+        static_cast<size_t>(baseRamAddr) + header.imageSize > g_pcmRamSize) {
+        printf("[DrumPcmSampleLoader] Cache is corrupted, decoding samples\n");
+        return false;
+    }
+
+    std::memcpy(g_pcmRam + baseRamAddr, data + sizeof(header) + entriesSize, header.imageSize);
+    entries.resize(header.entryCount);
+    if (header.entryCount > 0) {
+        std::memcpy(entries.data(), data + sizeof(header), entriesSize);
+    }
+    printf("[DrumPcmSampleLoader] Loaded %u drum samples from cache %s (%u bytes)\n",
+           header.entryCount, cacheFile.getFullPathName().toRawUTF8(), header.imageSize);
+    return true;
+}
+
+static void saveDrumPcmCache(uint32_t baseRamAddr, uint64_t key, uint32_t imageSize, const std::vector<DrumPcmCacheEntry>& entries) {
+    DrumPcmCacheHeader header;
+    std::memcpy(header.magic, "3HSD", 4);
+    header.version = DRUM_PCM_CACHE_VERSION;
+    header.key = key;
+    header.baseRamAddr = baseRamAddr;
+    header.imageSize = imageSize;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+
+    juce::MemoryBlock block;
+    block.append(&header, sizeof(header));
+    if (!entries.empty()) block.append(entries.data(), entries.size() * sizeof(DrumPcmCacheEntry));
+    block.append(g_pcmRam + baseRamAddr, imageSize);
+
+    juce::File cacheFile = getDrumPcmCacheFile();
+    cacheFile.getParentDirectory().createDirectory();
+    if (cacheFile.replaceWithData(block.getData(), block.getSize())) {
+        printf("[DrumPcmSampleLoader] Cache written to %s\n", cacheFile.getFullPathName().toRawUTF8());
+    } else {
+        printf("[Warning::DrumPcmSampleLoader] Failed to write cache %s\n", cacheFile.getFullPathName().toRawUTF8());
+    }
+}
+
+static std::vector<DrumSampleFile> listDrumSampleFiles(const std::string& pcmPath) {
+    // ディレクトリを1回だけ列挙して[ノート番号].wavを集める
+    std::vector<DrumSampleFile> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(pcmPath, ec)) {
+        if (!entry.is_regular_file(ec) || entry.path().extension() != ".wav") continue;
+        std::string stem = entry.path().stem().string();
+        if (stem.empty() || stem.size() > 3 || !std::all_of(stem.begin(), stem.end(), [](unsigned char c) { return std::isdigit(c) != 0; })) continue;
+        int note = std::stoi(stem);
+        if (note < 0 || note >= 128) continue;
+        files.push_back({ note, pcmPath + stem + ".wav" });
+    }
+    std::sort(files.begin(), files.end(), [](const DrumSampleFile& a, const DrumSampleFile& b) { return a.note < b.note; });
+    return files;
+}
+
+static std::vector<DecodedDrumSample> decodeDrumSampleFiles(const std::vector<DrumSampleFile>& files) {
+    // 複数スレッドでデコード（フォーマットマネージャはスレッドごとに1つ）
+    std::vector<DecodedDrumSample> decoded(files.size());
+    std::vector<char> succeeded(files.size(), 0);
+    std::atomic<size_t> nextIndex{0};
+    unsigned numThreads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), static_cast<unsigned>(files.size())));
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < numThreads; ++t) {
+        workers.emplace_back([&] {
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+            for (size_t i = nextIndex.fetch_add(1); i < files.size(); i = nextIndex.fetch_add(1)) {
+                decoded[i].note = files[i].note;
+                decoded[i].sampleRate = 44100;
+                decoded[i].format = DRUM_PCM_FORMAT_RAW8;
+                succeeded[i] = DrumPcmSampleLoader::decodeToRaw8bit(formatManager, files[i].path, decoded[i].pcm, decoded[i].sampleRate) ? 1 : 0;
+                #if DRUM_PCM_ENCODE_ADPCM == 1
+                if (succeeded[i]) {
+                    decoded[i].pcm = DrumPcmSampleLoader::encodeToAdpcm4(decoded[i].pcm);
+                    decoded[i].format = DRUM_PCM_FORMAT_ADPCM4;
+                }
+                #endif
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    std::vector<DecodedDrumSample> result;
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        if (succeeded[i]) result.push_back(std::move(decoded[i]));
+    }
+    printf("[DrumPcmSampleLoader] Decoded %zu of %zu drum samples with %u threads\n", result.size(), files.size(), numThreads);
+    return result;
+}
+
+std::vector<DecodedDrumSample> decodeDrumKit(const std::string& pcmPath) {
+    TRACE_SCOPE("decodeDrumKit");
+    return decodeDrumSampleFiles(listDrumSampleFiles(pcmPath));
+}
+
+std::string getDrumKitPath(int kit) {
+    if (kit == DRUM_KIT_DEFAULT) return "./pcm/";
+    return std::string(DRUM_KIT_MAP_DIRECTORY_PREFIX) + std::to_string(kit) + "/";
+}
+
 // 一括ロード: 指定ディレクトリ内の[ノート番号].wavを全てロードし、キーマップに登録
-void loadAllDrumSamples(DrumKeymapManager& keymap, uint32_t baseRamAddr, const std::string& pcmPath) {
-    uint32_t ramPtr = baseRamAddr;
+void loadAllDrumSamples(DrumKeymapManager& keymap, PcmRamAllocator& allocator,
+                        std::array<int, 128>& noteHandles, DrumSampleStreamer* streamer, const std::string& pcmPath) {
+    TRACE_SCOPE("loadAllDrumSamples");
     printf("[DrumPcmSampleLoader] Loading drum samples from: %s\n", pcmPath.c_str());
-    
-    for (int note = 0; note < 128; ++note) {
-        std::string wavPath = pcmPath + std::to_string(note) + ".wav";
-        if (!fs::exists(wavPath)) {
-            continue;
+    noteHandles.fill(-1);
+    if (!g_pcmRam) return;
+    auto startTime = std::chrono::steady_clock::now();
+    uint32_t baseRamAddr = allocator.getBase();
+
+    auto files = listDrumSampleFiles(pcmPath);
+    uint64_t key = computeDrumPcmCacheKey(pcmPath, baseRamAddr, streamer ? DRUM_STREAM_RESIDENT_BYTES : 0, files);
+    std::vector<DrumPcmCacheEntry> entries;
+    // ストリーミングするサンプルはキャッシュに先頭部分しか無いので、同じキーのサンプルストアが必要
+    bool cached = loadDrumPcmCache(baseRamAddr, key, entries);
+    if (cached && streamer && !streamer->openStore(key)) {
+        printf("[DrumPcmSampleLoader] Sample store is stale, decoding samples\n");
+        cached = false;
+        entries.clear();
+    }
+    if (cached) {
+        for (const auto& e : entries) {
+            int handle = allocator.adopt(e.ramAddr, e.length);
+            if (handle < 0) continue;
+            noteHandles[e.note & 0x7F] = handle;
+            keymap.assignNoteToSample(DRUM_KIT_DEFAULT, static_cast<uint8_t>(e.note), e.ramAddr, e.sampleRate, e.length, static_cast<int32_t>(e.format));
         }
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        printf("[DrumPcmSampleLoader] Drum samples ready in %.1f ms (cached)\n", ms);
+        return;
+    }
 
-        DrumPcmSampleLoader loader;
-        uint32_t sampleRate = 44100;
-        uint32_t pcmSize = 0;
-        if (loader.loadSampleToRam(wavPath, ramPtr, sampleRate, pcmSize)) {
-            keymap.assignNoteToSample(10, note, ramPtr, sampleRate, pcmSize); // MIDI ch10
-            ramPtr += pcmSize; // PCMデータ長分だけポインタを進める
-            printf("[DrumPcmSampleLoader] Loaded note %d from %s\n", note, wavPath.c_str());
+    // ノート番号順に確保（空のアロケータなら先頭から詰めて配置される。同じ内容のサンプルは共有）
+    // ストリーミング有効時、長いサンプル（Raw 8bitのみ）は全体をサンプルストアへ入れ、先頭部分だけを常駐させる
+    uint32_t imageEnd = baseRamAddr;
+    if (streamer) streamer->beginStore();
+    for (const auto& sample : decodeDrumSampleFiles(files)) {
+        uint32_t pcmSize = static_cast<uint32_t>(sample.pcm.size());
+        if (streamer && sample.format == DRUM_PCM_FORMAT_RAW8 && pcmSize > DRUM_STREAM_RESIDENT_BYTES) {
+            streamer->addSample(sample.note, sample.pcm.data(), pcmSize);
+            pcmSize = DRUM_STREAM_RESIDENT_BYTES;
+        }
+        int handle = allocator.allocate(sample.pcm.data(), pcmSize);
+        if (handle < 0) {
+            printf("[Warning::DrumPcmSampleLoader] PCM RAM full, note %d skipped\n", sample.note);
+            continue;
         }
+        uint32_t addr = allocator.get(handle).addr;
+        noteHandles[sample.note] = handle;
+        keymap.assignNoteToSample(DRUM_KIT_DEFAULT, static_cast<uint8_t>(sample.note), addr, sample.sampleRate, pcmSize, sample.format);
+        entries.push_back({ static_cast<uint32_t>(sample.note), addr, sample.sampleRate, pcmSize, static_cast<uint32_t>(sample.format) });
+        imageEnd = std::max(imageEnd, addr + pcmSize);
     }
-    printf("[DrumPcmSampleLoader] Loaded all drum samples from %s, %d bytes used (%d bytes free, %f%%)\n", pcmPath.c_str(), ramPtr - baseRamAddr, g_pcmRamSize - (ramPtr - baseRamAddr), (ramPtr - baseRamAddr) * 100.0f / g_pcmRamSize);
-}
\ No newline at end of file
+    if (streamer && !streamer->finishStore(key)) {
+        printf("[Warning::DrumPcmSampleLoader] Long samples will play only their first %d bytes\n", DRUM_STREAM_RESIDENT_BYTES);
+    }
+    saveDrumPcmCache(baseRamAddr, key, imageEnd - baseRamAddr, entries);
+
+    auto stats = allocator.getStats();
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    printf("[DrumPcmSampleLoader] Drum samples ready in %.1f ms\n", ms);
+    printf("[DrumPcmSampleLoader] Loaded all drum samples from %s, %u bytes used (%u bytes free, %f%%), %u duplicate(s) shared (%llu bytes saved)\n",
+           pcmPath.c_str(), stats.usedBytes, stats.freeBytes, stats.usedBytes * 100.0f / std::max<uint32_t>(stats.capacity, 1),
+           stats.dedupHits, static_cast<unsigned long long>(stats.dedupSavedBytes));
+}
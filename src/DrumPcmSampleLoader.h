@@ -3,6 +3,21 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <array>
+
+namespace juce { class AudioFormatManager; }
+
+// ドラムPCMイメージのキャッシュ（デコード済みのPCMイメージ＋キーマップ）
+// WAVファイル群のサイズ・更新日時が一致すれば、次回起動時はデコードせずにmmapして読み込む
+#define DRUM_PCM_CACHE_FILE_NAME "drum_pcm_cache.bin"
+#define DRUM_PCM_CACHE_VERSION 3
+
+// GSのドラムマップ（キット）ごとのサンプルディレクトリ: DRUM_KIT_DEFAULTは"./pcm/"、それ以外は"./pcm/map<番号>/"
+#define DRUM_KIT_MAP_DIRECTORY_PREFIX "./pcm/map"
+
+// ドラムサンプルを4bit ADPCMで格納する（1: 有効 0: 無効）
+// PCM RAMの使用量が約半分になるが、Raw 8bitより音質は落ちる
+#define DRUM_PCM_ENCODE_ADPCM 0
 
 struct DecodedWav {
     std::vector<float> pcm;
@@ -19,7 +34,31 @@ public:
 
     // サポート: WAV/AIFF/16bit PCM等からのロード
     static DecodedWav loadAndDecode(const std::string& filePath);
+    // フォーマットマネージャを使い回してデコードし、モノラル化とRaw Unsigned 8bit変換を1パスで行う（スレッドごとにマネージャを1つ用意すること）
+    static bool decodeToRaw8bit(juce::AudioFormatManager& formatManager, const std::string& filePath,
+                                std::vector<uint8_t>& out, uint32_t& outSampleRate);
+    // Raw Unsigned 8bit → 4bit ADPCMブロック列（PCMモード6で再生する形式）
+    static std::vector<uint8_t> encodeToAdpcm4(const std::vector<uint8_t>& raw8);
 };
 
+// デコード済みのドラムサンプル（Raw Unsigned 8bit、またはDRUM_PCM_ENCODE_ADPCMが有効なら4bit ADPCM）
+struct DecodedDrumSample {
+    int note;
+    std::vector<uint8_t> pcm;
+    uint32_t sampleRate;
+    int32_t format;   // DrumPcmFormat
+};
+
+// キット番号に対応するサンプルディレクトリ
+std::string getDrumKitPath(int kit);
+
+// 指定ディレクトリ内の[ノート番号].wavを複数スレッドでデコードする（ノート番号順）
+std::vector<DecodedDrumSample> decodeDrumKit(const std::string& pcmPath);
+
 // 一括ロード関数の宣言を追加
-void loadAllDrumSamples(class DrumKeymapManager& keymap, uint32_t baseRamAddr = 0, const std::string& pcmPath = "./pcm/");
\ No newline at end of file
+// キャッシュが有効ならそれを読み込み、無効ならデコードしてキャッシュを書き出す。
+// 領域はallocatorから確保し（同じ内容のサンプルは共有）、ノートごとのハンドルをnoteHandlesに格納する（未割り当ては-1）
+// streamerを渡すと、長いサンプルは先頭部分だけを常駐させて残りをディスクからストリーミングする
+void loadAllDrumSamples(class DrumKeymapManager& keymap, class PcmRamAllocator& allocator,
+                        std::array<int, 128>& noteHandles, class DrumSampleStreamer* streamer = nullptr,
+                        const std::string& pcmPath = "./pcm/");
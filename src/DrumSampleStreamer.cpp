@@ -0,0 +1,308 @@
+// DrumSampleStreamer.cpp
+#include "DrumSampleStreamer.h"
+#include "TraceRecorder.h"
+#include "HwPerfCounters.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <juce_core/juce_core.h>
+
+// ストアファイルの構造（リトルエンディアン）
+// ヘッダ: "3HSS" <version:u32> <key:u64> <entryCount:u32> <reserved:u32>
+// エントリ: { <note:u32> <length:u32> <offset:u64> } x entryCount（offsetはデータ部の先頭から）
+// データ部: サンプル全体（Raw Unsigned 8bit）を連結したもの
+struct DrumStreamStoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+struct DrumStreamStoreEntry {
+    uint32_t note;
+    uint32_t length;
+    uint64_t offset;
+};
+
+static juce::File getDrumStreamStoreFile() {
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("3HSPlug").getChildFile(DRUM_STREAM_STORE_FILE_NAME);
+}
+
+DrumSampleStreamer::DrumSampleStreamer() {
+    pagePool.resize(DRUM_STREAM_PAGE_POOL);
+    for (int i = 0; i < DRUM_STREAM_PAGE_POOL; ++i) {
+        pagePool[i].resize(DRUM_STREAM_PAGE_BYTES);
+        freePages[i] = i;
+    }
+    freePageCount = DRUM_STREAM_PAGE_POOL;
+}
+
+DrumSampleStreamer::~DrumSampleStreamer() {
+    stop();
+}
+
+//==============================================================================
+// ストア
+
+void DrumSampleStreamer::beginStore() {
+    building.clear();
+    buildingLengths.fill(0);
+    buildingOffsets.fill(0);
+}
+
+void DrumSampleStreamer::addSample(int note, const uint8_t* data, uint32_t length) {
+    if (note < 0 || note >= 128 || length == 0) return;
+    buildingOffsets[note] = building.size();
+    buildingLengths[note] = length;
+    building.insert(building.end(), data, data + length);
+}
+
+bool DrumSampleStreamer::finishStore(uint64_t key) {
+    std::vector<DrumStreamStoreEntry> list;
+    for (int note = 0; note < 128; ++note) {
+        if (buildingLengths[note] > 0) {
+            list.push_back({ static_cast<uint32_t>(note), buildingLengths[note], buildingOffsets[note] });
+        }
+    }
+    DrumStreamStoreHeader header;
+    std::memcpy(header.magic, "3HSS", 4);
+    header.version = DRUM_STREAM_STORE_VERSION;
+    header.key = key;
+    header.entryCount = static_cast<uint32_t>(list.size());
+    header.reserved = 0;
+
+    juce::File file = getDrumStreamStoreFile();
+    file.getParentDirectory().createDirectory();
+    juce::FileOutputStream out(file);
+    bool ok = out.openedOk() && out.setPosition(0) && out.truncate().wasOk();
+    ok = ok && out.write(&header, sizeof(header));
+    if (ok && !list.empty()) ok = out.write(list.data(), list.size() * sizeof(DrumStreamStoreEntry));
+    if (ok && !building.empty()) ok = out.write(building.data(), building.size());
+    out.flush();
+    building.clear();
+    building.shrink_to_fit();
+    if (!ok) {
+        printf("[Warning::DrumStream] Failed to write sample store %s\n", file.getFullPathName().toRawUTF8());
+        return false;
+    }
+    return openStore(key);
+}
+
+bool DrumSampleStreamer::openStore(uint64_t key) {
+    for (auto& e : entries) e.length.store(0);
+    storeData = nullptr;
+    storeDataSize = 0;
+    juce::File file = getDrumStreamStoreFile();
+    if (!file.existsAsFile()) return false;
+    auto mapped = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+    const uint8_t* data = static_cast<const uint8_t*>(mapped->getData());
+    size_t size = mapped->getSize();
+    if (data == nullptr || size < sizeof(DrumStreamStoreHeader)) return false;
+
+    DrumStreamStoreHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    size_t entriesSize = static_cast<size_t>(header.entryCount) * sizeof(DrumStreamStoreEntry);
+    if (std::memcmp(header.magic, "3HSS", 4) != 0 || header.version != DRUM_STREAM_STORE_VERSION ||
+        header.key != key || size < sizeof(header) + entriesSize) {
+        return false;
+    }
+    const uint8_t* dataStart = data + sizeof(header) + entriesSize;
+    uint64_t dataSize = size - sizeof(header) - entriesSize;
+    std::vector<DrumStreamStoreEntry> list(header.entryCount);
+    if (!list.empty()) std::memcpy(list.data(), data + sizeof(header), entriesSize);
+    for (const auto& e : list) {
+        if (e.note >= 128 || e.offset + e.length > dataSize) return false;
+    }
+    for (const auto& e : list) {
+        entries[e.note].offset = e.offset;
+        entries[e.note].length.store(e.length);
+    }
+    store = std::move(mapped);
+    storeData = dataStart;
+    storeDataSize = dataSize;
+    printf("[DrumStream] Sample store %s opened: %u streamed note(s), %llu bytes\n",
+           file.getFullPathName().toRawUTF8(), header.entryCount, static_cast<unsigned long long>(dataSize));
+    return true;
+}
+
+bool DrumSampleStreamer::isStreamed(int note) const {
+    return note >= 0 && note < 128 && storeData != nullptr && entries[note].length.load() > 0;
+}
+
+void DrumSampleStreamer::removeNote(int note) {
+    if (note >= 0 && note < 128) entries[note].length.store(0);
+}
+
+//==============================================================================
+// ワーカースレッド
+
+void DrumSampleStreamer::start(int voiceCount, uint32_t base) {
+    if (running.load()) return;
+    voices.assign(static_cast<size_t>(std::max(voiceCount, 0)), Voice{});
+    slotBase = base;
+    running.store(true);
+    worker = std::thread([this] { workerLoop(); });
+}
+
+void DrumSampleStreamer::stop() {
+    if (!running.exchange(false)) return;
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+uint32_t DrumSampleStreamer::getSlotAddress(int voice) const {
+    return slotBase + static_cast<uint32_t>(voice % 4) * (DRUM_STREAM_SLOT_BYTES + 1);
+}
+
+void DrumSampleStreamer::workerLoop() {
+    TRACE_THREAD_NAME("DrumStream");
+    PageRequest request;
+    while (running.load()) {
+        if (!requests.pop(request)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        // ページフォルト（ディスク読み込み）はここで発生する
+        {
+            TRACE_SCOPE("DrumStream::readPage");
+            HW_PERF_SCOPE("DrumStream");
+            std::memcpy(pagePool[request.buffer].data(), storeData + request.storeOffset, request.length);
+        }
+        auto us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - request.requestedAt).count());
+        latencyTotalUs.fetch_add(us);
+        latencyCount.fetch_add(1);
+        uint64_t prevMax = latencyMaxUs.load();
+        while (us > prevMax && !latencyMaxUs.compare_exchange_weak(prevMax, us)) {}
+        completions.push(request); // 要求数はページ数以下なので溢れない
+    }
+}
+
+//==============================================================================
+// オーディオスレッド
+
+void DrumSampleStreamer::startVoice(int voice, int note, uint8_t* chipRam, const uint8_t* head, uint32_t headLength) {
+    if (voice < 0 || voice >= static_cast<int>(voices.size()) || !isStreamed(note)) return;
+    auto& v = voices[voice];
+    if (!v.active) activeStreams.fetch_add(1);
+    v.active = true;
+    v.serial++;  // 読み込み中の古いページは届いても捨てる
+    v.chipRam = chipRam;
+    v.length = entries[note].length.load();
+    v.storeOffset = entries[note].offset;
+    v.playPos = 0;
+    v.filledUntil = 0;
+    v.requestedUntil = 0;
+    v.underrun = false;
+    v.padded = false;
+
+    uint32_t residentLength = std::min(std::min(headLength, v.length), static_cast<uint32_t>(DRUM_STREAM_SLOT_BYTES));
+    writeToRing(v, getSlotAddress(voice), 0, head, residentLength);
+    v.filledUntil = residentLength;
+    v.requestedUntil = residentLength;
+    updateVoice(voice, 0); // ノートオンと同時に続きの読み込みを開始
+}
+
+void DrumSampleStreamer::stopVoice(int voice) {
+    if (voice < 0 || voice >= static_cast<int>(voices.size())) return;
+    auto& v = voices[voice];
+    if (v.active) activeStreams.fetch_sub(1);
+    v.active = false;
+    v.serial++;
+}
+
+void DrumSampleStreamer::writeToRing(Voice& v, uint32_t slotAddr, uint32_t offset, const uint8_t* data, uint32_t length) {
+    uint32_t ringPos = offset % DRUM_STREAM_SLOT_BYTES;
+    uint32_t first = std::min(length, static_cast<uint32_t>(DRUM_STREAM_SLOT_BYTES) - ringPos);
+    std::memcpy(v.chipRam + slotAddr + ringPos, data, first);
+    if (length > first) {
+        std::memcpy(v.chipRam + slotAddr, data + first, length - first);
+    }
+    // リングの直後の1バイトは先頭の複製（チップは周回する直前にここを読む）
+    if (ringPos == 0 || length > first) {
+        v.chipRam[slotAddr + DRUM_STREAM_SLOT_BYTES] = v.chipRam[slotAddr];
+    }
+}
+
+void DrumSampleStreamer::pumpCompletions() {
+    PageRequest page;
+    while (completions.pop(page)) {
+        auto& v = voices[page.voice];
+        v.inflight--;
+        if (v.active && page.serial == v.serial && page.offset == v.filledUntil) {
+            writeToRing(v, getSlotAddress(page.voice), page.offset, pagePool[page.buffer].data(), page.length);
+            v.filledUntil += page.length;
+            bytesStreamed.fetch_add(page.length);
+            if (v.playPos <= page.offset) pageHits.fetch_add(1);
+        }
+        freePages[freePageCount++] = page.buffer;
+    }
+}
+
+DrumSampleStreamer::VoiceStatus DrumSampleStreamer::updateVoice(int voice, uint32_t playPos) {
+    if (voice < 0 || voice >= static_cast<int>(voices.size())) return VoiceStatus::Idle;
+    auto& v = voices[voice];
+    if (!v.active) return VoiceStatus::Idle;
+    v.playPos = playPos;
+    if (playPos >= v.length) {
+        stopVoice(voice);
+        return VoiceStatus::Finished;
+    }
+
+    // 先読み: まだ再生していないリングの内容を上書きしない範囲で要求する
+    while (v.inflight < DRUM_STREAM_MAX_INFLIGHT_PER_VOICE && freePageCount > 0 &&
+           v.requestedUntil < v.length) {
+        uint32_t length = std::min(static_cast<uint32_t>(DRUM_STREAM_PAGE_BYTES), v.length - v.requestedUntil);
+        if (static_cast<uint64_t>(v.requestedUntil) + length > static_cast<uint64_t>(playPos) + DRUM_STREAM_SLOT_BYTES) break;
+        PageRequest request;
+        request.voice = voice;
+        request.serial = v.serial;
+        request.offset = v.requestedUntil;
+        request.length = length;
+        request.storeOffset = v.storeOffset + v.requestedUntil;
+        request.buffer = freePages[freePageCount - 1];
+        request.requestedAt = std::chrono::steady_clock::now();
+        if (!requests.push(request)) break;
+        freePageCount--;
+        v.requestedUntil += length;
+        v.inflight++;
+    }
+
+    // 終端の後ろを無音で埋める（終端を過ぎてから無音化するまでの間に古いリングの内容を鳴らさない）
+    if (v.filledUntil >= v.length && !v.padded &&
+        static_cast<uint64_t>(v.length) + DRUM_STREAM_UNDERRUN_MARGIN <= static_cast<uint64_t>(playPos) + DRUM_STREAM_SLOT_BYTES) {
+        static const std::array<uint8_t, DRUM_STREAM_UNDERRUN_MARGIN> silence = [] {
+            std::array<uint8_t, DRUM_STREAM_UNDERRUN_MARGIN> a{};
+            a.fill(128);
+            return a;
+        }();
+        writeToRing(v, getSlotAddress(voice), v.length, silence.data(), DRUM_STREAM_UNDERRUN_MARGIN);
+        v.padded = true;
+    }
+
+    bool starving = v.filledUntil < v.length && static_cast<uint64_t>(playPos) + DRUM_STREAM_UNDERRUN_MARGIN > v.filledUntil;
+    if (starving) {
+        if (!v.underrun) pageMisses.fetch_add(1);
+        v.underrun = true;
+        return VoiceStatus::Underrun;
+    }
+    v.underrun = false;
+    return VoiceStatus::Playing;
+}
+
+DrumSampleStreamer::Stats DrumSampleStreamer::getStats() const {
+    Stats s;
+    s.pageHits = pageHits.load();
+    s.pageMisses = pageMisses.load();
+    s.bytesStreamed = bytesStreamed.load();
+    uint64_t count = latencyCount.load();
+    s.averageLatencyMs = count > 0 ? static_cast<double>(latencyTotalUs.load()) / count / 1000.0 : 0.0;
+    s.maxLatencyMs = static_cast<double>(latencyMaxUs.load()) / 1000.0;
+    s.activeStreams = activeStreams.load();
+    for (const auto& e : entries) {
+        if (e.length.load() > 0) s.streamedNotes++;
+    }
+    return s;
+}
@@ -0,0 +1,170 @@
+// DrumSampleStreamer.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace juce { class MemoryMappedFile; }
+
+// サンプルストア（ストリーミングするサンプルの全体を格納したファイル、mmapして読む）
+#define DRUM_STREAM_STORE_FILE_NAME "drum_stream.bin"
+#define DRUM_STREAM_STORE_VERSION 1
+
+#define DRUM_STREAM_RESIDENT_BYTES (32 * 1024)   // PCM RAMに常駐させる先頭部分（これより長いサンプルをストリーミング）
+#define DRUM_STREAM_PAGE_BYTES (16 * 1024)       // ストアからの読み込み単位
+#define DRUM_STREAM_SLOT_BYTES (256 * 1024)      // PCMチャンネルごとのリングバッファ（チップRAM上）
+#define DRUM_STREAM_PAGE_POOL 64                 // 読み込み中のページバッファ数（全チャンネル合計）
+#define DRUM_STREAM_MAX_INFLIGHT_PER_VOICE 4     // 1チャンネルあたりの同時読み込みページ数
+#define DRUM_STREAM_UNDERRUN_MARGIN 8192         // 再生位置からこのバイト数先までデータが無ければページミス
+
+/**
+ * ドラムPCMのディスクストリーミング（PCM RAMに入りきらない長いサンプル用）
+ *
+ * 長いサンプルは先頭DRUM_STREAM_RESIDENT_BYTESだけPCM RAMに常駐させ、全体はサンプルストアに置く。
+ * ノートオンで常駐部分をそのPCMチャンネル専用のリングバッファ（チップRAM上）へコピーしてすぐに発音し、
+ * 続きはワーカースレッドがストアからページ単位で読み込み、オーディオスレッドがリングへ書き込む。
+ * チップはループ開始アドレスをリングの先頭にしてリングを周回再生するので、アドレス空間はそのまま使える。
+ * 読み込みが間に合わなければ（ページミス）呼び出し側がそのチャンネルをミュートし、データが届いたら再開する。
+ *
+ * オーディオスレッド: startVoice() / stopVoice() / pumpCompletions() / updateVoice()（ロック・メモリ確保なし）
+ * ワーカースレッド: ページ要求を読み、ストアからページバッファへコピーして完了を返す
+ */
+class DrumSampleStreamer {
+public:
+    enum class VoiceStatus {
+        Idle,       // ストリーミングしていない
+        Playing,
+        Underrun,   // 再生位置にデータが追いついていない（ミュートすること）
+        Finished    // サンプルの終端を過ぎた（無音化すること）
+    };
+
+    struct Stats {
+        uint64_t pageHits = 0;         // 再生位置が届く前にリングへ書き込めたページ数
+        uint64_t pageMisses = 0;       // 読み込みが間に合わずミュートした回数
+        uint64_t bytesStreamed = 0;
+        double averageLatencyMs = 0.0; // ページ要求から読み込み完了まで
+        double maxLatencyMs = 0.0;
+        uint32_t activeStreams = 0;
+        uint32_t streamedNotes = 0;    // ストアに登録されているノート数
+    };
+
+    DrumSampleStreamer();
+    ~DrumSampleStreamer();
+
+    // ストアの作成（ローダーから呼ぶ）: beginStore() → addSample() x N → finishStore()
+    void beginStore();
+    void addSample(int note, const uint8_t* data, uint32_t length);
+    bool finishStore(uint64_t key);
+    // 前回作成したストアを開く（keyが一致しなければfalse）
+    bool openStore(uint64_t key);
+
+    bool isStreamed(int note) const;
+    void removeNote(int note);   // 常駐のみに戻す（キットの差し替え時）
+
+    // ワーカースレッドの開始・停止。リングはslotBaseから(DRUM_STREAM_SLOT_BYTES + 1)バイトずつチップ内のPCMチャンネル順に並ぶ
+    void start(int voiceCount, uint32_t slotBase);
+    void stop();
+    uint32_t getSlotAddress(int voice) const;
+
+    // オーディオスレッドから呼ぶ
+    // 常駐部分（head）をチップRAMのリングへコピーし、続きの読み込みを開始する
+    void startVoice(int voice, int note, uint8_t* chipRam, const uint8_t* head, uint32_t headLength);
+    void stopVoice(int voice);
+    // 読み込みが完了したページをリングへ書き込む（1ブロックに1回、updateVoice()より先に呼ぶ）
+    void pumpCompletions();
+    // 再生位置（サンプル先頭からのバイト数）を受け取り、先読みを要求して状態を返す
+    VoiceStatus updateVoice(int voice, uint32_t playPos);
+
+    Stats getStats() const;
+
+private:
+    struct PageRequest {
+        int voice = 0;
+        uint32_t serial = 0;
+        uint32_t offset = 0;     // サンプル先頭からのバイト位置
+        uint32_t length = 0;
+        uint64_t storeOffset = 0;
+        int buffer = 0;
+        std::chrono::steady_clock::time_point requestedAt;
+    };
+
+    // 単一生産者・単一消費者のキュー
+    template <typename T, size_t N>
+    class SpscQueue {
+    public:
+        bool push(const T& item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) >= N) return false;
+            items[t % N] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(T& item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) return false;
+            item = items[h % N];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+    private:
+        std::array<T, N> items;
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+    };
+
+    // オーディオスレッドだけが触る再生状態
+    struct Voice {
+        bool active = false;
+        uint32_t serial = 0;
+        uint8_t* chipRam = nullptr;
+        uint32_t length = 0;
+        uint64_t storeOffset = 0;
+        uint32_t playPos = 0;
+        uint32_t filledUntil = 0;     // リングに書き込み済みの位置
+        uint32_t requestedUntil = 0;  // 読み込みを要求済みの位置
+        int inflight = 0;
+        bool underrun = false;
+        bool padded = false;          // 終端の後ろを無音で埋めたか
+    };
+
+    struct StoreEntry {
+        uint64_t offset = 0;
+        std::atomic<uint32_t> length{0};   // 0: ストリーミングしない
+    };
+
+    void workerLoop();
+    void writeToRing(Voice& voice, uint32_t slotAddr, uint32_t offset, const uint8_t* data, uint32_t length);
+
+    std::vector<uint8_t> building;                 // 作成中のストアのデータ部
+    std::array<uint32_t, 128> buildingLengths{};
+    std::array<uint64_t, 128> buildingOffsets{};
+    std::unique_ptr<juce::MemoryMappedFile> store;
+    const uint8_t* storeData = nullptr;            // データ部の先頭
+    uint64_t storeDataSize = 0;
+    std::array<StoreEntry, 128> entries;
+
+    std::vector<Voice> voices;
+    uint32_t slotBase = 0;
+
+    std::vector<std::vector<uint8_t>> pagePool;
+    std::array<int, DRUM_STREAM_PAGE_POOL> freePages{};
+    int freePageCount = 0;
+    SpscQueue<PageRequest, DRUM_STREAM_PAGE_POOL> requests;    // オーディオ → ワーカー
+    SpscQueue<PageRequest, DRUM_STREAM_PAGE_POOL> completions; // ワーカー → オーディオ
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+    // 統計
+    std::atomic<uint64_t> pageHits{0};
+    std::atomic<uint64_t> pageMisses{0};
+    std::atomic<uint64_t> bytesStreamed{0};
+    std::atomic<uint64_t> latencyTotalUs{0};
+    std::atomic<uint64_t> latencyCount{0};
+    std::atomic<uint64_t> latencyMaxUs{0};
+    std::atomic<uint32_t> activeStreams{0};
+};
@@ -0,0 +1,317 @@
+// HwPerfCounters.cpp
+#include "HwPerfCounters.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__) && ENABLE_HW_PERF_COUNTERS
+#define HW_PERF_LINUX 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define HW_PERF_LINUX 0
+#endif
+
+//==============================================================================
+// Accumulator
+
+void HwPerfCounters::Accumulator::add(const Sample& delta, double weight) {
+    // 書き込みは1スレッドだけなので、読んで足して書くだけでよい
+    for (int i = 0; i < EventCount; ++i) {
+        uint64_t v = weight == 1.0 ? delta.values[i] : static_cast<uint64_t>(delta.values[i] * weight + 0.5);
+        values[i].store(values[i].load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    samples.store(samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void HwPerfCounters::Accumulator::clear() {
+    for (auto& v : values) v.store(0, std::memory_order_relaxed);
+    samples.store(0, std::memory_order_relaxed);
+}
+
+HwPerfCounters::Totals HwPerfCounters::Accumulator::load() const {
+    Totals t;
+    for (int i = 0; i < EventCount; ++i) t.values[i] = values[i].load(std::memory_order_relaxed);
+    t.samples = samples.load(std::memory_order_relaxed);
+    return t;
+}
+
+//==============================================================================
+// スレッドごとのカウンタグループ
+
+bool HwPerfCounters::isSupported() {
+    return HW_PERF_LINUX != 0;
+}
+
+HwPerfCounters& HwPerfCounters::forThisThread() {
+    // スレッドの終了時にデストラクタで閉じる
+    thread_local HwPerfCounters counters;
+    thread_local bool tried = false;
+    if (!tried) {
+        tried = true;
+        counters.open();
+    }
+    return counters;
+}
+
+HwPerfCounters::~HwPerfCounters() {
+    close();
+}
+
+#if HW_PERF_LINUX
+static int openPerfEvent(uint32_t type, uint64_t config, int groupFd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = groupFd < 0 ? 1 : 0;  // リーダーを有効にしたときにグループ全体が動き出す
+    attr.exclude_kernel = 1;              // perf_event_paranoidが2でも開けるようにユーザー空間のみ
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+
+void HwPerfCounters::open() {
+#if HW_PERF_LINUX
+    struct EventConfig {
+        Event event;
+        uint32_t type;
+        uint64_t config;
+    };
+    const EventConfig configs[EventCount] = {
+        { Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { L1DMisses, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { LLCMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { BranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+    for (const auto& c : configs) {
+        int fd = openPerfEvent(c.type, c.config, leaderFd);
+        if (fd < 0) {
+            if (leaderFd < 0) {
+                printf("[HwPerf] perf_event_open failed (errno %d: %s). Check /proc/sys/kernel/perf_event_paranoid\n",
+                       errno, std::strerror(errno));
+                return;
+            }
+            // CPUが対応していないイベントは0のまま
+            printf("[HwPerf] %s is not available on this CPU (errno %d)\n", getEventName(c.event), errno);
+            continue;
+        }
+        if (leaderFd < 0) leaderFd = fd;
+        fds[c.event] = fd;
+        readOrder[openedCount++] = c.event;
+    }
+    ioctl(leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    printf("[HwPerf] Counters opened for thread (%d events)\n", openedCount);
+#endif
+}
+
+void HwPerfCounters::close() {
+#if HW_PERF_LINUX
+    for (auto& fd : fds) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+#endif
+    leaderFd = -1;
+    openedCount = 0;
+}
+
+bool HwPerfCounters::read(Sample& out) const {
+#if HW_PERF_LINUX
+    if (leaderFd < 0) return false;
+    // PERF_FORMAT_GROUP: <nr> <value> x nr（開いた順）
+    uint64_t data[1 + EventCount];
+    ssize_t n = ::read(leaderFd, data, sizeof(data));
+    if (n < static_cast<ssize_t>(sizeof(uint64_t))) return false;
+    int count = static_cast<int>(std::min<uint64_t>(data[0], static_cast<uint64_t>(openedCount)));
+    for (int i = 0; i < count; ++i) {
+        out.values[readOrder[i]] = data[1 + i];
+    }
+    return true;
+#else
+    (void)out;
+    return false;
+#endif
+}
+
+HwPerfCounters::Sample HwPerfCounters::difference(const Sample& later, const Sample& earlier) {
+    Sample d;
+    for (int i = 0; i < EventCount; ++i) {
+        d.values[i] = later.values[i] >= earlier.values[i] ? later.values[i] - earlier.values[i] : 0;
+    }
+    return d;
+}
+
+const char* HwPerfCounters::getEventName(Event e) {
+    switch (e) {
+        case Cycles: return "cycles";
+        case Instructions: return "instructions";
+        case L1DMisses: return "l1dMisses";
+        case LLCMisses: return "llcMisses";
+        case BranchMisses: return "branchMisses";
+        default: return "unknown";
+    }
+}
+
+//==============================================================================
+// ワーカー（名前ごとの合計。同じ名前を使うのは1つのスレッドだけにすること）
+
+static std::array<std::atomic<const char*>, HW_PERF_MAX_WORKERS> workerNames{};
+static std::array<HwPerfCounters::Accumulator, HW_PERF_MAX_WORKERS> workerTotals;
+
+void HwPerfCounters::addWorker(const char* name, const Sample& delta) {
+    for (int i = 0; i < HW_PERF_MAX_WORKERS; ++i) {
+        const char* current = workerNames[i].load(std::memory_order_acquire);
+        if (current == nullptr) {
+            const char* expected = nullptr;
+            if (!workerNames[i].compare_exchange_strong(expected, name) && std::strcmp(expected, name) != 0) continue;
+            current = name;
+        }
+        if (current == name || std::strcmp(current, name) == 0) {
+            workerTotals[i].add(delta);
+            return;
+        }
+    }
+}
+
+int HwPerfCounters::getWorkerCount() {
+    int n = 0;
+    while (n < HW_PERF_MAX_WORKERS && workerNames[n].load(std::memory_order_acquire) != nullptr) ++n;
+    return n;
+}
+
+const char* HwPerfCounters::getWorkerName(int index) {
+    return workerNames[index].load(std::memory_order_acquire);
+}
+
+HwPerfCounters::Totals HwPerfCounters::getWorkerTotals(int index) {
+    return workerTotals[index].load();
+}
+
+HwPerfCounters::WorkerScope::WorkerScope(const char* scopeName) : name(scopeName) {
+    valid = forThisThread().read(begin);
+}
+
+HwPerfCounters::WorkerScope::~WorkerScope() {
+    Sample end;
+    if (valid && forThisThread().read(end)) {
+        addWorker(name, difference(end, begin));
+    }
+}
+
+//==============================================================================
+// オーディオスレッドの処理段ごとの集計
+
+void HwPerfStats::beginBlock() {
+    if (resetRequested.exchange(false)) {
+        for (auto& a : stages) a.clear();
+        for (auto& a : modModes) a.clear();
+    }
+    active = false;
+    auto& counters = HwPerfCounters::forThisThread();
+    if (!counters.isOpen()) return;
+    available.store(true, std::memory_order_relaxed);
+    if (counters.read(last)) {
+        blockBegin = last;
+        active = true;
+    }
+}
+
+bool HwPerfStats::readDelta(HwPerfCounters::Sample& delta) {
+    HwPerfCounters::Sample now;
+    if (!HwPerfCounters::forThisThread().read(now)) {
+        active = false;
+        return false;
+    }
+    delta = HwPerfCounters::difference(now, last);
+    last = now;
+    return true;
+}
+
+void HwPerfStats::mark(PerfStats::Stage stage) {
+    if (!active) return;
+    HwPerfCounters::Sample delta;
+    if (readDelta(delta)) stages[stage].add(delta);
+}
+
+void HwPerfStats::markChip(const std::array<int, HW_PERF_MODMODE_COUNT>& modModeWeights) {
+    if (!active) return;
+    HwPerfCounters::Sample delta;
+    if (!readDelta(delta)) return;
+    stages[PerfStats::ChipRender].add(delta);
+    int total = 0;
+    for (int w : modModeWeights) total += w;
+    if (total <= 0) return;
+    for (int m = 0; m < HW_PERF_MODMODE_COUNT; ++m) {
+        if (modModeWeights[m] > 0) modModes[m].add(delta, static_cast<double>(modModeWeights[m]) / total);
+    }
+}
+
+void HwPerfStats::endBlock() {
+    if (!active) return;
+    HwPerfCounters::Sample now;
+    if (HwPerfCounters::forThisThread().read(now)) {
+        stages[PerfStats::Block].add(HwPerfCounters::difference(now, blockBegin));
+    }
+    active = false;
+}
+
+static std::string totalsToJson(const HwPerfCounters::Totals& t) {
+    std::string json = "{";
+    char buf[96];
+    for (int e = 0; e < HwPerfCounters::EventCount; ++e) {
+        std::snprintf(buf, sizeof(buf), "\"%s\": %llu, ", HwPerfCounters::getEventName(static_cast<HwPerfCounters::Event>(e)),
+                      static_cast<unsigned long long>(t.values[e]));
+        json += buf;
+    }
+    std::snprintf(buf, sizeof(buf), "\"samples\": %llu, \"ipc\": %.3f}", static_cast<unsigned long long>(t.samples), t.ipc());
+    return json + buf;
+}
+
+std::string HwPerfStats::toJson() const {
+    std::string json = "{\n";
+    json += std::string("  \"available\": ") + (isAvailable() ? "true" : "false") + ",\n";
+    json += "  \"stages\": {\n";
+    for (int i = 0; i < PerfStats::StageCount; ++i) {
+        auto stage = static_cast<PerfStats::Stage>(i);
+        json += "    \"" + std::string(PerfStats::getStageName(stage)) + "\": " + totalsToJson(getStageTotals(stage));
+        json += i + 1 < PerfStats::StageCount ? ",\n" : "\n";
+    }
+    json += "  },\n  \"modModes\": [";
+    bool first = true;
+    for (int m = 0; m < HW_PERF_MODMODE_COUNT; ++m) {
+        auto t = getModModeTotals(m);
+        if (t.samples == 0) continue;
+        json += (first ? "\n    {\"modmode\": " : ",\n    {\"modmode\": ") + std::to_string(m) + ", \"counters\": " + totalsToJson(t) + "}";
+        first = false;
+    }
+    json += first ? "],\n" : "\n  ],\n";
+    json += "  \"workers\": [";
+    int workers = HwPerfCounters::getWorkerCount();
+    for (int i = 0; i < workers; ++i) {
+        json += std::string(i == 0 ? "\n" : ",\n") + "    {\"name\": \"" + HwPerfCounters::getWorkerName(i)
+              + "\", \"counters\": " + totalsToJson(HwPerfCounters::getWorkerTotals(i)) + "}";
+    }
+    json += workers == 0 ? "]\n" : "\n  ]\n";
+    json += "}\n";
+    return json;
+}
+
+bool HwPerfStats::dumpJson(const std::string& path) const {
+    std::ofstream fout(path);
+    if (!fout) {
+        printf("[HwPerf] Failed to open %s\n", path.c_str());
+        return false;
+    }
+    fout << toJson();
+    printf("[HwPerf] Counters written to %s\n", path.c_str());
+    return true;
+}
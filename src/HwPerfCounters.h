@@ -0,0 +1,143 @@
+// HwPerfCounters.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "PerfStats.h"
+
+#define ENABLE_HW_PERF_COUNTERS 0 // Linuxのハードウェアカウンタ計測（1で有効、0で無効。perf_event_openが使えなければ実行時に無効になる）
+#define HW_PERF_JSON_FILE_NAME "hw_counters.json" // Perf JSONボタンで一緒に書き出すファイル
+#define HW_PERF_MODMODE_COUNT 13                  // モジュレーションモードの数（0～12）
+#define HW_PERF_MAX_WORKERS 16                    // HW_PERF_SCOPEで集計できるワーカーの名前の数
+
+/**
+ * perf_event_openによるハードウェアカウンタ（サイクル・命令数・L1D/LLCミス・分岐ミス）の計測
+ *
+ * 経過時間だけでは分からない「なぜ遅いか」（キャッシュミスか、命令数か、分岐か）を処理段ごとに見るためのもの。
+ * カウンタはスレッドごとに1つのグループとして開き（HwPerfCounters::forThisThread()）、1回のread()で全部読む。
+ *
+ * オーディオスレッド: HwPerfStatsがprocessBlockの処理段の境目ごとに読み、前の境目からの差分を処理段
+ * （PerfStats::Stage）に加算する。チップのレンダリングは、そのチップで鳴っているボイスの
+ * モジュレーションモードの推定コストで按分してモードごとにも加算する。
+ * 境目ごとにシステムコールが1回入るので、計測中はその分だけ処理が重くなる（計測用のモード）。
+ * ワーカースレッド: HW_PERF_SCOPE("名前") のスコープの差分を名前ごとに加算する。
+ *
+ * Linux以外、またはENABLE_HW_PERF_COUNTERSが0のときは何も開かず、値はすべて0のまま。
+ */
+class HwPerfCounters {
+public:
+    enum Event {
+        Cycles,
+        Instructions,
+        L1DMisses,      // L1データキャッシュの読み込みミス
+        LLCMisses,      // 最終レベルキャッシュのミス
+        BranchMisses,
+        EventCount
+    };
+
+    struct Sample {
+        std::array<uint64_t, EventCount> values{};
+    };
+
+    struct Totals {
+        std::array<uint64_t, EventCount> values{};
+        uint64_t samples = 0;   // 加算した回数
+        double ipc() const { return values[Cycles] ? static_cast<double>(values[Instructions]) / values[Cycles] : 0.0; }
+        // 1000命令あたりの件数
+        double perKiloInstructions(Event e) const {
+            return values[Instructions] ? values[e] * 1000.0 / values[Instructions] : 0.0;
+        }
+    };
+
+    // 単一の書き込みスレッドが加算し、他のスレッドがそのまま読める合計値
+    class Accumulator {
+    public:
+        void add(const Sample& delta, double weight = 1.0);
+        void clear();
+        Totals load() const;
+    private:
+        std::array<std::atomic<uint64_t>, EventCount> values{};
+        std::atomic<uint64_t> samples{0};
+    };
+
+    HwPerfCounters() = default;
+    ~HwPerfCounters();
+    HwPerfCounters(const HwPerfCounters&) = delete;
+    HwPerfCounters& operator=(const HwPerfCounters&) = delete;
+
+    // 呼び出したスレッドのカウンタ（最初に呼んだときに開く）
+    static HwPerfCounters& forThisThread();
+    static bool isSupported();   // ENABLE_HW_PERF_COUNTERSが有効なLinux
+
+    bool isOpen() const { return leaderFd >= 0; }
+    bool read(Sample& out) const;
+    static Sample difference(const Sample& later, const Sample& earlier);
+    static const char* getEventName(Event e);
+
+    // ワーカーの名前ごとの合計（HW_PERF_SCOPE）
+    static void addWorker(const char* name, const Sample& delta);
+    static int getWorkerCount();
+    static const char* getWorkerName(int index);
+    static Totals getWorkerTotals(int index);
+
+    class WorkerScope {
+    public:
+        explicit WorkerScope(const char* name);
+        ~WorkerScope();
+    private:
+        const char* name;
+        Sample begin;
+        bool valid = false;
+    };
+
+private:
+    void open();
+    void close();
+
+    int leaderFd = -1;
+    std::array<int, EventCount> fds{{-1, -1, -1, -1, -1}};
+    std::array<int, EventCount> readOrder{{-1, -1, -1, -1, -1}}; // グループの読み出し順 → Event
+    int openedCount = 0;
+};
+
+/**
+ * オーディオスレッドの処理段・モジュレーションモードごとのカウンタ集計（プロセッサが持つ）
+ * beginBlock() → mark(処理段) / markChip(モードごとの重み) … → endBlock()
+ */
+class HwPerfStats {
+public:
+    void beginBlock();
+    // 前の境目からの差分をstageに加算する
+    void mark(PerfStats::Stage stage);
+    // チップのレンダリング: ChipRenderに加算し、modModeWeightsで按分してモードごとにも加算する
+    void markChip(const std::array<int, HW_PERF_MODMODE_COUNT>& modModeWeights);
+    void endBlock();
+    bool isActive() const { return active; }
+    bool isAvailable() const { return available.load(std::memory_order_relaxed); }
+
+    HwPerfCounters::Totals getStageTotals(PerfStats::Stage stage) const { return stages[stage].load(); }
+    HwPerfCounters::Totals getModModeTotals(int modmode) const { return modModes[modmode].load(); }
+    void requestReset() { resetRequested.store(true); }
+    std::string toJson() const;
+    bool dumpJson(const std::string& path) const;
+
+private:
+    bool readDelta(HwPerfCounters::Sample& delta);
+
+    std::array<HwPerfCounters::Accumulator, PerfStats::StageCount> stages;
+    std::array<HwPerfCounters::Accumulator, HW_PERF_MODMODE_COUNT> modModes;
+    HwPerfCounters::Sample blockBegin;
+    HwPerfCounters::Sample last;
+    bool active = false;                 // このブロックで計測中（オーディオスレッドのみ）
+    std::atomic<bool> available{false};  // カウンタを開けた
+    std::atomic<bool> resetRequested{false};
+};
+
+#if ENABLE_HW_PERF_COUNTERS
+#define HW_PERF_CONCAT_INNER(a, b) a##b
+#define HW_PERF_CONCAT(a, b) HW_PERF_CONCAT_INNER(a, b)
+#define HW_PERF_SCOPE(name) HwPerfCounters::WorkerScope HW_PERF_CONCAT(hwPerfScope_, __LINE__)(name)
+#else
+#define HW_PERF_SCOPE(name) ((void)0)
+#endif
@@ -1,12 +1,19 @@
 
 
 #include "PatchBankData.h"
+#include "TraceRecorder.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <string>
 #include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <bitset>
 #include <juce_core/juce_core.h>
 
 /*
@@ -14,12 +21,213 @@ PatchBankの初期化と、プログラム番号に該当しない場合のフ
 パッチ番号はMIDIプログラム番号によって決定される。GM準拠。
 */
 
-std::vector<std::vector<Patch>> PatchBanks(MAX_BANKS, std::vector<Patch>(PATCH_BANK_SIZE));
-std::vector<std::vector<Patch>> PatchBanksOriginal(MAX_BANKS, std::vector<Patch>(PATCH_BANK_SIZE));
+// ベースバンク（ファイルから読み込んだ内容）。バンクごとに不変のオブジェクトとして保持し、
+// 再読み込み時は新しいオブジェクトを組み立ててからポインタを差し替える（読み出し側はロック不要）
+struct PatchBank {
+    std::array<Patch, PATCH_BANK_SIZE> patches;
+};
+static const PatchBank emptyPatchBank{};                          // 未読み込みのバンク（全パッチ未定義）
+static std::array<std::atomic<PatchBank*>, MAX_BANKS> patchBanks{}; // nullptrはemptyPatchBank扱い
+
+// 差し替えで外れたバンクは、オーディオスレッドが2回以上patchBankQuiescentPoint()を通過し
+// （差し替え前のポインタを使っていたブロックが終わっている）、かつ一定時間経過してから解放する
+struct RetiredPatchBank {
+    std::unique_ptr<PatchBank> bank;
+    uint64_t epoch;
+    std::chrono::steady_clock::time_point time;
+    std::unique_ptr<juce::MemoryMappedFile> mapping; // デコードされないまま差し替えられた.3hsbのマッピング
+};
+static std::atomic<uint64_t> patchReadEpoch{0};
+static std::atomic<uint32_t> patchBankGeneration{0};
+static std::vector<RetiredPatchBank> retiredPatchBanks;
+static std::mutex retiredPatchBanksMutex;
+
+static const PatchBank& baseBank(int bankNumber) {
+    const PatchBank* bank = patchBanks[bankNumber].load(std::memory_order_acquire);
+    return bank ? *bank : emptyPatchBank;
+}
+
+static void publishPatchBank(int bankNumber, std::unique_ptr<PatchBank> bank) {
+    PatchBank* old = patchBanks[bankNumber].exchange(bank.release(), std::memory_order_acq_rel);
+    patchBankGeneration.fetch_add(1, std::memory_order_release);
+    if (old) {
+        std::lock_guard<std::mutex> lock(retiredPatchBanksMutex);
+        retiredPatchBanks.push_back({ std::unique_ptr<PatchBank>(old), patchReadEpoch.load(std::memory_order_acquire), std::chrono::steady_clock::now() });
+    }
+}
+
+static void applyDeferredPatchWrites();
+
+void patchBankQuiescentPoint() {
+    patchReadEpoch.fetch_add(1, std::memory_order_acq_rel);
+    applyDeferredPatchWrites();
+}
+
+void reclaimRetiredPatchBanks() {
+    uint64_t epoch = patchReadEpoch.load(std::memory_order_acquire);
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(retiredPatchBanksMutex);
+    retiredPatchBanks.erase(std::remove_if(retiredPatchBanks.begin(), retiredPatchBanks.end(),
+        [&](const RetiredPatchBank& r) {
+            return epoch >= r.epoch + 2 && now - r.time >= std::chrono::seconds(1);
+        }), retiredPatchBanks.end());
+}
+
+uint32_t getPatchBankGeneration() {
+    return patchBankGeneration.load(std::memory_order_acquire);
+}
+
+// オーバーライドレイヤー: (バンク, パッチ) → patchOverlayPool内のインデックス（-1でオーバーライドなし）
+static std::array<int16_t, MAX_BANKS * PATCH_BANK_SIZE> patchOverlayIndex = [] {
+    std::array<int16_t, MAX_BANKS * PATCH_BANK_SIZE> a;
+    a.fill(-1);
+    return a;
+}();
+// 1パッチにつきプールの要素は高々1つなので、全パッチ分を確保しておけば再確保（返した参照の無効化）は起きない
+static_assert(PATCH_OVERLAY_RESERVE >= MAX_BANKS * PATCH_BANK_SIZE && PATCH_OVERLAY_RESERVE <= INT16_MAX,
+              "patchOverlayPool must hold every patch and stay indexable by int16_t");
+static std::vector<Patch> patchOverlayPool;      // オーバーライドされたパッチ本体
+static std::vector<int> patchOverlaySlots;       // 使用中のpatchOverlayIndexの位置（リセット時にこれだけ戻す）
+
+// バイナリバンク: 起動時はmmapするだけで、レコードのデコードは直後にローダースレッドがバックグラウンドで行う
+// （参照されたバンクも要求する）。オーディオスレッドは要求フラグを立てるだけで、デコード（確保・CRC・munmap）はローダースレッドが
+// decodeRequestedPatchBanks()で行い、patchBanksのポインタ差し替えで公開する
+static std::array<std::unique_ptr<juce::MemoryMappedFile>, MAX_BANKS> mappedBanks;
+static std::array<std::atomic<bool>, MAX_BANKS> bankDecodePending{};
+static std::array<std::atomic<bool>, MAX_BANKS> bankDecodeRequested{};
+static std::atomic<bool> anyBankDecodeRequested{false};
+static std::mutex bankDecodeMutex;
+static bool decodeBinaryBank(const uint8_t* data, size_t size, PatchBank& out, int bankNumber, const char* name);
+
+// ファイルから読み込んだバンクで差し替える前に、デコード待ちの状態を破棄する（bankDecodeMutexを保持して呼ぶ）
+// 古いデコードが後から新しいバンクを上書きしないようにし、マッピングは差し替えたバンクと同じく後で解放する
+static void discardPendingBankDecode(int bankNumber) {
+    bankDecodeRequested[bankNumber].store(false, std::memory_order_relaxed);
+    bankDecodePending[bankNumber].store(false, std::memory_order_release);
+    if (mappedBanks[bankNumber]) {
+        std::lock_guard<std::mutex> lock(retiredPatchBanksMutex);
+        retiredPatchBanks.push_back({ nullptr, patchReadEpoch.load(std::memory_order_acquire), std::chrono::steady_clock::now(),
+                                      std::move(mappedBanks[bankNumber]) });
+    }
+}
+
+// その場でデコードする（オーディオスレッド以外から呼ぶ）
+static void ensureBankLoaded(int bankNumber) {
+    if (!bankDecodePending[bankNumber].load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(bankDecodeMutex);
+    if (!bankDecodePending[bankNumber].load(std::memory_order_relaxed)) return;
+    auto& mapped = mappedBanks[bankNumber];
+    if (mapped && mapped->getData() != nullptr) {
+        std::string name = std::to_string(bankNumber) + ".3hsb";
+        auto bank = std::make_unique<PatchBank>();
+        if (decodeBinaryBank(static_cast<const uint8_t*>(mapped->getData()), mapped->getSize(), *bank, bankNumber, name.c_str())) {
+            publishPatchBank(bankNumber, std::move(bank));
+        }
+    }
+    mapped.reset(); // デコード後はマッピング不要
+    bankDecodeRequested[bankNumber].store(false, std::memory_order_relaxed);
+    bankDecodePending[bankNumber].store(false, std::memory_order_release);
+}
+
+// デコード待ちのバンクをローダースレッドに要求する（ロック・確保なし。オーディオスレッドから呼んでよい）
+static void requestBankDecode(int bankNumber) {
+    if (!bankDecodePending[bankNumber].load(std::memory_order_acquire)) return;
+    if (!bankDecodeRequested[bankNumber].exchange(true, std::memory_order_acq_rel)) {
+        anyBankDecodeRequested.store(true, std::memory_order_release);
+    }
+}
+
+bool patchBankDecodeRequested() {
+    return anyBankDecodeRequested.load(std::memory_order_acquire);
+}
+
+void decodeRequestedPatchBanks() {
+    if (!anyBankDecodeRequested.exchange(false, std::memory_order_acq_rel)) return;
+    TRACE_SCOPE("decodeRequestedPatchBanks");
+    for (int bank = 0; bank < MAX_BANKS; ++bank) {
+        if (bankDecodeRequested[bank].load(std::memory_order_acquire)) ensureBankLoaded(bank);
+    }
+}
+
+// 有効なパッチ（オーバーライドがあればそれ、なければベース）
+// デコード待ちのバンクは要求だけ出し、公開されるまでは空のバンク（未定義 → バンク0へのフォールバック）として扱う
+static const Patch& patchAt(int bankNumber, int programNumber) {
+    requestBankDecode(bankNumber);
+    int16_t idx = patchOverlayIndex[bankNumber * PATCH_BANK_SIZE + programNumber];
+    return idx >= 0 ? patchOverlayPool[idx] : baseBank(bankNumber).patches[programNumber];
+}
+
+// 書き込み用: 初回はベースのパッチをオーバーライドレイヤーへコピーする
+static Patch& overridePatch(int bankNumber, int programNumber) {
+    int slot = bankNumber * PATCH_BANK_SIZE + programNumber;
+    if (patchOverlayIndex[slot] < 0) {
+        requestBankDecode(bankNumber);
+        patchOverlayIndex[slot] = static_cast<int16_t>(patchOverlayPool.size());
+        patchOverlayPool.push_back(baseBank(bankNumber).patches[programNumber]);
+        patchOverlaySlots.push_back(slot);
+    }
+    return patchOverlayPool[patchOverlayIndex[slot]];
+}
+
+// デコード待ちのバンクへの部分的な書き込み（Patch Override・未定義化）は、ベースのパッチが無いと正しく適用できないため
+// キューに積んでおき、デコードが公開された後のpatchBankQuiescentPoint()で受信順に適用する（オーディオスレッドのみ）
+// パッチ全体の書き込み（setPatchFromImage）はベースに依存しないので、その場で適用してそれ以前の分を破棄する
+struct DeferredPatchWrite {
+    int16_t slot;
+    int16_t relativeAddr; // -1: 未定義に戻す
+    uint8_t value;
+};
+static std::vector<DeferredPatchWrite> deferredPatchWrites;
+static std::bitset<MAX_BANKS * PATCH_BANK_SIZE> deferredPatchSlots; // キューに書き込みが残っているパッチ
+
+static void applyPatchByte(Patch& patch, int relativeAddr, int value);
+
+// キューに積んだ場合true（同じパッチへの書き込みは、キューが空になるまで順序を保つためすべて積む）
+static bool deferPatchWrite(int bankNumber, int programNumber, int relativeAddr, int value) {
+    int slot = bankNumber * PATCH_BANK_SIZE + programNumber;
+    if (!deferredPatchSlots.test(slot) &&
+        (patchOverlayIndex[slot] >= 0 || !bankDecodePending[bankNumber].load(std::memory_order_acquire))) {
+        return false;
+    }
+    if (deferredPatchWrites.size() >= deferredPatchWrites.capacity()) {
+        printf("[PatchBankData] Warning: Deferred patch write queue full, applying to bank %d patch %d before decode\n", bankNumber, programNumber);
+        return false;
+    }
+    requestBankDecode(bankNumber);
+    deferredPatchWrites.push_back({ static_cast<int16_t>(slot), static_cast<int16_t>(relativeAddr), static_cast<uint8_t>(value) });
+    deferredPatchSlots.set(slot);
+    return true;
+}
+
+static void applyDeferredPatchWrites() {
+    if (deferredPatchWrites.empty()) return;
+    // デコードの完了はこのパス中で変わり得るので先に確定させる（同じパッチの書き込みはすべて同じパスで適用する）
+    std::bitset<MAX_BANKS> decoded;
+    for (int bank = 0; bank < MAX_BANKS; ++bank) {
+        decoded[bank] = !bankDecodePending[bank].load(std::memory_order_acquire);
+    }
+    size_t kept = 0;
+    for (const auto& w : deferredPatchWrites) {
+        int bankNumber = w.slot / PATCH_BANK_SIZE;
+        if (!decoded[bankNumber]) {
+            deferredPatchWrites[kept++] = w;
+            continue;
+        }
+        deferredPatchSlots.reset(w.slot);
+        Patch& patch = overridePatch(bankNumber, w.slot % PATCH_BANK_SIZE);
+        if (w.relativeAddr < 0) {
+            patch.defined = false;
+        } else {
+            applyPatchByte(patch, w.relativeAddr, w.value);
+        }
+    }
+    deferredPatchWrites.resize(kept);
+}
 
 Patch defaultPatch; // デフォルトパッチ
 
 void initializePatchBanks(const std::string& patchesDir) {
+    TRACE_SCOPE("initializePatchBanks");
     printf("[PatchBankData] Initializing patch banks from directory: %s\n", patchesDir.c_str());
 
     // パッチ番号は実際のMIDIプログラム番号から1を引いた値, 1-128 -> 0-127
@@ -38,20 +246,65 @@ void initializePatchBanks(const std::string& patchesDir) {
     //defaultPatch.operators[1] = { 0x1000, 0,  0,255, 255,  17, 6 };
     //defaultPatch.operators[2] = { 0x0FF3, 0, 0, 255, 255, 16, 0 };
 
-    // すべてのバンクを初期化
+    // すべてのバンクを初期化（未定義に戻す）
     for (int bank = 0; bank < MAX_BANKS; ++bank) {
-        for (auto& patch : PatchBanks[bank]) {
-            patch.defined = false;
+        if (patchBanks[bank].load(std::memory_order_acquire)) {
+            publishPatchBank(bank, nullptr);
         }
     }
     
-    // パッチファイルをフォルダから読み込み
+    // パッチファイルをフォルダから読み込み（ディレクトリは1回だけ列挙する）
+    // <bank>.3hsbがあり、同じバンクの<bank>.jsonより新しければmmapだけ行い、デコードはローダースレッドに任せる
+    // バイナリが無い（または古い）バンクは従来通りJSONから読み込む
+    std::array<juce::File, MAX_BANKS> jsonFiles;
+    std::array<juce::File, MAX_BANKS> binaryFiles;
+    juce::File dir = juce::File::getCurrentWorkingDirectory().getChildFile(juce::String(patchesDir));
+    for (const auto& file : dir.findChildFiles(juce::File::findFiles, false, "*.json;*.3hsb")) {
+        juce::String name = file.getFileNameWithoutExtension();
+        if (name.isEmpty() || !name.containsOnly("0123456789")) continue;
+        int bank = name.getIntValue();
+        if (bank < 0 || bank >= MAX_BANKS) continue;
+        (file.hasFileExtension("3hsb") ? binaryFiles : jsonFiles)[bank] = file;
+    }
+
+    int mappedCount = 0;
+    int jsonCount = 0;
     for (int bank = 0; bank < MAX_BANKS; ++bank) {
-        std::string bankFilePath = patchesDir + std::to_string(bank) + ".json";
-        loadPatchBankFromJSON(bankFilePath, bank);
+        std::unique_lock<std::mutex> decodeLock(bankDecodeMutex);
+        bankDecodePending[bank].store(false);
+        bankDecodeRequested[bank].store(false);
+        mappedBanks[bank].reset();
+        const auto& bin = binaryFiles[bank];
+        const auto& json = jsonFiles[bank];
+        if (bin != juce::File() &&
+            (json == juce::File() || bin.getLastModificationTime() >= json.getLastModificationTime())) {
+            auto mapped = std::make_unique<juce::MemoryMappedFile>(bin, juce::MemoryMappedFile::readOnly);
+            if (mapped->getData() != nullptr) {
+                mappedBanks[bank] = std::move(mapped);
+                bankDecodePending[bank].store(true, std::memory_order_release);
+                ++mappedCount;
+                continue;
+            }
+            printf("[PatchLoaderBinary] Warning: Failed to map %s, falling back to JSON\n", bin.getFullPathName().toRawUTF8());
+        }
+        decodeLock.unlock();
+        if (json != juce::File()) {
+            loadPatchBankFromJSON(json.getFullPathName().toStdString(), bank);
+            ++jsonCount;
+        }
+    }
+    ensureBankLoaded(0); // バンク0は全バンクのフォールバック先なので起動時にデコードしておく
+    // 残りのバンクも最初のノートより前に揃うよう、参照を待たずにすべてデコードを要求しておく
+    for (int bank = 1; bank < MAX_BANKS; ++bank) {
+        requestBankDecode(bank);
     }
+    printf("[PatchBankData] %d binary bank(s) mapped, %d JSON bank(s) parsed\n", mappedCount, jsonCount);
     
-    PatchBanksOriginal = PatchBanks; // オリジナルのパッチバンクを保存
+    // オーバーライドレイヤーを空にし、リセット時に確保が起きないよう領域を確保しておく
+    resetPatchBanks();
+    patchOverlayPool.reserve(PATCH_OVERLAY_RESERVE);
+    patchOverlaySlots.reserve(PATCH_OVERLAY_RESERVE);
+    deferredPatchWrites.reserve(PATCH_DEFERRED_WRITE_RESERVE);
 }
 
 // 一時的な関数: 現在のPatchBankの内容をJSONファイルに書き出す
@@ -65,36 +318,50 @@ void exportCurrentPatchBankToJSON() {
 }
 
 void resetPatchBanks() {
-    PatchBanks = PatchBanksOriginal;
+    for (int slot : patchOverlaySlots) {
+        patchOverlayIndex[slot] = -1;
+    }
+    patchOverlaySlots.clear();
+    patchOverlayPool.clear(); // capacityは保持される
+    deferredPatchWrites.clear();
+    deferredPatchSlots.reset();
+}
+
+int getPatchOverrideCount() {
+    return static_cast<int>(patchOverlaySlots.size());
 }
 
 // プログラム番号に該当しない場合は0番パッチを返す
-Patch& getPatchOrDefault(int bankNumber, int programNumber) {
+const Patch& getPatchOrDefault(int bankNumber, int programNumber) {
     if (bankNumber >= 0 && bankNumber < MAX_BANKS &&
-        programNumber >= 0 && programNumber < PATCH_BANK_SIZE &&
-        PatchBanks[bankNumber][programNumber].defined) {
-        return PatchBanks[bankNumber][programNumber];
+        programNumber >= 0 && programNumber < PATCH_BANK_SIZE) {
+        const Patch& patch = patchAt(bankNumber, programNumber);
+        if (patch.defined) return patch;
     }
     return defaultPatch;
 }
 
 // 代理発音機能：指定バンクにパッチがない場合はバンク0にフォールバック
-Patch& getEffectivePatch(int bankNumber, int programNumber) {
+const Patch& getEffectivePatch(int bankNumber, int programNumber) {
     if (bankNumber >= 0 && bankNumber < MAX_BANKS &&
         programNumber >= 0 && programNumber < PATCH_BANK_SIZE) {
         
         // Temporary bypass !!!
-        //return PatchBanks[bankNumber][programNumber];
+        //return patchAt(bankNumber, programNumber);
 
-        // 指定バンクにパッチが定義されている場合
-        if (PatchBanks[bankNumber][programNumber].defined) {
-            return PatchBanks[bankNumber][programNumber];
+        // 指定バンクにパッチが定義されている場合（オーバーライドを優先）
+        const Patch& patch = patchAt(bankNumber, programNumber);
+        if (patch.defined) {
+            return patch;
         }
         
         // 指定バンクにパッチがない場合、バンク0（GM）にフォールバック
-        if (bankNumber != 0 && PatchBanks[0][programNumber].defined) {
-            //printf("[Warning::PatchBankData] No patch found for PC %d:%d, returning patch from bank 0\n", bankNumber, programNumber);
-            return PatchBanks[0][programNumber];
+        if (bankNumber != 0) {
+            const Patch& fallback = patchAt(0, programNumber);
+            if (fallback.defined) {
+                //printf("[Warning::PatchBankData] No patch found for PC %d:%d, returning patch from bank 0\n", bankNumber, programNumber);
+                return fallback;
+            }
         }
     }
     
@@ -103,18 +370,19 @@ Patch& getEffectivePatch(int bankNumber, int programNumber) {
     return defaultPatch;
 }
 
-// パッチの存在状況を取得する関数 (GUI用)
+// パッチの存在状況を取得する関数
+// オーバーライドレイヤーを読むのでオーディオスレッドから呼ぶ（エディタはプロセッサがブロックごとに公開する値を使う）
 int getPatchAvailability(int bankNumber, int programNumber) {
     if (bankNumber >= 0 && bankNumber < MAX_BANKS &&
         programNumber >= 0 && programNumber < PATCH_BANK_SIZE) {
         
         // 指定バンクにパッチが定義されている場合
-        if (PatchBanks[bankNumber][programNumber].defined) {
+        if (patchAt(bankNumber, programNumber).defined) {
             return 2; // 指定バンクに存在
         }
         
         // 指定バンクにパッチがない場合、バンク0（GM）にフォールバック
-        if (bankNumber != 0 && PatchBanks[0][programNumber].defined) {
+        if (bankNumber != 0 && patchAt(0, programNumber).defined) {
             return 1; // バンク0に存在
         }
     }
@@ -122,66 +390,102 @@ int getPatchAvailability(int bankNumber, int programNumber) {
     return 0; // 存在しない
 }
 
+// 相対アドレス1バイト分をパッチに反映する（Patch Override・バルクダンプ共通）
+static void applyPatchByte(Patch& patch, int relativeAddr, int value) {
+    if (relativeAddr < 0 || relativeAddr >= PATCH_IMAGE_SIZE) return;
+    if (relativeAddr >= 0x02 && relativeAddr <= 0x0F)
+    {
+        if ((relativeAddr & 1) == 0) {
+            patch.operators[relativeAddr/2].frequency &= 0x00FF;
+            patch.operators[relativeAddr/2].frequency |= (value << 8);
+        } else// OP2-8 frequency MSB
+        {
+            patch.operators[relativeAddr/2].frequency &= 0xFF00;
+            patch.operators[relativeAddr/2].frequency |= value;
+        }// OP2-8 frequency LSB
+    }
+    if (relativeAddr >= 0x10 && relativeAddr <= 0x17)
+    {
+        // 音量レジスタのオーバーライド
+        patch.operators[relativeAddr - 0x10].volume = value;
+    }
+    if (relativeAddr >= 0x18 && relativeAddr <= 0x1B)
+    {
+        patch.operators[(relativeAddr - 0x18)*2].waveform = (value & 0xF0) >> 4; // 波形は4bitなので下位4ビットのみを設定
+        patch.operators[(relativeAddr - 0x18)*2 + 1].waveform = value & 0x0F; // MSBを設定
+    }
+    if (relativeAddr == 0x1C) {
+            patch.modmode = value;
+    } 
+    if (relativeAddr == 0x1F) {
+            patch.feedback = value;
+    }
+    if (relativeAddr >= 0x20 && relativeAddr <= 0x3F ) {
+        int modulo = relativeAddr % 4;
+        switch (modulo)
+        {
+        case 0:
+            patch.operators[(relativeAddr - 0x20)/4].attack = value;
+            break;
+        case 1:
+            patch.operators[(relativeAddr - 0x20)/4].decay = value;
+            break;
+        case 2:
+            patch.operators[(relativeAddr - 0x20)/4].sustain = value;
+            break;
+        case 3:
+            patch.operators[(relativeAddr - 0x20)/4].release = value;
+            break;
+        default:
+            break;
+        }
+    }
+    if (relativeAddr == 0x40) {
+        patch.keyShift = static_cast<int8_t>(value); // キーシフトはint8_tなのでキャスト
+    }
+}
+
 void setPatchOverride(int bankNumber, int patchNumber, int relativeAddr, int value) {
     if (bankNumber >= 0 && bankNumber < MAX_BANKS &&
         patchNumber >= 0 && patchNumber < PATCH_BANK_SIZE) {
-        Patch& patch = PatchBanks[bankNumber][patchNumber];
-        // オーバーライド処理
-        if (relativeAddr >= 0 && relativeAddr < 0x41) {
-            if (relativeAddr >= 0x02 && relativeAddr <= 0x0F)
-            {
-                if ((relativeAddr & 1) == 0) {
-                    patch.operators[relativeAddr/2].frequency &= 0x00FF;
-                    patch.operators[relativeAddr/2].frequency |= (value << 8);
-                } else// OP2-8 frequency MSB
-                {
-                    patch.operators[relativeAddr/2].frequency &= 0xFF00;
-                    patch.operators[relativeAddr/2].frequency |= value;
-                }// OP2-8 frequency LSB
-            }
-            if (relativeAddr >= 0x10 && relativeAddr <= 0x17)
-            {
-                // 音量レジスタのオーバーライド
-                patch.operators[relativeAddr - 0x10].volume = value;
-            }
-            if (relativeAddr >= 0x18 && relativeAddr <= 0x1B)
-            {
-                patch.operators[(relativeAddr - 0x18)*2].waveform = (value & 0xF0) >> 4; // 波形は4bitなので下位4ビットのみを設定
-                patch.operators[(relativeAddr - 0x18)*2 + 1].waveform = value & 0x0F; // MSBを設定
-            }
-            if (relativeAddr == 0x1C) {
-                    patch.modmode = value;
-            } 
-            if (relativeAddr == 0x1F) {
-                    patch.feedback = value;
-            }
-            if (relativeAddr >= 0x20 && relativeAddr <= 0x3F ) {
-                int modulo = relativeAddr % 4;
-                switch (modulo)
-                {
-                case 0:
-                    patch.operators[(relativeAddr - 0x20)/4].attack = value;
-                    break;
-                case 1:
-                    patch.operators[(relativeAddr - 0x20)/4].decay = value;
-                    break;
-                case 2:
-                    patch.operators[(relativeAddr - 0x20)/4].sustain = value;
-                    break;
-                case 3:
-                    patch.operators[(relativeAddr - 0x20)/4].release = value;
-                    break;
-                default:
-                    break;
-                }
-            }
-            if (relativeAddr == 0x40) {
-                patch.keyShift = static_cast<int8_t>(value); // キーシフトはint8_tなのでキャスト
-            }
+        // オーバーライド処理（デコード待ちのバンクはデコード後に適用する）
+        if (deferPatchWrite(bankNumber, patchNumber, relativeAddr, value)) return;
+        applyPatchByte(overridePatch(bankNumber, patchNumber), relativeAddr, value);
+    }
+}
+
+void clearPatchDefinition(int bankNumber, int patchNumber) {
+    if (bankNumber >= 0 && bankNumber < MAX_BANKS &&
+        patchNumber >= 0 && patchNumber < PATCH_BANK_SIZE) {
+        if (deferPatchWrite(bankNumber, patchNumber, -1, 0)) return;
+        if (patchAt(bankNumber, patchNumber).defined) {
+            overridePatch(bankNumber, patchNumber).defined = false;
         }
     }
 }
 
+bool setPatchFromImage(int bankNumber, int patchNumber, const uint8_t* image) {
+    if (bankNumber < 0 || bankNumber >= MAX_BANKS ||
+        patchNumber < 0 || patchNumber >= PATCH_BANK_SIZE) {
+        return false;
+    }
+    // 一時オブジェクトに組み立ててから差し替える（途中状態のパッチが見えないように）
+    Patch patch = patchAt(bankNumber, patchNumber);
+    for (int addr = 0; addr < PATCH_IMAGE_SIZE; ++addr) {
+        applyPatchByte(patch, addr, image[addr]);
+    }
+    patch.defined = true;
+    // パッチ全体を置き換えるので、キューに残っている同じパッチへの書き込みは不要になる
+    int slot = bankNumber * PATCH_BANK_SIZE + patchNumber;
+    if (deferredPatchSlots.test(slot)) {
+        deferredPatchWrites.erase(std::remove_if(deferredPatchWrites.begin(), deferredPatchWrites.end(),
+            [slot](const DeferredPatchWrite& w) { return w.slot == slot; }), deferredPatchWrites.end());
+        deferredPatchSlots.reset(slot);
+    }
+    overridePatch(bankNumber, patchNumber) = patch;
+    return true;
+}
+
 // PatchクラスのtoRegValuesメソッドの実装
 std::array<uint8_t, 64> Patch::toRegValues(uint8_t midiVolume) {
     std::array<uint8_t, 64> regs{0};
@@ -222,7 +526,7 @@ std::array<uint8_t, 64> Patch::toRegValues(uint8_t midiVolume) {
 
 #define CLAMP(val, minVal, maxVal) std::min(std::max((val), (minVal)), (maxVal))
 
-Patch Patch::applyMutation(const Mutation& mutation) {
+Patch Patch::applyMutation(const Mutation& mutation) const {
     Patch mutatedPatch = *this; // 現在のパッチをコピー
     //printf("Applying mutation: Attack %+0.2f, Decay %+0.2f, Sustain %+0.2f, Release %+0.2f\n", mutation.attackTime, mutation.decayTime, mutation.sustainLevel, mutation.releaseTime);
     for (size_t i = 0; i < 8; ++i) {
@@ -245,6 +549,7 @@ Patch Patch::applyMutation(const Mutation& mutation) {
 
 // JSONからPatchBankを読み込む
 bool loadPatchBankFromJSON(const std::string& filePath, int bankNumber) {
+    TRACE_SCOPE("loadPatchBankFromJSON");
     try {
         // ファイルを読み込む
         
@@ -267,15 +572,12 @@ bool loadPatchBankFromJSON(const std::string& filePath, int bankNumber) {
             return false;
         }
         
-        // 指定バンクの全てのパッチを未定義状態にリセット
-        if (bankNumber >= 0 && bankNumber < MAX_BANKS) {
-            for (auto& patch : PatchBanks[bankNumber]) {
-                patch.defined = false;
-            }
-        } else {
+        if (bankNumber < 0 || bankNumber >= MAX_BANKS) {
             printf("[PatchLoaderJSON] Warning: Invalid bank number %d\n", bankNumber);
             return false;
         }
+        // 新しいバンク（全パッチ未定義）に読み込み、完成してから差し替える
+        auto bank = std::make_unique<PatchBank>();
         
         // パッチデータを読み込む
         juce::Array<juce::var>* patchArray = patches.getArray();
@@ -292,7 +594,7 @@ bool loadPatchBankFromJSON(const std::string& filePath, int bankNumber) {
                 continue;
             }
             
-            Patch& patch = PatchBanks[bankNumber][programNumber];
+            Patch& patch = bank->patches[programNumber];
             
             // パッチの基本情報
             patch.defined = true;
@@ -316,11 +618,16 @@ bool loadPatchBankFromJSON(const std::string& filePath, int bankNumber) {
                         patch.operators[j].waveform = static_cast<uint8_t>(static_cast<int>(opData.getProperty("waveform", 0)));
                     }
                 }
-                printf("[PatchLoaderJSON] Loaded patch %d (has %d operator(s)).\n", programNumber, operatorArray->size());
+                //printf("[PatchLoaderJSON] Loaded patch %d (has %d operator(s)).\n", programNumber, operatorArray->size());
             }
             
         }
         
+        {
+            std::lock_guard<std::mutex> lock(bankDecodeMutex);
+            discardPendingBankDecode(bankNumber);
+            publishPatchBank(bankNumber, std::move(bank));
+        }
         printf("[PatchLoaderJSON] Successfully loaded %d patches into bank %d from %s\n", patchArray->size(), bankNumber, filePath.c_str());
         return true;
         
@@ -336,9 +643,10 @@ bool savePatchBankToJSON(const std::string& filePath, int bankNumber) {
         std::ostringstream json;
         json << "{\n  \"patches\": [\n";
         
+        ensureBankLoaded(bankNumber);
         bool first = true;
         for (int i = 0; i < PATCH_BANK_SIZE; ++i) {
-            const Patch& patch = PatchBanks[bankNumber][i];
+            const Patch& patch = patchAt(bankNumber, i);
             if (!patch.defined) {
                 continue;
             }
@@ -388,3 +696,127 @@ bool savePatchBankToJSON(const std::string& filePath, int bankNumber) {
         return false;
     }
 }
+
+// ---- バイナリパッチバンク（.3hsb） ----
+
+// CRC-32（IEEE 802.3、zlib.crc32と同じ）。起動時・保存時にしか使わないためテーブルは持たない
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static uint16_t readU16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+static uint32_t readU32(const uint8_t* p) { return static_cast<uint32_t>(p[0] | (p[1] << 8) | (p[2] << 16)) | (static_cast<uint32_t>(p[3]) << 24); }
+static void writeU16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; }
+static void writeU32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = (v >> (i * 8)) & 0xFF; }
+
+static bool decodeBinaryBank(const uint8_t* data, size_t size, PatchBank& out, int bankNumber, const char* name) {
+    const size_t recordsSize = static_cast<size_t>(PATCH_BANK_SIZE) * PATCH_BINARY_RECORD_SIZE;
+    if (size < PATCH_BINARY_HEADER_SIZE + recordsSize || std::memcmp(data, "3HSB", 4) != 0) {
+        printf("[PatchLoaderBinary] Error: %s is not a patch bank file\n", name);
+        return false;
+    }
+    if (readU16(data + 4) != PATCH_BINARY_VERSION || readU16(data + 6) != PATCH_BINARY_RECORD_SIZE ||
+        readU16(data + 8) != PATCH_BANK_SIZE) {
+        printf("[PatchLoaderBinary] Error: %s has unsupported version %d\n", name, readU16(data + 4));
+        return false;
+    }
+    const uint8_t* records = data + PATCH_BINARY_HEADER_SIZE;
+    if (crc32(records, recordsSize) != readU32(data + 12)) {
+        printf("[PatchLoaderBinary] Error: %s checksum mismatch\n", name);
+        return false;
+    }
+
+    int definedCount = 0;
+    for (int program = 0; program < PATCH_BANK_SIZE; ++program) {
+        const uint8_t* rec = records + program * PATCH_BINARY_RECORD_SIZE;
+        Patch& patch = out.patches[program];
+        patch.defined = rec[0] != 0;
+        patch.modmode = rec[1];
+        patch.feedback = rec[2];
+        patch.keyShift = static_cast<int8_t>(rec[3]);
+        for (int j = 0; j < 8; ++j) {
+            const uint8_t* op = rec + 8 + j * 8;
+            patch.operators[j].frequency = readU16(op);
+            patch.operators[j].attack = op[2];
+            patch.operators[j].decay = op[3];
+            patch.operators[j].sustain = op[4];
+            patch.operators[j].release = op[5];
+            patch.operators[j].volume = op[6];
+            patch.operators[j].waveform = op[7];
+        }
+        if (patch.defined) ++definedCount;
+    }
+    printf("[PatchLoaderBinary] Loaded %d patches into bank %d from %s\n", definedCount, bankNumber, name);
+    return true;
+}
+
+// .3hsbを即座に読み込む（initializePatchBanks()はmmapのみ行い遅延デコードする）
+bool loadPatchBankFromBinary(const std::string& filePath, int bankNumber) {
+    TRACE_SCOPE("loadPatchBankFromBinary");
+    if (bankNumber < 0 || bankNumber >= MAX_BANKS) {
+        printf("[PatchLoaderBinary] Warning: Invalid bank number %d\n", bankNumber);
+        return false;
+    }
+    juce::File file = juce::File::getCurrentWorkingDirectory().getChildFile(juce::String(filePath));
+    juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+    if (mapped.getData() == nullptr) {
+        printf("[PatchLoaderBinary] Error: Failed to open %s\n", filePath.c_str());
+        return false;
+    }
+    auto bank = std::make_unique<PatchBank>();
+    if (!decodeBinaryBank(static_cast<const uint8_t*>(mapped.getData()), mapped.getSize(), *bank, bankNumber, filePath.c_str())) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(bankDecodeMutex);
+    discardPendingBankDecode(bankNumber);
+    publishPatchBank(bankNumber, std::move(bank));
+    return true;
+}
+
+// 現在の有効なパッチ（オーバーライド適用後）を.3hsbに書き出す
+bool savePatchBankToBinary(const std::string& filePath, int bankNumber) {
+    if (bankNumber < 0 || bankNumber >= MAX_BANKS) return false;
+    std::vector<uint8_t> out(PATCH_BINARY_HEADER_SIZE + static_cast<size_t>(PATCH_BANK_SIZE) * PATCH_BINARY_RECORD_SIZE, 0);
+    uint8_t* records = out.data() + PATCH_BINARY_HEADER_SIZE;
+    ensureBankLoaded(bankNumber);
+    for (int program = 0; program < PATCH_BANK_SIZE; ++program) {
+        const Patch& patch = patchAt(bankNumber, program);
+        uint8_t* rec = records + program * PATCH_BINARY_RECORD_SIZE;
+        rec[0] = patch.defined ? 1 : 0;
+        rec[1] = patch.modmode;
+        rec[2] = patch.feedback;
+        rec[3] = static_cast<uint8_t>(patch.keyShift);
+        for (int j = 0; j < 8; ++j) {
+            const Operator& op = patch.operators[j];
+            uint8_t* dst = rec + 8 + j * 8;
+            writeU16(dst, op.frequency);
+            dst[2] = op.attack;
+            dst[3] = op.decay;
+            dst[4] = op.sustain;
+            dst[5] = op.release;
+            dst[6] = op.volume;
+            dst[7] = op.waveform;
+        }
+    }
+    std::memcpy(out.data(), "3HSB", 4);
+    writeU16(out.data() + 4, PATCH_BINARY_VERSION);
+    writeU16(out.data() + 6, PATCH_BINARY_RECORD_SIZE);
+    writeU16(out.data() + 8, PATCH_BANK_SIZE);
+    writeU32(out.data() + 12, crc32(records, out.size() - PATCH_BINARY_HEADER_SIZE));
+
+    std::ofstream fout(filePath, std::ios::binary);
+    if (!fout) {
+        std::cout << "[PatchLoaderBinary] Error: Cannot write " << filePath << std::endl;
+        return false;
+    }
+    fout.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    std::cout << "[PatchLoaderBinary] Successfully saved bank " << bankNumber << " to " << filePath << std::endl;
+    return true;
+}
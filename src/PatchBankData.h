@@ -8,6 +8,15 @@
 
 #define PATCH_BANK_SIZE 128
 #define MAX_BANKS 128  // 最大バンク数（GSバンク対応）
+#define PATCH_OVERLAY_RESERVE (MAX_BANKS * PATCH_BANK_SIZE) // オーバーライドレイヤーに事前確保するパッチ数（全パッチ分。オーディオスレッドで再確保されず、参照も無効にならない）
+#define PATCH_DEFERRED_WRITE_RESERVE 1024 // デコード待ちのバンクへの書き込みを保留するキューの長さ（超えた分はデコード前のパッチへ書き込む）
+// バイナリパッチバンク（<bank>.3hsb）: ヘッダ + プログラム番号順の固定長レコード x 128（リトルエンディアン）
+// ヘッダ: "3HSB" <version:u16> <recordSize:u16> <recordCount:u16> <reserved:u16> <CRC32 of records:u32>
+// レコード: <defined:u8> <modmode:u8> <feedback:u8> <keyShift:s8> <reserved:4> { <frequency:u16> <A> <D> <S> <R> <volume> <waveform> } x 8
+#define PATCH_BINARY_VERSION 1
+#define PATCH_BINARY_HEADER_SIZE 16
+#define PATCH_BINARY_RECORD_SIZE 72
+#define PATCH_IMAGE_SIZE 0x41 // パッチのバイナリイメージのサイズ（Patch Overrideの相対アドレス0x00～0x40と同じ配置）
 
 // オペレーター 構造体
 struct Operator {
@@ -45,7 +54,7 @@ struct Patch {
 
     // レジスタ値配列へ変換
     std::array<uint8_t, 64> toRegValues(uint8_t midiVolume = 255);
-    Patch applyMutation(const Mutation& mutation);
+    Patch applyMutation(const Mutation& mutation) const;
     bool volumeScalingNeeded(int operatorIndex) const {
         if (modmode < 13) {
             return volumeScalingMap[modmode][operatorIndex];
@@ -55,8 +64,8 @@ struct Patch {
 };
 
 // バンクごとのパッチ定義（GSバンク対応）
-extern std::vector<std::vector<Patch>> PatchBanks;
-extern std::vector<std::vector<Patch>> PatchBanksOriginal;
+// ファイルから読み込んだベースバンクはバンクごとの不変オブジェクトで、再読み込み時はポインタを差し替える。
+// SysExによる変更は、変更されたパッチだけを持つオーバーライドレイヤーへコピーオンライトで書き込む
 extern Patch defaultPatch; // デフォルトパッチ
 
 void initializePatchBanks(const std::string& patchesDir = "patches/");
@@ -64,11 +73,27 @@ bool loadPatchBankFromYAML(const std::string& filePath);
 bool loadPatchBankFromJSON(const std::string& filePath, int bankNumber = 0);
 bool savePatchBankToYAML(const std::string& filePath);
 bool savePatchBankToJSON(const std::string& filePath, int bankNumber = 0);
+bool loadPatchBankFromBinary(const std::string& filePath, int bankNumber = 0);
+bool savePatchBankToBinary(const std::string& filePath, int bankNumber = 0);
 void exportCurrentPatchBankToJSON(); // 一時的な関数: 現在のPatchBankをJSONに書き出す
-Patch& getPatchOrDefault(int bankNumber, int programNumber);
+const Patch& getPatchOrDefault(int bankNumber, int programNumber);
 void setPatchOverride(int bankNumber, int patchNumber, int relativeAddr, int value);
-void resetPatchBanks();
+void clearPatchDefinition(int bankNumber, int patchNumber); // パッチを未定義にする（フォールバック対象にする）
+// パッチ全体をイメージ（PATCH_IMAGE_SIZEバイト）から一括で置き換える（バルクダンプ用）
+bool setPatchFromImage(int bankNumber, int patchNumber, const uint8_t* image);
+void resetPatchBanks(); // オーバーライドレイヤーを破棄してベースバンクに戻す（変更されたパッチ数に比例するコスト）
+int getPatchOverrideCount();
 
 // 代理発音関連（バンク0へのフォールバック）
-Patch& getEffectivePatch(int bankNumber, int programNumber);
-int getPatchAvailability(int bankNumber, int programNumber);
\ No newline at end of file
+// 返される参照は、オーディオスレッドでは次のpatchBankQuiescentPoint()まで有効
+const Patch& getEffectivePatch(int bankNumber, int programNumber);
+int getPatchAvailability(int bankNumber, int programNumber); // オーディオスレッド専用（オーバーライドレイヤーを読む）
+
+// ベースバンクの差し替え（ホットリロード）
+// loadPatchBankFromJSON/Binaryは新しいバンクを組み立ててからアトミックに差し替えるため、どのスレッドから呼んでもよい
+void patchBankQuiescentPoint();   // オーディオスレッドが各ブロックの先頭で呼ぶ（以前のブロックで取得した参照を使い終えた印。デコード待ちだったバンクへの書き込みもここで適用する）
+void reclaimRetiredPatchBanks();  // 差し替えで外れた古いバンクのうち、参照され得なくなったものを解放する（オーディオスレッド以外から呼ぶ）
+uint32_t getPatchBankGeneration(); // ベースバンクが差し替えられるたびに増える
+// 遅延デコード（.3hsb）: 起動後のバックグラウンドデコードと参照されたバンクのデコードは、ローダースレッドがこれを呼んで行う（オーディオスレッドでは行わない）
+bool patchBankDecodeRequested();
+void decodeRequestedPatchBanks();
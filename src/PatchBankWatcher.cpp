@@ -0,0 +1,90 @@
+// PatchBankWatcher.cpp
+#include "PatchBankWatcher.h"
+#include "TraceRecorder.h"
+#include <chrono>
+#include <cstdio>
+#include <juce_core/juce_core.h>
+
+PatchBankWatcher::~PatchBankWatcher() {
+    stop();
+}
+
+void PatchBankWatcher::start(const std::string& dir, int interval) {
+    if (running.load()) return;
+    patchesDir = dir;
+    intervalMs = interval;
+    poll(true); // 現在の更新日時を記録するだけ（読み込みはinitializePatchBanks()で済んでいる）
+    running.store(true);
+    worker = std::thread([this] { run(); });
+    printf("[PatchBankWatcher] Watching %s (every %d ms)\n", patchesDir.c_str(), intervalMs);
+}
+
+void PatchBankWatcher::stop() {
+    if (!running.exchange(false)) return;
+    wakeCondition.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void PatchBankWatcher::run() {
+    while (running.load()) {
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(intervalMs), [this] { return !running.load(); });
+        }
+        if (!running.load()) break;
+        poll(false);
+        reclaimRetiredPatchBanks();
+    }
+}
+
+void PatchBankWatcher::poll(bool initial) {
+    TRACE_THREAD_NAME("PatchBankWatcher");
+    TRACE_SCOPE("PatchBankWatcher::poll");
+    std::array<int64_t, MAX_BANKS> jsonTimes{};
+    std::array<int64_t, MAX_BANKS> binaryTimes{};
+    std::array<juce::File, MAX_BANKS> jsonFiles;
+    std::array<juce::File, MAX_BANKS> binaryFiles;
+
+    juce::File dir = juce::File::getCurrentWorkingDirectory().getChildFile(juce::String(patchesDir));
+    for (const auto& file : dir.findChildFiles(juce::File::findFiles, false, "*.json;*.3hsb")) {
+        juce::String name = file.getFileNameWithoutExtension();
+        if (name.isEmpty() || !name.containsOnly("0123456789")) continue;
+        int bank = name.getIntValue();
+        if (bank < 0 || bank >= MAX_BANKS) continue;
+        int64_t modTime = file.getLastModificationTime().toMilliseconds();
+        if (file.hasFileExtension("3hsb")) {
+            binaryFiles[bank] = file;
+            binaryTimes[bank] = modTime;
+        } else {
+            jsonFiles[bank] = file;
+            jsonTimes[bank] = modTime;
+        }
+    }
+
+    for (int bank = 0; bank < MAX_BANKS; ++bank) {
+        if (initial) {
+            jsonModTimes[bank] = jsonTimes[bank];
+            binaryModTimes[bank] = binaryTimes[bank];
+            continue;
+        }
+        if (jsonTimes[bank] == jsonModTimes[bank] && binaryTimes[bank] == binaryModTimes[bank]) continue;
+
+        // initializePatchBanks()と同じ規則: 新しい方を使う（同時刻ならバイナリ）
+        bool ok = true; // ファイルが削除された場合は現在のバンクをそのまま使う
+        if (binaryTimes[bank] != 0 && binaryTimes[bank] >= jsonTimes[bank]) {
+            ok = loadPatchBankFromBinary(binaryFiles[bank].getFullPathName().toStdString(), bank);
+        } else if (jsonTimes[bank] != 0) {
+            ok = loadPatchBankFromJSON(jsonFiles[bank].getFullPathName().toStdString(), bank);
+        }
+        if (!ok) {
+            printf("[PatchBankWatcher] Reload of bank %d failed, will retry\n", bank);
+            continue; // 更新日時を記録しないので次回再試行する
+        }
+        jsonModTimes[bank] = jsonTimes[bank];
+        binaryModTimes[bank] = binaryTimes[bank];
+        reloadCount.fetch_add(1);
+        printf("[PatchBankWatcher] Bank %d reloaded\n", bank);
+    }
+}
@@ -0,0 +1,45 @@
+// PatchBankWatcher.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "PatchBankData.h"
+
+/**
+ * パッチフォルダ（<bank>.json / <bank>.3hsb）の変更を監視し、変更されたバンクを再読み込みする
+ *
+ * ワーカースレッドで一定間隔ごとに更新日時を確認し、変わったバンクだけを読み込み直す。
+ * 読み込みは新しいバンクを組み立ててからアトミックに差し替えるので、オーディオスレッドは止まらない。
+ * 書き込み途中のファイルで読み込みに失敗した場合は、次の確認で再試行する。
+ */
+class PatchBankWatcher {
+public:
+    ~PatchBankWatcher();
+
+    void start(const std::string& patchesDir, int intervalMs = 500);
+    void stop();
+
+    uint32_t getReloadCount() const { return reloadCount.load(); }
+
+private:
+    void run();
+    void poll(bool initial);
+
+    std::string patchesDir;
+    int intervalMs = 500;
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+
+    // 最後に読み込んだ時点の更新日時（ミリ秒、ファイルが無ければ0）
+    std::array<int64_t, MAX_BANKS> jsonModTimes{};
+    std::array<int64_t, MAX_BANKS> binaryModTimes{};
+
+    std::atomic<uint32_t> reloadCount{0};
+};
@@ -0,0 +1,234 @@
+// PcmRamAllocator.cpp
+#include "PcmRamAllocator.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+void PcmRamAllocator::reset(uint8_t* ramPtr, uint32_t baseAddr, uint32_t sizeBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ram = ramPtr;
+    base = baseAddr;
+    size = sizeBytes;
+    blocks.clear();
+    freeHandles.clear();
+    freeExtents.clear();
+    byHash.clear();
+    dedupHits = 0;
+    dedupSavedBytes = 0;
+    if (size > 0) {
+        freeExtents[base] = size;
+    }
+}
+
+// FNV-1a（64bit）
+uint64_t PcmRamAllocator::hashContent(const uint8_t* data, uint32_t length) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < length; ++i) {
+        h ^= data[i];
+        h *= 0x100000001B3ull;
+    }
+    return h ^ length;
+}
+
+int PcmRamAllocator::findDuplicate(const uint8_t* data, uint32_t length, uint64_t hash) const {
+    auto range = byHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Block& b = blocks[it->second];
+        if (b.refCount > 0 && b.length == length && std::memcmp(ram + b.addr, data, length) == 0) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+int PcmRamAllocator::newHandle(const Block& block) {
+    int handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        blocks[handle] = block;
+    } else {
+        handle = static_cast<int>(blocks.size());
+        blocks.push_back(block);
+    }
+    byHash.emplace(block.hash, handle);
+    return handle;
+}
+
+// 空き領域から[addr, addr+length)を切り出す（全体が1つの空き領域に含まれている場合のみ）
+bool PcmRamAllocator::takeExtent(uint32_t addr, uint32_t length) {
+    auto it = freeExtents.upper_bound(addr);
+    if (it == freeExtents.begin()) return false;
+    --it;
+    uint32_t extAddr = it->first;
+    uint32_t extLen = it->second;
+    if (addr < extAddr || addr + length > extAddr + extLen) return false;
+    freeExtents.erase(it);
+    if (addr > extAddr) freeExtents[extAddr] = addr - extAddr;
+    if (addr + length < extAddr + extLen) freeExtents[addr + length] = extAddr + extLen - (addr + length);
+    return true;
+}
+
+void PcmRamAllocator::giveExtent(uint32_t addr, uint32_t length) {
+    auto next = freeExtents.lower_bound(addr);
+    // 後ろの空き領域と結合
+    if (next != freeExtents.end() && addr + length == next->first) {
+        length += next->second;
+        next = freeExtents.erase(next);
+    }
+    // 前の空き領域と結合
+    if (next != freeExtents.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == addr) {
+            prev->second += length;
+            return;
+        }
+    }
+    freeExtents[addr] = length;
+}
+
+int PcmRamAllocator::allocate(const uint8_t* data, uint32_t length, bool* shared) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (shared) *shared = false;
+    if (!ram || length == 0) return -1;
+    uint64_t hash = hashContent(data, length);
+    int dup = findDuplicate(data, length, hash);
+    if (dup >= 0) {
+        blocks[dup].refCount++;
+        dedupHits++;
+        dedupSavedBytes += length;
+        if (shared) *shared = true;
+        return dup;
+    }
+    for (const auto& ext : freeExtents) {
+        if (ext.second >= length) {
+            uint32_t addr = ext.first;
+            takeExtent(addr, length);
+            std::memcpy(ram + addr, data, length);
+            return newHandle(Block{ addr, length, hash, 1 });
+        }
+    }
+    return -1;
+}
+
+int PcmRamAllocator::adopt(uint32_t addr, uint32_t length, bool pinned) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ram || length == 0 || addr < base || addr + length > base + size) return -1;
+    // 同じ位置の領域が既に登録済みなら共有（重複排除済みのキャッシュを復元した場合）
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].refCount > 0 && blocks[i].addr == addr && blocks[i].length == length) {
+            blocks[i].refCount++;
+            dedupHits++;
+            dedupSavedBytes += length;
+            return static_cast<int>(i);
+        }
+    }
+    if (!takeExtent(addr, length)) {
+        printf("[PcmRamAllocator] Cannot adopt overlapping region 0x%06X + %u\n", addr, length);
+        return -1;
+    }
+    return newHandle(Block{ addr, length, hashContent(ram + addr, length), 1, pinned });
+}
+
+bool PcmRamAllocator::isFree(uint32_t addr, uint32_t length) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (length == 0) return true;
+    auto it = freeExtents.upper_bound(addr);
+    if (it == freeExtents.begin()) return false;
+    --it;
+    return addr >= it->first && addr + length <= it->first + it->second;
+}
+
+bool PcmRamAllocator::reserveTail(uint32_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (length > size) return false;
+    if (length > 0 && !takeExtent(base + size - length, length)) return false;
+    size -= length; // 以後の確保・コンパクションはこの手前までで行う
+    return true;
+}
+
+void PcmRamAllocator::release(int handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (handle < 0 || handle >= static_cast<int>(blocks.size())) return;
+    Block& b = blocks[handle];
+    if (b.refCount == 0) return;
+    if (--b.refCount > 0) return;
+    auto range = byHash.equal_range(b.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == handle) {
+            byHash.erase(it);
+            break;
+        }
+    }
+    giveExtent(b.addr, b.length);
+    freeHandles.push_back(handle);
+}
+
+PcmRamAllocator::Region PcmRamAllocator::get(int handle) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (handle < 0 || handle >= static_cast<int>(blocks.size()) || blocks[handle].refCount == 0) return {};
+    return Region{ blocks[handle].addr, blocks[handle].length };
+}
+
+bool PcmRamAllocator::needsCompaction(uint32_t length) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t total = 0;
+    for (const auto& ext : freeExtents) {
+        if (ext.second >= length) return false;
+        total += ext.second;
+    }
+    return total >= length;
+}
+
+bool PcmRamAllocator::compact(uint32_t& dirtyStart, uint32_t& dirtyEnd) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> live;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].refCount > 0) live.push_back(static_cast<int>(i));
+    }
+    std::sort(live.begin(), live.end(), [this](int a, int b) { return blocks[a].addr < blocks[b].addr; });
+
+    // アドレス順に先頭へ詰める（移動先は常に移動元以下なので前から順にmemmoveしてよい）
+    // 固定された領域はそのまま残し、次の領域はその直後から詰める（元の位置より後ろへは動かないので重ならない）
+    uint32_t cursor = base;
+    dirtyStart = base + size;
+    dirtyEnd = base;
+    freeExtents.clear();
+    for (int handle : live) {
+        Block& b = blocks[handle];
+        if (b.pinned) {
+            if (b.addr > cursor) freeExtents[cursor] = b.addr - cursor;
+            cursor = b.addr + b.length;
+            continue;
+        }
+        if (b.addr != cursor) {
+            std::memmove(ram + cursor, ram + b.addr, b.length);
+            dirtyStart = std::min(dirtyStart, cursor);
+            dirtyEnd = std::max(dirtyEnd, cursor + b.length);
+            b.addr = cursor;
+        }
+        cursor += b.length;
+    }
+    if (cursor < base + size) {
+        freeExtents[cursor] = base + size - cursor;
+    }
+    return dirtyEnd > dirtyStart;
+}
+
+PcmRamAllocator::Stats PcmRamAllocator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats s;
+    s.capacity = size;
+    for (const auto& ext : freeExtents) {
+        s.freeBytes += ext.second;
+        s.largestFreeBlock = std::max(s.largestFreeBlock, ext.second);
+    }
+    s.usedBytes = size - s.freeBytes;
+    for (const auto& b : blocks) {
+        if (b.refCount > 0) s.regionCount++;
+    }
+    s.dedupHits = dedupHits;
+    s.dedupSavedBytes = dedupSavedBytes;
+    return s;
+}
@@ -0,0 +1,87 @@
+// PcmRamAllocator.h
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * ドラムPCM RAM（g_pcmRam）の領域管理
+ *
+ * - allocate(): 空き領域（先頭から最初に収まる位置）にデータを書き込んでハンドルを返す。
+ *               内容が同じサンプルが既にあれば書き込まずに参照カウントを増やして共有する
+ * - release():  参照カウントが0になった領域を空き領域に戻す（隣接する空き領域と結合）
+ * - compact():  使用中の領域を先頭へ詰めて空き領域を1つにまとめる。ハンドルは変わらずアドレスだけが変わる
+ *               （adopt()でpinnedにした領域は動かさない。その前後の空き領域は別々に残る）
+ *
+ * g_pcmRamを書き換えるだけで、チップRAMへの転送とキーマップの更新は呼び出し側
+ * （PcmUploadManager::runExclusiveCommit()）で行う。オーディオスレッドからは呼ばないこと。
+ */
+class PcmRamAllocator {
+public:
+    struct Region {
+        uint32_t addr = 0;
+        uint32_t length = 0;
+    };
+
+    struct Stats {
+        uint32_t capacity = 0;
+        uint32_t usedBytes = 0;
+        uint32_t freeBytes = 0;
+        uint32_t largestFreeBlock = 0;
+        uint32_t regionCount = 0;      // 使用中の領域数（共有分は1つと数える）
+        uint32_t dedupHits = 0;        // 重複排除で共有した回数
+        uint64_t dedupSavedBytes = 0;  // 重複排除で節約したバイト数
+    };
+
+    void reset(uint8_t* ram, uint32_t base, uint32_t size);
+
+    // dataをコピーして領域を確保（-1: 連続した空き領域が無い）。sharedには既存の領域を共有したかを返す
+    int allocate(const uint8_t* data, uint32_t length, bool* shared = nullptr);
+    // 既にRAM上にあるデータを領域として登録する（キャッシュから復元した場合など）
+    // pinnedはコンパクションで移動しない領域（SysExアップロードなど、アドレスを送信側が決めている場合）
+    int adopt(uint32_t addr, uint32_t length, bool pinned = false);
+    void release(int handle);
+    // [addr, addr+length)がすべて空き領域か（管理範囲の外はfalse）
+    bool isFree(uint32_t addr, uint32_t length) const;
+    // 管理範囲の末尾lengthバイトを切り離してアロケータの外で使う（空いていなければfalse）
+    bool reserveTail(uint32_t length);
+    Region get(int handle) const;
+    uint32_t getBase() const { return base; }
+
+    // 合計の空き容量は足りるが、連続した空き領域が足りない
+    bool needsCompaction(uint32_t length) const;
+    // 使用中の領域を先頭に詰める。書き換えた範囲を[dirtyStart, dirtyEnd)で返す（移動が無ければfalse）
+    bool compact(uint32_t& dirtyStart, uint32_t& dirtyEnd);
+
+    Stats getStats() const;
+
+private:
+    struct Block {
+        uint32_t addr = 0;
+        uint32_t length = 0;
+        uint64_t hash = 0;
+        uint32_t refCount = 0;
+        bool pinned = false;
+    };
+
+    static uint64_t hashContent(const uint8_t* data, uint32_t length);
+    int findDuplicate(const uint8_t* data, uint32_t length, uint64_t hash) const;
+    int newHandle(const Block& block);
+    bool takeExtent(uint32_t addr, uint32_t length);
+    void giveExtent(uint32_t addr, uint32_t length);
+
+    mutable std::mutex mutex;
+    uint8_t* ram = nullptr;
+    uint32_t base = 0;
+    uint32_t size = 0;
+
+    std::vector<Block> blocks;                   // ハンドル → 領域（refCount 0は未使用）
+    std::vector<int> freeHandles;
+    std::map<uint32_t, uint32_t> freeExtents;    // 空き領域: アドレス → 長さ
+    std::unordered_multimap<uint64_t, int> byHash;
+
+    uint32_t dedupHits = 0;
+    uint64_t dedupSavedBytes = 0;
+};
@@ -0,0 +1,367 @@
+// PcmUploadManager.cpp
+#include "PcmUploadManager.h"
+#include "HwPerfCounters.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+PcmUploadManager::PcmUploadManager(size_t ringCapacity) {
+    ring.resize(ringCapacity);
+}
+
+PcmUploadManager::~PcmUploadManager() {
+    stop();
+    delete publishedCommit.exchange(nullptr);
+    delete finishedCommit.exchange(nullptr);
+    delete activeCommit.exchange(nullptr);
+}
+
+void PcmUploadManager::start(uint8_t* ram, size_t ramSize, PcmRamAllocator* ramAllocator) {
+    if (running.load()) return;
+    pcmRam = ram;
+    pcmRamSize = ramSize;
+    allocator = ramAllocator;
+    running.store(true);
+    worker = std::thread([this] { workerLoop(); });
+}
+
+void PcmUploadManager::stop() {
+    if (!running.exchange(false)) return;
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+//==============================================================================
+// オーディオスレッド側
+
+bool PcmUploadManager::enqueue(uint8_t command, const uint8_t* payload, int size) {
+    if (size < 0) return false;
+    size_t need = 5 + static_cast<size_t>(size);
+    uint64_t w = writeCount.load(std::memory_order_relaxed);
+    uint64_t r = readCount.load(std::memory_order_acquire);
+    if (ring.size() - (w - r) < need) {
+        droppedMessages.fetch_add(1);
+        return false;
+    }
+    uint8_t header[5] = {
+        command,
+        static_cast<uint8_t>(size & 0xFF),
+        static_cast<uint8_t>((size >> 8) & 0xFF),
+        static_cast<uint8_t>((size >> 16) & 0xFF),
+        static_cast<uint8_t>((size >> 24) & 0xFF)
+    };
+    ringWrite(w, header, 5);
+    ringWrite(w + 5, payload, static_cast<size_t>(size));
+    writeCount.store(w + need, std::memory_order_release);
+    bytesReceived.fetch_add(static_cast<uint64_t>(size));
+    return true;
+}
+
+PcmUploadManager::PendingCommit* PcmUploadManager::acquireCommit() {
+    PendingCommit* commit = activeCommit.load(std::memory_order_acquire);
+    if (commit) return commit;
+    commit = publishedCommit.exchange(nullptr, std::memory_order_acq_rel);
+    if (commit) {
+        activeCommit.store(commit, std::memory_order_release);
+        copyRemaining.store(commit->end - commit->start);
+    }
+    return commit;
+}
+
+void PcmUploadManager::advanceCommit(PendingCommit* commit, uint32_t bytes) {
+    if (!commit) return;
+    commit->copyPos = std::min(commit->end, commit->copyPos + bytes);
+    copyRemaining.store(commit->end - commit->copyPos);
+}
+
+void PcmUploadManager::finishCommit(PendingCommit* commit) {
+    if (!commit) return;
+    activeCommit.store(nullptr, std::memory_order_release);
+    copyRemaining.store(0);
+    commits.fetch_add(1);
+    finishedCommit.store(commit, std::memory_order_release);
+}
+
+bool PcmUploadManager::isRangeUpdating(uint32_t start, uint32_t end) const {
+    const PendingCommit* commit = activeCommit.load(std::memory_order_acquire);
+    if (!commit) return false;
+    return start < commit->end && commit->start < end;
+}
+
+PcmUploadManager::Stats PcmUploadManager::getStats() const {
+    Stats s;
+    s.bytesReceived = bytesReceived.load();
+    s.bytesDecoded = bytesDecoded.load();
+    s.chunksReceived = chunksReceived.load();
+    s.tableEntries = tableEntries.load();
+    s.commits = commits.load();
+    s.droppedMessages = droppedMessages.load();
+    s.decodeErrors = decodeErrors.load();
+    s.rejectedCommits = rejectedCommits.load();
+    s.stagedBytes = stagedBytes.load();
+    s.copyRemaining = copyRemaining.load();
+    s.throughputBytesPerSec = throughput.load();
+    return s;
+}
+
+void PcmUploadManager::ringWrite(uint64_t pos, const uint8_t* src, size_t len) {
+    size_t cap = ring.size();
+    size_t offset = static_cast<size_t>(pos % cap);
+    size_t first = std::min(len, cap - offset);
+    std::memcpy(ring.data() + offset, src, first);
+    if (len > first) {
+        std::memcpy(ring.data(), src + first, len - first);
+    }
+}
+
+void PcmUploadManager::ringRead(uint64_t pos, uint8_t* dst, size_t len) const {
+    size_t cap = ring.size();
+    size_t offset = static_cast<size_t>(pos % cap);
+    size_t first = std::min(len, cap - offset);
+    std::memcpy(dst, ring.data() + offset, first);
+    if (len > first) {
+        std::memcpy(dst + first, ring.data(), len - first);
+    }
+}
+
+//==============================================================================
+// ワーカースレッド側
+
+void PcmUploadManager::workerLoop() {
+    uint8_t command = 0;
+    std::vector<uint8_t> payload;
+    while (running.load()) {
+        releaseFinishedCommit();
+        if (!readMessage(command, payload)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        HW_PERF_SCOPE("PcmUpload");
+        switch (command) {
+        case SampleLoad: handleSampleLoad(payload); break;
+        case TableEntry: handleTableEntry(payload); break;
+        case Commit:     handleCommit(); break;
+        default:
+            decodeErrors.fetch_add(1);
+            break;
+        }
+    }
+}
+
+bool PcmUploadManager::readMessage(uint8_t& command, std::vector<uint8_t>& payload) {
+    uint64_t r = readCount.load(std::memory_order_relaxed);
+    uint64_t w = writeCount.load(std::memory_order_acquire);
+    if (w - r < 5) return false;
+    uint8_t header[5];
+    ringRead(r, header, 5);
+    command = header[0];
+    size_t size = static_cast<size_t>(header[1]) | (static_cast<size_t>(header[2]) << 8) |
+                  (static_cast<size_t>(header[3]) << 16) | (static_cast<size_t>(header[4]) << 24);
+    payload.resize(size);
+    ringRead(r + 5, payload.data(), size);
+    readCount.store(r + 5 + size, std::memory_order_release);
+    return true;
+}
+
+uint32_t PcmUploadManager::read28(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0] & 0x7F) << 21) | (static_cast<uint32_t>(p[1] & 0x7F) << 14) |
+           (static_cast<uint32_t>(p[2] & 0x7F) << 7) | static_cast<uint32_t>(p[3] & 0x7F);
+}
+
+void PcmUploadManager::handleSampleLoad(const std::vector<uint8_t>& payload) {
+    if (payload.size() < 4) {
+        decodeErrors.fetch_add(1);
+        return;
+    }
+    if (stagedChunks.empty() && stagedEntries.empty()) {
+        // 新しいアップロードの開始
+        droppedAtStageStart = droppedMessages.load();
+        stageStartTime = std::chrono::steady_clock::now();
+        stageDecodedBytes = 0;
+    }
+
+    StagedChunk chunk;
+    chunk.addr = read28(payload.data());
+    chunk.data.reserve((payload.size() - 4) * 7 / 8 + 7);
+    size_t i = 4;
+    while (i < payload.size()) {
+        uint8_t msb = payload[i++];
+        for (int k = 0; k < 7 && i < payload.size(); ++k) {
+            chunk.data.push_back(static_cast<uint8_t>((payload[i++] & 0x7F) | (((msb >> k) & 1) << 7)));
+        }
+    }
+    if (static_cast<size_t>(chunk.addr) + chunk.data.size() > pcmRamSize) {
+        printf("[PcmUpload] Chunk out of range: 0x%06X + %zu\n", chunk.addr, chunk.data.size());
+        decodeErrors.fetch_add(1);
+        return;
+    }
+
+    size_t decoded = chunk.data.size();
+    stagedChunks.push_back(std::move(chunk));
+    chunksReceived.fetch_add(1);
+    bytesDecoded.fetch_add(decoded);
+    stagedBytes.fetch_add(static_cast<uint32_t>(decoded));
+
+    stageDecodedBytes += decoded;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - stageStartTime).count();
+    if (elapsed > 0.0) {
+        throughput.store(static_cast<double>(stageDecodedBytes) / elapsed);
+    }
+}
+
+void PcmUploadManager::handleTableEntry(const std::vector<uint8_t>& payload) {
+    if (payload.size() < static_cast<size_t>(tableEntryMinPayload) || payload.size() > static_cast<size_t>(tableEntryMaxPayload)) {
+        decodeErrors.fetch_add(1);
+        return;
+    }
+    if (stagedChunks.empty() && stagedEntries.empty()) {
+        droppedAtStageStart = droppedMessages.load();
+        stageStartTime = std::chrono::steady_clock::now();
+        stageDecodedBytes = 0;
+    }
+    uint8_t note = payload[0] & 0x7F;
+    DrumSampleInfo info;
+    info.pcmIndex = static_cast<int32_t>(read28(payload.data() + 1));
+    info.pcmLength = static_cast<int32_t>(read28(payload.data() + 5));
+    info.sampleRate = static_cast<int32_t>(read28(payload.data() + 9));
+    info.format = payload.size() > static_cast<size_t>(tableEntryMinPayload) && payload[tableEntryMinPayload] == DRUM_PCM_FORMAT_ADPCM4 ? DRUM_PCM_FORMAT_ADPCM4 : DRUM_PCM_FORMAT_RAW8;
+    if (static_cast<size_t>(info.pcmIndex) + static_cast<size_t>(info.pcmLength) > pcmRamSize) {
+        printf("[PcmUpload] Table entry out of range: note %d, 0x%06X + %d\n", note, info.pcmIndex, info.pcmLength);
+        decodeErrors.fetch_add(1);
+        return;
+    }
+    stagedEntries.push_back(KeymapEntry{ DRUM_KIT_DEFAULT, note, info });
+    tableEntries.fetch_add(1);
+}
+
+void PcmUploadManager::handleCommit() {
+    if (droppedMessages.load() != droppedAtStageStart) {
+        printf("[PcmUpload] Upload discarded: %u message(s) dropped while staging\n",
+               droppedMessages.load() - droppedAtStageStart);
+        stagedChunks.clear();
+        stagedEntries.clear();
+        stagedBytes.store(0);
+        droppedAtStageStart = droppedMessages.load();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (!waitForTransferIdle()) return;
+
+    // 書き込む範囲（連続・重複するチャンクはまとめる）
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (const auto& chunk : stagedChunks) {
+        if (!chunk.data.empty()) ranges.push_back({ chunk.addr, chunk.addr + static_cast<uint32_t>(chunk.data.size()) });
+    }
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<uint32_t, uint32_t>> merged;
+    for (const auto& r : ranges) {
+        if (!merged.empty() && r.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, r.second);
+        } else {
+            merged.push_back(r);
+        }
+    }
+    if (!reserveStagedRanges(merged)) {
+        rejectedCommits.fetch_add(1);
+        stagedChunks.clear();
+        stagedEntries.clear();
+        stagedBytes.store(0);
+        return;
+    }
+
+    auto* commit = new PendingCommit();
+    uint32_t start = static_cast<uint32_t>(pcmRamSize);
+    uint32_t end = 0;
+    for (const auto& chunk : stagedChunks) {
+        std::memcpy(pcmRam + chunk.addr, chunk.data.data(), chunk.data.size());
+        start = std::min(start, chunk.addr);
+        end = std::max(end, chunk.addr + static_cast<uint32_t>(chunk.data.size()));
+    }
+    if (allocator) {
+        // 書き込み後の内容で登録する（重複排除のハッシュは登録時の内容から計算される）
+        for (const auto& r : merged) {
+            uploadHandles.push_back(allocator->adopt(r.first, r.second - r.first, true));
+        }
+    }
+    if (end <= start) {
+        start = end = 0;
+    }
+    commit->start = start;
+    commit->end = end;
+    commit->copyPos = start;
+    commit->entries = std::move(stagedEntries);
+    printf("[PcmUpload] Commit: %zu chunk(s), range 0x%06X-0x%06X, %zu table entr%s\n",
+           stagedChunks.size(), start, end, commit->entries.size(), commit->entries.size() == 1 ? "y" : "ies");
+
+    stagedChunks.clear();
+    stagedEntries.clear();
+    stagedBytes.store(0);
+    publishCommit(commit);
+}
+
+// コミットする範囲がアロケータの空き領域か確認する（commitMutex保持中）
+// 前回のアップロードの範囲は上書きしてよいので先に解放し、破棄する場合は登録し直す
+bool PcmUploadManager::reserveStagedRanges(const std::vector<std::pair<uint32_t, uint32_t>>& ranges) {
+    if (!allocator) return true;
+    std::vector<PcmRamAllocator::Region> releasedRegions;
+    std::vector<int> keptHandles;
+    for (int handle : uploadHandles) {
+        auto region = allocator->get(handle);
+        bool overlaps = false;
+        for (const auto& r : ranges) {
+            overlaps = overlaps || (region.addr < r.second && region.addr + region.length > r.first);
+        }
+        if (overlaps) {
+            allocator->release(handle);
+            releasedRegions.push_back(region);
+        } else {
+            keptHandles.push_back(handle);
+        }
+    }
+    for (const auto& r : ranges) {
+        if (allocator->isFree(r.first, r.second - r.first)) continue;
+        printf("[PcmUpload] Commit rejected: range 0x%06X-0x%06X overlaps PCM RAM already in use\n", r.first, r.second);
+        for (const auto& region : releasedRegions) {
+            keptHandles.push_back(allocator->adopt(region.addr, region.length, true));
+        }
+        uploadHandles = std::move(keptHandles);
+        return false;
+    }
+    uploadHandles = std::move(keptHandles);
+    return true;
+}
+
+bool PcmUploadManager::runExclusiveCommit(const std::function<bool(PendingCommit& commit)>& writer) {
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (!waitForTransferIdle()) return false;
+    auto* commit = new PendingCommit();
+    if (!writer(*commit) || (commit->end <= commit->start && commit->entries.empty())) {
+        delete commit;
+        return false;
+    }
+    if (commit->end <= commit->start) {
+        commit->start = commit->end = 0;
+    }
+    commit->copyPos = commit->start;
+    publishCommit(commit);
+    return true;
+}
+
+bool PcmUploadManager::waitForTransferIdle() {
+    // 前のコミットの転送が終わるまで待つ（その間もg_pcmRamは転送元として使われている）
+    while (running.load() && (publishedCommit.load() || activeCommit.load())) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    releaseFinishedCommit();
+    return running.load();
+}
+
+void PcmUploadManager::publishCommit(PendingCommit* commit) {
+    publishedCommit.store(commit, std::memory_order_release);
+}
+
+void PcmUploadManager::releaseFinishedCommit() {
+    delete finishedCommit.exchange(nullptr, std::memory_order_acq_rel);
+}
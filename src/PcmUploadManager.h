@@ -0,0 +1,155 @@
+// PcmUploadManager.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "DrumKeymapManager.h"
+#include "PcmRamAllocator.h"
+
+/**
+ * SysExによるドラムPCMのストリーミングアップロード（3HSPlugコマンド 0x01/0x02/0x03）
+ *
+ * オーディオスレッド: enqueue()で受信したペイロードを事前確保済みのリングバッファへコピーするだけ（ロック・メモリ確保なし）
+ * ワーカースレッド: 7bitパッキングのデコードとステージング領域への蓄積、コミット時のg_pcmRamへの書き込み
+ * オーディオスレッド: コミットを受け取ったら各チップのPCM領域へ1ブロックあたり一定バイト数ずつ転送し、
+ *                     転送完了と同時にキーマップを差し替える（新しいキットはすべて揃ってから有効になる）
+ *
+ * ペイロード形式（数値はすべて7bit x 4バイトのビッグエンディアン、28bit）:
+ *   0x01 Sample Load : <addr:4> <packed data>
+ *        packed data = 7バイトごとに <MSB集合> <下位7bit x 最大7>（MSB集合のbit iがi番目のバイトの最上位ビット）
+ *   0x02 Table Entry : <note> <start:4> <length:4> <sampleRate:4> [<format>]
+ *        format = 0: Raw Unsigned 8bit（省略時） 1: 4bit ADPCM（s3hs_core/lib/adpcm.cpp のブロック形式）
+ *   0x03 Commit      : （なし）ステージングしたサンプルとテーブルをまとめて反映
+ *
+ * コミットで書き込む範囲はPcmRamAllocatorに登録してから書き込む。ドラムキットなどアロケータが確保済みの範囲
+ * （前回のアップロードで書き込んだ範囲を除く）と重なるコミットは破棄する。
+ */
+class PcmUploadManager {
+public:
+    enum Command : uint8_t {
+        SampleLoad = 0x01,
+        TableEntry = 0x02,
+        Commit = 0x03
+    };
+
+    // Table Entryのペイロード長（末尾のformatは省略可）
+    static constexpr int tableEntryMinPayload = 13;
+    static constexpr int tableEntryMaxPayload = 14;
+
+    // キーマップの更新1件（SysExのテーブルエントリはDRUM_KIT_DEFAULTのキットに反映する）
+    struct KeymapEntry {
+        uint8_t kit = DRUM_KIT_DEFAULT;
+        uint8_t note = 0;
+        DrumSampleInfo info;
+    };
+
+    // オーディオスレッドへ受け渡すコミット（ワーカーが生成し、オーディオスレッドが転送完了後に返却する）
+    struct PendingCommit {
+        uint32_t start = 0;      // 転送範囲 [start, end)
+        uint32_t end = 0;
+        uint32_t copyPos = 0;    // オーディオスレッドでの転送位置
+        bool started = false;    // 転送開始時の処理（重なるドラムの停止）を済ませたか
+        std::vector<KeymapEntry> entries; // キット・ノート → サンプル情報
+    };
+
+    struct Stats {
+        uint64_t bytesReceived = 0;    // 受信したSysExペイロード（7bit）バイト数
+        uint64_t bytesDecoded = 0;     // デコード済みPCMバイト数
+        uint32_t chunksReceived = 0;
+        uint32_t tableEntries = 0;
+        uint32_t commits = 0;          // 転送まで完了したコミット数
+        uint32_t droppedMessages = 0;  // リングバッファ溢れで破棄したメッセージ数
+        uint32_t decodeErrors = 0;
+        uint32_t rejectedCommits = 0;  // 確保済みの範囲と重なって破棄したコミット数
+        uint32_t stagedBytes = 0;      // 未コミットのPCMバイト数
+        uint32_t copyRemaining = 0;    // チップへの転送待ちバイト数
+        double throughputBytesPerSec = 0.0; // 現在のアップロードのデコードスループット
+    };
+
+    explicit PcmUploadManager(size_t ringCapacity = 1 << 21);
+    ~PcmUploadManager();
+
+    // ワーカースレッドの開始・停止（allocatorを渡すと、コミットする範囲をアロケータに登録してから書き込む）
+    void start(uint8_t* pcmRam, size_t pcmRamSize, PcmRamAllocator* allocator = nullptr);
+    void stop();
+
+    // オーディオスレッドから呼ぶ: ペイロードをキューへ積む（満杯なら破棄してfalse）
+    bool enqueue(uint8_t command, const uint8_t* payload, int size);
+
+    // オーディオスレッドから呼ぶ: 転送すべきコミットを取得（なければnullptr）。finishCommit()まで所有する
+    PendingCommit* acquireCommit();
+    // オーディオスレッドから呼ぶ: 転送位置をbytes進める（進捗の統計に反映）
+    void advanceCommit(PendingCommit* commit, uint32_t bytes);
+    // オーディオスレッドから呼ぶ: 転送とキーマップ反映が完了したコミットを返却（解放はワーカー側）
+    void finishCommit(PendingCommit* commit);
+    // 転送中の範囲と重なるか（転送中のサンプルを発音しないために使用）
+    bool isRangeUpdating(uint32_t start, uint32_t end) const;
+
+    // 他のスレッドから呼ぶ: g_pcmRamを書き換えてコミットする（ドラムキットの差し替え・コンパクション用）
+    // SysExアップロードのコミットと直列化され、前のコミットの転送完了を待ってからwriterを呼ぶ。
+    // writerはg_pcmRamを書き換え、転送範囲（start/end）とキーマップ更新（entries）を設定する。falseを返すとコミットしない
+    bool runExclusiveCommit(const std::function<bool(PendingCommit& commit)>& writer);
+
+    Stats getStats() const;
+
+private:
+    void workerLoop();
+    bool readMessage(uint8_t& command, std::vector<uint8_t>& payload);
+    void handleSampleLoad(const std::vector<uint8_t>& payload);
+    void handleTableEntry(const std::vector<uint8_t>& payload);
+    void handleCommit();
+    bool reserveStagedRanges(const std::vector<std::pair<uint32_t, uint32_t>>& ranges);
+    void releaseFinishedCommit();
+    bool waitForTransferIdle();           // 前のコミットの転送完了を待つ（停止中ならfalse）
+    void publishCommit(PendingCommit* commit);
+    std::mutex commitMutex;               // g_pcmRamへの書き込みとコミットの発行を直列化
+    static uint32_t read28(const uint8_t* p);
+
+    // SPSCリングバッファ（書き込み: オーディオスレッド、読み出し: ワーカー）
+    std::vector<uint8_t> ring;
+    std::atomic<uint64_t> writeCount{0};
+    std::atomic<uint64_t> readCount{0};
+    void ringWrite(uint64_t pos, const uint8_t* src, size_t len);
+    void ringRead(uint64_t pos, uint8_t* dst, size_t len) const;
+
+    // ワーカー側のステージング
+    struct StagedChunk {
+        uint32_t addr;
+        std::vector<uint8_t> data;
+    };
+    std::vector<StagedChunk> stagedChunks;
+    std::vector<KeymapEntry> stagedEntries;
+
+    uint8_t* pcmRam = nullptr;
+    size_t pcmRamSize = 0;
+    PcmRamAllocator* allocator = nullptr;
+    std::vector<int> uploadHandles;  // アップロードで書き込んだ範囲のハンドル（次のアップロードで上書きされたら解放する）
+
+    std::atomic<PendingCommit*> publishedCommit{nullptr}; // ワーカー → オーディオ
+    std::atomic<PendingCommit*> finishedCommit{nullptr};  // オーディオ → ワーカー
+    std::atomic<PendingCommit*> activeCommit{nullptr};    // 転送中（isRangeUpdating用）
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+    // 統計
+    std::atomic<uint64_t> bytesReceived{0};
+    std::atomic<uint64_t> bytesDecoded{0};
+    std::atomic<uint32_t> chunksReceived{0};
+    std::atomic<uint32_t> tableEntries{0};
+    std::atomic<uint32_t> commits{0};
+    std::atomic<uint32_t> droppedMessages{0};
+    std::atomic<uint32_t> decodeErrors{0};
+    std::atomic<uint32_t> rejectedCommits{0};
+    std::atomic<uint32_t> stagedBytes{0};
+    std::atomic<uint32_t> copyRemaining{0};
+    std::atomic<double> throughput{0.0};
+    uint32_t droppedAtStageStart = 0;  // ステージング開始時点のdroppedMessages（途中で破棄があればコミットしない）
+    std::chrono::steady_clock::time_point stageStartTime;
+    uint64_t stageDecodedBytes = 0;
+};
@@ -0,0 +1,255 @@
+// PerfStats.cpp
+#include "PerfStats.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+int PerfStats::bucketIndex(uint64_t ns) {
+    if (ns < (1ull << minOctave)) return 0;
+    int msb = minOctave;
+    while (msb < 63 && (ns >> (msb + 1)) != 0) ++msb;
+    if (msb > maxOctave) return bucketCount - 1;
+    int sub = static_cast<int>((ns >> (msb - 2)) & (bucketsPerOctave - 1));
+    return 1 + (msb - minOctave) * bucketsPerOctave + sub;
+}
+
+uint64_t PerfStats::bucketUpperNs(int bucket) {
+    if (bucket <= 0) return 1ull << minOctave;
+    int octave = minOctave + (bucket - 1) / bucketsPerOctave;
+    int sub = (bucket - 1) % bucketsPerOctave;
+    return static_cast<uint64_t>(bucketsPerOctave + sub + 1) << (octave - 2);
+}
+
+void PerfStats::Histogram::record(uint64_t ns) {
+    // 書き込みはオーディオスレッドだけなので、fetch_addではなく読んで足して書くだけでよい
+    auto& bucket = buckets[bucketIndex(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totalNs.store(totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > maxNs.load(std::memory_order_relaxed)) maxNs.store(ns, std::memory_order_relaxed);
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void PerfStats::Histogram::clear() {
+    for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    totalNs.store(0, std::memory_order_relaxed);
+    maxNs.store(0, std::memory_order_relaxed);
+}
+
+PerfStats::Summary PerfStats::Histogram::summarize() const {
+    Summary s;
+    std::array<uint64_t, bucketCount> snapshot;
+    uint64_t total = 0;
+    for (int i = 0; i < bucketCount; ++i) {
+        snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+    if (total == 0) return s;
+    uint64_t maxValue = maxNs.load(std::memory_order_relaxed);
+    // 書き込み中に読んでも崩れないよう、件数はバケットの合計を使う
+    auto percentile = [&](double q) {
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(total) + 0.999999));
+        uint64_t cumulative = 0;
+        for (int i = 0; i < bucketCount; ++i) {
+            cumulative += snapshot[i];
+            if (cumulative >= target) return std::min(bucketUpperNs(i), maxValue) / 1000.0;
+        }
+        return maxValue / 1000.0;
+    };
+    s.count = total;
+    uint64_t n = count.load(std::memory_order_relaxed);
+    s.meanUs = n > 0 ? totalNs.load(std::memory_order_relaxed) / 1000.0 / static_cast<double>(n) : 0.0;
+    s.p50Us = percentile(0.50);
+    s.p99Us = percentile(0.99);
+    s.p999Us = percentile(0.999);
+    s.maxUs = maxValue / 1000.0;
+    return s;
+}
+
+void PerfStats::clear() {
+    for (auto& h : stages) h.clear();
+    for (auto& h : chips) h.clear();
+    blockCount.store(0, std::memory_order_relaxed);
+    deadlineMisses.store(0, std::memory_order_relaxed);
+    uint32_t seq = worstSequence.load(std::memory_order_relaxed);
+    worstSequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    worstBlockCount = 0;
+    worstThresholdNs = 0;
+    worstSequence.store(seq + 2, std::memory_order_release);
+}
+
+void PerfStats::beginBlock() {
+    if (resetRequested.exchange(false)) {
+        clear();
+    }
+    blockStageNs.fill(0);
+    blockChipNs.fill(0);
+    blockMidiEvents = 0;
+    blockNoteOns = 0;
+    blockSegments = 0;
+}
+
+void PerfStats::endBlock(uint64_t tick, int numSamples, double sampleRate, int activeChips) {
+    // MIDIイベントの処理時間にはノートオンでのボイス割り当てが含まれているので差し引く
+    blockStageNs[MidiDecode] -= std::min(blockStageNs[MidiDecode], blockStageNs[VoiceAlloc]);
+    for (int i = 0; i < StageCount; ++i) {
+        stages[i].record(blockStageNs[i]);
+    }
+    int chipCount = std::min(activeChips, PERF_MAX_CHIPS);
+    for (int chip = 0; chip < chipCount; ++chip) {
+        chips[chip].record(blockChipNs[chip]);
+    }
+
+    uint64_t blockIndex = blockCount.load(std::memory_order_relaxed);
+    blockCount.store(blockIndex + 1, std::memory_order_relaxed);
+    uint64_t deadlineNs = sampleRate > 0.0 ? static_cast<uint64_t>(numSamples * 1.0e9 / sampleRate) : 0;
+    if (deadlineNs > 0 && blockStageNs[Block] > deadlineNs) {
+        deadlineMisses.store(deadlineMisses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    uint32_t blockNs = static_cast<uint32_t>(std::min<uint64_t>(blockStageNs[Block], UINT32_MAX));
+    if (worstBlockCount < PERF_WORST_BLOCK_COUNT || blockNs > worstThresholdNs) {
+        BlockRecord record;
+        record.blockIndex = blockIndex;
+        record.tick = tick;
+        record.numSamples = static_cast<uint32_t>(numSamples);
+        record.deadlineNs = static_cast<uint32_t>(std::min<uint64_t>(deadlineNs, UINT32_MAX));
+        for (int i = 0; i < StageCount; ++i) {
+            record.stageNs[i] = static_cast<uint32_t>(std::min<uint64_t>(blockStageNs[i], UINT32_MAX));
+        }
+        record.midiEvents = static_cast<uint16_t>(std::min<uint32_t>(blockMidiEvents, UINT16_MAX));
+        record.noteOns = static_cast<uint16_t>(std::min<uint32_t>(blockNoteOns, UINT16_MAX));
+        record.segments = static_cast<uint16_t>(std::min<uint32_t>(blockSegments, UINT16_MAX));
+        record.activeChips = static_cast<uint16_t>(chipCount);
+        publishWorstBlock(record);
+    }
+}
+
+void PerfStats::publishWorstBlock(const BlockRecord& record) {
+    uint32_t seq = worstSequence.load(std::memory_order_relaxed);
+    worstSequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (worstBlockCount < PERF_WORST_BLOCK_COUNT) {
+        worstBlocks[worstBlockCount++] = record;
+    } else {
+        // 記録済みの中で最も短いブロックと入れ替える
+        int shortest = 0;
+        for (int i = 1; i < worstBlockCount; ++i) {
+            if (worstBlocks[i].stageNs[Block] < worstBlocks[shortest].stageNs[Block]) shortest = i;
+        }
+        worstBlocks[shortest] = record;
+    }
+    if (worstBlockCount == PERF_WORST_BLOCK_COUNT) {
+        worstThresholdNs = UINT32_MAX;
+        for (int i = 0; i < worstBlockCount; ++i) {
+            worstThresholdNs = std::min(worstThresholdNs, worstBlocks[i].stageNs[Block]);
+        }
+    }
+
+    worstSequence.store(seq + 2, std::memory_order_release);
+}
+
+std::vector<PerfStats::BlockRecord> PerfStats::getWorstBlocks() const {
+    std::vector<BlockRecord> result;
+    std::array<BlockRecord, PERF_WORST_BLOCK_COUNT> copy;
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        uint32_t before = worstSequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        int n = worstBlockCount;
+        copy = worstBlocks;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (worstSequence.load(std::memory_order_relaxed) != before) continue;
+        result.assign(copy.begin(), copy.begin() + std::min(n, PERF_WORST_BLOCK_COUNT));
+        break;
+    }
+    std::sort(result.begin(), result.end(), [](const BlockRecord& a, const BlockRecord& b) {
+        return a.stageNs[Block] > b.stageNs[Block];
+    });
+    return result;
+}
+
+const char* PerfStats::getStageName(Stage stage) {
+    switch (stage) {
+        case Block: return "block";
+        case Housekeeping: return "housekeeping";
+        case MidiDecode: return "midiDecode";
+        case VoiceAlloc: return "voiceAlloc";
+        case Control: return "control";
+        case ChipRender: return "chipRender";
+        case Mix: return "mix";
+        case Effects: return "effects";
+        default: return "unknown";
+    }
+}
+
+static std::string summaryToJson(const PerfStats::Summary& s) {
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"count\": %llu, \"meanUs\": %.3f, \"p50Us\": %.3f, \"p99Us\": %.3f, \"p999Us\": %.3f, \"maxUs\": %.3f}",
+                  static_cast<unsigned long long>(s.count), s.meanUs, s.p50Us, s.p99Us, s.p999Us, s.maxUs);
+    return buf;
+}
+
+std::string PerfStats::toJson() const {
+    std::string json = "{\n";
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "  \"blocks\": %llu,\n  \"deadlineMisses\": %llu,\n",
+                  static_cast<unsigned long long>(getBlockCount()), static_cast<unsigned long long>(getDeadlineMisses()));
+    json += buf;
+
+    json += "  \"stages\": {\n";
+    for (int i = 0; i < StageCount; ++i) {
+        json += "    \"" + std::string(getStageName(static_cast<Stage>(i))) + "\": " + summaryToJson(getStageSummary(static_cast<Stage>(i)));
+        json += i + 1 < StageCount ? ",\n" : "\n";
+    }
+    json += "  },\n";
+
+    json += "  \"chips\": [";
+    bool first = true;
+    for (int chip = 0; chip < PERF_MAX_CHIPS; ++chip) {
+        Summary s = getChipSummary(chip);
+        if (s.count == 0) continue;
+        std::snprintf(buf, sizeof(buf), "%s\n    {\"chip\": %d, \"render\": ", first ? "" : ",", chip);
+        json += buf + summaryToJson(s) + "}";
+        first = false;
+    }
+    json += first ? "],\n" : "\n  ],\n";
+
+    json += "  \"worstBlocks\": [";
+    auto worst = getWorstBlocks();
+    for (size_t i = 0; i < worst.size(); ++i) {
+        const auto& r = worst[i];
+        std::snprintf(buf, sizeof(buf),
+                      "%s\n    {\"blockIndex\": %llu, \"tick\": %llu, \"numSamples\": %u, \"deadlineUs\": %.3f, "
+                      "\"midiEvents\": %u, \"noteOns\": %u, \"segments\": %u, \"activeChips\": %u, \"stagesUs\": {",
+                      i == 0 ? "" : ",", static_cast<unsigned long long>(r.blockIndex), static_cast<unsigned long long>(r.tick),
+                      r.numSamples, r.deadlineNs / 1000.0, r.midiEvents, r.noteOns, r.segments, r.activeChips);
+        json += buf;
+        for (int s = 0; s < StageCount; ++s) {
+            std::snprintf(buf, sizeof(buf), "%s\"%s\": %.3f", s == 0 ? "" : ", ", getStageName(static_cast<Stage>(s)), r.stageNs[s] / 1000.0);
+            json += buf;
+        }
+        json += "}}";
+    }
+    json += worst.empty() ? "]\n" : "\n  ]\n";
+    json += "}\n";
+    return json;
+}
+
+bool PerfStats::dumpJson(const std::string& path) const {
+    std::ofstream fout(path);
+    if (!fout) {
+        printf("[Perf] Failed to open %s\n", path.c_str());
+        return false;
+    }
+    fout << toJson();
+    printf("[Perf] Stats written to %s (%llu blocks, %llu over deadline)\n", path.c_str(),
+           static_cast<unsigned long long>(getBlockCount()), static_cast<unsigned long long>(getDeadlineMisses()));
+    return true;
+}
@@ -0,0 +1,120 @@
+// PerfStats.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define PERF_STATS_JSON_FILE_NAME "perf_stats.json" // エディタのPerf JSONボタンで書き出すファイル
+#define PERF_WORST_BLOCK_COUNT 16                   // 処理時間の長かったブロックを記録しておく数
+#define PERF_MAX_CHIPS 16
+
+/**
+ * 処理段ごと・チップごとのレイテンシ分布（移動平均では見えない、まれに遅いブロックを見つけるため）
+ *
+ * ヒストグラムはナノ秒単位の対数バケット（1オクターブを4分割、誤差は最大で約19%）で、
+ * ブロックごとの合計時間を1回ずつ記録する。p50/p99/p99.9はバケットの上端で返す（最大値は正確な値）。
+ * バッファの長さ（締め切り）を超えたブロックを数え、特に遅かったブロックはイベント数と一緒に残す。
+ *
+ * オーディオスレッド: beginBlock() → addStage() / addChip() / countEvent() / countSegment() → endBlock()
+ * （ロック・メモリ確保なし。カウンタはオーディオスレッドだけが書くアトミック変数なので、他のスレッドからそのまま読める）
+ * 他のスレッド: get〜() / toJson() / dumpJson() / requestReset()
+ */
+class PerfStats {
+public:
+    enum Stage {
+        Block,         // processBlock全体
+        Housekeeping,  // ブロック先頭の処理（チップ差し替え・リリース状態の取得・PCM転送・ストリーミングなど）
+        MidiDecode,    // MIDIイベントの処理（VoiceAllocを除く）
+        VoiceAlloc,    // ノートオンでのボイス・ドラムチャンネルの割り当て
+        Control,       // 制御レート処理（LFO・ピッチレジスタ更新）
+        ChipRender,    // 全チップのレンダリング（チップごとの内訳はaddChip()）
+        Mix,           // チップ出力の足し合わせ
+        Effects,       // DCオフセット除去フィルタ
+        StageCount
+    };
+
+    static constexpr int bucketsPerOctave = 4;
+    static constexpr int minOctave = 6;    // 64ns未満はバケット0
+    static constexpr int maxOctave = 33;   // 約8.6秒以上は最後のバケット
+    static constexpr int bucketCount = 1 + (maxOctave - minOctave + 1) * bucketsPerOctave;
+
+    struct Summary {
+        uint64_t count = 0;
+        double meanUs = 0.0;
+        double p50Us = 0.0;
+        double p99Us = 0.0;
+        double p999Us = 0.0;
+        double maxUs = 0.0;
+    };
+
+    struct BlockRecord {
+        uint64_t blockIndex = 0;
+        uint64_t tick = 0;
+        uint32_t numSamples = 0;
+        uint32_t deadlineNs = 0;
+        std::array<uint32_t, StageCount> stageNs{};
+        uint16_t midiEvents = 0;
+        uint16_t noteOns = 0;
+        uint16_t segments = 0;     // イベント位置で分割したレンダリング区間の数
+        uint16_t activeChips = 0;
+    };
+
+    // オーディオスレッドから呼ぶ
+    void beginBlock();
+    void addStage(Stage stage, uint64_t ns) { blockStageNs[stage] += ns; }
+    void addChip(int chip, uint64_t ns) { if (chip >= 0 && chip < PERF_MAX_CHIPS) blockChipNs[chip] += ns; }
+    void countEvent(bool noteOn) { ++blockMidiEvents; if (noteOn) ++blockNoteOns; }
+    void countSegment() { ++blockSegments; }
+    void endBlock(uint64_t tick, int numSamples, double sampleRate, int activeChips);
+
+    // 他のスレッドから呼ぶ
+    Summary getStageSummary(Stage stage) const { return stages[stage].summarize(); }
+    Summary getChipSummary(int chip) const { return chips[chip].summarize(); }
+    uint64_t getBlockCount() const { return blockCount.load(std::memory_order_relaxed); }
+    uint64_t getDeadlineMisses() const { return deadlineMisses.load(std::memory_order_relaxed); }
+    std::vector<BlockRecord> getWorstBlocks() const;   // 処理時間の長い順
+    std::string toJson() const;
+    bool dumpJson(const std::string& path) const;
+    void requestReset() { resetRequested.store(true); } // 次のbeginBlock()で消去する
+
+    static const char* getStageName(Stage stage);
+
+private:
+    class Histogram {
+    public:
+        void record(uint64_t ns);   // 書き込みは1スレッドだけ
+        void clear();
+        Summary summarize() const;
+    private:
+        std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> totalNs{0};
+        std::atomic<uint64_t> maxNs{0};
+    };
+
+    static int bucketIndex(uint64_t ns);
+    static uint64_t bucketUpperNs(int bucket);
+    void clear();
+    void publishWorstBlock(const BlockRecord& record);
+
+    std::array<Histogram, StageCount> stages;
+    std::array<Histogram, PERF_MAX_CHIPS> chips;
+    std::atomic<uint64_t> blockCount{0};
+    std::atomic<uint64_t> deadlineMisses{0};
+    std::atomic<bool> resetRequested{false};
+
+    // 1ブロック分の集計（オーディオスレッドのみ）
+    std::array<uint64_t, StageCount> blockStageNs{};
+    std::array<uint64_t, PERF_MAX_CHIPS> blockChipNs{};
+    uint32_t blockMidiEvents = 0;
+    uint32_t blockNoteOns = 0;
+    uint32_t blockSegments = 0;
+
+    // 遅かったブロック（シーケンスロックで公開: 書き込み中は奇数、読む側は値が変わらなかったコピーだけを使う）
+    std::array<BlockRecord, PERF_WORST_BLOCK_COUNT> worstBlocks{};
+    int worstBlockCount = 0;
+    uint32_t worstThresholdNs = 0;   // 記録済みの中で最も短い処理時間（満杯のとき）
+    std::atomic<uint32_t> worstSequence{0};
+};
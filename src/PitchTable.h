@@ -0,0 +1,46 @@
+// PitchTable.h
+#pragma once
+#include <array>
+#include <cmath>
+
+// 半音 → 周波数比の変換テーブル
+// 1オクターブを1/64半音刻みで持ち、線形補間とオクターブ（2の累乗）の合成で任意の半音値を求める。
+// std::pow(2, x/12) との相対誤差は1e-7程度で、周波数レジスタ（整数Hz）には影響しない。
+namespace PitchTable {
+
+constexpr int stepsPerSemitone = 64;
+constexpr int stepsPerOctave = 12 * stepsPerSemitone;
+
+struct RatioTable {
+    std::array<float, stepsPerOctave + 1> ratio{};
+    RatioTable() {
+        for (int i = 0; i <= stepsPerOctave; ++i) {
+            ratio[i] = static_cast<float>(std::pow(2.0, static_cast<double>(i) / stepsPerOctave));
+        }
+    }
+};
+
+inline const RatioTable& table() {
+    static const RatioTable t;
+    return t;
+}
+
+// 2^(semitones / 12)
+inline float semitonesToRatio(float semitones) {
+    const auto& t = table();
+    float pos = semitones * stepsPerSemitone;
+    float posFloor = std::floor(pos);
+    int idx = static_cast<int>(posFloor);
+    float frac = pos - posFloor;
+    int octave = idx >= 0 ? idx / stepsPerOctave : -((-idx + stepsPerOctave - 1) / stepsPerOctave);
+    int rem = idx - octave * stepsPerOctave;
+    float r = t.ratio[rem] + (t.ratio[rem + 1] - t.ratio[rem]) * frac;
+    return std::ldexp(r, octave);
+}
+
+// MIDIノート番号（小数可） → 周波数[Hz]（A4 = 440Hz）
+inline float noteToFrequency(float note) {
+    return 440.0f * semitonesToRatio(note - 69.0f);
+}
+
+} // namespace PitchTable
@@ -174,6 +174,18 @@ _3HSPlugAudioProcessorEditor::_3HSPlugAudioProcessorEditor (_3HSPlugAudioProcess
     gmResetButton.setButtonText("GM Reset");
     gmResetButton.onClick = [this] { audioProcessor.resetGM(); };
     addAndMakeVisible(gmResetButton);
+
+    // レイテンシ分布をJSONで書き出す（PERF_STATS_JSON_FILE_NAME）
+    perfDumpButton.setButtonText("Perf JSON");
+    perfDumpButton.onClick = [this] { audioProcessor.dumpPerfStats(); };
+    addAndMakeVisible(perfDumpButton);
+
+    #if ENABLE_TRACE_RECORDER == 1
+    // 直近TRACE_DUMP_SECONDS秒のタイムラインをChromeトレース形式で書き出す（TRACE_JSON_FILE_NAME）
+    traceDumpButton.setButtonText("Trace");
+    traceDumpButton.onClick = [] { TraceRecorder::dumpChromeTrace(TRACE_JSON_FILE_NAME); };
+    addAndMakeVisible(traceDumpButton);
+    #endif
     
     // Num Chips
     numChipsLabel.setText("Num Chips:", juce::dontSendNotification);
@@ -188,6 +200,42 @@ _3HSPlugAudioProcessorEditor::_3HSPlugAudioProcessorEditor (_3HSPlugAudioProcess
     };
     addAndMakeVisible(numChipsComboBox);
     
+    // Voice Allocation Strategy
+    voiceStrategyComboBox.addItem("Rolling", 1);
+    voiceStrategyComboBox.addItem("Oldest First", 2);
+    voiceStrategyComboBox.addItem("Load Balanced", 3);
+    voiceStrategyComboBox.setSelectedId(static_cast<int>(audioProcessor.getVoiceAllocationStrategy()) + 1,
+                                        juce::dontSendNotification);
+    voiceStrategyComboBox.onChange = [this] {
+        audioProcessor.setVoiceAllocationStrategy(
+            static_cast<VoiceAllocator::Strategy>(voiceStrategyComboBox.getSelectedId() - 1));
+    };
+    addAndMakeVisible(voiceStrategyComboBox);
+    
+    chipAffinityButton.setButtonText("Chip Affinity");
+    chipAffinityButton.setToggleState(audioProcessor.getVoiceChipAffinity(), juce::dontSendNotification);
+    chipAffinityButton.onClick = [this] {
+        audioProcessor.setVoiceChipAffinity(chipAffinityButton.getToggleState());
+    };
+    addAndMakeVisible(chipAffinityButton);
+
+    elasticPolyphonyButton.setButtonText("Elastic");
+    elasticPolyphonyButton.setToggleState(audioProcessor.getElasticPolyphony(), juce::dontSendNotification);
+    elasticPolyphonyButton.onClick = [this] {
+        audioProcessor.setElasticPolyphony(elasticPolyphonyButton.getToggleState());
+    };
+    addAndMakeVisible(elasticPolyphonyButton);
+
+    // 制御レート（LFO・ピッチ更新間隔）選択
+    for (int size : {16, 32, 64, 128, 256}) {
+        controlBlockComboBox.addItem("Ctrl " + juce::String(size), size);
+    }
+    controlBlockComboBox.setSelectedId(audioProcessor.getControlBlockSize(), juce::dontSendNotification);
+    controlBlockComboBox.onChange = [this] {
+        audioProcessor.setControlBlockSize(controlBlockComboBox.getSelectedId());
+    };
+    addAndMakeVisible(controlBlockComboBox);
+    
     // PC Override
     pcOverrideButton.setButtonText("PC Override");
     pcOverrideButton.setToggleState(audioProcessor.isPcOverrideEnabled(), juce::dontSendNotification);
@@ -303,6 +351,7 @@ void _3HSPlugAudioProcessorEditor::drawPanBars(juce::Graphics& g, int x, int y,
 //==============================================================================
 void _3HSPlugAudioProcessorEditor::paint (juce::Graphics& g)
 {
+    TRACE_SCOPE("Editor::paint");
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
 
@@ -368,7 +417,7 @@ void _3HSPlugAudioProcessorEditor::paint (juce::Graphics& g)
         drawPanBars(g, panBarX, panBarY, panBarWidth, panBarHeight, panValues.first, panValues.second);
         
         // テキスト情報（Chip, Note, Ch, Vol, Prg等）をパンポットの右に表示
-        int availability = getPatchAvailability(audioProcessor.getCurrentProgramBankForChannel(v.midiChannel), audioProcessor.getCurrentProgramForChannel(v.midiChannel));
+        int availability = audioProcessor.getPatchAvailabilityForChannel(v.midiChannel);
         switch (availability)
         {
         case 2: // 有効
@@ -526,18 +575,72 @@ void _3HSPlugAudioProcessorEditor::paint (juce::Graphics& g)
     g.drawFittedText(timeText, barStartX, timeTextY, 400, 16, juce::Justification::centredLeft, 1);
     
     int midiTimeTextY = timeTextY + 18;
-    juce::String midiTimeText = "MIDI: " + juce::String(midiProcessingTime, 3) + " ms, Synth: " + juce::String(synthProcessingTime, 3) + " ms";
+    juce::String midiTimeText = "MIDI: " + juce::String(midiProcessingTime, 3) + " ms, Synth: " + juce::String(synthProcessingTime, 3) + " ms"
+        + " (Control: " + juce::String(audioProcessor.getControlRateTimeMs(), 3) + " ms)";
     g.drawFittedText(midiTimeText, barStartX, midiTimeTextY, 400, 16, juce::Justification::centredLeft, 1);
     
     // サンプルレート情報
     int sampleRateTextY = midiTimeTextY + 20;
-    juce::String sampleRateText = "Sample Rate: " + juce::String(audioProcessor.getSampleRate(), 0) + " Hz";
-    g.drawFittedText(sampleRateText, barStartX, sampleRateTextY, 300, 16, juce::Justification::centredLeft, 1);
+    auto blockLatency = audioProcessor.getPerfStats().getStageSummary(PerfStats::Block);
+    juce::String sampleRateText = "Sample Rate: " + juce::String(audioProcessor.getSampleRate(), 0) + " Hz"
+        + ", p99: " + juce::String(blockLatency.p99Us / 1000.0, 2) + " ms, max: " + juce::String(blockLatency.maxUs / 1000.0, 2) + " ms"
+        + ", Overruns: " + juce::String(static_cast<int64_t>(audioProcessor.getPerfStats().getDeadlineMisses()));
+    g.drawFittedText(sampleRateText, barStartX, sampleRateTextY, 400, 16, juce::Justification::centredLeft, 1);
     
     // バッファサイズ情報
     int bufferSizeTextY = sampleRateTextY + 18;
-    juce::String bufferText = "Buffer Size: " + juce::String(static_cast<int>(audioProcessor.getBlockSize())) + " samples";
-    g.drawFittedText(bufferText, barStartX, bufferSizeTextY, 300, 16, juce::Justification::centredLeft, 1);
+    juce::String bufferText = "Buffer Size: " + juce::String(static_cast<int>(audioProcessor.getBlockSize())) + " samples"
+        + ", Control: " + juce::String(audioProcessor.getControlBlockSize()) + " samples";
+    if (audioProcessor.getElasticPolyphony()) {
+        bufferText += ", Chips: " + juce::String(audioProcessor.getActiveChipCount()) + "/" + juce::String(audioProcessor.getNumChips());
+    }
+    g.drawFittedText(bufferText, barStartX, bufferSizeTextY, 400, 16, juce::Justification::centredLeft, 1);
+
+    // ボイスの使用状況（チップ数の目安）
+    const auto& voiceUsage = audioProcessor.getVoiceUsageStats();
+    auto fmOccupancy = voiceUsage.getFmOccupancy();
+    auto pcmOccupancy = voiceUsage.getPcmOccupancy();
+    auto voiceCounters = voiceUsage.getCounters();
+    double busyPercent = voiceCounters.totalSamples > 0 ? voiceCounters.fmAllBusySamples * 100.0 / voiceCounters.totalSamples : 0.0;
+    int voiceTextY = bufferSizeTextY + 18;
+    juce::String voiceText = "Voices p99/max: FM " + juce::String(fmOccupancy.p99) + "/" + juce::String(fmOccupancy.max)
+        + ", PCM " + juce::String(pcmOccupancy.p99) + "/" + juce::String(pcmOccupancy.max)
+        + ", Steals: " + juce::String(static_cast<int64_t>(voiceCounters.fmStealsHeld + voiceCounters.fmStealsReleasing + voiceCounters.drumSteals))
+        + ", Busy: " + juce::String(busyPercent, 1) + "%, Min Chips: " + juce::String(voiceUsage.getRecommendedChips());
+    g.drawFittedText(voiceText, barStartX, voiceTextY, 400, 16, juce::Justification::centredLeft, 1);
+
+    // SysExによるPCMアップロードの進捗（アップロード中・転送中のみ表示）
+    auto upload = audioProcessor.getPcmUploadStats();
+    if (upload.stagedBytes > 0 || upload.copyRemaining > 0) {
+        int uploadTextY = bufferSizeTextY + 36;
+        juce::String uploadText = "PCM Upload: " + juce::String(static_cast<int>(upload.stagedBytes / 1024)) + " KB staged, "
+            + juce::String(static_cast<int>(upload.copyRemaining / 1024)) + " KB to chip, "
+            + juce::String(upload.throughputBytesPerSec / 1024.0, 1) + " KB/s";
+        g.drawFittedText(uploadText, barStartX, uploadTextY, 400, 16, juce::Justification::centredLeft, 1);
+    }
+
+    auto stream = audioProcessor.getDrumStreamStats();
+    if (stream.streamedNotes > 0) {
+        int streamTextY = bufferSizeTextY + 54;
+        juce::String streamText = "Drum Stream: " + juce::String(static_cast<int>(stream.activeStreams)) + " active, "
+            + juce::String(static_cast<int>(stream.pageHits)) + " hits, "
+            + juce::String(static_cast<int>(stream.pageMisses)) + " misses, "
+            + juce::String(stream.averageLatencyMs, 2) + " ms avg / " + juce::String(stream.maxLatencyMs, 2) + " ms max";
+        g.drawFittedText(streamText, barStartX, streamTextY, 400, 16, juce::Justification::centredLeft, 1);
+    }
+
+    // ハードウェアカウンタ（計測モードのときのみ）: チップのレンダリングがキャッシュミスで遅いのかを見る
+    const auto& hwPerf = audioProcessor.getHwPerfStats();
+    if (hwPerf.isAvailable()) {
+        int hwTextY = bufferSizeTextY + 72;
+        auto render = hwPerf.getStageTotals(PerfStats::ChipRender);
+        auto block = hwPerf.getStageTotals(PerfStats::Block);
+        juce::String hwText = "HW: IPC " + juce::String(block.ipc(), 2) + " (Render " + juce::String(render.ipc(), 2) + ")"
+            + ", L1D " + juce::String(render.perKiloInstructions(HwPerfCounters::L1DMisses), 1)
+            + ", LLC " + juce::String(render.perKiloInstructions(HwPerfCounters::LLCMisses), 2)
+            + ", Br " + juce::String(render.perKiloInstructions(HwPerfCounters::BranchMisses), 1) + " /kinst";
+        g.drawFittedText(hwText, barStartX, hwTextY, 400, 16, juce::Justification::centredLeft, 1);
+    }
 
     // GS Dot Matrix 描画 (16x16)
     int dmStartX = barStartX + 320 + 100; // 画面右側の空いているスペース
@@ -591,13 +694,21 @@ void _3HSPlugAudioProcessorEditor::resized()
     
     panicButton.setBounds(x, startY, 80, 24);
     gmResetButton.setBounds(x + 90, startY, 80, 24);
+    perfDumpButton.setBounds(x + 180, startY, 80, 24);
+    #if ENABLE_TRACE_RECORDER == 1
+    traceDumpButton.setBounds(x + 270, startY, 80, 24);
+    #endif
     
     startY += 30;
     numChipsLabel.setBounds(x, startY, 80, 24);
     numChipsComboBox.setBounds(x + 80, startY, 60, 24);
+    voiceStrategyComboBox.setBounds(x + 150, startY, 110, 24);
+    chipAffinityButton.setBounds(x + 270, startY, 110, 24);
     
     startY += 30;
     pcOverrideButton.setBounds(x, startY, 100, 24);
+    controlBlockComboBox.setBounds(x + 150, startY, 110, 24);
+    elasticPolyphonyButton.setBounds(x + 270, startY, 110, 24);
     
     startY += 30;
     pcOverrideBankLabel.setBounds(x, startY, 40, 24);
@@ -640,6 +751,8 @@ void _3HSPlugAudioProcessorEditor::updateGSDotMatrix(const uint8_t* newData)
 
 void _3HSPlugAudioProcessorEditor::timerCallback()
 {
+    TRACE_THREAD_NAME("Message");
+    TRACE_SCOPE("Editor::timerCallback");
     // GSドットマトリクスデータの更新チェック
     if (audioProcessor.gsDotMatrixUpdated.exchange(false)) {
         updateGSDotMatrix(audioProcessor.gsDotMatrixData.data());
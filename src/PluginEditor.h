@@ -87,9 +87,17 @@ private:
     // GUI Components
     juce::TextButton panicButton;
     juce::TextButton gmResetButton;
+    juce::TextButton perfDumpButton; // レイテンシ分布のJSON書き出し
+    #if ENABLE_TRACE_RECORDER == 1
+    juce::TextButton traceDumpButton; // タイムライントレースの書き出し
+    #endif
     
     juce::Label numChipsLabel;
     juce::ComboBox numChipsComboBox;
+    juce::ComboBox voiceStrategyComboBox;
+    juce::ToggleButton chipAffinityButton;
+    juce::ToggleButton elasticPolyphonyButton; // 伸縮ポリフォニー（Num Chipsを上限に必要な分だけ鳴らす）
+    juce::ComboBox controlBlockComboBox; // 制御レートのサブブロック長
     
     juce::ToggleButton pcOverrideButton;
     juce::Label pcOverrideBankLabel;
@@ -34,14 +34,12 @@ void _3HSPlugAudioProcessor::resetGM()
 {
     juce::ScopedLock sl(processLock);
     printf("[GM] GM reset\n");
+    voiceAllocator.resetRollingIndex(); // ローリングチャンネル割り当て戦略用インデックスをリセット
     // すべてのCCを0にリセット
     for (int ch = 0; ch <= 16; ++ch) {
         for (int cc = 0; cc < 128; ++cc) {
             channelCC[ch][cc] = 0;
         }
-        #if USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY
-        currentRollingIndex = 0; // ローリングチャンネル割り当て戦略用インデックスをリセット
-        #endif
         channelCC[ch][10] = 64;  // パン
         channelCC[ch][7]  = 127; // ボリューム
         channelCC[ch][11] = 127; // エクスプレッション
@@ -74,12 +72,13 @@ void _3HSPlugAudioProcessor::resetGM()
                 currentBank[arrayIdx] = 0; // バンク番号を0にリセット
             }
             channelSustainPedal[arrayIdx] = false; // サスティンペダルをリセット
-            heldNotes[arrayIdx].clear(); // ホールドノートをクリア
+            voiceAllocator.clearHeld(ch); // ホールドノートをクリア
             channelLfoPhase[arrayIdx] = 0.0f; // LFO位相をリセット
             channelKeyShift[arrayIdx] = 0; // キーシフトをリセット
         }
     }
     gsDrumChannels.clear(); // GSドラムチャンネルをクリア
+    channelDrumMap.fill(0); // ドラムマップを既定のキットに戻す
     resetPatchBanks(); // オーバーライドされたパッチをリセット
 }
 
@@ -143,29 +142,83 @@ _3HSPlugAudioProcessor::_3HSPlugAudioProcessor()
             std::fill(g_pcmRam, g_pcmRam + g_pcmRamSize, 0);
             printf("[DrumPCM] g_pcmRam allocated: %zu bytes\n", g_pcmRamSize);
         }
+        pcmUploadManager.start(g_pcmRam, g_pcmRamSize, &pcmRamAllocator);
 
 
         channelPitchBend.fill(0x0);
+        PitchTable::table(); // 周波数テーブルをオーディオスレッド外で初期化しておく
+        registerSysExHandlers();
+        renderScratchL.resize(maxControlBlockSize);
+        renderScratchR.resize(maxControlBlockSize);
         // サウンドチップ数を設定（初期値1、将来拡張可）
+        // 伸縮ポリフォニーもこのチップ数の範囲で増減する（上限を増やすときはsetNumChips()で準備済みのチップを受け渡す）
         numChips = DEFAULT_CHIP_COUNT; // 例: 2チップ構成
+        // チップ数の変更でオーディオスレッドがメモリを確保しないよう、最大チップ数分の容量を確保しておく
+        s3hsSounds.reserve(VoiceAllocator::maxChips);
+        voiceSlots.reserve(VoiceAllocator::maxChips * numVoices);
+        drumPcmChannelStates.reserve(VoiceAllocator::maxChips * 4);
+        voiceFreqRegCache.reserve(VoiceAllocator::maxChips * numVoices);
+        drumFreqRegCache.reserve(VoiceAllocator::maxChips * 4);
         s3hsSounds.resize(numChips);
         voiceSlots.resize(numChips * numVoices);
-        displayBufferL.resize(numChips*12);
-        displayBufferR.resize(numChips*12);
+        voiceAllocator.reset(numChips * numVoices, numVoices);
+        resetActiveChips();
+        committedNumChips.store(numChips);
+        #if USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY == 1
+        voiceAllocator.setStrategy(VoiceAllocator::Strategy::Rolling);
+        #else
+        voiceAllocator.setStrategy(VoiceAllocator::Strategy::OldestFirst);
+        #endif
+        displayBufferL.resize(VoiceAllocator::maxChips * 12);
+        displayBufferR.resize(VoiceAllocator::maxChips * 12);
         # define DISPLAY_BUFFER_SIZE 1024 
-        for (int i = 0; i < numChips*12; ++i) {
+        for (int i = 0; i < VoiceAllocator::maxChips * 12; ++i) {
             displayBufferL[i].resize(DISPLAY_BUFFER_SIZE);
             displayBufferR[i].resize(DISPLAY_BUFFER_SIZE);
         }
         voiceMutexes.clear();
-        for (int i = 0; i < numChips; ++i) {
+        for (int i = 0; i < VoiceAllocator::maxChips; ++i) {
             voiceMutexes.emplace_back(std::make_unique<std::mutex>());
         }
         
         // ドラムPCMチャンネル状態の初期化（各チップごと4チャンネル）
         drumPcmChannelStates.resize(numChips * 4);
+        invalidateFrequencyCache();
         // ドラムPCMサンプルロード
-        loadAllDrumSamples(drumKeymapManager, 0);
+        #if ENABLE_DRUM_PCM_STREAMING == 1
+        pcmRamAllocator.reset(g_pcmRam, 0, static_cast<uint32_t>(g_pcmRamSize));
+        loadAllDrumSamples(drumKeymapManager, pcmRamAllocator, drumNoteHandles[DRUM_KIT_DEFAULT], &drumSampleStreamer);
+        // ストリーミングするノートがあるときだけ、リングバッファ（チップ内のPCMチャンネルごとに1つ）を
+        // PCM RAMの末尾に確保してアロケータの管理範囲から外す（無ければPCM RAMをすべてサンプルに使う）
+        if (drumSampleStreamer.getStats().streamedNotes > 0) {
+            uint32_t streamRingBytes = 4 * (DRUM_STREAM_SLOT_BYTES + 1);
+            if (pcmRamAllocator.reserveTail(streamRingBytes)) {
+                drumSampleStreamer.start(VoiceAllocator::maxChips * 4, static_cast<uint32_t>(g_pcmRamSize) - streamRingBytes);
+            } else {
+                // 末尾まで常駐サンプルで埋まっている: 長いサンプルは常駐している先頭部分だけを再生する
+                printf("[Warning::DrumPCM] No room for streaming rings, long samples will play only their first %d bytes\n", DRUM_STREAM_RESIDENT_BYTES);
+                for (int note = 0; note < 128; ++note) drumSampleStreamer.removeNote(note);
+            }
+        }
+        #else
+        pcmRamAllocator.reset(g_pcmRam, 0, static_cast<uint32_t>(g_pcmRamSize));
+        loadAllDrumSamples(drumKeymapManager, pcmRamAllocator, drumNoteHandles[DRUM_KIT_DEFAULT]);
+        #endif
+        for (int kit = 0; kit < DRUM_KIT_COUNT; ++kit) {
+            if (kit != DRUM_KIT_DEFAULT) drumNoteHandles[kit].fill(-1);
+            drumNoteSampleRates[kit].fill(-1);
+            drumNoteFormats[kit].fill(DRUM_PCM_FORMAT_RAW8);
+            drumKitStates[kit].store(kit == DRUM_KIT_DEFAULT ? DrumKitState::Loaded : DrumKitState::Unloaded);
+        }
+        for (int note = 0; note < 128; ++note) {
+            auto info = drumKeymapManager.getSampleInfo(DRUM_KIT_DEFAULT, static_cast<uint8_t>(note));
+            drumNoteSampleRates[DRUM_KIT_DEFAULT][note] = info.sampleRate;
+            drumNoteFormats[DRUM_KIT_DEFAULT][note] = info.format;
+        }
+        drumKitWorkerRunning = true;
+        drumKitWorker = std::thread([this] { drumKitWorkerLoop(); });
+        chipPrepareRunning = true;
+        chipPrepareWorker = std::thread([this] { chipPrepareWorkerLoop(); });
         
         // 全チップにPCM RAMを転送
         for (int chip = 0; chip < numChips; ++chip) {
@@ -173,12 +226,39 @@ _3HSPlugAudioProcessor::_3HSPlugAudioProcessor()
             printf("[DrumPCM] PCM RAM transferred to chip %d\n", chip);
         }
         initializePatchBanks(); // パッチバンク初期化
+        drumKitWorkerCv.notify_one(); // mmapしたバンクのデコード要求を次のポーリングを待たずに処理させる
+        lastPatchBankGeneration = getPatchBankGeneration();
+        #if ENABLE_PATCH_BANK_HOT_RELOAD == 1
+        patchBankWatcher.start("patches/");
+        #endif
         resetGM(); // GMリセット
         
 }
 
 _3HSPlugAudioProcessor::~_3HSPlugAudioProcessor()
 {
+    pcmUploadManager.stop(); // 転送待ちのドラムキット処理・チップセットの準備もここで打ち切られる
+    {
+        std::lock_guard<std::mutex> lock(chipPrepareMutex);
+        chipPrepareRunning = false;
+    }
+    chipPrepareCv.notify_all();
+    if (chipPrepareWorker.joinable()) {
+        chipPrepareWorker.join();
+    }
+    delete pendingChipSet.exchange(nullptr);
+    delete retiredChipSet.exchange(nullptr);
+    delete stagedChipSet;
+    drumSampleStreamer.stop();
+    {
+        std::lock_guard<std::mutex> lock(drumKitWorkerMutex);
+        drumKitWorkerRunning = false;
+    }
+    drumKitWorkerCv.notify_all();
+    if (drumKitWorker.joinable()) {
+        drumKitWorker.join();
+    }
+    patchBankWatcher.stop();
 }
 
 //==============================================================================
@@ -256,6 +336,13 @@ int _3HSPlugAudioProcessor::getCurrentProgramBankForChannel(int channel) const
     return 0;
 }
 
+int _3HSPlugAudioProcessor::getPatchAvailabilityForChannel(int channel) const
+{
+    if (channel >= 1 && channel <= 16)
+        return channelPatchAvailability[channel-1].load(std::memory_order_relaxed);
+    return 0;
+}
+
 const juce::String _3HSPlugAudioProcessor::getProgramName (int index)
 {
     return {};
@@ -268,11 +355,17 @@ void _3HSPlugAudioProcessor::changeProgramName (int index, const juce::String& n
 //==============================================================================
 void _3HSPlugAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
+    #if ENABLE_TRACE_RECORDER == 1
+    TraceRecorder::start(); // トレース用のリングをまとめて確保する（オーディオスレッドでは確保しない）
+    #endif
+
     // S3HS音源エンジン初期化
     for (int chip = 0; chip < numChips; ++chip) {
         s3hsSounds[chip].initSound();
         s3hsSounds[chip].setSampleRate(static_cast<float>(sampleRate));
+        s3hsSounds[chip].reserveRender();
     }
+    invalidateFrequencyCache(); // レジスタが初期化されたため
 
     // DCオフセット除去フィルタの初期化
     dcHighPassFilters.clear();
@@ -361,11 +454,14 @@ std::array<std::array<bool, 16>, 16> updateGSDotMatrix(const uint8_t* dotData)
 
 void _3HSPlugAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    TRACE_THREAD_NAME("Audio");
+    TRACE_SCOPE("processBlock");
     juce::ScopedLock sl(processLock);
 
     // パフォーマンス測定開始
     auto processStartTime = std::chrono::high_resolution_clock::now();
-    auto midiStartTime = processStartTime;
+    perfStats.beginBlock();
+    hwPerfStats.beginBlock();
     
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels  = getTotalNumInputChannels();
@@ -375,1077 +471,94 @@ void _3HSPlugAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juc
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
-    bool patchAltered = false; // パッチが変更されたかどうかのフラグ
-    bool CCUpdated = false; // CCが更新されたかどうかのフラグ
-
-    // GMリセット検出（SysEx: F0 7E 7F 09 01 F7 またはCC#121=0）
-    bool gmReset = false;
-    for (const auto metadata : midiMessages)
-    {
-        const auto msg = metadata.getMessage();
-        // SysEx GM Reset
-        // JUCEのgetSysExData()では、SysExの1バイト目(0xF0)と最後の1バイト(0xF7)は取り除かれる
-        // 例: F0 7E 7F 09 01 F7 → {0x7E, 0x7F, 0x09, 0x01}
-
-        if (msg.isSysEx()) {
-            const uint8* data = msg.getSysExData();
-            printf("[MIDI] SysEx: ");
-            for (int i = 0; i < msg.getSysExDataSize(); ++i) {
-                printf("%02X ", data[i]);
-            }
-            printf("\n");
-        }
-
-        // 3HSPlug SysEx Data Entry (SysEx: F0 7D 33 48 <addr> <datas> <checksum> F7)
-        // Data Entry Address List:
-        // 0x00: Patch Override Data Entry
-        // Not implemented yet, will be implemented soon:
-        // 0x01: Drum PCM Sample Load (Start Address: 0x000000 ~ 0x3FFFFF, Data: Length Varied, 8bit Unsigned PCM Data)
-        // 0x02: Drum PCM Sample Table Entry (Address: 0x000 ~ 0x7FF, Data: 16 bytes per entry, 128 entries (each corresponding to a drum sound) total)
-        // 0xFF: Reset Application (All Settings Reset and Reload All Data from Default)
-        
-        // 3HSPlug Patch Override (SysEx: F0 7D 33 48 00 <bank#(00~7F)> <patch#(00~7F)> <relative addr(00~3F)> <data MSB(00~0F)> <data LSB(00~0F)> <checksum> F7)
-        if (msg.isSysEx() && msg.getSysExDataSize() == 10 && msg.getSysExData()[0] == 0x7D && 
-            msg.getSysExData()[1] == 0x33 && msg.getSysExData()[2] == 0x48 && msg.getSysExData()[3] == 0x00) {
-            const uint8* data = msg.getSysExData();
-            int bankNumber = data[4];
-            int patchNumber = data[5];
-            int relativeAddr = data[6];
-            int valueMSB = data[7];
-            int valueLSB = data[8];
-            int value = (valueMSB << 4) | valueLSB;
-            printf("[Patch Override] Bank %02X, Patch %02X, Addr %02X, Value %02X\n", bankNumber, patchNumber, relativeAddr, value);
-            // パッチオーバーライド処理
-            if (patchNumber >= 0 && patchNumber < 128 && bankNumber >= 0 && bankNumber < 128) {
-                setPatchOverride(bankNumber, patchNumber, relativeAddr, value);
-            }
-        }
-
-        // GS Data Set 1 (SysEx: F0 41 10 42 12 <addr 3 bytes BE> <datas> <checksum> F7)
-        // GS Dot Matrix Set (GS Address: 0x10_01_00) (SysEx: F0 41 10 42(45?) 12 10 01 00 <data 64 bytes> <checksum> F7)
-        
-        if (msg.isSysEx() && msg.getSysExDataSize() >= 22) {// loosened sysex check for GSドットマトリクスセット{
-            const uint8* data = msg.getSysExData();
-            if (data[0] == 0x41 && data[1] == 0x10 && data[3] == 0x12 && data[4] == 0x10 && data[5] == 0x01 && data[6] == 0x00) {
-                printf("[GS] Dot Matrix Set received\n");
-                // ドットマトリクスの更新処理をここに実装
-                if (msg.getSysExDataSize() >= 7 + 64) {
-                    std::copy(data + 7, data + 7 + 64, gsDotMatrixData.begin());
-                    gsDotMatrixUpdated.store(true);
-                }
-                this->lastGSDotUpdateTick = this->getCurrentTick(); // ドットマトリクスの更新時刻を記録
-            }
-        }
-
-        // GS Text Display (Patch Name) Set (GS Address: 0x10_00_00) (SysEx: F0 41 10 42 12 10 00 00 <ASCII> <checksum> F7)
-            if (msg.isSysEx() && msg.getSysExDataSize() >= 11) {// loosened sysex check for GSテキストディスプレイセット
-                const uint8* data = msg.getSysExData();
-                if (data[0] == 0x41 && data[1] == 0x10 && data[3] == 0x12 && data[4] == 0x10 && data[5] == 0x00 && data[6] == 0x00) {
-                    printf("[GS] Text Display Set received: ");
-                    std::string text;
-                    for (int i = 7; i < msg.getSysExDataSize() - 1; ++i) { // 最後の1バイトはチェックサムなので除外
-                        text += static_cast<char>(data[i]);
-                    }
-                    TextDisplayData = text;
-                    gsTextUpdated.store(true);
-                    printf("%s\n", text.c_str());
-                    // テキストディスプレイの更新処理をここに実装（必要に応じてクラスメンバに保存するなどしても良い）
-                    this->lastGSTextUpdateTick = this->getCurrentTick(); // テキストディスプレイの更新時刻を記録
-                }
-            }
-
-        // GM Reset (SysEx: F0 7E 7F 09 01 F7)
-        if (msg.isSysEx() && msg.getSysExDataSize() == 4)
-        {
-            const uint8* data = msg.getSysExData();
-            if (data[0] == 0x7E && data[2] == 0x09 && data[3] == 0x01)
-                gmReset = true;
-        }
-
-        // GS Reset (SysEx: F0 41 10 42 12 40 00 7F 00 41 F7)
-        if (msg.isSysEx() && msg.getSysExDataSize() == 9)
-        {
-            const uint8* data = msg.getSysExData();
-            if (data[0] == 0x41 && data[1] == 0x10 && data[2] == 0x42 &&
-                data[3] == 0x12 && data[4] == 0x40 && data[5] == 0x00 &&
-                data[6] == 0x7F && data[7] == 0x00 && data[8] == 0x41)
-            {
-                gmReset = true; // GSリセットもGMリセットとして扱う
-                gsDrumChannels.clear(); // GSドラムチャンネルをクリア
-                printf("[GS] GS Reset received, Drum channels cleared\n");
-            }
-        }
-
-        // GS Drum Part SysEx (F0 41 10 42 12 40 1x 15 mm sum F7)
-        if (msg.isSysEx() && (msg.getSysExDataSize() == 9))
-        {
-            const uint8* data = msg.getSysExData();
-            // GS Drum Part判定
-            if (data[0] == 0x41 && data[1] == 0x10 && data[2] == 0x42 &&
-                data[3] == 0x12 && data[4] == 0x40 && data[6] == 0x15) // loosened sysex check
-            {
-                uint8_t part = data[5]; // 1x
-                uint8_t mm = data[7];   // マップ
-                // part番号→MIDIチャンネル変換
-                uint8_t midiCh = (part == 0x10 ? 10 : 
-                    (part >= 0x1A && part <= 0x1F) ? (part - 0x10 + 1) : 
-                    (part >= 0x11 && part <= 0x19) ? (part - 0x10) : 0);
-                printf("[GS] part %d (MIDI CH%d) Map %d\n", part, midiCh, mm);
-                if (mm >= 1) { // GSm 拡張 : 1-2だけではなく 3-15もドラムマップとして扱う
-                    gsDrumChannels.insert(midiCh);
-                    printf("[GS] MIDI CH%d set to Drum (MAP%d)\n", midiCh, mm);
-                }
-            }
-        }
-        // CC#120 (All Sound Off) - GMリセットとは別処理
-        // + CC#123 (All Notes Off)
-        if (msg.isController() && (msg.getControllerNumber() == 120 || msg.getControllerNumber() == 123)) {
-            // All Sound Off: 指定チャンネルの音のみを停止
-            int targetChannel = msg.getChannel();
-            printf("[MIDI] All Sound Off at CH%d\n", targetChannel);
-            CCUpdated = true; // 更新フラグを立てる
-            // FM音源ボイス：該当チャンネルのみを音量0ダミーノートで上書き
-            for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                auto& v = voiceSlots[flat];
-                if (v.midiChannel == targetChannel) {
-                    int chip = flat / numVoices;
-                    int vIdx = flat % numVoices;
-                    int baseAddr = 0x400000 + 0x40 * vIdx;
-                    
-                    // 音量を0に設定（即座に無音化）
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x10, 0);
-                    
-                    // ダミー周波数設定（0Hz）
-                    int dummyFreq = 0;
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (dummyFreq >> 8) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, dummyFreq & 0xFF);
-                    
-                    // Gate OFF（音量0なのでリリースにはならず、即座に音が止まる）
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0);
-                    s3hsSounds[chip].resetGate(vIdx);
-                    
-                    // ボイススロット状態をダミーノートに更新
-                    v.inUse = false; // 使用中フラグをfalseに設定
-                    v.noteNumber = -1; // ダミーノート識別用
-                    v.midiChannel = 0;
-                    v.velocity = 0;
-                    v.volume = 0;
-                    v.lastUsedTick = currentTick;
-                }
-            }
-            
-            // ドラムPCMチャンネル：該当チャンネルのみを音量0で上書き
-            for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
-                auto& drumState = drumPcmChannelStates[i];
-                if (drumState.midiChannel == targetChannel) {
-                    int chip = i / 4;
-                    int pcmChannel = i % 4;
-                    
-                    // 音量を0に設定（即座に無音化）
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
-                    
-                    // ダミーPCM設定（適当なアドレス）
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x10, 0x00);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x11, 0x00);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x12, 0x00);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x13, 0x00);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x14, 0x00);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x15, 0x01);
-                    
-                    // ダミー周波数設定
-                    int dummyPcmFreq = static_cast<int>(std::floor(0)); // 0Hz
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x00, (dummyPcmFreq >> 8) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x01, dummyPcmFreq & 0xFF);
-                    
-                    // PCM再生トリガ（音量0で開始）
-                    s3hsSounds[chip].wtSync(pcmChannel);
-                    
-                    // ドラムPCMチャンネル状態をダミーに更新
-                    drumState.inUse = false;
-                    drumState.noteNumber = -1; // ダミーノート識別用
-                    drumState.midiChannel = 0;
-                    drumState.velocity = 0;
-                    drumState.lastUsedTick = currentTick;
-                    drumState.pcmAddr = 0;
-                    drumState.sampleRate = 8000;
-                }
-            }
-            
-            // ホールドノート：該当チャンネルのみクリア
-            if (targetChannel >= 1 && targetChannel <= 16) {
-                heldNotes[targetChannel - 1].clear();
-            }
-        }
-    }
-    if (gmReset)
-    {
-        // GMリセット時も音量0ダミーノート方式で即座に停止
-        printf("[MIDI] GM Reset executed (dummy note method)\n");
-        CCUpdated = true;
-        // FM音源ボイスを音量0ダミーノートで上書き
-        for (int flat = 0; flat < numChips * numVoices; ++flat) {
-            int chip = flat / numVoices;
-            int vIdx = flat % numVoices;
-            int baseAddr = 0x400000 + 0x40 * vIdx;
-            
-            // 音量を0に設定（即座に無音化）
-            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x10, 0);
-            
-            // ダミー周波数設定（0Hz）
-            int dummyFreq = 0;
-            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (dummyFreq >> 8) & 0xFF);
-            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, dummyFreq & 0xFF);
-            
-            // Gate OFF（音量0なのでリリースにはならず、即座に音が止まる）
-            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0);
-            s3hsSounds[chip].resetGate(vIdx);
-            
-            // ボイススロット状態をダミーノートに更新
-            voiceSlots[flat].inUse = false;
-            voiceSlots[flat].noteNumber = -1; // ダミーノート識別用
-            voiceSlots[flat].midiChannel = 0;
-            voiceSlots[flat].velocity = 0;
-            voiceSlots[flat].volume = 0;
-            voiceSlots[flat].lastUsedTick = currentTick;
-        }
-        
-        // ドラムPCMチャンネルを音量0で上書き
-        for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
-            int chip = i / 4;
-            int pcmChannel = i % 4;
-            
-            // 音量を0に設定（即座に無音化）
-            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
-            
-            // PCM再生トリガ（音量0で開始）
-            s3hsSounds[chip].wtSync(pcmChannel);
-            
-            // ドラムPCMチャンネル状態をダミーに更新
-            auto& drumState = drumPcmChannelStates[i];
-            drumState.inUse = false;
-            drumState.noteNumber = -1; // ダミーノート識別用
-            drumState.midiChannel = 0;
-            drumState.velocity = 0;
-            drumState.lastUsedTick = currentTick;
-            drumState.pcmAddr = 0;
-            drumState.sampleRate = 8000;
-        }
-        
-        // GMリセット時、全チャンネルのボリューム・エクスプレッションを127にリセット
-        resetGM();
-    }
-
-    // パラメータ値をCH1レジスタに反映（例: 0x400000～）
-    // ここでは簡易的にボリューム・ADSR・モード等を反映する例
-    // 詳細なレジスタ割り当てはs3hs register map.md参照
-
-    // MIDIノートON/OFFをGate/Freqに反映
-    for (const auto metadata : midiMessages)
-    {
-        const auto msg = metadata.getMessage();
-        int ch = msg.getChannel();
-        // CC#7: ボリューム, CC#11: エクスプレッション, CC#64: Sustain Pedal
-        if (msg.isController()) { // MIDI CCメッセージを解析し、必要に応じてレジスタを更新する
-            this->channelCC[ch][msg.getControllerNumber()] = msg.getControllerValue();
-            CCUpdated = true; // 更新フラグを立てる
-            // CC#0 (Bank Select MSB) 処理 - バンク変更 (例: 008:080: Sine Wave)
-            if (msg.getControllerNumber() == 0) {
-                if (!pcOverrideEnabled) {
-                    int bankMSB = msg.getControllerValue();
-                    currentBank[ch - 1] = bankMSB;
-                    printf("[GS] Bank Select MSB CH%d: %d (Bank: %d)\n", ch, bankMSB, currentBank[ch - 1]);
-                }
-            }
-            
-            // CC#32 (Bank Select LSB) 処理 - バンクには使用しない
-            /*if (msg.getControllerNumber() == 32) {
-                int bankLSB = msg.getControllerValue();
-                currentBank[ch - 1] = bankLSB;
-                printf("[GS] Bank Select LSB CH%d: %d (Bank: %d)\n", ch, bankLSB, currentBank[ch - 1]);
-            }*/
-            
-            // CC#64 (Sustain Pedal) 処理
-            if (msg.getControllerNumber() == 64) {
-                bool newSustainState = msg.getControllerValue() >= 64;
-                bool oldSustainState = channelSustainPedal[ch - 1];
-                channelSustainPedal[ch - 1] = newSustainState;
-                
-                printf("[MIDI] Sustain Pedal CH%d: %s\n", ch, newSustainState ? "ON" : "OFF");
-                
-                // ペダルが離された場合、ホールド中のノートを停止
-                if (oldSustainState && !newSustainState) {
-                    auto& heldList = heldNotes[ch - 1];
-                    for (int heldNote : heldList) {
-                        // ホールド中のノートを実際に停止
-                        for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                            auto& v = voiceSlots[flat];
-                            if (v.inUse && v.noteNumber == heldNote && v.midiChannel == ch) {
-                                int chip = flat / numVoices;
-                                std::lock_guard<std::mutex> lock(*voiceMutexes[chip]);
-                                int vIdx = flat % numVoices;
-                                int baseAddr = 0x400000 + 0x40 * vIdx;
-                                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0); // Gate OFF
-                                v.inUse = false;
-                                v.noteNumber = -1;
-                                printf("[GM] Released held note %d on CH%d\n", heldNote, ch);
-                                break;
-                            }
-                        }
-                    }
-                    heldList.clear();
-                }
-            }
-            // CC#7, CC#11受信時は全ONボイスの音量を即時更新
-            if (msg.getControllerNumber() == 7 || msg.getControllerNumber() == 11 || msg.getControllerNumber() == 10) {
-                for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                    auto& v = voiceSlots[flat];
-                    if (v.inUse && v.midiChannel == ch) {
-                        int chip = flat / numVoices;
-                        int vIdx = flat % numVoices;
-                        uint8 velocity = v.velocity;
-                        uint8 expr = this->channelCC[ch][11];
-                        uint8 volCC = this->channelCC[ch][7];
-                        float volumeExponentialFactor = 2.0f; // 将来的に音量カーブ調整用に使用可能
-                        float exprExponentialFactor = 2.0f;   // 将来的に音量カーブ調整用に使用可能
-                        float volExp = std::pow(static_cast<float>(volCC) / 127.0f, volumeExponentialFactor);
-                        float exprExp = std::pow(static_cast<float>(expr) / 127.0f, exprExponentialFactor);
-                        float volF = (static_cast<float>(velocity) / 127.0f)
-                                * exprExp
-                                * volExp
-                                * 255.0f;
-                        uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
-                        v.volume = vol;
-                        int baseAddr = 0x400000 + 0x40 * vIdx;
-                        int bank = (baseAddr - 0x400000) / 0x40;
-                        int progIdx = currentProgram[v.midiChannel-1];
-                        auto mut = DoMutation(this->channelCC[v.midiChannel]);
-                        auto regs = getEffectivePatch(currentBank[ch-1], progIdx).applyMutation(mut).toRegValues(vol);
-                        
-                        for (size_t i = 0x10; i < 0x18; ++i) {
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
-                        //printf("%02x: %02x, ", i, regs[i]);
-                        }
-                        //printf("\n");
-                            // パンCC受信時は即時パン反映
-                        if (msg.getControllerNumber() == 10) {
-                            uint8 panCC = msg.getControllerValue();
-                            float panNorm = static_cast<float>(panCC) / 127.0f;
-                            uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                            uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                            uint8 panReg = (left << 4) | (right & 0x0F);
-                            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg);
-                        }
-                       
-                    }
-                }
-            }
-             // --- ピッチベンドレンジ処理 ---
-            // RPN 0,0（ピッチベンドレンジ）を受信した場合、channelPitchBendRangeを更新
-            // --- RPN処理 ---
-            // RPN 0,0: ピッチベンドレンジ
-            // RPN 0,1: ファインチューニング
-            // RPN 0,2: コースチューニング
-            if (ch >= 1 && ch <= 16) {
-                if (msg.getControllerNumber() == 101) {
-                    channelRpnMsb[ch-1] = msg.getControllerValue();
-                    printf("[MIDI] RPN MSB Set: %d (ch %d)\n", channelRpnMsb[ch-1], ch);
-                }
-                if (msg.getControllerNumber() == 100) {
-                    channelRpnLsb[ch-1] = msg.getControllerValue();
-                    printf("[MIDI] RPN LSB Set: %d (ch %d)\n", channelRpnLsb[ch-1], ch);
-                }
-                if (msg.getControllerNumber() == 99) {
-                    channelNrpnMsb[ch-1] = msg.getControllerValue();
-                    printf("[MIDI] NRPN MSB Set: %d (ch %d)\n", channelNrpnMsb[ch-1], ch);
-                }
-                if (msg.getControllerNumber() == 98) {
-                    channelNrpnLsb[ch-1] = msg.getControllerValue();
-                    printf("[MIDI] NRPN LSB Set: %d (ch %d)\n", channelNrpnLsb[ch-1], ch);
-                }
-                // Data Entry MSB (CC#6) 受信時、RPN/NRPN値ごとに処理
-                if (msg.getControllerNumber() == 6) {
-                    printf("[MIDI] NRPN: Parameter %d: %d (ch %d)\n", channelNrpnMsb[ch-1] * 128 + channelNrpnLsb[ch-1], msg.getControllerValue(), ch);
-                    if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 0) {
-                        channelPitchBendRange[ch-1] = msg.getControllerValue();
-                        if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
-                            printf("[DrumPCM] Pitch Bend Range Set: %d (drum ch %d)\n", channelPitchBendRange[ch-1], ch);
-                        } else {
-                            printf("[GM] Pitch Bend Range Set: %d (ch %d)\n", channelPitchBendRange[ch-1], ch);
-                        }
-                        channelRpnMsb[ch-1] = 127;
-                        channelRpnLsb[ch-1] = 127;
-                    } else if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 1) {
-                        // ファインチューニング: -100～+100セント, 100/8192単位
-                        int value = msg.getControllerValue();
-                        // value: 0..127, center=64
-                        int cents = ((value - 64) * 100) / 64; // -100～+100
-                        channelFineTune[ch-1] = cents;
-                        printf("[GM] Fine Tune Set: %d cents (ch %d)\n", channelFineTune[ch-1], ch);
-                        channelRpnMsb[ch-1] = 127;
-                        channelRpnLsb[ch-1] = 127;
-                    } else if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 2) {
-                        // コースチューニング: -6400～+6300セント, 100単位, MSBのみ
-                        int value = msg.getControllerValue();
-                        // value: 0..127, center=64
-                        int cents = (value - 64) * 100; // -6400～+6300
-                        channelCoarseTune[ch-1] = cents;
-                        printf("[GM] Coarse Tune Set: %d cents (ch %d)\n", channelCoarseTune[ch-1], ch);
-                        channelRpnMsb[ch-1] = 127;
-                        channelRpnLsb[ch-1] = 127;
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 8) {
-                        // ビブラートレート (Vibrato Rate)
-                        channelCC[ch][76] = msg.getControllerValue();
-                        printf("[GS/XG] Vibrato Rate (NRPN) Set: %d (ch %d)\n", channelCC[ch][76], ch);
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 9) {
-                        // ビブラートデプス (Vibrato Depth)
-                        channelCC[ch][77] = msg.getControllerValue();
-                        printf("[GS/XG] Vibrato Depth (NRPN) Set: %d (ch %d)\n", channelCC[ch][77], ch);
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 10) {
-                        // ビブラートディレイ (Vibrato Delay)
-                        channelCC[ch][78] = msg.getControllerValue();
-                        printf("[GS/XG] Vibrato Delay (NRPN) Set: %d (ch %d)\n", channelCC[ch][78], ch);
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 99) {
-                        // エンベロープアタックタイム (Envelope Attack Time)
-                        channelCC[ch][73] = msg.getControllerValue();
-                        printf("[GS/XG] Envelope Attack Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][73], ch);
-                        patchAltered = true; // パッチが変更されたフラグを立てる
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 100) {
-                        // エンベロープディケイタイム (Envelope Decay Time)
-                        channelCC[ch][75] = msg.getControllerValue();
-                        printf("[GS/XG] Envelope Decay Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][75], ch);
-                        patchAltered = true; // パッチが変更されたフラグを立てる
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 102) {
-                        // エンベロープリリースタイム (Envelope Release Time)
-                        channelCC[ch][72] = msg.getControllerValue();
-                        printf("[GS/XG] Envelope Release Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][72], ch);
-                        patchAltered = true; // パッチが変更されたフラグを立てる
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 32) {
-                        // LPFカットオフ (LPF Cutoff)
-                        channelCC[ch][74] = msg.getControllerValue();
-                        printf("[GS/XG] LPF Cutoff (NRPN) Set: %d (ch %d)\n", channelCC[ch][74], ch);
-                        patchAltered = true; // パッチが変更されたフラグを立てる
-                    } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 33) {
-                        // LPFレゾナンス (LPF Resonance)
-                        channelCC[ch][71] = msg.getControllerValue();
-                        printf("[GS/XG] LPF Resonance (NRPN) Set: %d (ch %d)\n", channelCC[ch][71], ch);
-                        patchAltered = true; // パッチが変更されたフラグを立てる
-                    }                
-                }
-                if (msg.getControllerNumber() >= 71 && msg.getControllerNumber() <= 75) {
-                    // エンベロープやLPFのCC受信時もパッチ変更フラグを立てる
-                    patchAltered = true;
-                }
-                        
-            }
-            if (patchAltered) {
-                // パッチが変更されたフラグが立っている場合、現在のプログラムに対してエフェクトを適用してレジスタを更新
-                int progIdx = currentProgram[ch-1];
-                auto& effectivePatch = getEffectivePatch(currentBank[ch-1], progIdx);
-                auto mut = DoMutation(this->channelCC[ch]);
-                auto regs = effectivePatch.applyMutation(mut).toRegValues(0); // 音量は個別に計算するため0で取得
-                for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                    auto& v = voiceSlots[flat];
-                    if (v.inUse && v.midiChannel == ch) {
-                        int chip = flat / numVoices;
-                        int vIdx = flat % numVoices;
-                        int baseAddr = 0x400000 + 0x40 * vIdx;
-                        for (size_t i = 0x10; i < 0x18; ++i) {// OP Modulator Amount
-                            if (!effectivePatch.volumeScalingNeeded(i-0x10)) {
-                                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
-                            }
-                        }
-                        for (size_t i = 0x20; i < 0x40; ++i) {// ADSR
-                            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
-                        }
-                    }
-                }
-            }
-
-            //printf("[MIDI] CC# %d: %d (ch %d)\n", msg.getControllerNumber(), msg.getControllerValue(), ch);
-        }
-        // ピッチベンド処理
-        if (msg.isPitchWheel())
-        {
-            int ch = msg.getChannel();
-            int bend = msg.getPitchWheelValue() - 8192; // -8192～+8191
-            if (ch >= 1 && ch <= 16)
-                channelPitchBend[ch - 1] = bend;
-
-            // 周波数の即時書き込みは廃止。最後に一括更新する。
-            
-            // --- ドラムPCMピッチベンド処理 ---
-            if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
-                int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2;
-                int bendVal = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
-                
-                for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
-                    auto& drumState = drumPcmChannelStates[i];
-                    if (drumState.inUse && drumState.midiChannel == ch) {
-                        // ピッチベンド値を構造体に保存（後段での使用のため）
-                        drumState.pitchBendValue = bendVal + 8192; // 0x0000-0x3FFF形式に変換
-                        drumState.pitchBendRange = static_cast<float>(bendRange);
-                    }
-                }
-            }
-        }
-        // プログラムチェンジ処理
-        if (msg.isProgramChange())
-        {
-            #if PROGRAM_CHANGE_ALSO_ALL_SOUNDS_OFF == 1
-                // プログラムチェンジ受信時、同チャンネルの全ONボイスを音量0ダミーノートで上書きしてからプログラム変更を適用
-                int targetChannel = msg.getChannel();
-                for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                    auto& v = voiceSlots[flat];
-                    if (v.midiChannel == targetChannel) {
-                        int chip = flat / numVoices;
-                        int vIdx = flat % numVoices;
-                        int baseAddr = 0x400000 + 0x40 * vIdx;
-                        
-                        // 音量を0に設定（即座に無音化）
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x10, 0);
-                        
-                        // ダミー周波数設定（0Hz）
-                        int dummyFreq = 0;
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (dummyFreq >> 8) & 0xFF);
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, dummyFreq & 0xFF);
-                        
-                        // Gate OFF（音量0なのでリリースにはならず、即座に音が止まる）
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0);
-                        s3hsSounds[chip].resetGate(vIdx);
-                        
-                        // ボイススロット状態をダミーノートに更新
-                        v.inUse = false; // 使用中フラグをfalseに設定
-                        v.noteNumber = -1; // ダミーノート識別用
-                        v.midiChannel = 0;
-                        v.velocity = 0;
-                        v.volume = 0;
-                        v.lastUsedTick = currentTick;
-                    }
-                }
-            #endif
-            if (!pcOverrideEnabled) {
-                int prog = msg.getProgramChangeNumber();
-                if (prog >= 0 && prog < 128) {
-                    int ch = msg.getChannel() - 1;
-                    if (ch >= 0 && ch < 16) {
-                        currentProgram[ch] = prog;
-                        int bank = currentBank[ch];
-                        printf("[MIDI] Program Change: Bank %d, Program %d, CH %d\n", bank, prog, msg.getChannel());
-                        
-                        // 代理発音の確認
-                        auto& effectivePatch = getEffectivePatch(bank, prog);
-                        if (bank != 0 && !PatchBanks[bank][prog].defined && PatchBanks[0][prog].defined) {
-                            printf("[PatchBank] Using fallback from Bank 0 for Bank %d Program %d\n", bank, prog);
-                        }
-                    }
-                }
-            }
-        }
-        if (msg.isNoteOn())
-        {
-            int note = msg.getNoteNumber();
-            int ch = msg.getChannel();
-
-            // --- ドラムPCM再生処理 ---
-            // ドラムチャンネル（例: ch==10）かつキーマップ登録済みノートの場合
-            // ドラムチャンネルかつキーマップ登録済みノートはFM音源処理を完全スキップ
-            if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
-                auto info = drumKeymapManager.getSampleInfo(10, note);
-                if (info.pcmIndex != -1 && info.sampleRate != -1 && info.pcmLength != -1) {
-                    // PCM RAMアドレス取得
-                    uint32_t pcmAddr_Start = info.pcmIndex;
-                    uint32_t pcmAddr_End = pcmAddr_Start + info.pcmLength;
-                    if (pcmAddr_End > g_pcmRamSize) {
-                        printf("[Warning::DrumPCM] Drum PCM Sample out of bounds: %d-%d (size: %zu)\n", pcmAddr_Start, pcmAddr_End, g_pcmRamSize);
-                    }
-                    // 既存の同じMIDIチャンネル&ノート番号のドラムボイスを検索
-                    int globalPcmChannel = -1;
-                    int chip = -1;
-                    int pcmChannel = -1;
-                    
-                    // まず既存のボイスがあるかチェック
-                    for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
-                        const auto& drumState = drumPcmChannelStates[i];
-                        if (drumState.inUse && drumState.midiChannel == ch && drumState.noteNumber == note) {
-                            // 同じMIDIチャンネル&ノート番号の既存ボイスを発見、上書きする
-                            globalPcmChannel = i;
-                            chip = globalPcmChannel / 4;
-                            pcmChannel = globalPcmChannel % 4;
-                            //printf("[DrumPCM] Overwriting existing voice: MIDI ch %d, note %d, globalChannel %d\n", ch, note, globalPcmChannel);
-                            break;
-                        }
-                    }
-                    
-                    // 既存ボイスがなければ新しいチャンネルを割り当て
-                    if (globalPcmChannel == -1) {
-                        int totalPcmChannels = numChips * 4; // 各チップ4チャンネル
-                        
-                        // 安全策：インデックスが範囲外ならリセット
-                        if (drumPcmChannelIndex >= totalPcmChannels) {
-                            drumPcmChannelIndex = 0;
-                        }
-
-                        globalPcmChannel = drumPcmChannelIndex;
-                        drumPcmChannelIndex = (drumPcmChannelIndex + 1) % totalPcmChannels;
-                        
-                        // チップとローカルチャンネルを計算
-                        chip = globalPcmChannel / 4;
-                        pcmChannel = globalPcmChannel % 4;
-                        
-                        // さらに安全策
-                        if (chip >= numChips) {
-                            printf("[Error] Chip index out of bounds: %d >= %d. Resetting to 0.\n", chip, numChips);
-                            chip = 0;
-                            pcmChannel = 0;
-                            globalPcmChannel = 0;
-                        }
-
-                        printf("[DrumPCM] Assigning new voice: MIDI ch %d, note %d, globalChannel %d\n", ch, note, globalPcmChannel);
-                    }
-
-                    // PCM RAMアドレスをS3HS音源に設定（例: regwtやram_pokeでpcm_addr[pcmChannel]等を設定）
-                    // s3hsSounds[0].ram_poke(..., ..., pcmAddr);
-
-                    // PCM周波数は後の一括更新ループで計算・設定されるためここではスキップ
-                    
-                    // PCM アドレスを書き込む (24bit ビッグエンディアン)
-                    // PCM音源部のレジスタは0x30刻み
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x10, (pcmAddr_Start >> 16) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x11, (pcmAddr_Start >> 8) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x12, pcmAddr_Start & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x13, (pcmAddr_End >> 16) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x14, (pcmAddr_End >> 8) & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x15, pcmAddr_End & 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x16, 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x17, 0xFF);
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x18, 0xFF); // ループ開始アドレス（0xFFFFFFでワンショット）
-                    
-                    // 音量を書き込む
-                    uint8 velocity = msg.getVelocity();
-                    uint8 expr = this->channelCC[ch][11];
-                    uint8 volCC = this->channelCC[ch][7];
-                    float volF = (static_cast<float>(velocity) / 127.0f)
-                                * (static_cast<float>(expr) / 127.0f)
-                                * (static_cast<float>(volCC) / 127.0f)
-                                * 255.0f;
-                    uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, vol);
-                    
-                    // PCM再生トリガ
-                    s3hsSounds[chip].wtSync(pcmChannel);
-                    //printf("Drum Note on: note %d, freq %d, channel %d, pcmAddr %d-%d\n", note, pcmFreq, pcmChannel, pcmAddr_Start, pcmAddr_End);
-
-                    // ドラムPCMチャンネル状態を更新
-                    if (globalPcmChannel >= 0 && globalPcmChannel < static_cast<int>(drumPcmChannelStates.size())) {
-                        int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2;
-                        int bend = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
-                        
-                        auto& drumState = drumPcmChannelStates[globalPcmChannel];
-                        drumState.inUse = true;
-                        drumState.noteNumber = note;
-                        drumState.midiChannel = ch;
-                        drumState.velocity = velocity;
-                        drumState.volume = vol;
-                        drumState.lastUsedTick = currentTick;
-                        drumState.pcmAddr = pcmAddr_Start;
-                        drumState.sampleRate = info.sampleRate;
-                        drumState.pitchBendValue = bend + 8192; // 0x0000-0x3FFF形式で保存
-                        drumState.pitchBendRange = static_cast<float>(bendRange);
-                    }
-                    
-                    //printf("Drum Note on: note %d, chip %d, pcmChannel %d, globalChannel %d, pcmAddr %d-%d\n",
-                    //       note, chip, pcmChannel, globalPcmChannel, pcmAddr_Start, pcmAddr_End);
-                } else {// PCMファイルが無い場合は何も鳴らさない
-                    printf("[Warning::DrumPCM] Drum PCM Sample not found for note %d on channel %d\n", note, ch);
-                }
-            } else {
-            // それ以外はFM音源等の従来処理
-
-                channelLfoPhase[ch - 1] = 0.0f; // リセット
-
-                // channelKeyShiftは値の更新がないため常に0で計算。
-                // CH1のみ2足されるというバグがあったため、現状は常に0で計算するように修正。将来的に実装する場合は、ここで値を取得して加算する。
-                int keyShift = 0;//(ch >= 1 && ch <= 16) ? channelKeyShift[ch - 1] : 0;
-                //printf("Ch %d keyShift: %d\n", ch, channelKeyShift[ch - 1]);
-                int bend = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
-                int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2; // デフォルト2
-
-                int progIdx = currentProgram[ch-1];
-                auto mut = DoMutation(this->channelCC[ch]);
-                auto patch = getEffectivePatch(currentBank[ch-1], progIdx).applyMutation(mut);
-                int totalKeyShift = keyShift + patch.keyShift;
-
-                float bendSemis = bendRange * (static_cast<float>(bend) / 8192.0f);
-
-                // チューニング値をセミトーン換算で加算
-                float coarse = (ch >= 1 && ch <= 16) ? static_cast<float>(channelCoarseTune[ch - 1]) : 0.0f;
-                float fine   = (ch >= 1 && ch <= 16) ? static_cast<float>(channelFineTune[ch - 1]) : 0.0f;
-                bendSemis += (coarse + fine) / 100.0f;
-
-                float freq = 440.0f * std::pow(2.0f, ((note + totalKeyShift + bendSemis) - 69) / 12.0f);
-                int freqInt = static_cast<int>(freq);
-                #if USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY == 1
-                // ローリングチャンネル割り当て戦略: 常に次のスロットを使用する。もし該当スロットが使用中なら、次の空きスロットを探す。
-                int voiceIndex = currentRollingIndex;
-                // Held Listにnoteがある場合はそれを上書きする。なければ、もしスロットが使用中なら次の空きスロットを探す。
-                int heldIndex = std::find(heldNotes[ch - 1].begin(), heldNotes[ch - 1].end(), note) - heldNotes[ch - 1].begin();
-                if (heldIndex >= 0 && heldIndex < static_cast<int>(heldNotes[ch - 1].size())) {
-                    // Held Listにある場合は、現在のvoiceIndexを使用する（上書き）
-                    for (int i = 0; i < numChips * numVoices; ++i) {
-                        int idx = (currentRollingIndex + i) % (numChips * numVoices);
-                        if (voiceSlots[idx].inUse && voiceSlots[idx].noteNumber == note + totalKeyShift && voiceSlots[idx].midiChannel == ch) {
-                            voiceIndex = idx;
-                            printf("[Voice] Rolling allocation: note %d on channel %d is held, reusing slot %d\n", note, ch, voiceIndex);
-                            break;
-                        }
-                    }
-                } else {
-                    if (voiceSlots[voiceIndex].inUse) {
-                        //printf("[Warning::Voice] Rolling allocation: slot %d is in use, searching for next free slot\n", voiceIndex);
-                        int foundFree = -1;
-                        for (int i = 0; i < numChips * numVoices; ++i) {
-                            int idx = (currentRollingIndex + i) % (numChips * numVoices);
-                            if (!voiceSlots[idx].inUse) {
-                                foundFree = idx;
-                                break;
-                            }
-                        }
-                        if (foundFree >= 0) {
-                            voiceIndex = foundFree;
-                            //printf("[Voice] Found free slot %d for rolling allocation\n", voiceIndex);
-                        } else {
-                            printf("[Warning::Voice] No free slots found during rolling allocation, reusing slot %d\n", currentRollingIndex);
-                        }
-                    }
-                    currentRollingIndex = (currentRollingIndex + 1) % (numChips * numVoices);
-                }
-                #else
-                // 既存ノート（同じch/note）が再生中なら、そのスロットを再利用
-                int voiceIndex = -1;
-                for (int i = 0; i < numChips * numVoices; ++i) {
-                    if (voiceSlots[i].inUse && voiceSlots[i].noteNumber == note + totalKeyShift && voiceSlots[i].midiChannel == ch) {
-                        voiceIndex = i;
-                        if (std::find(heldNotes[ch - 1].begin(), heldNotes[ch - 1].end(), note) != heldNotes[ch - 1].end()) {
-                            printf("[Voice] Reusing voice slot %d for held note %d on channel %d, but key is held\n", voiceIndex, note, ch);
-                        } else {
-                            printf("[Warning::Voice] Reusing voice slot %d for note %d on channel %d, forgot note off?\n", voiceIndex, note, ch);
-                        }
-                    }
-                    break;
-                }
-                // 見つからなければ空きスロットを探す
-                if (voiceIndex < 0) {
-                    for (int i = 0; i < numChips * numVoices; ++i) {
-                        if (!voiceSlots[i].inUse) {
-                            voiceIndex = i;
-                            break;
-                        }
-                    }
-                }
-                // 空きもなければ最も古いスロットを強制的に使う
-                if (voiceIndex < 0) {
-                    uint64_t minTick = UINT64_MAX;
-                    int oldestIndex = -1;
-                    for (int i = 0; i < numChips * numVoices; ++i) {
-                        if (voiceSlots[i].lastUsedTick < minTick) {
-                            minTick = voiceSlots[i].lastUsedTick;
-                            oldestIndex = i;
-                        }
-                    }
-                    if (oldestIndex >= 0) {
-                        voiceIndex = oldestIndex;
-                    }
-                    printf("[Warning::Voice] No free voice slots, reusing oldest slot %d\n", voiceIndex);
-                }
-                #endif
-                // tickカウンタを進める
-                ++currentTick;
-            
-                // --- パンをリアルタイム反映 ---
-                for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                    auto& v = voiceSlots[flat];
-                    if (v.inUse) {
-                        int ch = v.midiChannel;
-                        int chip = flat / numVoices;
-                        int vIdx = flat % numVoices;
-                        int baseAddr = 0x400000 + 0x40 * vIdx;
-                        uint8 panCC = this->channelCC[ch][10];
-                        float panNorm = static_cast<float>(panCC) / 127.0f;
-                        uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                        uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                        uint8 panReg = (left << 4) | (right & 0x0F);
-                        int bank = (baseAddr - 0x400000) / 0x40;
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg);
-                    }
-                }
-                if (voiceIndex >= 0) {
-                    // 割り当て
-
-                    // もし該当するMIDIチャンネルのMIDIノートがすでに再生中なら、強制的にスロットを再利用する (ノートが重なるのを防止)
-
-                    voiceSlots[voiceIndex].noteNumber = note + totalKeyShift;
-                    voiceSlots[voiceIndex].midiChannel = ch;
-                    voiceSlots[voiceIndex].inUse = true;
-                    voiceSlots[voiceIndex].lastUsedTick = currentTick;
-
-                    int chip = voiceIndex / numVoices;
-                    std::lock_guard<std::mutex> lock(*voiceMutexes[chip]);
-                    int vIdx = voiceIndex % numVoices;
-                    int baseAddr = 0x400000 + 0x40 * vIdx;
-                    uint8 velocity = msg.getVelocity(); // Velocity, 0 - 127
-                    uint8 expr = this->channelCC[ch][11]; // CC#11 Expression, 0 - 127
-                    uint8 volCC = this->channelCC[ch][7]; // CC#7 Channel Volume, 0 - 127
-                    float volumeExponentialFactor = 2.0f; // 将来的に音量カーブ調整用に使用可能
-                    float exprExponentialFactor = 2.0f;   // 将来的に音量カーブ調整用に使用可能
-                    float volExp = std::pow(static_cast<float>(volCC) / 127.0f, volumeExponentialFactor);
-                    float exprExp = std::pow(static_cast<float>(expr) / 127.0f, exprExponentialFactor);
-                    float volF = (static_cast<float>(velocity) / 127.0f)
-                            * exprExp
-                            * volExp
-                            * 255.0f;
-                    uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
-                    //printf("Note On: %d, chip# %d, chipch %d, MIDIch %d, Volume: %d (unclipped %f, vel %d, vol %d, expr %d)\n", note, chip, vIdx, ch, vol, volF, velocity, volCC, expr);
-                    voiceSlots[voiceIndex].velocity = velocity;
-                    voiceSlots[voiceIndex].volume = vol;
-                    // voiceSlots, s3hsSounds へのアクセスはこのスコープ内で
-
-                    // パッチ適用: PatchBank[currentProgram]のtoRegValues()で得たregValuesをレジスタに書き込む
-                    // Patch.keyShiftはすでに上で取得済み
-                    // volumeScalingMapに応じてuint8_t volでスケーリングされたレジスタ値を取得
-                    auto regs = patch.toRegValues(vol);
-                    int bank = (baseAddr - 0x400000) / 0x40;
-                    for (size_t i = 0; i < regs.size(); ++i) {
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
-                    }
-
-                    // パン設定（CC#10, 0-127, デフォルト64中心）
-                    uint8 panCC = this->channelCC[ch][10];
-                    float panNorm = static_cast<float>(panCC) / 127.0f; // 0.0=Left, 1.0=Right
-                    uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                    uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
-                    uint8 panReg = (left << 4) | (right & 0x0F);
-                    bank = (baseAddr - 0x400000) / 0x40;
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg); // パンレジスタ書き込み
-                    // OP1 周波数書き込みは一括処理ループに任せるためここではスキップ
-                    /*s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x02, 0x10); // OP2 周波数倍率 上位ビット
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x03, 0x00);   // OP2 周波数倍率 下位ビット*/
-                    // Gate ON
-                    bank = (baseAddr - 0x400000) / 0x40;
-                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 1);
-                    s3hsSounds[chip].resetGate(vIdx);
-                }
-            }
-        }
-        if (msg.isNoteOff())
-        {
-            int note = msg.getNoteNumber();
-            int ch = msg.getChannel();
-            
-            // Note ONと同様にkeyShiftを計算
-            // channelKeyShiftは値の更新がないため常に0で計算。同上
-            int keyShift = 0;//(ch >= 1 && ch <= 16) ? channelKeyShift[ch - 1] : 0;
-            int progIdx = currentProgram[ch-1];
-            auto mut = DoMutation(this->channelCC[ch]);
-            auto patch = getEffectivePatch(currentBank[ch-1], progIdx).applyMutation(mut);
-            int totalKeyShift = keyShift + patch.keyShift;
-            int adjustedNote = note + totalKeyShift;
-            
-            // Sustain Pedalの状態を確認
-            bool sustainActive = (ch >= 1 && ch <= 16) ? channelSustainPedal[ch - 1] : false;
-            
-            if (sustainActive) {
-                // ペダルが押されている場合、ノートをホールドリストに追加
-                auto& heldList = heldNotes[ch - 1];
-                if (std::find(heldList.begin(), heldList.end(), adjustedNote) == heldList.end()) {
-                    heldList.push_back(adjustedNote);
-                    printf("[GM] Note %d held on CH%d (Sustain Pedal active)\n", adjustedNote, ch);
-                }
-                // ノートは停止せずに継続
-            } else {
-                // 該当スロットを探して停止
-                for (int flat = 0; flat < numChips * numVoices; ++flat) {
-                    auto& v = voiceSlots[flat];
-                    if (v.inUse && v.noteNumber == adjustedNote && v.midiChannel == ch) {
-                        int chip = flat / numVoices;
-                        std::lock_guard<std::mutex> lock(*voiceMutexes[chip]);
-                        int vIdx = flat % numVoices;
-                        int baseAddr = 0x400000 + 0x40 * vIdx;
-                        int bank = (baseAddr - 0x400000) / 0x40;
-                        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0); // Gate OFF
-                        v.inUse = false;
-                        v.noteNumber = -1;
-                        //printf("Note Off: %d (adjusted: %d), chip# %d, chipch %d, MIDIch %d\n", note, adjustedNote, chip, vIdx, ch);
-                        #ifndef EMULATE_MSGS_RELEASE_BEHAVIOR
-                            break; // MSGSのリリースはすべての該当ノートをオフにするが、ほとんどのシンセサイザー実装では通常一番最後に押されたノートだけオフにするため、ここでループを抜ける。
-                            // TODO: 現在の実装では最後のボイスではなく一番最初に見つかったボイスをオフにするため、同一ノートの重複再生がある場合は最後のボイスをオフにするように修正する。
-                        #endif
-                    }
-                }
-            }
-        }
-    
-    }
-    
-    // LFO（CC#1 モジュレーション・CC#76/77 ビブラート）の更新とピッチ反映
-    double sampleRate = getSampleRate();
-    if (sampleRate > 0.0) {
-        float timeDelta = static_cast<float>(buffer.getNumSamples() / sampleRate);
-
+    // 前のブロックで取得したパッチの参照はもう使わない（差し替え済みの古いバンクを解放してよい）
+    patchBankQuiescentPoint();
+    uint32_t patchGeneration = getPatchBankGeneration();
+    if (patchGeneration != lastPatchBankGeneration) {
+        // バンクが再読み込みされた: 発音中のボイスにも新しいパッチを反映する
+        lastPatchBankGeneration = patchGeneration;
         for (int ch = 1; ch <= 16; ++ch) {
-            uint8_t modVal = channelCC[ch][1];
-            uint8_t rateVal = channelCC[ch][76];
-            uint8_t depthVal = channelCC[ch][77];
-            
-            float lfoFreq;
-            if (rateVal < 64) {
-               lfoFreq = lfoFrequencyMin * std::pow(lfoFrequencyCenter / lfoFrequencyMin, rateVal / 64.0f);
-            } else {
-               lfoFreq = lfoFrequencyCenter * std::pow(lfoFrequencyMax / lfoFrequencyCenter, (rateVal - 64) / 63.0f);
-            }
-            float dPhase = timeDelta * lfoFreq * 2.0f * juce::MathConstants<float>::pi;
-
-            if (modVal > 0 || depthVal != 64) {
-                // 位相更新
-                channelLfoPhase[ch - 1] += dPhase; // 1-16 -> 0-15
-                if (channelLfoPhase[ch - 1] > 2.0f * juce::MathConstants<float>::pi) {
-                    channelLfoPhase[ch - 1] -= 2.0f * juce::MathConstants<float>::pi;
-                }
-            } else {
-                channelLfoPhase[ch - 1] = 0.0f; // リセット
-            }
+            markChannelDirty(ch, DirtyPatch);
         }
+    }
 
-        // FM音源ボイスの周波数を更新
-        for (int flat = 0; flat < numChips * numVoices; ++flat) {
-            auto& v = voiceSlots[flat];
-            if (v.inUse) {
-                int ch = v.midiChannel;
-                int chip = flat / numVoices;
-                int vIdx = flat % numVoices;
-                int baseAddr = 0x400000 + 0x40 * vIdx;
-
-                float desiredNote = static_cast<float>(v.noteNumber); // すでにkeyShiftとpatch.keyShiftが加算された状態のノート番号
-                
-                // ピッチベンド
-                int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2; // デフォルト2
-                int bendVal = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
-                float bendSemis = bendRange * (static_cast<float>(bendVal) / 8192.0f);
-                //printf("Updating pitch for CH%d note %d: bendRange=%d, bendVal=%d, bendSemis=%f\n", ch, v.noteNumber, bendRange, bendVal, bendSemis);
-
-                // チューニング
-                float coarse = (ch >= 1 && ch <= 16) ? static_cast<float>(channelCoarseTune[ch - 1]) : 0.0f;
-                float fine   = (ch >= 1 && ch <= 16) ? static_cast<float>(channelFineTune[ch - 1]) : 0.0f;
-                bendSemis += (coarse + fine) / 100.0f;
-
-                // LFOモジュレーション
-                if (ch >= 1 && ch <= 16) {
-                    uint8_t modVal = channelCC[ch][1];
-                    uint8_t depthVal = channelCC[ch][77];
-                    if (modVal > 0 || depthVal != 64) {
-                        float baseDepth = ((depthVal - 64) / 64.0f) * 1.0f; // -1.0 ~ 1.0
-                        float modDepth = (modVal / 127.0f) * lfoDepthNormal; // -lfoDepthNormal ~ lfoDepthNormal
-                        float lfoDepth = std::max(0.0f, baseDepth + modDepth);
-                        float lfoOffset = std::sin(channelLfoPhase[ch - 1]) * lfoDepth;
-                        bendSemis += lfoOffset;
-                    }
-                }
-
-                float freq = 440.0f * std::pow(2.0f, (desiredNote - 69.0f + bendSemis) / 12.0f);
-                int freqInt = static_cast<int>(freq);
-
-                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (freqInt >> 8) & 0xFF);
-                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, freqInt & 0xFF);
-            }
-        }
-        
-        // ドラムPCMのピッチ更新
-        for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
-            auto& drumState = drumPcmChannelStates[i];
-            if (drumState.inUse) {
-                int ch = drumState.midiChannel;
-                
-                // ピッチベンド
-                int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2;
-                int bendVal = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
-                float bendSemis = bendRange * (static_cast<float>(bendVal) / 8192.0f);
-
-                // LFOモジュレーション
-                if (ch >= 1 && ch <= 16) {
-                    uint8_t modVal = channelCC[ch][1];
-                    uint8_t depthVal = channelCC[ch][77];
-                    if (modVal > 0 || depthVal != 64) {
-                        float baseDepth = ((depthVal - 64) / 64.0f) * 1.0f; // -1.0 ~ 1.0
-                        float modDepth = (modVal / 127.0f) * lfoDepthNormal; // -lfoDepthNormal ~ lfoDepthNormal
-                        float lfoDepth = std::max(0.0f, baseDepth + modDepth);
-                        float lfoOffset = std::sin(channelLfoPhase[ch - 1]) * lfoDepth;
-                        bendSemis += lfoOffset;
-                    }
-                }
+    // 準備済みのチップセットへの差し替え（チップ数の変更）
+    serviceChipSetChange();
 
-                float pitchRatio = std::pow(2.0f, bendSemis / 12.0f);
-                float modifiedSampleRate = drumState.sampleRate * pitchRatio;
-                int pcmFreq = static_cast<int>(std::floor(modifiedSampleRate / 32.0));
+    // リリース中ボイスのエンベロープ状態を音源から取得（1ブロックに1回）
+    updateVoiceReleaseStates();
+    // 終端まで鳴り終わったドラムPCMチャンネルを空きに戻す
+    reclaimFinishedDrumChannels();
+    // 伸縮ポリフォニー: 余韻が消えたチップを休止させる
+    retireIdleChips();
+    // ボイスの使用状況（リリース状態を更新した直後の発音数をこのブロックの長さで記録）
+    recordVoiceUsage(buffer.getNumSamples());
 
-                int chip = i / 4;
-                int pcmChannel = i % 4;
-                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x00, (pcmFreq >> 8) & 0xFF);
-                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x01, pcmFreq & 0xFF);
-            }
-        }
-    }
+    // SysExでアップロードされたPCMのチップRAMへの転送（1ブロックあたり一定量ずつ）
+    servicePcmUpload();
 
-    // MIDI処理時間測定終了
-    auto midiEndTime = std::chrono::high_resolution_clock::now();
-    auto midiDuration = std::chrono::duration_cast<std::chrono::microseconds>(midiEndTime - midiStartTime);
-    double midiTimeMs = midiDuration.count() / 1000.0;
+    // ストリーミング中のドラムサンプルの先読みとリングへの書き込み
+    serviceDrumStreams();
+    perfStats.addStage(PerfStats::Housekeeping, elapsedNs(processStartTime));
+    hwPerfStats.mark(PerfStats::Housekeeping);
 
-    // 音声合成処理時間測定開始
-    auto synthStartTime = std::chrono::high_resolution_clock::now();
-    
-    // 音声生成
-    // 各チップの出力を合成
-    std::vector<std::vector<std::vector<std::vector<float>>>> allFrames(numChips);
-    for (int chip = 0; chip < numChips; ++chip) {
-        allFrames[chip] = s3hsSounds[chip].AudioCallBack(buffer.getNumSamples());
-    }
+    // MIDIイベントをサンプル位置順に処理し、イベント位置でレンダリングを分割する（サンプル精度のタイミング）
+    // 区間開始位置からeventCoalesceSamples未満の距離にあるイベントはまとめて区間の先頭で適用し、分割数の上限を抑える
     auto* left = buffer.getWritePointer(0);
     auto* right = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
-
-    for (int i = 0; i < buffer.getNumSamples(); ++i)
-    {
-        
-        for (int chip = 0; chip < numChips; ++chip) {
-            // 各チップの出力を加算
-            
-            /*for (int ch = 0; ch < 12; ++ch) { // 0-12までのフレーム
-                int flat = chip * 12 + ch; // チップとチャンネルのフラットインデックス
-                displayBufferL[flat].push_back(allFrames[chip][0][ch][i]);
-                displayBufferR[flat].push_back(allFrames[chip][1][ch][i]);
-                if (displayBufferL[flat].size() > DISPLAY_BUFFER_SIZE) {
-                    displayBufferL[flat].erase(displayBufferL[flat].begin());
-                    displayBufferR[flat].erase(displayBufferR[flat].begin());
-                }
-            }*/
-                    
-                    
+    const int numSamples = buffer.getNumSamples();
+    const int coalesceSamples = std::max(1, eventCoalesceSamples.load());
+    double midiTimeMs = 0.0;
+    double synthTimeMs = 0.0;
+    double controlTimeMs = 0.0;
+
+    auto event = midiMessages.cbegin();
+    const auto eventEnd = midiMessages.cend();
+    int pos = 0;
+    while (pos < numSamples || event != eventEnd) {
+        // 区間先頭でまとめて適用するイベント
+        auto eventStartTime = std::chrono::high_resolution_clock::now();
+        while (event != eventEnd && ((*event).samplePosition < pos + coalesceSamples || pos >= numSamples)) {
+            const auto msg = (*event).getMessage();
+            perfStats.countEvent(msg.isNoteOn());
+            handleSystemMessage(msg);
+            handleChannelMessage(msg);
+            ++event;
         }
-        float sumL = 0.0f, sumR = 0.0f;
-        for (int chip = 0; chip < numChips; ++chip) {
-            sumL += allFrames[chip][0][12][i];
-            sumR += allFrames[chip][1][12][i];
+        flushAllChannelUpdates();
+        updateLfoIncrements();
+        auto eventEndTime = std::chrono::high_resolution_clock::now();
+        midiTimeMs += std::chrono::duration<double, std::milli>(eventEndTime - eventStartTime).count();
+        perfStats.addStage(PerfStats::MidiDecode, std::chrono::duration_cast<std::chrono::nanoseconds>(eventEndTime - eventStartTime).count());
+        hwPerfStats.mark(PerfStats::MidiDecode);
+        if (pos >= numSamples) break;
+
+        // 次のイベント位置（なければブロック末尾）までレンダリング
+        int segmentEnd = numSamples;
+        if (event != eventEnd) {
+            segmentEnd = std::min(numSamples, std::max(pos + 1, (*event).samplePosition));
         }
-        left[i] = sumL / 32768.0f;
-        if (right)
-            right[i] = sumR / 32768.0f;
+        auto renderStartTime = std::chrono::high_resolution_clock::now();
+        controlTimeMs += renderSegment(left, right, pos, segmentEnd - pos);
+        perfStats.countSegment();
+        auto renderEndTime = std::chrono::high_resolution_clock::now();
+        synthTimeMs += std::chrono::duration<double, std::milli>(renderEndTime - renderStartTime).count();
+        pos = segmentEnd;
     }
 
     // DCオフセット除去フィルタの適用（最終出力）
-    if (dcHighPassFilters.size() >= 1) {
-        dcHighPassFilters[0].processSamples(left, buffer.getNumSamples());
-    }
-    if (right && dcHighPassFilters.size() >= 2) {
-        dcHighPassFilters[1].processSamples(right, buffer.getNumSamples());
+    auto effectsStartTime = std::chrono::high_resolution_clock::now();
+    {
+        TRACE_SCOPE("effects");
+        if (dcHighPassFilters.size() >= 1) {
+            dcHighPassFilters[0].processSamples(left, buffer.getNumSamples());
+        }
+        if (right && dcHighPassFilters.size() >= 2) {
+            dcHighPassFilters[1].processSamples(right, buffer.getNumSamples());
+        }
     }
+    perfStats.addStage(PerfStats::Effects, elapsedNs(effectsStartTime));
+    hwPerfStats.mark(PerfStats::Effects);
     // This is here to avoid people getting screaming feedback
     // when they first compile a plugin, but obviously you don't need to keep
     // this code if your algorithm always overwrites all the output channels.
@@ -1464,12 +577,12 @@ void _3HSPlugAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juc
 
         // ..do something to the data...
     }
-    currentTick += buffer.getNumSamples(); // 現在のtickカウントを更新
-    
-    // 音声合成処理時間測定終了
-    auto synthEndTime = std::chrono::high_resolution_clock::now();
-    auto synthDuration = std::chrono::duration_cast<std::chrono::microseconds>(synthEndTime - synthStartTime);
-    double synthTimeMs = synthDuration.count() / 1000.0;
+
+    // エディタ用のパッチの存在状況（オーバーライドレイヤーはオーディオスレッドだけが触るので、ここで読んで公開する）
+    for (int ch = 0; ch < 16; ++ch) {
+        channelPatchAvailability[ch].store(static_cast<uint8_t>(getPatchAvailability(currentBank[ch], currentProgram[ch])),
+                                           std::memory_order_relaxed);
+    }
     
     // パフォーマンス測定終了
     auto processEndTime = std::chrono::high_resolution_clock::now();
@@ -1487,18 +600,1516 @@ void _3HSPlugAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juc
     movingAverageCpuUsage = (1.0 - SMOOTHING_FACTOR) * movingAverageCpuUsage + SMOOTHING_FACTOR * cpuUsage;
     movingAverageMidiTime = (1.0 - SMOOTHING_FACTOR) * movingAverageMidiTime + SMOOTHING_FACTOR * midiTimeMs;
     movingAverageSynthTime = (1.0 - SMOOTHING_FACTOR) * movingAverageSynthTime + SMOOTHING_FACTOR * synthTimeMs;
+    movingAverageControlRateTime = (1.0 - SMOOTHING_FACTOR) * movingAverageControlRateTime + SMOOTHING_FACTOR * controlTimeMs;
     
     // アトミック変数に保存
     audioProcessingTimeMs.store(movingAverageProcessingTime);
     cpuUsagePercent.store(movingAverageCpuUsage);
     midiProcessingTimeMs.store(movingAverageMidiTime);
     synthProcessingTimeMs.store(movingAverageSynthTime);
+    controlRateTimeMs.store(movingAverageControlRateTime);
+
+    // レイテンシ分布（平均に埋もれる遅いブロックを拾う）
+    perfStats.addStage(PerfStats::Block, std::chrono::duration_cast<std::chrono::nanoseconds>(processEndTime - processStartTime).count());
+    perfStats.endBlock(currentTick, numSamples, getSampleRate(), activeChips);
+    hwPerfStats.endBlock();
     
     lastProcessTime = processEndTime;
 }
-std::vector<std::vector<float>> _3HSPlugAudioProcessor::getChipAudioDataL(int chip) const
+void _3HSPlugAudioProcessor::registerSysExHandlers()
 {
-    juce::ScopedLock sl(processLock);
+    using Msg = SysExRouter::Message;
+
+    // 3HSPlug SysEx Data Entry (SysEx: F0 7D 33 48 <addr> <datas> <checksum> F7)
+    // Data Entry Address List:
+    // 0x00: Patch Override Data Entry
+    // 0x01: Drum PCM Sample Load (Start Address: 0x000000 ~ 0x3FFFFF, Data: Length Varied, 8bit Unsigned PCM Data, 7bit packed)
+    // 0x02: Drum PCM Sample Table Entry (Note, Start Address, Length, Sample Rate)
+    // 0x03: Drum PCM Commit (ステージングしたサンプルとテーブルをまとめて反映)
+    // 0x04: Bulk Patch Dump (1パッチ分のイメージをニブル分割で一括転送)
+    // 0x05: Bulk Bank Dump (1バンク128パッチ分のイメージをニブル分割で一括転送)
+    // 形式の詳細はPcmUploadManager.hを参照
+    // Not implemented yet, will be implemented soon:
+    // 0x7F: Reset Application (All Settings Reset and Reload All Data from Default)（SysExのデータバイトは7bitのため0xFFは使えない）
+
+    // 3HSPlug Patch Override (SysEx: F0 7D 33 48 00 <bank#(00~7F)> <patch#(00~7F)> <relative addr(00~3F)> <data MSB(00~0F)> <data LSB(00~0F)> <checksum> F7)
+    sysExRouter.add3HSRoute(0x00, 5, 5, [this](const Msg& m) {
+        int bankNumber = m.payload[0];
+        int patchNumber = m.payload[1];
+        int relativeAddr = m.payload[2];
+        int value = (m.payload[3] << 4) | m.payload[4];
+        printf("[Patch Override] Bank %02X, Patch %02X, Addr %02X, Value %02X\n", bankNumber, patchNumber, relativeAddr, value);
+        setPatchOverride(bankNumber, patchNumber, relativeAddr, value);
+    });
+
+    // 3HSPlug Bulk Patch Dump (SysEx: F0 7D 33 48 04 <bank#> <patch#> <image: PATCH_IMAGE_SIZE bytes, MSB/LSB nibbles> <checksum> F7)
+    // イメージの配置はPatch Overrideの相対アドレス0x00～0x40と同じ。パッチ全体を1回で差し替える
+    sysExRouter.add3HSRoute(0x04, 2 + PATCH_IMAGE_SIZE * 2, 2 + PATCH_IMAGE_SIZE * 2, [this](const Msg& m) {
+        int bankNumber = m.payload[0];
+        int patchNumber = m.payload[1];
+        std::array<uint8_t, PATCH_IMAGE_SIZE> image;
+        for (int i = 0; i < PATCH_IMAGE_SIZE; ++i) {
+            image[i] = static_cast<uint8_t>((m.payload[2 + i * 2] << 4) | (m.payload[3 + i * 2] & 0x0F));
+        }
+        if (setPatchFromImage(bankNumber, patchNumber, image.data())) {
+            markPatchChannelsDirty(bankNumber, patchNumber);
+            printf("[Patch Bulk] Bank %02X, Patch %02X replaced\n", bankNumber, patchNumber);
+        }
+    });
+
+    // 3HSPlug Bulk Bank Dump (SysEx: F0 7D 33 48 05 <bank#> { <defined(00/01)> <image: PATCH_IMAGE_SIZE bytes, MSB/LSB nibbles> } x 128 <checksum> F7)
+    // definedが00のパッチは未定義に戻す（バンク0へのフォールバック対象になる）
+    sysExRouter.add3HSRoute(0x05, 1 + PATCH_BANK_SIZE * (1 + PATCH_IMAGE_SIZE * 2), 1 + PATCH_BANK_SIZE * (1 + PATCH_IMAGE_SIZE * 2), [this](const Msg& m) {
+        int bankNumber = m.payload[0];
+        if (bankNumber >= MAX_BANKS) return;
+        int definedCount = 0;
+        std::array<uint8_t, PATCH_IMAGE_SIZE> image;
+        for (int p = 0; p < PATCH_BANK_SIZE; ++p) {
+            const uint8_t* record = m.payload + 1 + p * (1 + PATCH_IMAGE_SIZE * 2);
+            if (record[0] == 0) {
+                clearPatchDefinition(bankNumber, p);
+                continue;
+            }
+            for (int i = 0; i < PATCH_IMAGE_SIZE; ++i) {
+                image[i] = static_cast<uint8_t>((record[1 + i * 2] << 4) | (record[2 + i * 2] & 0x0F));
+            }
+            setPatchFromImage(bankNumber, p, image.data());
+            ++definedCount;
+        }
+        markPatchChannelsDirty(bankNumber, -1);
+        printf("[Patch Bulk] Bank %02X replaced (%d patches defined)\n", bankNumber, definedCount);
+    });
+
+    // 3HSPlug Drum PCM Upload (SysEx: F0 7D 33 48 01/02/03 <payload> <checksum> F7)
+    // オーディオスレッドではキューへ積むだけ。デコードはPcmUploadManagerのワーカースレッドで行う
+    sysExRouter.add3HSRoute(PcmUploadManager::SampleLoad, 5, SysExRouter::unlimited, [this](const Msg& m) {
+        pcmUploadManager.enqueue(PcmUploadManager::SampleLoad, m.payload, m.payloadSize);
+    });
+    sysExRouter.add3HSRoute(PcmUploadManager::TableEntry, PcmUploadManager::tableEntryMinPayload,
+                            PcmUploadManager::tableEntryMaxPayload, [this](const Msg& m) {
+        pcmUploadManager.enqueue(PcmUploadManager::TableEntry, m.payload, m.payloadSize);
+    });
+    sysExRouter.add3HSRoute(PcmUploadManager::Commit, 0, 0, [this](const Msg& m) {
+        pcmUploadManager.enqueue(PcmUploadManager::Commit, m.payload, m.payloadSize);
+    });
+
+    // GS Data Set 1 (SysEx: F0 41 10 42 12 <addr 3 bytes BE> <datas> <checksum> F7)
+    // GS Dot Matrix Set (GS Address: 0x10_01_00) (SysEx: F0 41 10 45 12 10 01 00 <data 64 bytes> <checksum> F7)
+    sysExRouter.addRolandRoute(SysExRouter::anyModel, 0x100100, 0xFFFFFF, 64, 64, [this](const Msg& m) {
+        printf("[GS] Dot Matrix Set received\n");
+        std::copy(m.payload, m.payload + 64, gsDotMatrixData.begin());
+        gsDotMatrixUpdated.store(true);
+        this->lastGSDotUpdateTick = this->getCurrentTick(); // ドットマトリクスの更新時刻を記録
+    });
+
+    // GS Text Display (Patch Name) Set (GS Address: 0x10_00_00) (SysEx: F0 41 10 45 12 10 00 00 <ASCII> <checksum> F7)
+    sysExRouter.addRolandRoute(SysExRouter::anyModel, 0x100000, 0xFFFFFF, 1, 32, [this](const Msg& m) {
+        setDisplayText(m.payload, m.payloadSize);
+        printf("[GS] Text Display Set received: %s\n", TextDisplayData.c_str());
+    });
+
+    // GM Reset (SysEx: F0 7E 7F 09 01 F7)
+    sysExRouter.addUniversalRoute(0x09, 0x01, 0, 0, [this](const Msg&) {
+        executeGMReset();
+    });
+
+    // GS Reset (SysEx: F0 41 10 42 12 40 00 7F 00 41 F7)
+    sysExRouter.addRolandRoute(0x42, 0x40007F, 0xFFFFFF, 1, 1, [this](const Msg& m) {
+        if (m.payload[0] != 0x00) return;
+        gsDrumChannels.clear(); // GSドラムチャンネルをクリア
+        channelDrumMap.fill(0);
+        printf("[GS] GS Reset received, Drum channels cleared\n");
+        executeGMReset(); // GSリセットもGMリセットとして扱う
+    });
+
+    // GS Drum Part SysEx (F0 41 10 42 12 40 1x 15 mm sum F7)
+    sysExRouter.addRolandRoute(0x42, 0x401015, 0xFFF0FF, 1, 1, [this](const Msg& m) {
+        uint8_t part = static_cast<uint8_t>((m.address >> 8) & 0xFF); // 1x
+        uint8_t mm = m.payload[0];   // マップ
+        // part番号→MIDIチャンネル変換
+        uint8_t midiCh = (part == 0x10 ? 10 : 
+            (part >= 0x1A && part <= 0x1F) ? (part - 0x10 + 1) : 
+            (part >= 0x11 && part <= 0x19) ? (part - 0x10) : 0);
+        printf("[GS] part %d (MIDI CH%d) Map %d\n", part, midiCh, mm);
+        if (mm >= 1 && midiCh >= 1) { // GSm 拡張 : 1-2だけではなく 3-15もドラムマップとして扱う
+            gsDrumChannels.insert(midiCh);
+            channelDrumMap[midiCh - 1] = static_cast<uint8_t>(std::min<int>(mm, DRUM_KIT_COUNT - 1));
+            requestDrumMap(channelDrumMap[midiCh - 1]); // 初めて選ばれたマップならキットを読み込む
+            printf("[GS] MIDI CH%d set to Drum (MAP%d)\n", midiCh, mm);
+        }
+    });
+
+    // XG System On (SysEx: F0 43 1n 4C 00 00 7E 00 F7)
+    sysExRouter.addYamahaRoute(0x4C, 0x00007E, 0xFFFFFF, 1, 1, [this](const Msg& m) {
+        if (m.payload[0] != 0x00) return;
+        printf("[XG] XG System On received\n");
+        gsDrumChannels.clear();
+        channelDrumMap.fill(0);
+        executeGMReset();
+    });
+
+    // XG Display Letter (SysEx: F0 43 1n 4C 06 00 00 <ASCII> F7)
+    sysExRouter.addYamahaRoute(0x4C, 0x060000, 0xFFFFFF, 1, 32, [this](const Msg& m) {
+        setDisplayText(m.payload, m.payloadSize);
+        printf("[XG] Display Letter received: %s\n", TextDisplayData.c_str());
+    });
+}
+
+void _3HSPlugAudioProcessor::setDisplayText(const uint8_t* text, int length)
+{
+    TextDisplayData.assign(reinterpret_cast<const char*>(text), static_cast<size_t>(length));
+    gsTextUpdated.store(true);
+    this->lastGSTextUpdateTick = this->getCurrentTick(); // テキストディスプレイの更新時刻を記録
+}
+
+// SysExでアップロードされたPCMをg_pcmRamから各チップのRAMへ転送する（オーディオスレッド）
+// 転送は1ブロックあたりPCM_UPLOAD_COPY_BYTES_PER_BLOCKバイトに分割し、すべて転送し終えてからキーマップを差し替える
+void _3HSPlugAudioProcessor::servicePcmUpload()
+{
+    auto* commit = pcmUploadManager.acquireCommit();
+    if (!commit) return;
+
+    // 公開済みで未適用のチップセットがある: 追加するチップにも転送されるよう、次のブロックで適用してから始める
+    // （チップセットはコミットより先に公開されるので、コミットを受け取った後に確認すれば見落とさない）
+    if (!commit->started && pendingChipSet.load() != nullptr) return;
+
+    if (!commit->started) {
+        // 転送範囲と重なるサンプルを再生中のドラムは、書き換え途中のデータを読まないよう停止する
+        for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+            const auto& drumState = drumPcmChannelStates[i];
+            if (!drumState.inUse) continue;
+            uint32_t drumEnd = drumState.pcmAddr + drumState.pcmLength;
+            if (drumState.pcmAddr < commit->end && drumEnd > commit->start) {
+                silenceDrumChannel(i);
+            }
+        }
+        commit->started = true;
+        printf("[PcmUpload] Transfer started: 0x%06X-0x%06X\n", commit->start, commit->end);
+    }
+
+    uint32_t n = std::min<uint32_t>(PCM_UPLOAD_COPY_BYTES_PER_BLOCK, commit->end - commit->copyPos);
+    if (n > 0) {
+        for (int chip = 0; chip < numChips; ++chip) {
+            std::copy(g_pcmRam + commit->copyPos, g_pcmRam + commit->copyPos + n,
+                      s3hsSounds[chip].ram.begin() + commit->copyPos);
+        }
+        pcmUploadManager.advanceCommit(commit, n);
+    }
+
+    if (commit->copyPos >= commit->end) {
+        for (const auto& entry : commit->entries) {
+            const auto& info = entry.info;
+            drumKeymapManager.assignNoteToSample(entry.kit, entry.note, info.pcmIndex, info.sampleRate, info.pcmLength, info.format);
+        }
+        printf("[PcmUpload] Transfer finished: %zu table entries applied\n", commit->entries.size());
+        pcmUploadManager.finishCommit(commit);
+    }
+}
+
+// ドラムキット処理はワーカースレッドで1つずつ実行する（積まれた順に処理）
+void _3HSPlugAudioProcessor::runDrumKitTask(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(drumKitWorkerMutex);
+        drumKitTasks.push_back(std::move(task));
+    }
+    drumKitWorkerCv.notify_one();
+}
+
+void _3HSPlugAudioProcessor::drumKitWorkerLoop()
+{
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(drumKitWorkerMutex);
+            // オーディオスレッドからのマップ読み込み要求・パッチバンクのデコード要求はアトミックなフラグで届くので、
+            // 通知が無くても定期的に確認する
+            drumKitWorkerCv.wait_for(lock, std::chrono::milliseconds(20), [this] {
+                return !drumKitWorkerRunning || !drumKitTasks.empty() || drumKitLoadRequests.load() != 0
+                    || patchBankDecodeRequested();
+            });
+            if (!drumKitWorkerRunning) return;
+            if (!drumKitTasks.empty()) {
+                task = std::move(drumKitTasks.front());
+                drumKitTasks.pop_front();
+            }
+        }
+        if (task) {
+            task();
+            continue;
+        }
+        decodeRequestedPatchBanks(); // 参照された.3hsbバンクのデコード（オーディオスレッドでは行わない）
+        uint32_t requests = drumKitLoadRequests.exchange(0);
+        for (int kit = 0; kit < DRUM_KIT_COUNT; ++kit) {
+            if (requests & (1u << kit)) loadDrumKitForMap(kit);
+        }
+    }
+}
+
+// GS Drum Partでマップが選ばれた（オーディオスレッド）。未読み込みのキットだけワーカーに読み込みを要求する
+void _3HSPlugAudioProcessor::requestDrumMap(uint8_t kit)
+{
+    if (kit >= DRUM_KIT_COUNT) return;
+    DrumKitState expected = DrumKitState::Unloaded;
+    if (drumKitStates[kit].compare_exchange_strong(expected, DrumKitState::Loading)) {
+        drumKitLoadRequests.fetch_or(1u << kit);
+    }
+}
+
+void _3HSPlugAudioProcessor::loadDrumKitForMap(int kit)
+{
+    TRACE_SCOPE("loadDrumKitForMap");
+    HW_PERF_SCOPE("DrumKitLoader");
+    std::string pcmPath = getDrumKitPath(kit);
+    auto samples = decodeDrumKit(pcmPath);
+    if (samples.empty()) {
+        // ディレクトリが無いマップは既定のキットで鳴らす（DrumKeymapManager::resolveKit()）
+        printf("[DrumPCM] No drum samples in %s, MAP%d falls back to the default kit\n", pcmPath.c_str(), kit);
+        drumKitStates[kit].store(DrumKitState::Missing);
+        return;
+    }
+    if (commitDrumKitChange(kit, samples, {})) {
+        drumKitStates[kit].store(DrumKitState::Loaded);
+        printf("[DrumPCM] Drum kit MAP%d (%s) queued for transfer\n", kit, pcmPath.c_str());
+    } else {
+        drumKitStates[kit].store(DrumKitState::Unloaded); // 停止中などでコミットできなかった（次に選ばれたときに再試行）
+    }
+}
+
+void _3HSPlugAudioProcessor::requestDrumKitLoad(const std::string& pcmPath, int kit)
+{
+    if (kit < 0 || kit >= DRUM_KIT_COUNT) return;
+    runDrumKitTask([this, pcmPath, kit] {
+        auto samples = decodeDrumKit(pcmPath);
+        if (samples.empty()) {
+            printf("[Warning::DrumPCM] No drum samples found in %s, kit not changed\n", pcmPath.c_str());
+            return;
+        }
+        // 新しいキットに無いノートは外す
+        std::vector<int> allNotes(128);
+        for (int note = 0; note < 128; ++note) allNotes[note] = note;
+        if (commitDrumKitChange(kit, samples, allNotes)) {
+            drumKitStates[kit].store(DrumKitState::Loaded);
+            printf("[DrumPCM] Drum kit %s (MAP%d) queued for transfer\n", pcmPath.c_str(), kit);
+        }
+    });
+}
+
+void _3HSPlugAudioProcessor::unloadDrumNote(int note, int kit)
+{
+    if (note < 0 || note >= 128 || kit < 0 || kit >= DRUM_KIT_COUNT) return;
+    runDrumKitTask([this, note, kit] {
+        commitDrumKitChange(kit, {}, { note });
+    });
+}
+
+// g_pcmRam上の領域を確保・解放し、変わったノートのキーマップ更新と書き換えた範囲の転送を1つのコミットにまとめる
+// （オーディオスレッドは転送中の範囲のドラムを止め、転送完了と同時にキーマップを差し替える）
+// コンパクションは他のキットのサンプルも移動させるので、移動したノートは全キット分キーマップを更新する
+bool _3HSPlugAudioProcessor::commitDrumKitChange(int kit, const std::vector<DecodedDrumSample>& samples, const std::vector<int>& notesToRelease)
+{
+    return pcmUploadManager.runExclusiveCommit([&](PcmUploadManager::PendingCommit& commit) {
+        auto& handles = drumNoteHandles[kit];
+        auto& sampleRates = drumNoteSampleRates[kit];
+        auto& formats = drumNoteFormats[kit];
+        std::vector<std::array<PcmRamAllocator::Region, 128>> oldRegions(DRUM_KIT_COUNT);
+        for (int k = 0; k < DRUM_KIT_COUNT; ++k) {
+            for (int note = 0; note < 128; ++note) {
+                oldRegions[k][note] = pcmRamAllocator.get(drumNoteHandles[k][note]);
+            }
+        }
+        uint32_t dirtyStart = static_cast<uint32_t>(g_pcmRamSize);
+        uint32_t dirtyEnd = 0;
+        auto extendDirty = [&](uint32_t start, uint32_t end) {
+            dirtyStart = std::min(dirtyStart, start);
+            dirtyEnd = std::max(dirtyEnd, end);
+        };
+
+        // 新しいサンプルを先に確保する（古いキットや他のキットと同じ内容のサンプルは書き込まずに共有される）
+        std::array<int, 128> newHandles;
+        newHandles.fill(-1);
+        std::vector<const DecodedDrumSample*> pending;
+        std::vector<bool> changed(128, false);
+        for (const auto& sample : samples) {
+            bool shared = false;
+            int handle = pcmRamAllocator.allocate(sample.pcm.data(), static_cast<uint32_t>(sample.pcm.size()), &shared);
+            if (handle < 0) {
+                pending.push_back(&sample);
+                continue;
+            }
+            newHandles[sample.note] = handle;
+            if (!shared) {
+                auto region = pcmRamAllocator.get(handle);
+                extendDirty(region.addr, region.addr + region.length);
+            }
+            sampleRates[sample.note] = static_cast<int32_t>(sample.sampleRate);
+            formats[sample.note] = sample.format;
+            changed[sample.note] = true;
+        }
+        for (int note : notesToRelease) {
+            if (note < 0 || note >= 128) continue;
+            pcmRamAllocator.release(handles[note]);
+            handles[note] = -1;
+            changed[note] = true;
+        }
+        for (int note = 0; note < 128; ++note) {
+            if (newHandles[note] >= 0) {
+                pcmRamAllocator.release(handles[note]); // 置き換えられたサンプル（notesToReleaseで解放済みなら何もしない）
+                handles[note] = newHandles[note];
+            }
+        }
+
+        // 古いサンプルを解放してから入りきらなかった分を確保し直す（断片化していれば先に詰める）
+        for (const auto* sample : pending) {
+            uint32_t length = static_cast<uint32_t>(sample->pcm.size());
+            uint32_t start = 0, end = 0;
+            if (pcmRamAllocator.needsCompaction(length) && pcmRamAllocator.compact(start, end)) {
+                extendDirty(start, end);
+            }
+            int handle = pcmRamAllocator.allocate(sample->pcm.data(), length);
+            changed[sample->note] = true;
+            if (handle < 0) {
+                printf("[Warning::DrumPCM] PCM RAM full, note %d of MAP%d skipped\n", sample->note, kit);
+                continue;
+            }
+            auto region = pcmRamAllocator.get(handle);
+            extendDirty(region.addr, region.addr + region.length);
+            pcmRamAllocator.release(handles[sample->note]);
+            handles[sample->note] = handle;
+            sampleRates[sample->note] = static_cast<int32_t>(sample->sampleRate);
+            formats[sample->note] = sample->format;
+        }
+
+        // 空き容量の半分以上が細切れになっていたら詰めておく
+        auto stats = pcmRamAllocator.getStats();
+        if (stats.largestFreeBlock < stats.freeBytes / 2) {
+            uint32_t start = 0, end = 0;
+            if (pcmRamAllocator.compact(start, end)) {
+                extendDirty(start, end);
+                printf("[DrumPCM] PCM RAM compacted: 0x%06X-0x%06X\n", start, end);
+            }
+        }
+
+        // アドレスが変わったノート（差し替え・削除・コンパクションでの移動）のキーマップを更新する
+        for (int k = 0; k < DRUM_KIT_COUNT; ++k) {
+            for (int note = 0; note < 128; ++note) {
+                auto region = pcmRamAllocator.get(drumNoteHandles[k][note]);
+                bool moved = region.addr != oldRegions[k][note].addr || region.length != oldRegions[k][note].length;
+                bool replaced = k == kit && changed[note];
+                if (!moved && !replaced) continue;
+                DrumSampleInfo info{ -1, -1, -1, DRUM_PCM_FORMAT_RAW8 };
+                if (drumNoteHandles[k][note] >= 0) {
+                    info = DrumSampleInfo{ static_cast<int32_t>(region.addr), drumNoteSampleRates[k][note], static_cast<int32_t>(region.length), drumNoteFormats[k][note] };
+                }
+                commit.entries.push_back(PcmUploadManager::KeymapEntry{ static_cast<uint8_t>(k), static_cast<uint8_t>(note), info });
+                if (replaced && k == DRUM_KIT_DEFAULT) {
+                    drumSampleStreamer.removeNote(note); // 差し替えたサンプルは常駐のみで再生する
+                }
+            }
+        }
+        if (dirtyEnd > dirtyStart) {
+            commit.start = dirtyStart;
+            commit.end = dirtyEnd;
+        }
+        stats = pcmRamAllocator.getStats();
+        printf("[DrumPCM] Drum kit change (MAP%d): %zu note(s) updated, range 0x%06X-0x%06X, %u/%u bytes used, %u duplicate(s) shared\n",
+               kit, commit.entries.size(), commit.start, commit.end, stats.usedBytes, stats.capacity, stats.dedupHits);
+        return true;
+    });
+}
+
+// ストリーミング中のドラムPCMチャンネルの再生位置を渡して先読みさせ、ページミス・終端に応じて音量を操作する（オーディオスレッド）
+void _3HSPlugAudioProcessor::serviceDrumStreams()
+{
+    drumSampleStreamer.pumpCompletions();
+    for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+        auto& drumState = drumPcmChannelStates[i];
+        if (!drumState.inUse || !drumState.streaming) continue;
+        int chip = i / 4;
+        int pcmChannel = i % 4;
+        switch (drumSampleStreamer.updateVoice(i, s3hsSounds[chip].getPcmPosition(pcmChannel))) {
+        case DrumSampleStreamer::VoiceStatus::Underrun:
+            // 読み込みが間に合っていない: 古いリングの内容を鳴らさないようミュートする（再生位置は進み続ける）
+            if (!drumState.streamMuted) {
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
+                drumState.streamMuted = true;
+            }
+            break;
+        case DrumSampleStreamer::VoiceStatus::Playing:
+            if (drumState.streamMuted) {
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, static_cast<uint8_t>(drumState.volume));
+                drumState.streamMuted = false;
+            }
+            break;
+        case DrumSampleStreamer::VoiceStatus::Finished:
+        case DrumSampleStreamer::VoiceStatus::Idle:
+            silenceDrumChannel(i);
+            break;
+        }
+    }
+}
+
+void _3HSPlugAudioProcessor::markPatchChannelsDirty(int bankNumber, int patchNumber)
+{
+    // バンク0はフォールバック先でもあるため、どのバンクを選択中のチャンネルも影響を受けうる
+    for (int ch = 1; ch <= 16; ++ch) {
+        bool bankAffected = (bankNumber == 0) || (currentBank[ch - 1] == bankNumber);
+        bool patchAffected = (patchNumber < 0) || (currentProgram[ch - 1] == patchNumber);
+        if (bankAffected && patchAffected) {
+            markChannelDirty(ch, DirtyPatch);
+        }
+    }
+}
+
+// ドラムPCMチャンネルを音量0のダミーPCMで上書きして即座に無音化
+void _3HSPlugAudioProcessor::silenceDrumChannel(int i)
+{
+    auto& drumState = drumPcmChannelStates[i];
+    int chip = i / 4;
+    int pcmChannel = i % 4;
+    
+    // 音量を0に設定（即座に無音化）
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
+    
+    // ダミーPCM設定（適当なアドレス）
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x10, 0x00);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x11, 0x00);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x12, 0x00);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x13, 0x00);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x14, 0x00);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x15, 0x01);
+    
+    // ダミー周波数設定
+    int dummyPcmFreq = static_cast<int>(std::floor(0)); // 0Hz
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x00, (dummyPcmFreq >> 8) & 0xFF);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x01, dummyPcmFreq & 0xFF);
+    drumFreqRegCache[i] = -1;
+    
+    // PCM再生トリガ（音量0で開始）
+    s3hsSounds[chip].wtSync(pcmChannel);
+    drumSampleStreamer.stopVoice(i);
+    
+    // ドラムPCMチャンネル状態をダミーに更新
+    drumState.inUse = false;
+    drumState.streaming = false;
+    drumState.streamMuted = false;
+    drumState.noteNumber = -1; // ダミーノート識別用
+    drumState.midiChannel = 0;
+    drumState.velocity = 0;
+    drumState.lastUsedTick = currentTick;
+    drumState.pcmAddr = 0;
+    drumState.sampleRate = 8000;
+    drumState.pcmLength = 0;
+}
+
+void _3HSPlugAudioProcessor::resetActiveChips()
+{
+    activeChips = elasticPolyphony.load() ? std::min(1, numChips) : numChips;
+    if (activeChips < 1) activeChips = 1;
+    topChipIdleSinceTick = 0;
+    applyEnabledChips();
+}
+
+void _3HSPlugAudioProcessor::applyEnabledChips()
+{
+    voiceAllocator.setEnabledChips(std::min(activeChips, chipAllocLimit), elasticPolyphony.load());
+    activeChipCount.store(activeChips);
+}
+
+bool _3HSPlugAudioProcessor::activateChip()
+{
+    if (!elasticPolyphony.load() || activeChips >= std::min(numChips, chipAllocLimit)) return false;
+    // 休止中のチップは発音終了したボイスしか持たないので、そのままレンダリングを再開してよい
+    ++activeChips;
+    topChipIdleSinceTick = 0;
+    applyEnabledChips();
+    printf("[Voice] Elastic polyphony: chip %d activated (%d/%d chips)\n", activeChips - 1, activeChips, numChips);
+    return true;
+}
+
+bool _3HSPlugAudioProcessor::isDrumChipIdle(int chip) const
+{
+    for (int i = chip * 4; i < chip * 4 + 4 && i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+        if (drumPcmChannelStates[i].inUse) return false;
+    }
+    return true;
+}
+
+void _3HSPlugAudioProcessor::retireIdleChips()
+{
+    if (!elasticPolyphony.load() || activeChips <= 1) return;
+    int top = activeChips - 1;
+    if (!voiceAllocator.isChipIdle(top) || !isDrumChipIdle(top)) {
+        topChipIdleSinceTick = 0;
+        return;
+    }
+    if (topChipIdleSinceTick == 0) {
+        topChipIdleSinceTick = std::max<uint64_t>(currentTick, 1);
+        return;
+    }
+    uint64_t retireSamples = static_cast<uint64_t>(getSampleRate() * ELASTIC_CHIP_RETIRE_MS / 1000.0);
+    if (currentTick - topChipIdleSinceTick < retireSamples) return;
+    --activeChips;
+    topChipIdleSinceTick = 0; // 次のチップはここから改めて待つ
+    applyEnabledChips();
+    if (drumPcmChannelIndex >= activeChips * 4) drumPcmChannelIndex = 0;
+    printf("[Voice] Elastic polyphony: chip %d retired (%d/%d chips)\n", top, activeChips, numChips);
+}
+
+void _3HSPlugAudioProcessor::setElasticPolyphony(bool enabled)
+{
+    juce::ScopedLock sl(processLock);
+    if (elasticPolyphony.load() == enabled) return;
+    elasticPolyphony.store(enabled);
+    if (enabled) {
+        // 鳴っているボイスがあるチップまでは有効のまま残し、以降は順に休止させる
+        int needed = 1;
+        for (int chip = 0; chip < numChips; ++chip) {
+            if (!voiceAllocator.isChipIdle(chip) || !isDrumChipIdle(chip)) needed = chip + 1;
+        }
+        activeChips = needed;
+        topChipIdleSinceTick = 0;
+        applyEnabledChips();
+    } else {
+        resetActiveChips();
+    }
+    printf("[Voice] Elastic polyphony %s\n", enabled ? "enabled" : "disabled");
+}
+
+// ワンショットのサンプルが終端に達したチャンネルを空きに戻す（ストリーミング中のチャンネルはserviceDrumStreams()が終端を判定する）
+void _3HSPlugAudioProcessor::reclaimFinishedDrumChannels()
+{
+    for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+        auto& drumState = drumPcmChannelStates[i];
+        if (drumState.inUse && !drumState.streaming && s3hsSounds[i / 4].isPcmEnded(i % 4)) {
+            drumState.inUse = false;
+        }
+    }
+}
+
+// 発音するドラムPCMチャンネルを選ぶ。鳴り終わった（空きの）チャンネルをdrumPcmChannelIndexから順に探し、
+// 全て発音中なら音量が最も小さいもの（同じなら最も古いもの）を奪う
+// 伸縮ポリフォニー時は鳴っているチップのチャンネルだけを使い（最後のチップは後回し）、空きが無ければチップを起こす
+int _3HSPlugAudioProcessor::allocateDrumChannel(bool& stolen)
+{
+    stolen = false;
+    auto isFree = [this](int i) {
+        const auto& drumState = drumPcmChannelStates[i];
+        // このブロックの途中で鳴り終わったチャンネルも空きとして扱う
+        return !drumState.inUse || (!drumState.streaming && s3hsSounds[i / 4].isPcmEnded(i % 4));
+    };
+    for (int pass = 0; pass < 2; ++pass) {
+        int totalPcmChannels = std::min(static_cast<int>(drumPcmChannelStates.size()), std::min(activeChips, chipAllocLimit) * 4);
+        if (drumPcmChannelIndex >= totalPcmChannels) {
+            drumPcmChannelIndex = 0;
+        }
+        int drainStart = elasticPolyphony.load() && totalPcmChannels > 4 ? totalPcmChannels - 4 : totalPcmChannels;
+        for (int n = 0; n < totalPcmChannels; ++n) {
+            int i = (drumPcmChannelIndex + n) % totalPcmChannels;
+            if (i < drainStart && isFree(i)) {
+                drumPcmChannelIndex = (i + 1) % totalPcmChannels;
+                return i;
+            }
+        }
+        for (int i = drainStart; i < totalPcmChannels; ++i) {
+            if (isFree(i)) return i;
+        }
+        if (!activateChip()) break;
+    }
+    int totalPcmChannels = std::min(static_cast<int>(drumPcmChannelStates.size()), std::min(activeChips, chipAllocLimit) * 4);
+    int victim = 0;
+    for (int i = 1; i < totalPcmChannels; ++i) {
+        const auto& a = drumPcmChannelStates[i];
+        const auto& b = drumPcmChannelStates[victim];
+        if (a.volume < b.volume || (a.volume == b.volume && a.lastUsedTick < b.lastUsedTick)) {
+            victim = i;
+        }
+    }
+    stolen = true;
+    drumPcmChannelIndex = (victim + 1) % totalPcmChannels;
+    return victim;
+}
+
+void _3HSPlugAudioProcessor::executeGMReset()
+{
+    // GMリセット時も音量0ダミーノート方式で即座に停止
+    printf("[MIDI] GM Reset executed (dummy note method)\n");
+    // FM音源ボイスを音量0ダミーノートで上書き
+    for (int flat = 0; flat < numChips * numVoices; ++flat) {
+        silenceVoice(flat);
+    }
+
+    // ドラムPCMチャンネルを音量0で上書き
+    for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+        int chip = i / 4;
+        int pcmChannel = i % 4;
+
+        // 音量を0に設定（即座に無音化）
+        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
+
+        // PCM再生トリガ（音量0で開始）
+        s3hsSounds[chip].wtSync(pcmChannel);
+        drumSampleStreamer.stopVoice(i);
+
+        // ドラムPCMチャンネル状態をダミーに更新
+        auto& drumState = drumPcmChannelStates[i];
+        drumState.inUse = false;
+        drumState.streaming = false;
+        drumState.streamMuted = false;
+        drumState.noteNumber = -1; // ダミーノート識別用
+        drumState.midiChannel = 0;
+        drumState.velocity = 0;
+        drumState.lastUsedTick = currentTick;
+        drumState.pcmAddr = 0;
+        drumState.sampleRate = 8000;
+    }
+
+    // GMリセット時、全チャンネルのボリューム・エクスプレッションを127にリセット
+    resetGM();
+}
+
+void _3HSPlugAudioProcessor::handleSystemMessage(const juce::MidiMessage& msg)
+{
+    bool CCUpdated = false; // CCが更新されたかどうかのフラグ
+
+    // SysExはsysExRouterで登録済みのハンドラへ振り分ける（registerSysExHandlers）
+    // JUCEのgetSysExData()では、SysExの1バイト目(0xF0)と最後の1バイト(0xF7)は取り除かれる
+    // 例: F0 7E 7F 09 01 F7 → {0x7E, 0x7F, 0x09, 0x01}
+    if (msg.isSysEx()) {
+        sysExRouter.dispatch(msg.getSysExData(), msg.getSysExDataSize());
+    }
+
+    // CC#120 (All Sound Off) - GMリセットとは別処理
+    // + CC#123 (All Notes Off)
+    if (msg.isController() && (msg.getControllerNumber() == 120 || msg.getControllerNumber() == 123)) {
+        // All Sound Off: 指定チャンネルの音のみを停止
+        int targetChannel = msg.getChannel();
+        printf("[MIDI] All Sound Off at CH%d\n", targetChannel);
+        CCUpdated = true; // 更新フラグを立てる
+        // FM音源ボイス：該当チャンネルのみを音量0ダミーノートで上書き
+        voiceAllocator.ownedVoicesOf(targetChannel).forEach([this](int flat) { silenceVoice(flat); });
+        
+        // ドラムPCMチャンネル：該当チャンネルのみを音量0で上書き
+        for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+            if (drumPcmChannelStates[i].midiChannel == targetChannel) {
+                silenceDrumChannel(i);
+            }
+        }
+        
+        // ホールドノート：該当チャンネルのみクリア
+        if (targetChannel >= 1 && targetChannel <= 16) {
+            voiceAllocator.clearHeld(targetChannel);
+        }
+    }
+}
+
+void _3HSPlugAudioProcessor::handleChannelMessage(const juce::MidiMessage& msg)
+{
+    bool patchAltered = false; // パッチが変更されたかどうかのフラグ
+    bool CCUpdated = false; // CCが更新されたかどうかのフラグ
+
+    // パラメータ値をCH1レジスタに反映（例: 0x400000～）
+    // ここでは簡易的にボリューム・ADSR・モード等を反映する例
+    // 詳細なレジスタ割り当てはs3hs register map.md参照
+
+    // MIDIノートON/OFFをGate/Freqに反映
+    int ch = msg.getChannel();
+    // CC#7: ボリューム, CC#11: エクスプレッション, CC#64: Sustain Pedal
+    if (msg.isController()) { // MIDI CCメッセージを解析し、必要に応じてレジスタを更新する
+        this->channelCC[ch][msg.getControllerNumber()] = msg.getControllerValue();
+        CCUpdated = true; // 更新フラグを立てる
+        // CC#0 (Bank Select MSB) 処理 - バンク変更 (例: 008:080: Sine Wave)
+        if (msg.getControllerNumber() == 0) {
+            if (!pcOverrideEnabled) {
+                flushChannelUpdates(ch); // 保留中の更新は変更前のバンクで反映する
+                int bankMSB = msg.getControllerValue();
+                currentBank[ch - 1] = bankMSB;
+                printf("[GS] Bank Select MSB CH%d: %d (Bank: %d)\n", ch, bankMSB, currentBank[ch - 1]);
+            }
+        }
+        
+        // CC#32 (Bank Select LSB) 処理 - バンクには使用しない
+        /*if (msg.getControllerNumber() == 32) {
+            int bankLSB = msg.getControllerValue();
+            currentBank[ch - 1] = bankLSB;
+            printf("[GS] Bank Select LSB CH%d: %d (Bank: %d)\n", ch, bankLSB, currentBank[ch - 1]);
+        }*/
+        
+        // CC#64 (Sustain Pedal) 処理
+        if (msg.getControllerNumber() == 64) {
+            bool newSustainState = msg.getControllerValue() >= 64;
+            bool oldSustainState = channelSustainPedal[ch - 1];
+            channelSustainPedal[ch - 1] = newSustainState;
+            
+            printf("[MIDI] Sustain Pedal CH%d: %s\n", ch, newSustainState ? "ON" : "OFF");
+            
+            // ペダルが離された場合、ホールド中のノートを停止
+            if (oldSustainState && !newSustainState) {
+                // ホールド中のノートを実際に停止（ノートOFFと同じ規則で解放）
+                voiceAllocator.heldNotesOf(ch).forEach([this, ch](int heldNote) {
+                    releaseNote(ch, heldNote);
+                    printf("[GM] Released held note %d on CH%d\n", heldNote, ch);
+                });
+                voiceAllocator.clearHeld(ch);
+            }
+        }
+        // CC#7, CC#11, CC#10受信時はチャンネルを要更新としてマークし、区間の先頭でまとめて反映する（flushChannelUpdates）
+        if (msg.getControllerNumber() == 7 || msg.getControllerNumber() == 11) {
+            markChannelDirty(ch, DirtyVolume);
+        }
+        if (msg.getControllerNumber() == 10) {
+            markChannelDirty(ch, DirtyPan);
+        }
+         // --- ピッチベンドレンジ処理 ---
+        // RPN 0,0（ピッチベンドレンジ）を受信した場合、channelPitchBendRangeを更新
+        // --- RPN処理 ---
+        // RPN 0,0: ピッチベンドレンジ
+        // RPN 0,1: ファインチューニング
+        // RPN 0,2: コースチューニング
+        if (ch >= 1 && ch <= 16) {
+            if (msg.getControllerNumber() == 101) {
+                channelRpnMsb[ch-1] = msg.getControllerValue();
+                printf("[MIDI] RPN MSB Set: %d (ch %d)\n", channelRpnMsb[ch-1], ch);
+            }
+            if (msg.getControllerNumber() == 100) {
+                channelRpnLsb[ch-1] = msg.getControllerValue();
+                printf("[MIDI] RPN LSB Set: %d (ch %d)\n", channelRpnLsb[ch-1], ch);
+            }
+            if (msg.getControllerNumber() == 99) {
+                channelNrpnMsb[ch-1] = msg.getControllerValue();
+                printf("[MIDI] NRPN MSB Set: %d (ch %d)\n", channelNrpnMsb[ch-1], ch);
+            }
+            if (msg.getControllerNumber() == 98) {
+                channelNrpnLsb[ch-1] = msg.getControllerValue();
+                printf("[MIDI] NRPN LSB Set: %d (ch %d)\n", channelNrpnLsb[ch-1], ch);
+            }
+            // Data Entry MSB (CC#6) 受信時、RPN/NRPN値ごとに処理
+            if (msg.getControllerNumber() == 6) {
+                printf("[MIDI] NRPN: Parameter %d: %d (ch %d)\n", channelNrpnMsb[ch-1] * 128 + channelNrpnLsb[ch-1], msg.getControllerValue(), ch);
+                if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 0) {
+                    channelPitchBendRange[ch-1] = msg.getControllerValue();
+                    if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
+                        printf("[DrumPCM] Pitch Bend Range Set: %d (drum ch %d)\n", channelPitchBendRange[ch-1], ch);
+                    } else {
+                        printf("[GM] Pitch Bend Range Set: %d (ch %d)\n", channelPitchBendRange[ch-1], ch);
+                    }
+                    channelRpnMsb[ch-1] = 127;
+                    channelRpnLsb[ch-1] = 127;
+                } else if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 1) {
+                    // ファインチューニング: -100～+100セント, 100/8192単位
+                    int value = msg.getControllerValue();
+                    // value: 0..127, center=64
+                    int cents = ((value - 64) * 100) / 64; // -100～+100
+                    channelFineTune[ch-1] = cents;
+                    printf("[GM] Fine Tune Set: %d cents (ch %d)\n", channelFineTune[ch-1], ch);
+                    channelRpnMsb[ch-1] = 127;
+                    channelRpnLsb[ch-1] = 127;
+                } else if (channelRpnMsb[ch-1] == 0 && channelRpnLsb[ch-1] == 2) {
+                    // コースチューニング: -6400～+6300セント, 100単位, MSBのみ
+                    int value = msg.getControllerValue();
+                    // value: 0..127, center=64
+                    int cents = (value - 64) * 100; // -6400～+6300
+                    channelCoarseTune[ch-1] = cents;
+                    printf("[GM] Coarse Tune Set: %d cents (ch %d)\n", channelCoarseTune[ch-1], ch);
+                    channelRpnMsb[ch-1] = 127;
+                    channelRpnLsb[ch-1] = 127;
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 8) {
+                    // ビブラートレート (Vibrato Rate)
+                    channelCC[ch][76] = msg.getControllerValue();
+                    printf("[GS/XG] Vibrato Rate (NRPN) Set: %d (ch %d)\n", channelCC[ch][76], ch);
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 9) {
+                    // ビブラートデプス (Vibrato Depth)
+                    channelCC[ch][77] = msg.getControllerValue();
+                    printf("[GS/XG] Vibrato Depth (NRPN) Set: %d (ch %d)\n", channelCC[ch][77], ch);
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 10) {
+                    // ビブラートディレイ (Vibrato Delay)
+                    channelCC[ch][78] = msg.getControllerValue();
+                    printf("[GS/XG] Vibrato Delay (NRPN) Set: %d (ch %d)\n", channelCC[ch][78], ch);
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 99) {
+                    // エンベロープアタックタイム (Envelope Attack Time)
+                    channelCC[ch][73] = msg.getControllerValue();
+                    printf("[GS/XG] Envelope Attack Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][73], ch);
+                    patchAltered = true; // パッチが変更されたフラグを立てる
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 100) {
+                    // エンベロープディケイタイム (Envelope Decay Time)
+                    channelCC[ch][75] = msg.getControllerValue();
+                    printf("[GS/XG] Envelope Decay Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][75], ch);
+                    patchAltered = true; // パッチが変更されたフラグを立てる
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 102) {
+                    // エンベロープリリースタイム (Envelope Release Time)
+                    channelCC[ch][72] = msg.getControllerValue();
+                    printf("[GS/XG] Envelope Release Time (NRPN) Set: %d (ch %d)\n", channelCC[ch][72], ch);
+                    patchAltered = true; // パッチが変更されたフラグを立てる
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 32) {
+                    // LPFカットオフ (LPF Cutoff)
+                    channelCC[ch][74] = msg.getControllerValue();
+                    printf("[GS/XG] LPF Cutoff (NRPN) Set: %d (ch %d)\n", channelCC[ch][74], ch);
+                    patchAltered = true; // パッチが変更されたフラグを立てる
+                } else if (channelNrpnMsb[ch-1] == 1 && channelNrpnLsb[ch-1] == 33) {
+                    // LPFレゾナンス (LPF Resonance)
+                    channelCC[ch][71] = msg.getControllerValue();
+                    printf("[GS/XG] LPF Resonance (NRPN) Set: %d (ch %d)\n", channelCC[ch][71], ch);
+                    patchAltered = true; // パッチが変更されたフラグを立てる
+                }                
+            }
+            if (msg.getControllerNumber() >= 71 && msg.getControllerNumber() <= 75) {
+                // エンベロープやLPFのCC受信時もパッチ変更フラグを立てる
+                patchAltered = true;
+            }
+                    
+        }
+        if (patchAltered) {
+            // パッチが変更された場合も、現在のプログラムへの反映は区間の先頭でまとめて行う
+            markChannelDirty(ch, DirtyPatch);
+        }
+
+        //printf("[MIDI] CC# %d: %d (ch %d)\n", msg.getControllerNumber(), msg.getControllerValue(), ch);
+    }
+    // ピッチベンド処理
+    if (msg.isPitchWheel())
+    {
+        int ch = msg.getChannel();
+        int bend = msg.getPitchWheelValue() - 8192; // -8192～+8191
+        if (ch >= 1 && ch <= 16)
+            channelPitchBend[ch - 1] = bend;
+
+        // 周波数の即時書き込みは廃止。最後に一括更新する。
+        // ドラムPCM状態へのベンド値の保存もflushChannelUpdates()でまとめて行う
+        markChannelDirty(ch, DirtyBend);
+    }
+    // プログラムチェンジ処理
+    if (msg.isProgramChange())
+    {
+        flushChannelUpdates(msg.getChannel()); // 保留中の更新は変更前のプログラムで反映する
+        #if PROGRAM_CHANGE_ALSO_ALL_SOUNDS_OFF == 1
+            // プログラムチェンジ受信時、同チャンネルの全ONボイスを音量0ダミーノートで上書きしてからプログラム変更を適用
+            int targetChannel = msg.getChannel();
+            voiceAllocator.ownedVoicesOf(targetChannel).forEach([this](int flat) { silenceVoice(flat); });
+        #endif
+        if (!pcOverrideEnabled) {
+            int prog = msg.getProgramChangeNumber();
+            if (prog >= 0 && prog < 128) {
+                int ch = msg.getChannel() - 1;
+                if (ch >= 0 && ch < 16) {
+                    currentProgram[ch] = prog;
+                    int bank = currentBank[ch];
+                    printf("[MIDI] Program Change: Bank %d, Program %d, CH %d\n", bank, prog, msg.getChannel());
+                    
+                    // 代理発音の確認
+                    auto& effectivePatch = getEffectivePatch(bank, prog);
+                    if (bank != 0 && getPatchAvailability(bank, prog) == 1) {
+                        printf("[PatchBank] Using fallback from Bank 0 for Bank %d Program %d\n", bank, prog);
+                    }
+                }
+            }
+        }
+    }
+    if (msg.isNoteOn())
+    {
+        int note = msg.getNoteNumber();
+        int ch = msg.getChannel();
+
+        // --- ドラムPCM再生処理 ---
+        // ドラムチャンネル（例: ch==10）かつキーマップ登録済みノートの場合
+        // ドラムチャンネルかつキーマップ登録済みノートはFM音源処理を完全スキップ
+        if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
+            uint8_t drumMap = channelDrumMap[(ch - 1) & 0x0F];
+            uint8_t kit = drumKeymapManager.resolveKit(drumMap != 0 ? drumMap : DRUM_KIT_DEFAULT, static_cast<uint8_t>(note));
+            auto info = drumKeymapManager.getSampleInfo(kit, static_cast<uint8_t>(note));
+            if (info.pcmIndex != -1 && info.sampleRate != -1 && info.pcmLength != -1) {
+                // PCM RAMアドレス取得
+                uint32_t pcmAddr_Start = info.pcmIndex;
+                uint32_t pcmAddr_End = pcmAddr_Start + info.pcmLength;
+                if (pcmAddr_End > g_pcmRamSize) {
+                    printf("[Warning::DrumPCM] Drum PCM Sample out of bounds: %d-%d (size: %zu)\n", pcmAddr_Start, pcmAddr_End, g_pcmRamSize);
+                }
+                // チップRAMへ転送中の範囲のサンプルは発音しない（転送完了までは古いデータと新しいデータが混在する）
+                if (pcmUploadManager.isRangeUpdating(pcmAddr_Start, pcmAddr_End)) {
+                    return;
+                }
+                // 既存の同じMIDIチャンネル&ノート番号のドラムボイスを検索
+                int globalPcmChannel = -1;
+                int chip = -1;
+                int pcmChannel = -1;
+                
+                // まず既存のボイスがあるかチェック
+                for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+                    const auto& drumState = drumPcmChannelStates[i];
+                    if (drumState.inUse && drumState.midiChannel == ch && drumState.noteNumber == note) {
+                        // 同じMIDIチャンネル&ノート番号の既存ボイスを発見、上書きする
+                        globalPcmChannel = i;
+                        chip = globalPcmChannel / 4;
+                        pcmChannel = globalPcmChannel % 4;
+                        //printf("[DrumPCM] Overwriting existing voice: MIDI ch %d, note %d, globalChannel %d\n", ch, note, globalPcmChannel);
+                        break;
+                    }
+                }
+                if (globalPcmChannel != -1) {
+                    voiceUsageStats.countDrumHit(true, false, false);
+                }
+                
+                // 既存ボイスがなければ新しいチャンネルを割り当て（空きを優先し、無ければ最も小さく古いものを奪う）
+                if (globalPcmChannel == -1) {
+                    bool stolen = false;
+                    auto allocStartTime = std::chrono::high_resolution_clock::now();
+                    hwPerfStats.mark(PerfStats::MidiDecode);
+                    globalPcmChannel = allocateDrumChannel(stolen);
+                    perfStats.addStage(PerfStats::VoiceAlloc, elapsedNs(allocStartTime));
+                    hwPerfStats.mark(PerfStats::VoiceAlloc);
+                    voiceUsageStats.countDrumHit(false, stolen, stolen && drumPcmChannelStates[globalPcmChannel].volume > 0);
+                    
+                    // チップとローカルチャンネルを計算
+                    chip = globalPcmChannel / 4;
+                    pcmChannel = globalPcmChannel % 4;
+                    
+                    // さらに安全策
+                    if (chip >= numChips) {
+                        printf("[Error] Chip index out of bounds: %d >= %d. Resetting to 0.\n", chip, numChips);
+                        chip = 0;
+                        pcmChannel = 0;
+                        globalPcmChannel = 0;
+                    }
+
+                    printf("[DrumPCM] Assigning new voice: MIDI ch %d, note %d, globalChannel %d%s\n", ch, note, globalPcmChannel, stolen ? " (stolen)" : "");
+                }
+
+                // PCM RAMアドレスをS3HS音源に設定（例: regwtやram_pokeでpcm_addr[pcmChannel]等を設定）
+                // s3hsSounds[0].ram_poke(..., ..., pcmAddr);
+
+                // PCM周波数は後の一括更新ループで計算・設定されるためここではスキップ
+                
+                // ストリーミングするサンプルは、常駐している先頭部分をこのチャンネルのリングへコピーしてリングを周回再生する
+                uint32_t playStart = pcmAddr_Start;
+                uint32_t playEnd = pcmAddr_End;
+                uint32_t loopStart = 0xFFFFFF; // ループ開始アドレス（0xFFFFFFでワンショット）
+                bool streamed = kit == DRUM_KIT_DEFAULT && info.format == DRUM_PCM_FORMAT_RAW8 && drumSampleStreamer.isStreamed(note);
+                if (streamed) {
+                    playStart = drumSampleStreamer.getSlotAddress(globalPcmChannel);
+                    playEnd = playStart + DRUM_STREAM_SLOT_BYTES;
+                    loopStart = playStart;
+                    drumSampleStreamer.startVoice(globalPcmChannel, note, s3hsSounds[chip].ram.data(),
+                                                  s3hsSounds[chip].ram.data() + pcmAddr_Start, static_cast<uint32_t>(info.pcmLength));
+                } else {
+                    drumSampleStreamer.stopVoice(globalPcmChannel);
+                }
+
+                // PCM アドレスを書き込む (24bit ビッグエンディアン)
+                // PCM音源部のレジスタは0x30刻み
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x10, (playStart >> 16) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x11, (playStart >> 8) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x12, playStart & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x13, (playEnd >> 16) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x14, (playEnd >> 8) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x15, playEnd & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x16, (loopStart >> 16) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x17, (loopStart >> 8) & 0xFF);
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x18, loopStart & 0xFF);
+                // 再生モード（0: Raw 8bit PCM 6: 4bit ADPCM）
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x03,
+                                          info.format == DRUM_PCM_FORMAT_ADPCM4 ? S3HS_WT_MODE_ADPCM : 0);
+                
+                // 音量を書き込む
+                uint8 velocity = msg.getVelocity();
+                uint8 expr = this->channelCC[ch][11];
+                uint8 volCC = this->channelCC[ch][7];
+                float volF = (static_cast<float>(velocity) / 127.0f)
+                            * (static_cast<float>(expr) / 127.0f)
+                            * (static_cast<float>(volCC) / 127.0f)
+                            * 255.0f;
+                uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, vol);
+                
+                // PCM再生トリガ
+                s3hsSounds[chip].wtSync(pcmChannel);
+                //printf("Drum Note on: note %d, freq %d, channel %d, pcmAddr %d-%d\n", note, pcmFreq, pcmChannel, pcmAddr_Start, pcmAddr_End);
+
+                // ドラムPCMチャンネル状態を更新
+                if (globalPcmChannel >= 0 && globalPcmChannel < static_cast<int>(drumPcmChannelStates.size())) {
+                    int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2;
+                    int bend = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
+                    
+                    auto& drumState = drumPcmChannelStates[globalPcmChannel];
+                    drumState.inUse = true;
+                    drumState.noteNumber = note;
+                    drumState.midiChannel = ch;
+                    drumState.velocity = velocity;
+                    drumState.volume = vol;
+                    drumState.lastUsedTick = currentTick;
+                    drumState.pcmAddr = pcmAddr_Start;
+                    drumState.sampleRate = info.sampleRate;
+                    drumState.pcmLength = info.pcmLength;
+                    drumState.streaming = streamed;
+                    drumState.streamMuted = false;
+                    drumState.pitchBendValue = bend + 8192; // 0x0000-0x3FFF形式で保存
+                    drumState.pitchBendRange = static_cast<float>(bendRange);
+                }
+                
+                //printf("Drum Note on: note %d, chip %d, pcmChannel %d, globalChannel %d, pcmAddr %d-%d\n",
+                //       note, chip, pcmChannel, globalPcmChannel, pcmAddr_Start, pcmAddr_End);
+            } else {// PCMファイルが無い場合は何も鳴らさない
+                printf("[Warning::DrumPCM] Drum PCM Sample not found for note %d on channel %d\n", note, ch);
+            }
+        } else {
+        // それ以外はFM音源等の従来処理
+
+            channelLfoPhase[ch - 1] = 0.0f; // リセット
+
+            // channelKeyShiftは値の更新がないため常に0で計算。
+            // CH1のみ2足されるというバグがあったため、現状は常に0で計算するように修正。将来的に実装する場合は、ここで値を取得して加算する。
+            int keyShift = 0;//(ch >= 1 && ch <= 16) ? channelKeyShift[ch - 1] : 0;
+            //printf("Ch %d keyShift: %d\n", ch, channelKeyShift[ch - 1]);
+            int bend = (ch >= 1 && ch <= 16) ? channelPitchBend[ch - 1] : 0;
+            int bendRange = (ch >= 1 && ch <= 16) ? (channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2) : 2; // デフォルト2
+
+            int progIdx = currentProgram[ch-1];
+            auto mut = DoMutation(this->channelCC[ch]);
+            auto patch = getEffectivePatch(currentBank[ch-1], progIdx).applyMutation(mut);
+            int totalKeyShift = keyShift + patch.keyShift;
+
+            float bendSemis = bendRange * (static_cast<float>(bend) / 8192.0f);
+
+            // チューニング値をセミトーン換算で加算
+            float coarse = (ch >= 1 && ch <= 16) ? static_cast<float>(channelCoarseTune[ch - 1]) : 0.0f;
+            float fine   = (ch >= 1 && ch <= 16) ? static_cast<float>(channelFineTune[ch - 1]) : 0.0f;
+            bendSemis += (coarse + fine) / 100.0f;
+
+            float freq = 440.0f * std::pow(2.0f, ((note + totalKeyShift + bendSemis) - 69) / 12.0f);
+            int freqInt = static_cast<int>(freq);
+            // 伸縮ポリフォニー: 鳴っているチップに発音終了ボイスが無ければ、奪う前に休止中のチップを起こす
+            auto allocStartTime = std::chrono::high_resolution_clock::now();
+            hwPerfStats.mark(PerfStats::MidiDecode);
+            if (!voiceAllocator.hasFinishedVoice()) {
+                activateChip();
+            }
+            // ボイス割り当て（戦略はvoiceAllocatorの設定に従う。ホールド中の同一ノートは再利用）
+            int voiceIndex = voiceAllocator.chooseVoice(ch, note + totalKeyShift);
+            perfStats.addStage(PerfStats::VoiceAlloc, elapsedNs(allocStartTime));
+            hwPerfStats.mark(PerfStats::VoiceAlloc);
+            if (voiceIndex >= 0) {
+                // 奪ったボイスがまだ鳴っていたか（ゲートON / リリース中）。ホールド中の同じノートの再利用は奪ったことにしない
+                const auto& prev = voiceSlots[voiceIndex];
+                bool retrigger = prev.inUse && prev.midiChannel == ch && prev.noteNumber == note + totalKeyShift;
+                voiceUsageStats.countFmNote(retrigger, voiceAllocator.isActive(voiceIndex), voiceAllocator.isReleasing(voiceIndex));
+            }
+            // tickカウンタを進める
+            ++currentTick;
+        
+            // --- パンをリアルタイム反映 ---
+            voiceAllocator.activeVoices().forEach([&](int flat) {
+                auto& v = voiceSlots[flat];
+                int ch = v.midiChannel;
+                int chip = flat / numVoices;
+                int vIdx = flat % numVoices;
+                int baseAddr = 0x400000 + 0x40 * vIdx;
+                uint8 panCC = this->channelCC[ch][10];
+                float panNorm = static_cast<float>(panCC) / 127.0f;
+                uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+                uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+                uint8 panReg = (left << 4) | (right & 0x0F);
+                int bank = (baseAddr - 0x400000) / 0x40;
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg);
+            });
+            if (voiceIndex >= 0) {
+                // 割り当て
+
+                // もし該当するMIDIチャンネルのMIDIノートがすでに再生中なら、強制的にスロットを再利用する (ノートが重なるのを防止)
+
+                voiceSlots[voiceIndex].noteNumber = note + totalKeyShift;
+                voiceSlots[voiceIndex].midiChannel = ch;
+                voiceSlots[voiceIndex].inUse = true;
+                voiceSlots[voiceIndex].lastUsedTick = currentTick;
+                voiceSlots[voiceIndex].modmode = patch.modmode;
+                voiceAllocator.assign(voiceIndex, ch, note + totalKeyShift, getModModeRenderCost(patch.modmode));
+
+                int chip = voiceIndex / numVoices;
+                std::lock_guard<std::mutex> lock(*voiceMutexes[chip]);
+                int vIdx = voiceIndex % numVoices;
+                int baseAddr = 0x400000 + 0x40 * vIdx;
+                uint8 velocity = msg.getVelocity(); // Velocity, 0 - 127
+                uint8 expr = this->channelCC[ch][11]; // CC#11 Expression, 0 - 127
+                uint8 volCC = this->channelCC[ch][7]; // CC#7 Channel Volume, 0 - 127
+                float volumeExponentialFactor = 2.0f; // 将来的に音量カーブ調整用に使用可能
+                float exprExponentialFactor = 2.0f;   // 将来的に音量カーブ調整用に使用可能
+                float volExp = std::pow(static_cast<float>(volCC) / 127.0f, volumeExponentialFactor);
+                float exprExp = std::pow(static_cast<float>(expr) / 127.0f, exprExponentialFactor);
+                float volF = (static_cast<float>(velocity) / 127.0f)
+                        * exprExp
+                        * volExp
+                        * 255.0f;
+                uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
+                //printf("Note On: %d, chip# %d, chipch %d, MIDIch %d, Volume: %d (unclipped %f, vel %d, vol %d, expr %d)\n", note, chip, vIdx, ch, vol, volF, velocity, volCC, expr);
+                voiceSlots[voiceIndex].velocity = velocity;
+                voiceSlots[voiceIndex].volume = vol;
+                // voiceSlots, s3hsSounds へのアクセスはこのスコープ内で
+
+                // パッチ適用: PatchBank[currentProgram]のtoRegValues()で得たregValuesをレジスタに書き込む
+                // Patch.keyShiftはすでに上で取得済み
+                // volumeScalingMapに応じてuint8_t volでスケーリングされたレジスタ値を取得
+                auto regs = patch.toRegValues(vol);
+                int bank = (baseAddr - 0x400000) / 0x40;
+                for (size_t i = 0; i < regs.size(); ++i) {
+                    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
+                }
+                voiceFreqRegCache[voiceIndex] = -1; // 周波数レジスタもパッチ値で上書きされたため再書き込みさせる
+
+                // パン設定（CC#10, 0-127, デフォルト64中心）
+                uint8 panCC = this->channelCC[ch][10];
+                float panNorm = static_cast<float>(panCC) / 127.0f; // 0.0=Left, 1.0=Right
+                uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+                uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+                uint8 panReg = (left << 4) | (right & 0x0F);
+                bank = (baseAddr - 0x400000) / 0x40;
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg); // パンレジスタ書き込み
+                // OP1 周波数書き込みは一括処理ループに任せるためここではスキップ
+                /*s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x02, 0x10); // OP2 周波数倍率 上位ビット
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x03, 0x00);   // OP2 周波数倍率 下位ビット*/
+                // Gate ON
+                bank = (baseAddr - 0x400000) / 0x40;
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 1);
+                s3hsSounds[chip].resetGate(vIdx);
+            }
+        }
+    }
+    if (msg.isNoteOff())
+    {
+        int note = msg.getNoteNumber();
+        int ch = msg.getChannel();
+        
+        // Note ONと同様にkeyShiftを計算
+        // channelKeyShiftは値の更新がないため常に0で計算。同上
+        int keyShift = 0;//(ch >= 1 && ch <= 16) ? channelKeyShift[ch - 1] : 0;
+        int progIdx = currentProgram[ch-1];
+        auto mut = DoMutation(this->channelCC[ch]);
+        auto patch = getEffectivePatch(currentBank[ch-1], progIdx).applyMutation(mut);
+        int totalKeyShift = keyShift + patch.keyShift;
+        int adjustedNote = note + totalKeyShift;
+        
+        // Sustain Pedalの状態を確認
+        bool sustainActive = (ch >= 1 && ch <= 16) ? channelSustainPedal[ch - 1] : false;
+        
+        if (sustainActive) {
+            // ペダルが押されている場合、ノートをホールドリストに追加
+            if (!voiceAllocator.isHeld(ch, adjustedNote)) {
+                voiceAllocator.holdNote(ch, adjustedNote);
+                printf("[GM] Note %d held on CH%d (Sustain Pedal active)\n", adjustedNote, ch);
+            }
+            // ノートは停止せずに継続
+        } else {
+            // 該当スロットを探して停止
+            releaseNote(ch, adjustedNote);
+        }
+    }
+}
+
+void _3HSPlugAudioProcessor::markChannelDirty(int ch, uint8_t flags)
+{
+    if (ch < 1 || ch > 16) return;
+    channelDirty[ch] |= flags;
+    dirtyChannelMask |= 1u << ch;
+}
+
+void _3HSPlugAudioProcessor::flushAllChannelUpdates()
+{
+    while (dirtyChannelMask != 0) {
+        int ch = static_cast<int>(countTrailingZeros64(dirtyChannelMask));
+        flushChannelUpdates(ch);
+    }
+}
+
+void _3HSPlugAudioProcessor::flushChannelUpdates(int ch)
+{
+    if (ch < 1 || ch > 16) return;
+    uint8_t flags = channelDirty[ch];
+    channelDirty[ch] = 0;
+    dirtyChannelMask &= ~(1u << ch);
+    if (flags == 0) return;
+
+    // ピッチベンド: ドラムPCM状態に最新のベンド値を保存
+    if (flags & DirtyBend) {
+        if (gsDrumChannels.find(ch) != gsDrumChannels.end() || ch == 10) {
+            int bendRange = channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2;
+            int bendVal = channelPitchBend[ch - 1];
+            for (auto& drumState : drumPcmChannelStates) {
+                if (drumState.inUse && drumState.midiChannel == ch) {
+                    // ピッチベンド値を構造体に保存（後段での使用のため）
+                    drumState.pitchBendValue = bendVal + 8192; // 0x0000-0x3FFF形式に変換
+                    drumState.pitchBendRange = static_cast<float>(bendRange);
+                }
+            }
+        }
+    }
+
+    const BitSet128& voices = voiceAllocator.activeVoicesOf(ch);
+    if (!(flags & (DirtyVolume | DirtyPan | DirtyPatch)) || !voices.any()) return;
+
+    // パッチ（ミューテーション適用済み）はチャンネルごとに1回だけ生成する
+    auto& effectivePatch = getEffectivePatch(currentBank[ch-1], currentProgram[ch-1]);
+    auto mut = DoMutation(this->channelCC[ch]);
+    auto patch = effectivePatch.applyMutation(mut);
+
+    // パッチの変更（SysEx・バンク再読み込み）、エンベロープ・LPF（CC#71-75, NRPN）:
+    // ノートオン時と同じレジスタイメージを書き直す。ノートごとの値（OP1周波数・パン・ゲート）は残し、
+    // 音量スケーリングは各ボイスの音量で計算し直す
+    if (flags & DirtyPatch) {
+        voices.forEach([&](int flat) {
+            auto& v = voiceSlots[flat];
+            int chip = flat / numVoices;
+            int vIdx = flat % numVoices;
+            int baseAddr = 0x400000 + 0x40 * vIdx;
+            auto regs = patch.toRegValues(v.volume);
+            for (size_t i = 0x02; i < regs.size(); ++i) {// 0x00-0x01: OP1周波数（ノートごと）
+                if (i == 0x1D || i == 0x1E) continue; // パン・ゲート
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
+            }
+            v.modmode = patch.modmode;
+        });
+    }
+
+    // CC#7, CC#11: 全ONボイスの音量を更新
+    if (flags & DirtyVolume) {
+        uint8 expr = this->channelCC[ch][11];
+        uint8 volCC = this->channelCC[ch][7];
+        float volumeExponentialFactor = 2.0f; // 将来的に音量カーブ調整用に使用可能
+        float exprExponentialFactor = 2.0f;   // 将来的に音量カーブ調整用に使用可能
+        float volExp = std::pow(static_cast<float>(volCC) / 127.0f, volumeExponentialFactor);
+        float exprExp = std::pow(static_cast<float>(expr) / 127.0f, exprExponentialFactor);
+        voices.forEach([&](int flat) {
+            auto& v = voiceSlots[flat];
+            int chip = flat / numVoices;
+            int vIdx = flat % numVoices;
+            float volF = (static_cast<float>(v.velocity) / 127.0f)
+                    * exprExp
+                    * volExp
+                    * 255.0f;
+            uint8_t vol = static_cast<uint8_t>(std::min(std::max(volF, 0.0f), 255.0f));
+            v.volume = vol;
+            int baseAddr = 0x400000 + 0x40 * vIdx;
+            auto regs = patch.toRegValues(vol);
+            for (size_t i = 0x10; i < 0x18; ++i) {
+                s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + static_cast<int>(i), regs[i]);
+            }
+        });
+    }
+
+    // CC#10: パン
+    if (flags & DirtyPan) {
+        uint8 panCC = this->channelCC[ch][10];
+        float panNorm = static_cast<float>(panCC) / 127.0f;
+        uint8 left = clip(static_cast<uint8>(std::round((1.0f - panNorm) * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+        uint8 right = clip(static_cast<uint8>(std::round(panNorm * 15.0f + 0.5f)), (uint8)0, (uint8)15);
+        uint8 panReg = (left << 4) | (right & 0x0F);
+        voices.forEach([&](int flat) {
+            int chip = flat / numVoices;
+            int baseAddr = 0x400000 + 0x40 * (flat % numVoices);
+            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1D, panReg);
+        });
+    }
+}
+
+// LFO（CC#1 モジュレーション・CC#76/77 ビブラート）の1サンプルあたりの位相増分を計算
+// 位相の更新とピッチ反映はサブブロックごとに行う（updateControlRatePitch）
+void _3HSPlugAudioProcessor::updateLfoIncrements()
+{
+    double sampleRate = getSampleRate();
+    if (sampleRate <= 0.0) return;
+    float phasePerSample = static_cast<float>(2.0 * juce::MathConstants<double>::pi / sampleRate);
+
+    for (int ch = 1; ch <= 16; ++ch) {
+        uint8_t modVal = channelCC[ch][1];
+        uint8_t rateVal = channelCC[ch][76];
+        uint8_t depthVal = channelCC[ch][77];
+        
+        if (modVal > 0 || depthVal != 64) {
+            float lfoFreq;
+            if (rateVal < 64) {
+               lfoFreq = lfoFrequencyMin * std::pow(lfoFrequencyCenter / lfoFrequencyMin, rateVal / 64.0f);
+            } else {
+               lfoFreq = lfoFrequencyCenter * std::pow(lfoFrequencyMax / lfoFrequencyCenter, (rateVal - 64) / 63.0f);
+            }
+            channelLfoIncrement[ch - 1] = lfoFreq * phasePerSample; // 1-16 -> 0-15
+        } else {
+            channelLfoIncrement[ch - 1] = 0.0f;
+            channelLfoPhase[ch - 1] = 0.0f; // リセット
+        }
+    }
+}
+
+// [start, start + numSamples) を制御レートのサブブロックに分割してレンダリングし、制御レート処理の時間[ms]を返す
+// サブブロックごとにLFO・ピッチを更新してから各チップの出力を合成する
+// （ホストのバッファサイズに関係なく、モジュレーションの時間分解能はcontrolBlockSizeで決まる）
+double _3HSPlugAudioProcessor::renderSegment(float* left, float* right, int start, int numSamples)
+{
+    const int subBlockSize = controlBlockSize.load();
+    const bool controlRateEnabled = getSampleRate() > 0.0;
+    double controlTimeMs = 0.0;
+
+    for (int pos = start; pos < start + numSamples; pos += subBlockSize) {
+        int subLen = std::min(subBlockSize, start + numSamples - pos);
+
+        // 制御レート処理（LFO位相・ピッチレジスタ更新）
+        if (controlRateEnabled) {
+            auto controlStartTime = std::chrono::high_resolution_clock::now();
+            advanceLfoPhases(subLen);
+            updateControlRatePitch();
+            auto controlEndTime = std::chrono::high_resolution_clock::now();
+            controlTimeMs += std::chrono::duration<double, std::milli>(controlEndTime - controlStartTime).count();
+            perfStats.addStage(PerfStats::Control, std::chrono::duration_cast<std::chrono::nanoseconds>(controlEndTime - controlStartTime).count());
+            hwPerfStats.mark(PerfStats::Control);
+        }
+
+        std::fill(left + pos, left + pos + subLen, 0.0f);
+        if (right)
+            std::fill(right + pos, right + pos + subLen, 0.0f);
+        for (int chip = 0; chip < activeChips; ++chip) {
+            auto chipStartTime = std::chrono::high_resolution_clock::now();
+            s3hsSounds[chip].renderMaster(renderScratchL.data(), renderScratchR.data(), subLen);
+            auto mixStartTime = std::chrono::high_resolution_clock::now();
+            if (hwPerfStats.isActive()) {
+                hwPerfStats.markChip(getChipModModeWeights(chip));
+            }
+            for (int i = 0; i < subLen; ++i) {
+                left[pos + i] += renderScratchL[i] / 32768.0f;
+                if (right)
+                    right[pos + i] += renderScratchR[i] / 32768.0f;
+            }
+            uint64_t chipNs = std::chrono::duration_cast<std::chrono::nanoseconds>(mixStartTime - chipStartTime).count();
+            perfStats.addChip(chip, chipNs);
+            perfStats.addStage(PerfStats::ChipRender, chipNs);
+            perfStats.addStage(PerfStats::Mix, elapsedNs(mixStartTime));
+            hwPerfStats.mark(PerfStats::Mix);
+        }
+        currentTick += subLen; // 現在のtickカウントを更新
+    }
+    return controlTimeMs;
+}
+
+void _3HSPlugAudioProcessor::recordVoiceUsage(int numSamples)
+{
+    std::array<int, 16> fmPerChannel{};
+    std::array<int, 16> pcmPerChannel{};
+    for (int ch = 1; ch <= 16; ++ch) {
+        fmPerChannel[ch - 1] = voiceAllocator.activeVoicesOf(ch).count();
+    }
+    int pcmInUse = 0;
+    for (const auto& drumState : drumPcmChannelStates) {
+        if (!drumState.inUse) continue;
+        ++pcmInUse;
+        if (drumState.midiChannel >= 1 && drumState.midiChannel <= 16) ++pcmPerChannel[drumState.midiChannel - 1];
+    }
+    // リリース中のボイスも音源の処理とチャンネルを占有しているので数える
+    int fmSounding = voiceAllocator.activeVoices().count() + voiceAllocator.releasingVoices().count();
+    voiceUsageStats.recordBlock(numSamples, fmSounding, numChips * numVoices, pcmInUse, numChips * 4, fmPerChannel, pcmPerChannel);
+}
+
+std::array<int, HW_PERF_MODMODE_COUNT> _3HSPlugAudioProcessor::getChipModModeWeights(int chip) const
+{
+    // 発音中・リリース中のボイスだけを数える（発音終了したボイスは音源側の処理がほぼ無い）
+    std::array<int, HW_PERF_MODMODE_COUNT> weights{};
+    const auto& releasing = voiceAllocator.releasingVoices();
+    for (int flat = chip * numVoices; flat < (chip + 1) * numVoices && flat < static_cast<int>(voiceSlots.size()); ++flat) {
+        const auto& v = voiceSlots[flat];
+        if (!v.inUse && !releasing.test(flat)) continue;
+        if (v.modmode < HW_PERF_MODMODE_COUNT) weights[v.modmode] += getModModeRenderCost(v.modmode);
+    }
+    return weights;
+}
+
+void _3HSPlugAudioProcessor::advanceLfoPhases(int numSamples)
+{
+    const float twoPi = 2.0f * juce::MathConstants<float>::pi;
+    for (int i = 0; i < 16; ++i) {
+        channelLfoPhase[i] += channelLfoIncrement[i] * numSamples;
+        while (channelLfoPhase[i] > twoPi) {
+            channelLfoPhase[i] -= twoPi;
+        }
+    }
+}
+
+void _3HSPlugAudioProcessor::updateControlRatePitch()
+{
+    // チャンネルごとのピッチオフセット（ベンド・チューニング・LFO）をサブブロックごとに1回だけ計算
+    std::array<float, 17> channelPitchSemis{};  // FM音源用: ベンド + チューニング + LFO（半音）
+    std::array<float, 17> channelDrumRatio{};   // ドラムPCM用: 2^((ベンド + LFO) / 12)
+    for (int ch = 1; ch <= 16; ++ch) {
+        // ピッチベンド
+        int bendRange = channelPitchBendRange[ch - 1] ? channelPitchBendRange[ch - 1] : 2; // デフォルト2
+        float bendSemis = bendRange * (static_cast<float>(channelPitchBend[ch - 1]) / 8192.0f);
+
+        // LFOモジュレーション
+        float lfoOffset = 0.0f;
+        uint8_t modVal = channelCC[ch][1];
+        uint8_t depthVal = channelCC[ch][77];
+        if (modVal > 0 || depthVal != 64) {
+            float baseDepth = ((depthVal - 64) / 64.0f) * 1.0f; // -1.0 ~ 1.0
+            float modDepth = (modVal / 127.0f) * lfoDepthNormal; // -lfoDepthNormal ~ lfoDepthNormal
+            float lfoDepth = std::max(0.0f, baseDepth + modDepth);
+            lfoOffset = std::sin(channelLfoPhase[ch - 1]) * lfoDepth;
+        }
+
+        // チューニング
+        float tuneSemis = static_cast<float>(channelCoarseTune[ch - 1] + channelFineTune[ch - 1]) / 100.0f;
+
+        channelPitchSemis[ch] = bendSemis + tuneSemis + lfoOffset;
+        channelDrumRatio[ch] = PitchTable::semitonesToRatio(bendSemis + lfoOffset);
+    }
+
+    // FM音源ボイスの周波数を更新（値が変わったときだけレジスタへ書き込む）
+    voiceAllocator.activeVoices().forEach([&](int flat) {
+        auto& v = voiceSlots[flat];
+        int ch = v.midiChannel;
+        if (ch < 1 || ch > 16) return;
+
+        // v.noteNumberはすでにkeyShiftとpatch.keyShiftが加算された状態のノート番号
+        float freq = PitchTable::noteToFrequency(static_cast<float>(v.noteNumber) + channelPitchSemis[ch]);
+        int freqInt = static_cast<int>(freq);
+        if (voiceFreqRegCache[flat] == freqInt) return;
+        voiceFreqRegCache[flat] = freqInt;
+
+        int chip = flat / numVoices;
+        int vIdx = flat % numVoices;
+        int baseAddr = 0x400000 + 0x40 * vIdx;
+        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (freqInt >> 8) & 0xFF);
+        s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, freqInt & 0xFF);
+    });
+    
+    // ドラムPCMのピッチ更新
+    for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
+        auto& drumState = drumPcmChannelStates[i];
+        if (drumState.inUse) {
+            int ch = drumState.midiChannel;
+            float pitchRatio = (ch >= 1 && ch <= 16) ? channelDrumRatio[ch] : 1.0f;
+            float modifiedSampleRate = drumState.sampleRate * pitchRatio;
+            int pcmFreq = static_cast<int>(std::floor(modifiedSampleRate / 32.0));
+            if (drumFreqRegCache[i] == pcmFreq) continue;
+            drumFreqRegCache[i] = pcmFreq;
+
+            int chip = i / 4;
+            int pcmChannel = i % 4;
+            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x00, (pcmFreq >> 8) & 0xFF);
+            s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x01, pcmFreq & 0xFF);
+        }
+    }
+}
+
+void _3HSPlugAudioProcessor::setEventCoalesceSamples(int samples)
+{
+    if (samples < 1) samples = 1;
+    if (samples > maxControlBlockSize) samples = maxControlBlockSize;
+    eventCoalesceSamples.store(samples);
+    printf("[MIDI] Event coalesce threshold set to %d samples\n", samples);
+}
+
+void _3HSPlugAudioProcessor::setControlBlockSize(int samples)
+{
+    if (samples < minControlBlockSize) samples = minControlBlockSize;
+    if (samples > maxControlBlockSize) samples = maxControlBlockSize;
+    controlBlockSize.store(samples);
+    printf("[Control] Control block size set to %d samples\n", samples);
+}
+
+std::vector<std::vector<float>> _3HSPlugAudioProcessor::getChipAudioDataL(int chip) const
+{
+    juce::ScopedLock sl(processLock);
     if (chip < 0 || chip >= displayBufferL.size())
         return {};
     std::vector<std::vector<float>> slicedData;
@@ -1698,6 +2309,8 @@ void _3HSPlugAudioProcessor::allNotesOff()
         voiceSlots[flat].volume = 0;
         voiceSlots[flat].lastUsedTick = currentTick;
     }
+    voiceAllocator.reset(numChips * numVoices, numVoices);
+    resetActiveChips(); // 全ボイスが止まったので、伸縮時は1チップに戻す
     
     // ドラムPCMチャンネルを停止
     for (int i = 0; i < static_cast<int>(drumPcmChannelStates.size()); ++i) {
@@ -1707,9 +2320,13 @@ void _3HSPlugAudioProcessor::allNotesOff()
         // 音量を0に設定
         s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, 0x400200 + pcmChannel * 0x30 + 0x02, 0);
         
+        drumSampleStreamer.stopVoice(i);
+        
         // ドラムPCMチャンネル状態をクリア
         auto& drumState = drumPcmChannelStates[i];
         drumState.inUse = false;
+        drumState.streaming = false;
+        drumState.streamMuted = false;
         drumState.noteNumber = -1;
         drumState.midiChannel = 0;
         drumState.velocity = 0;
@@ -1718,9 +2335,7 @@ void _3HSPlugAudioProcessor::allNotesOff()
     }
     
     // ホールドノートをクリア
-    for (auto& heldList : heldNotes) {
-        heldList.clear();
-    }
+    voiceAllocator.clearAllHeld();
     
     // サスティンペダル状態をリセット
     for (auto& pedal : channelSustainPedal) {
@@ -1728,6 +2343,113 @@ void _3HSPlugAudioProcessor::allNotesOff()
     }
 }
 
+// Gate OFF（リリースへ移行）。ボイスは空きに戻るが所有チャンネルは保持する
+void _3HSPlugAudioProcessor::releaseVoice(int flat)
+{
+    int chip = flat / numVoices;
+    std::lock_guard<std::mutex> lock(*voiceMutexes[chip]);
+    int vIdx = flat % numVoices;
+    int baseAddr = 0x400000 + 0x40 * vIdx;
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0); // Gate OFF
+    voiceSlots[flat].inUse = false;
+    voiceSlots[flat].noteNumber = -1;
+    voiceAllocator.release(flat);
+}
+
+// (ch, note)で発音中のボイスをGate OFF
+void _3HSPlugAudioProcessor::releaseNote(int ch, int adjustedNote)
+{
+    #ifdef EMULATE_MSGS_RELEASE_BEHAVIOR
+        // MSGSのリリースはすべての該当ノートをオフにする
+        voiceAllocator.forEachVoiceFor(ch, adjustedNote, [this](int flat) { releaseVoice(flat); });
+    #else
+        // 一般的なシンセサイザー実装では一番最後に押されたノートだけオフにする
+        int flat = voiceAllocator.lastVoiceFor(ch, adjustedNote);
+        if (flat >= 0) {
+            releaseVoice(flat);
+        }
+    #endif
+}
+
+// 音量0ダミーノートで即座に無音化し、ボイスの所有チャンネルも解除する
+void _3HSPlugAudioProcessor::silenceVoice(int flat)
+{
+    int chip = flat / numVoices;
+    int vIdx = flat % numVoices;
+    int baseAddr = 0x400000 + 0x40 * vIdx;
+    
+    // 音量を0に設定（即座に無音化）
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x10, 0);
+    
+    // ダミー周波数設定（0Hz）
+    int dummyFreq = 0;
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x00, (dummyFreq >> 8) & 0xFF);
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x01, dummyFreq & 0xFF);
+    voiceFreqRegCache[flat] = -1;
+    
+    // Gate OFF（音量0なのでリリースにはならず、即座に音が止まる）
+    s3hsSounds[chip].ram_poke(s3hsSounds[chip].ram, baseAddr + 0x1E, 0);
+    s3hsSounds[chip].resetGate(vIdx);
+    
+    // ボイススロット状態をダミーノートに更新
+    auto& v = voiceSlots[flat];
+    v.inUse = false; // 使用中フラグをfalseに設定
+    v.noteNumber = -1; // ダミーノート識別用
+    v.midiChannel = 0;
+    v.velocity = 0;
+    v.volume = 0;
+    v.lastUsedTick = currentTick;
+    voiceAllocator.clearOwner(flat);
+}
+
+// 周波数レジスタの書き込みキャッシュを無効化（次のブロックで全ボイスの周波数を書き直す）
+void _3HSPlugAudioProcessor::invalidateFrequencyCache()
+{
+    voiceFreqRegCache.assign(numChips * numVoices, -1);
+    drumFreqRegCache.assign(numChips * 4, -1);
+}
+
+// リリース中ボイスのうち、エンベロープが終了したものを発音終了扱いにする
+void _3HSPlugAudioProcessor::updateVoiceReleaseStates()
+{
+    voiceAllocator.releasingVoices().forEach([this](int flat) {
+        int chip = flat / numVoices;
+        int vIdx = flat % numVoices;
+        const auto& sound = s3hsSounds[chip];
+        voiceAllocator.updateRelease(flat, sound.isChannelFinished(vIdx),
+                                     static_cast<float>(sound.getChannelEnvLevel(vIdx)));
+    });
+}
+
+void _3HSPlugAudioProcessor::setVoiceAllocationStrategy(VoiceAllocator::Strategy strategy)
+{
+    juce::ScopedLock sl(processLock);
+    if (voiceAllocator.getStrategy() != strategy) {
+        voiceAllocator.setStrategy(strategy);
+        voiceAllocator.resetRollingIndex();
+        printf("[Voice] Allocation strategy changed to %s\n",
+               strategy == VoiceAllocator::Strategy::Rolling ? "Rolling" :
+               strategy == VoiceAllocator::Strategy::OldestFirst ? "OldestFirst" : "LoadBalanced");
+    }
+}
+
+VoiceAllocator::Strategy _3HSPlugAudioProcessor::getVoiceAllocationStrategy() const
+{
+    return voiceAllocator.getStrategy();
+}
+
+void _3HSPlugAudioProcessor::setVoiceChipAffinity(bool enabled)
+{
+    juce::ScopedLock sl(processLock);
+    voiceAllocator.setChannelAffinity(enabled);
+    printf("[Voice] Chip affinity %s\n", enabled ? "enabled" : "disabled");
+}
+
+bool _3HSPlugAudioProcessor::getVoiceChipAffinity() const
+{
+    return voiceAllocator.getChannelAffinity();
+}
+
 // PC Override
 void _3HSPlugAudioProcessor::setPcOverrideEnabled(bool enabled)
 {
@@ -1787,50 +2509,171 @@ int _3HSPlugAudioProcessor::getPcOverrideProgram() const
 
 void _3HSPlugAudioProcessor::setNumChips(int n)
 {
+    if (n < 1) n = 1;
+    if (n > VoiceAllocator::maxChips) n = VoiceAllocator::maxChips; // 上限設定
+
+    // 準備は常駐の準備スレッドで1つずつ行う（準備中に続けて変更された場合は最後の値だけを準備する）
+    {
+        std::lock_guard<std::mutex> lock(chipPrepareMutex);
+        requestedNumChips = n;
+    }
+    chipPrepareCv.notify_one();
+}
+
+void _3HSPlugAudioProcessor::chipPrepareWorkerLoop()
+{
+    TRACE_THREAD_NAME("ChipPrepare");
+    for (;;) {
+        int n = 0;
+        {
+            std::unique_lock<std::mutex> lock(chipPrepareMutex);
+            chipPrepareCv.wait(lock, [this] { return !chipPrepareRunning || requestedNumChips != 0; });
+            if (!chipPrepareRunning) return;
+            n = requestedNumChips;
+            requestedNumChips = 0;
+        }
+        prepareChipSet(n);
+    }
+}
+
+void _3HSPlugAudioProcessor::prepareChipSet(int n)
+{
+    TRACE_SCOPE("prepareChipSet");
+    HW_PERF_SCOPE("ChipPrepare");
+    waitForChipSetApplied();
+    delete retiredChipSet.exchange(nullptr); // 前回外したチップの解放
+
+    int current = committedNumChips.load();
+    if (n == current) return;
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto* set = new PreparedChipSet();
+    set->numChips = n;
+    if (n > current) {
+        set->addedChips.resize(n - current);
+        for (auto& chip : set->addedChips) {
+            chip.initSound();
+            chip.setSampleRate(static_cast<float>(getSampleRate()));
+            chip.reserveRender();
+        }
+    } else {
+        set->removedChips.reserve(current - n);
+    }
+    auto publish = [&] {
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        chipSetInFlight.store(true);
+        pendingChipSet.store(set);
+        printf("[System] Chip set prepared: %d -> %d chips (%.1f ms)\n", current, n, elapsedMs);
+    };
+    if (set->addedChips.empty()) {
+        publish();
+        return;
+    }
+
+    // 追加するチップへのPCM RAMのコピーはSysExアップロード・ドラムキットのコミットと直列化する（転送中のコミットが無い状態でコピーする）
+    // チップセットはロックを離す前に公開し、その後に発行されたコミットはservicePcmUpload()がチップセットの適用まで転送を始めない
+    bool copied = false;
+    pcmUploadManager.runExclusiveCommit([&](PcmUploadManager::PendingCommit&) {
+        for (auto& chip : set->addedChips) {
+            transferPcmRamToS3HS(chip.ram);
+        }
+        copied = true;
+        publish();
+        return false; // g_pcmRamは書き換えていないのでコミットは発行しない
+    });
+    if (!copied) {
+        // アップロードのワーカーが停止している（終了処理中）: 書き換える者はいないのでそのままコピーする
+        for (auto& chip : set->addedChips) {
+            transferPcmRamToS3HS(chip.ram);
+        }
+        publish();
+    }
+    waitForChipSetApplied(); // コミットのロックは持たずに待つ（その間もアップロード・キットの読み込みは進められる）
+}
+
+void _3HSPlugAudioProcessor::waitForChipSetApplied()
+{
+    // オーディオスレッドが動いていれば次のブロックで受け取る（減らす場合は鳴り終わるまで待つ）
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CHIP_SET_DRAIN_TIMEOUT_MS + 500);
+    while (chipSetInFlight.load() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!chipSetInFlight.load()) return;
+    // processBlockが呼ばれていない（再生停止中など）ので、オーディオスレッドの代わりに適用する
     juce::ScopedLock sl(processLock);
+    PreparedChipSet* set = stagedChipSet ? stagedChipSet : pendingChipSet.exchange(nullptr);
+    stagedChipSet = nullptr;
+    if (set) {
+        applyChipSet(set);
+        delete set;
+    }
+}
 
-    if (n < 1) n = 1;
-    if (n > 16) n = 16; // 上限設定
-    
-    if (numChips != n) {
-        numChips = n;
-        drumPcmChannelIndex = 0; // チャンネルインデックスをリセット
-        
-        // リサイズ処理
-        s3hsSounds.resize(numChips);
-        voiceSlots.resize(numChips * numVoices);
-        displayBufferL.resize(numChips * 12);
-        displayBufferR.resize(numChips * 12);
-        
-        for (int i = 0; i < numChips * 12; ++i) {
-            if (displayBufferL[i].size() != DISPLAY_BUFFER_SIZE) {
-                displayBufferL[i].resize(DISPLAY_BUFFER_SIZE);
-                displayBufferR[i].resize(DISPLAY_BUFFER_SIZE);
-            }
+// オーディオスレッド: 準備済みのチップセットを受け取って差し替える
+void _3HSPlugAudioProcessor::serviceChipSetChange()
+{
+    if (!stagedChipSet) {
+        stagedChipSet = pendingChipSet.exchange(nullptr);
+        if (!stagedChipSet) return;
+    }
+    auto* set = stagedChipSet;
+    if (set->numChips < numChips) {
+        // 外すチップには新しいボイスを割り当てず、鳴っているボイスの余韻が消えるのを待つ
+        if (!set->draining) {
+            set->draining = true;
+            set->drainStartTick = currentTick;
+            chipAllocLimit = set->numChips;
+            applyEnabledChips();
         }
-        
-        voiceMutexes.clear();
-        for (int i = 0; i < numChips; ++i) {
-            voiceMutexes.emplace_back(std::make_unique<std::mutex>());
+        bool idle = true;
+        for (int chip = set->numChips; chip < numChips; ++chip) {
+            idle = idle && voiceAllocator.isChipIdle(chip) && isDrumChipIdle(chip);
         }
-        
-        drumPcmChannelStates.resize(numChips * 4);
-        
-        // 新しいチップの初期化
-        for (int chip = 0; chip < numChips; ++chip) {
-            s3hsSounds[chip].initSound();
-            s3hsSounds[chip].setSampleRate(static_cast<float>(getSampleRate()));
-            transferPcmRamToS3HS(s3hsSounds[chip].ram);
+        uint64_t timeoutSamples = static_cast<uint64_t>(getSampleRate() * CHIP_SET_DRAIN_TIMEOUT_MS / 1000.0);
+        if (!idle && currentTick - set->drainStartTick < timeoutSamples) return;
+    }
+    applyChipSet(set);
+    stagedChipSet = nullptr;
+    retiredChipSet.store(set);
+}
+
+void _3HSPlugAudioProcessor::applyChipSet(PreparedChipSet* set)
+{
+    int oldChips = numChips;
+    int n = set->numChips;
+    if (n > oldChips) {
+        // 追加: 容量は確保済みなのでムーブだけで済む（既存チップのボイスはそのまま鳴り続ける）
+        for (auto& chip : set->addedChips) {
+            chip.setSampleRate(static_cast<float>(getSampleRate()));
+            s3hsSounds.push_back(std::move(chip));
+        }
+    } else {
+        // 削除: 外すチップのボイスを捨て、チップは準備スレッドで解放する
+        for (int flat = n * numVoices; flat < oldChips * numVoices; ++flat) {
+            voiceSlots[flat] = VoiceSlot{};
+        }
+        for (int i = n * 4; i < oldChips * 4; ++i) {
+            drumSampleStreamer.stopVoice(i);
+            drumPcmChannelStates[i] = DrumPcmChannelState{};
+        }
+        while (static_cast<int>(s3hsSounds.size()) > n) {
+            set->removedChips.push_back(std::move(s3hsSounds.back()));
+            s3hsSounds.pop_back();
         }
-        
-        // 状態リセット
-        allNotesOff();
-        #if USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY == 1 // 未割当インデックスによる例外回避
-        currentRollingIndex = 0; // ローリングチャンネル割り当て戦略用インデックスをリセット
-        #endif
-        
-        printf("[System] NumChips changed to %d\n", numChips);
     }
+    numChips = n;
+    voiceSlots.resize(numChips * numVoices);
+    drumPcmChannelStates.resize(numChips * 4);
+    voiceAllocator.resize(numChips * numVoices);
+    chipAllocLimit = VoiceAllocator::maxChips;
+    activeChips = elasticPolyphony.load() ? std::max(1, std::min(activeChips, numChips)) : numChips;
+    topChipIdleSinceTick = 0;
+    if (drumPcmChannelIndex >= numChips * 4) drumPcmChannelIndex = 0;
+    applyEnabledChips();
+    invalidateFrequencyCache();
+    committedNumChips.store(numChips);
+    chipSetInFlight.store(false);
+    printf("[System] NumChips changed from %d to %d\n", oldChips, numChips);
 }
 
 // ドラムPCMチャンネルデバッグ情報取得
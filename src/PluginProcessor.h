@@ -5,13 +5,39 @@
 #include <mutex>
 #include <cstdint>
 #include <chrono>
+#include <array>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <JuceHeader.h>
 #include "DrumKeymapManager.h"
+#include "VoiceAllocator.h"
+#include "SysExRouter.h"
+#include "PcmUploadManager.h"
+#include "PcmRamAllocator.h"
+#include "DrumSampleStreamer.h"
+#include "DrumPcmSampleLoader.h"
+#include "PatchBankWatcher.h"
+#include "PitchTable.h"
+#include "PerfStats.h"
+#include "TraceRecorder.h"
+#include "HwPerfCounters.h"
+#include "VoiceUsageStats.h"
 #include "s3hs_core/sound.cpp"
 
-#define USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY 1 // チャンネル割り当て戦略の切り替え（定義するとローリング戦略、未定義で従来の戦略）
+#define USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY 1 // チャンネル割り当て戦略の初期値（1でローリング戦略、0で従来の戦略。実行時はsetVoiceAllocationStrategy()で切り替え可能）
 #define EMULATE_MSGS_RELEASE_BEHAVIOR 1 // MSGSのリリース挙動をエミュレートするか（定義するとMSGSのように同一ノートのすべてのスロットをオフにする、未定義で一般的なシンセのように最後に押されたノートだけオフにする）
 #define PROGRAM_CHANGE_ALSO_ALL_SOUNDS_OFF 1 // プログラムチェンジで全音オフするか（定義するとプログラムチェンジで全音オフ、未定義で全音オフしない）
+#define DEFAULT_CONTROL_BLOCK_SIZE 32 // 制御レート（LFO・ピッチ更新）のサブブロック長の初期値（サンプル数。実行時はsetControlBlockSize()で変更可能）
+#define DEFAULT_EVENT_COALESCE_SAMPLES 16 // この距離（サンプル数）未満のMIDIイベントはまとめて同じ位置で適用する（1でサンプル精度、大きいほどレンダリングの分割が減る）
+#define DEFAULT_ELASTIC_POLYPHONY 0 // 発音数に応じてレンダリングするチップ数を増減する伸縮ポリフォニーの初期値（1で有効、0で無効。実行時はsetElasticPolyphony()で切り替え可能。設定したチップ数が上限になる）
+#define CHIP_SET_DRAIN_TIMEOUT_MS 1000 // チップ数を減らすとき、外すチップのボイスが鳴り終わるのを待つ最大時間（ミリ秒、過ぎたら打ち切る）
+#define ELASTIC_CHIP_RETIRE_MS 250 // 伸縮ポリフォニーで余韻が消えたチップを休止させるまでの待ち時間（ミリ秒、増減の繰り返しを防ぐ）
+#define ENABLE_DRUM_PCM_STREAMING 1 // 長いドラムサンプルを先頭だけ常駐させ、残りをディスクからストリーミングするか（1で有効、0で無効）
+#define ENABLE_PATCH_BANK_HOT_RELOAD 1 // パッチフォルダの変更を監視してバンクを自動で再読み込みするか（1で有効、0で無効）
+#define PCM_UPLOAD_COPY_BYTES_PER_BLOCK 65536 // SysExでアップロードしたPCMを各チップのRAMへ転送する1ブロックあたりのバイト数（大きいほど反映が速く、ブロックあたりの負荷が増える）
 #define CUT_NOTE_IN_FIRST_TICK 0 // ノートオンの時に1tickのみ音を切り、それ以降は通常の音量で鳴らす（定義するとノートオンの最初のtickだけ音量0で鳴らす、未定義で通常通り鳴らす、SNESの音声ドライバの挙動を再現）
 // ドラムPCMチャンネルデバッグ情報構造体
 struct DrumPcmChannelDebugInfo {
@@ -35,6 +61,9 @@ struct DrumPcmChannelState {
     uint64_t lastUsedTick = 0;
     uint32_t pcmAddr = 0;
     uint32_t sampleRate = 0;
+    uint32_t pcmLength = 0;      // 発音中サンプルの長さ（アップロード中の範囲との重なり判定用）
+    bool streaming = false;      // ストリーミング再生中（DrumSampleStreamer）
+    bool streamMuted = false;    // ページミスでミュート中
     int pitchBendValue = 0x2000; // 14bit ピッチベンド値 (0x0000-0x3FFF, センター: 0x2000)
     float pitchBendRange = 2.0f; // ピッチベンドレンジ（半音単位）
 };
@@ -48,6 +77,8 @@ class _3HSPlugAudioProcessor  : public juce::AudioProcessor
 {
     // GSドラムパートとして扱うMIDIチャンネル集合
     std::set<uint8_t> gsDrumChannels;
+    // MIDIチャンネルごとのドラムマップ（GS Drum Partのmm、0は未指定でDRUM_KIT_DEFAULTを使う）
+    std::array<uint8_t, 16> channelDrumMap{};
 
     // DCオフセット除去用ハイパスフィルタ（チャンネルごと）
     std::vector<juce::IIRFilter> dcHighPassFilters;
@@ -84,6 +115,8 @@ public:
     // 指定チャンネルの現在のプログラム番号を取得
     int getCurrentProgramForChannel(int channel) const; // プログラムチェンジ
     int getCurrentProgramBankForChannel(int channel) const; // バンクMSB
+    // 現在のプログラムのパッチの存在状況（getPatchAvailability()と同じ値。オーディオスレッドがブロックごとに更新する）
+    int getPatchAvailabilityForChannel(int channel) const;
 
 
     //==============================================================================
@@ -133,6 +166,39 @@ public:
     double getCpuUsagePercent() const { return cpuUsagePercent; }
     double getMidiProcessingTimeMs() const { return midiProcessingTimeMs; }
     double getSynthProcessingTimeMs() const { return synthProcessingTimeMs; }
+    double getControlRateTimeMs() const { return controlRateTimeMs; } // 1ブロック中の制御レート処理の合計時間
+
+    // 制御レート（LFO・ピッチレジスタ更新の間隔）のサブブロック長（8～1024サンプル）
+    void setControlBlockSize(int samples);
+    int getControlBlockSize() const { return controlBlockSize.load(); }
+
+    // MIDIイベントの合流しきい値（1～1024サンプル）
+    void setEventCoalesceSamples(int samples);
+    int getEventCoalesceSamples() const { return eventCoalesceSamples.load(); }
+
+    // SysExによるPCMアップロードの進捗・スループット
+    PcmUploadManager::Stats getPcmUploadStats() const { return pcmUploadManager.getStats(); }
+
+    // ドラムキットの差し替え（バックグラウンドでデコードし、チップRAMへの転送完了と同時に切り替わる）
+    void requestDrumKitLoad(const std::string& pcmPath, int kit = DRUM_KIT_DEFAULT);
+    // ノートのドラムサンプルを外して領域を解放する（断片化していればコンパクションも行う）
+    void unloadDrumNote(int note, int kit = DRUM_KIT_DEFAULT);
+    PcmRamAllocator::Stats getPcmRamStats() const { return pcmRamAllocator.getStats(); }
+    // ドラムサンプルのストリーミングのヒット・ミス・読み込み遅延
+    DrumSampleStreamer::Stats getDrumStreamStats() const { return drumSampleStreamer.getStats(); }
+
+    // 処理段・チップごとのレイテンシ分布（p50/p99/p99.9/最大、締め切り超過数、遅かったブロック）
+    const PerfStats& getPerfStats() const { return perfStats; }
+    // ハードウェアカウンタ（ENABLE_HW_PERF_COUNTERSが有効なLinuxのみ）: 処理段・モジュレーションモードごとのサイクル・命令数・キャッシュミス
+    const HwPerfStats& getHwPerfStats() const { return hwPerfStats; }
+    // ボイス・ドラムPCMチャンネルの使用状況（processLockを取らずに読める）
+    const VoiceUsageStats& getVoiceUsageStats() const { return voiceUsageStats; }
+    bool dumpPerfStats(const std::string& path = PERF_STATS_JSON_FILE_NAME) const {
+        if (hwPerfStats.isAvailable()) hwPerfStats.dumpJson(HW_PERF_JSON_FILE_NAME);
+        voiceUsageStats.dumpJson(VOICE_STATS_JSON_FILE_NAME);
+        return perfStats.dumpJson(path);
+    }
+    void resetPerfStats() { perfStats.requestReset(); hwPerfStats.requestReset(); voiceUsageStats.requestReset(); }
     std::vector<std::vector<float>> getChipAudioDataL(int chip) const;
     std::vector<std::vector<float>> getChipAudioDataR(int chip) const;
 
@@ -144,13 +210,28 @@ public:
         uint8_t velocity = 0;  // ベロシティ（ノートON時値）
         uint8_t volume = 0;    // 実際に書き込んだ音量値
         uint64_t lastUsedTick = 0; // 最終使用時刻（ノートON時に更新）
+        uint8_t modmode = 0;   // 発音中パッチのモジュレーションモード（ハードウェアカウンタの按分用）
     };
     static constexpr int numVoices = 8;
     const std::vector<VoiceSlot>& getVoiceSlots() const noexcept { return voiceSlots; }
     int getNumVoices() const noexcept { return numChips * numVoices; }
     int getNumChips() const noexcept { return numChips; }
+    // チップ数の変更（追加するチップはバックグラウンドで初期化し、オーディオスレッドがブロックの先頭で差し替える。
+    // 残るチップのボイスはそのまま鳴り続け、外すチップは鳴り終わるのを待ってから外す）
     void setNumChips(int n);
 
+    // 伸縮ポリフォニー（チップ数を上限として、空きボイスが無くなったらチップを起こし、鳴り終わったチップを休止させる）
+    void setElasticPolyphony(bool enabled);
+    bool getElasticPolyphony() const { return elasticPolyphony.load(); }
+    int getActiveChipCount() const noexcept { return activeChipCount.load(); }   // レンダリング中のチップ数
+
+    // ボイス割り当て戦略（実行時切り替え）
+    void setVoiceAllocationStrategy(VoiceAllocator::Strategy strategy);
+    VoiceAllocator::Strategy getVoiceAllocationStrategy() const;
+    // LoadBalanced戦略で同じMIDIチャンネルを同じチップにまとめるか
+    void setVoiceChipAffinity(bool enabled);
+    bool getVoiceChipAffinity() const;
+
     std::atomic<int> frequencyQuantizeFrequency{0}; // 周波数量子化の基準周波数（0の場合は量子化なし）
     void setFrequencyQuantizeFrequency(int frequency);
     int getFrequencyQuantizeFrequency();
@@ -177,6 +258,42 @@ private:
     // S3HS音源エンジン
     std::vector<S3HS_sound> s3hsSounds;
     int numChips = 1;
+    // 伸縮ポリフォニー: 先頭からactiveChips個のチップだけをレンダリング・割り当てする（残りは休止中）
+    std::atomic<bool> elasticPolyphony{DEFAULT_ELASTIC_POLYPHONY == 1};
+    int activeChips = 1;
+    int chipAllocLimit = VoiceAllocator::maxChips; // 割り当て対象にできるチップ数の上限（チップ数を減らす前の待機中）
+    std::atomic<int> activeChipCount{1};   // エディタ表示用
+    void applyEnabledChips();              // activeChips・chipAllocLimitをボイスアロケータへ反映
+    uint64_t topChipIdleSinceTick = 0;     // 最後のチップが無音になった時刻（0: 発音中）
+    void resetActiveChips();               // 伸縮時は1チップ、それ以外は全チップを有効にする
+    bool activateChip();                   // 休止中のチップを1つ起こす（上限ならfalse）
+    void retireIdleChips();                // 無音が続いた最後のチップを休止させる（1ブロックに1回）
+    bool isDrumChipIdle(int chip) const;
+
+    // チップ数の変更: 準備スレッドが追加するチップを初期化し、ポインタの受け渡しだけでオーディオスレッドへ渡す
+    // （PcmUploadManagerのコミットと同じく、オーディオスレッドは受け取ったものを適用して返却するだけでメモリ確保・解放をしない）
+    struct PreparedChipSet {
+        int numChips = 0;                      // 変更後のチップ数
+        std::vector<S3HS_sound> addedChips;    // 追加するチップ（初期化・PCM転送済み）
+        std::vector<S3HS_sound> removedChips;  // 外したチップ（容量確保済み、解放は準備スレッド）
+        bool draining = false;                 // 外すチップのボイスが鳴り終わるのを待っている
+        uint64_t drainStartTick = 0;
+    };
+    std::atomic<PreparedChipSet*> pendingChipSet{nullptr};  // 準備スレッド → オーディオ
+    std::atomic<PreparedChipSet*> retiredChipSet{nullptr};  // オーディオ → 準備スレッド（解放待ち）
+    PreparedChipSet* stagedChipSet = nullptr;               // オーディオスレッドが適用待ちで保持中
+    std::atomic<bool> chipSetInFlight{false};               // 発行したチップセットがまだ適用されていない
+    std::atomic<int> committedNumChips{0};                  // 適用済みのチップ数
+    std::thread chipPrepareWorker;                          // 準備スレッド（常駐。setNumChips()で起こす）
+    std::mutex chipPrepareMutex;
+    std::condition_variable chipPrepareCv;
+    int requestedNumChips = 0;                              // 準備を要求されたチップ数（0: 要求なし。chipPrepareMutexで保護）
+    bool chipPrepareRunning = false;
+    void chipPrepareWorkerLoop();
+    void prepareChipSet(int n);                 // 準備スレッド
+    void waitForChipSetApplied();               // 準備スレッド: 前のチップセットの適用を待つ（オーディオが止まっていれば自分で適用）
+    void serviceChipSetChange();                // オーディオスレッド: ブロックの先頭で呼ぶ
+    void applyChipSet(PreparedChipSet* set);    // オーディオスレッド（またはprocessLock保持中）
     
     // パス設定
     std::string pcmPath = "./pcm/";
@@ -194,15 +311,104 @@ private:
     // ボイスアロケーション用tickカウンタ
     uint64_t currentTick = 0;
 
-    // チャンネル割り当て用ローリングインデックス
-    #ifdef USE_ROLLING_CHANNEL_ALLOCATION_STRATEGY
-    int currentRollingIndex = 0; // ローリングチャンネル割り当て戦略用インデックス
-    #endif
+    // ボイスアロケータ（(ch, note)索引・空きボイス集合・LRU・ホールドノート）
+    VoiceAllocator voiceAllocator;
+
+    // ボイス状態更新ヘルパー（voiceSlotsとvoiceAllocatorを同期させる）
+    void releaseVoice(int flat);                // Gate OFF（リリースへ移行）
+    void releaseNote(int ch, int adjustedNote); // (ch, note)のボイスをGate OFF
+    void silenceVoice(int flat);                // 音量0ダミーノートで即座に無音化
+    void updateVoiceReleaseStates();            // リリース中ボイスの余韻状態を音源から更新
+    void invalidateFrequencyCache();            // 周波数レジスタキャッシュを無効化
+
+    // SysExディスパッチャ（ハンドラはコンストラクタでregisterSysExHandlers()により登録）
+    SysExRouter sysExRouter;
+    void registerSysExHandlers();
+    void executeGMReset();                                  // GM/GS/XGリセット: 全ボイスを無音化しCCを初期化
+    void setDisplayText(const uint8_t* text, int length);   // GS/XGテキストディスプレイ
+
+    // SysExによるPCMアップロード（デコードはワーカースレッド、チップRAMへの転送はprocessBlockで分割実行）
+    PcmUploadManager pcmUploadManager;
+    void servicePcmUpload();
+    void silenceDrumChannel(int i);                         // ドラムPCMチャンネルを即座に無音化
+    void reclaimFinishedDrumChannels();                     // 鳴り終わったドラムPCMチャンネルを空きに戻す
+    int allocateDrumChannel(bool& stolen);                  // 空きチャンネルを優先して割り当て、無ければ奪う
+
+    // ドラムPCM RAMの領域管理（キットの差し替え・アンロードはdrumKitWorkerで1つずつ実行し、
+    // PcmUploadManager::runExclusiveCommit()でSysExアップロードと同じ経路でチップへ転送する）
+    PcmRamAllocator pcmRamAllocator;
+    std::array<std::array<int, 128>, DRUM_KIT_COUNT> drumNoteHandles;          // キット・ノート → アロケータのハンドル（-1: 未割り当て）
+    std::array<std::array<int32_t, 128>, DRUM_KIT_COUNT> drumNoteSampleRates;  // コンパクションで移動したサンプルの再登録用
+    std::array<std::array<int32_t, 128>, DRUM_KIT_COUNT> drumNoteFormats;
+    std::thread drumKitWorker; // ドラムキットの読み込みと、遅延デコードするパッチバンクのローダーを兼ねる
+    std::mutex drumKitWorkerMutex;
+    std::condition_variable drumKitWorkerCv;
+    std::deque<std::function<void()>> drumKitTasks;
+    bool drumKitWorkerRunning = false;
+    void runDrumKitTask(std::function<void()> task);
+    void drumKitWorkerLoop();
+    bool commitDrumKitChange(int kit, const std::vector<DecodedDrumSample>& samples, const std::vector<int>& notesToRelease);
+
+    // GSのドラムマップごとのキット（初めて選択されたときにワーカーでgetDrumKitPath()から読み込む）
+    enum class DrumKitState : uint8_t { Unloaded, Loading, Loaded, Missing };
+    std::array<std::atomic<DrumKitState>, DRUM_KIT_COUNT> drumKitStates;
+    std::atomic<uint32_t> drumKitLoadRequests{0};    // 読み込み待ちのキット（ビットマスク、オーディオスレッド → ワーカー）
+    void requestDrumMap(uint8_t kit);                // オーディオスレッドから呼ぶ（ロック・メモリ確保なし）
+    void loadDrumKitForMap(int kit);
+
+    // 長いドラムサンプルのストリーミング（リングバッファはPCM RAMの末尾、アロケータの管理範囲外）
+    DrumSampleStreamer drumSampleStreamer;
+    void serviceDrumStreams();
+
+    // パッチのバルクダンプ（3HSPlug 0x04/0x05）を反映した後、該当パッチを使用中のチャンネルを1回だけ再適用対象にする
+    void markPatchChannelsDirty(int bankNumber, int patchNumber);   // patchNumber < 0でバンク全体
+
+    // パッチバンクのホットリロード（差し替えを検知したら全チャンネルのパッチを再適用する）
+    PatchBankWatcher patchBankWatcher;
+    uint32_t lastPatchBankGeneration = 0;
+
+    // MIDIメッセージ処理（processBlockからサンプル位置順に1メッセージずつ呼ばれる）
+    void handleSystemMessage(const juce::MidiMessage& msg);  // SysEx・GM/GSリセット・All Sound Off
+    void handleChannelMessage(const juce::MidiMessage& msg); // CC・プログラムチェンジ・ノートON/OFFなど
+
+    // CC・ピッチベンドの遅延反映: イベント区間内ではチャンネルごとに最新値だけを記録し、
+    // 区間の先頭（またはバンクセレクト・プログラムチェンジの直前）でチャンネル単位に1回だけレジスタを更新する
+    enum ChannelDirtyFlags : uint8_t {
+        DirtyVolume = 1 << 0, // CC#7/11 → OP音量（0x10-0x17）
+        DirtyPan    = 1 << 1, // CC#10 → パン（0x1D）
+        DirtyPatch  = 1 << 2, // CC#71-75・NRPN → OP音量・ADSR（0x20-0x3F）
+        DirtyBend   = 1 << 3  // ピッチベンド → ドラムPCM状態
+    };
+    void markChannelDirty(int ch, uint8_t flags);
+    void flushChannelUpdates(int ch);
+    void flushAllChannelUpdates();
+    std::array<uint8_t, 17> channelDirty{}; // [1-16]
+    uint32_t dirtyChannelMask = 0;          // bit ch = channelDirty[ch] != 0
+
+    // [start, start + numSamples) をレンダリングし、制御レート処理の時間[ms]を返す
+    double renderSegment(float* left, float* right, int start, int numSamples);
+    std::atomic<int> eventCoalesceSamples{DEFAULT_EVENT_COALESCE_SAMPLES};
+
+    // 制御レート処理（サブブロックごとに呼ばれる）
+    void updateLfoIncrements();                 // CCからLFOの位相増分を計算（イベント適用後に呼ぶ）
+    void advanceLfoPhases(int numSamples);      // LFO位相をnumSamples分進める
+    void updateControlRatePitch();              // ベンド・チューニング・LFOから周波数レジスタを更新
+
+    static constexpr int minControlBlockSize = 8;
+    static constexpr int maxControlBlockSize = 1024;
+    std::atomic<int> controlBlockSize{DEFAULT_CONTROL_BLOCK_SIZE};
+    std::vector<float> renderScratchL;  // チップごとのサブブロック出力（maxControlBlockSize分を事前確保）
+    std::vector<float> renderScratchR;
+
+    // 最後に書き込んだ周波数レジスタ値（-1 = 未書き込み）。変化がなければ書き込みを省略する
+    std::vector<int> voiceFreqRegCache;  // FM音源ボイスごと
+    std::vector<int> drumFreqRegCache;   // ドラムPCMチャンネルごと
 
     // パッチバンク機能
     // std::vector<Patch> patchBank = std::vector<Patch>(128); // 外部定義に切り替え
     std::array<int, 16> currentProgram{{0}};
     std::array<int, 16> currentBank{{0}};          // 各チャンネルの現在のバンク番号
+    std::array<std::atomic<uint8_t>, 16> channelPatchAvailability{}; // エディタ用（2: 定義あり, 1: バンク0で代理発音, 0: なし）
 
     // ピッチベンド・レンジ・キーシフト
     std::array<int, 16> channelPitchBend{};        // -8192～+8191
@@ -226,6 +432,7 @@ private:
 
     // LFO（モジュレーション用）
     std::array<float, 16> channelLfoPhase{};
+    std::array<float, 16> channelLfoIncrement{}; // 1サンプルあたりの位相増分（0 = LFO停止）
     std::array<float, 16> channelLfoDepth{}; // LFO深さ（0.0～1.0）
     std::array<float, 16> channelLfoRate{};  // LFOレート（Hz）
     
@@ -241,19 +448,28 @@ private:
     uint8_t channelCC[17][128] = {{127}};
     
     // Hold/Sustain Pedal状態管理
-    std::array<bool, 16> channelSustainPedal{};  // CC#64の状態
-    std::array<std::vector<int>, 16> heldNotes;  // ペダル押下中のノート番号リスト
+    std::array<bool, 16> channelSustainPedal{};  // CC#64の状態（ホールド中のノートはvoiceAllocatorが管理）
 
     // パフォーマンス測定
     mutable std::atomic<double> audioProcessingTimeMs{0.0};
     mutable std::atomic<double> cpuUsagePercent{0.0};
     mutable std::atomic<double> midiProcessingTimeMs{0.0};
     mutable std::atomic<double> synthProcessingTimeMs{0.0};
+    mutable std::atomic<double> controlRateTimeMs{0.0};
     std::chrono::high_resolution_clock::time_point lastProcessTime;
+    PerfStats perfStats;
+    HwPerfStats hwPerfStats;
+    VoiceUsageStats voiceUsageStats;
+    void recordVoiceUsage(int numSamples); // ブロックごとの発音数をvoiceUsageStatsへ記録
+    std::array<int, HW_PERF_MODMODE_COUNT> getChipModModeWeights(int chip) const; // チップで鳴っているボイスのモード別推定コスト
+    static uint64_t elapsedNs(std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    }
     double movingAverageProcessingTime = 0.0;
     double movingAverageCpuUsage = 0.0;
     double movingAverageMidiTime = 0.0;
     double movingAverageSynthTime = 0.0;
+    double movingAverageControlRateTime = 0.0;
     static constexpr double SMOOTHING_FACTOR = 0.1; // 移動平均のスムージング係数
 
     // PC Override
@@ -0,0 +1,162 @@
+// SysExRouter.cpp
+#include "SysExRouter.h"
+#include <cstdio>
+#include <utility>
+
+void SysExRouter::addRoute(Family family, Route route) {
+    routes[family].push_back(std::move(route));
+}
+
+void SysExRouter::addUniversalRoute(uint8_t subId1, uint8_t subId2, int minPayload, int maxPayload, Handler handler) {
+    Route r;
+    r.model = subId1;
+    r.address = subId2;
+    r.addressMask = 0x7F;
+    r.minPayload = minPayload;
+    r.maxPayload = maxPayload;
+    r.handler = std::move(handler);
+    addRoute(Universal, std::move(r));
+}
+
+void SysExRouter::addRolandRoute(uint8_t model, uint32_t address, uint32_t addressMask,
+                                 int minPayload, int maxPayload, Handler handler) {
+    Route r;
+    r.model = model;
+    r.address = address & addressMask;
+    r.addressMask = addressMask;
+    r.minPayload = minPayload;
+    r.maxPayload = maxPayload;
+    r.handler = std::move(handler);
+    addRoute(Roland, std::move(r));
+}
+
+void SysExRouter::addYamahaRoute(uint8_t model, uint32_t address, uint32_t addressMask,
+                                 int minPayload, int maxPayload, Handler handler) {
+    Route r;
+    r.model = model;
+    r.address = address & addressMask;
+    r.addressMask = addressMask;
+    r.minPayload = minPayload;
+    r.maxPayload = maxPayload;
+    r.handler = std::move(handler);
+    addRoute(Yamaha, std::move(r));
+}
+
+void SysExRouter::add3HSRoute(uint8_t command, int minPayload, int maxPayload, Handler handler) {
+    Route r;
+    r.model = 0;
+    r.address = command;
+    r.addressMask = 0x7F;
+    r.minPayload = minPayload;
+    r.maxPayload = maxPayload;
+    r.handler = std::move(handler);
+    addRoute(ThreeHS, std::move(r));
+}
+
+bool SysExRouter::rolandChecksumValid(const uint8_t* from, int count) {
+    unsigned int sum = 0;
+    for (int i = 0; i < count; ++i) {
+        sum += from[i];
+    }
+    return (sum & 0x7F) == 0;
+}
+
+static uint32_t readAddress3(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+}
+
+bool SysExRouter::dispatch(const uint8_t* data, int size) const {
+    if (data == nullptr || size < 1) return false;
+
+    Message msg;
+    msg.data = data;
+    msg.size = size;
+    Family family;
+
+    switch (data[0]) {
+    case 0x7E: // Universal Non-Real Time: 7E <dev> <sub1> <sub2> <payload>
+        if (size < 4) break;
+        family = Universal;
+        msg.deviceId = data[1];
+        msg.model = data[2];
+        msg.address = data[3];
+        msg.payload = data + 4;
+        msg.payloadSize = size - 4;
+        return route(family, msg);
+
+    case 0x41: // Roland DT1: 41 <dev> <model> 12 <addr 3byte> <payload> <sum>
+        if (size < 8 || data[3] != 0x12) break;
+        if (!rolandChecksumValid(data + 4, size - 4)) {
+            ++rejectedCount;
+            dump("Roland checksum error", data, size);
+            return false;
+        }
+        family = Roland;
+        msg.deviceId = data[1];
+        msg.model = data[2];
+        msg.address = readAddress3(data + 4);
+        msg.payload = data + 7;
+        msg.payloadSize = size - 8;
+        return route(family, msg);
+
+    case 0x43: // Yamaha Parameter Change: 43 1n <model> <addr 3byte> <payload>
+        if (size < 6 || (data[1] & 0xF0) != 0x10) break;
+        family = Yamaha;
+        msg.deviceId = data[1] & 0x0F;
+        msg.model = data[2];
+        msg.address = readAddress3(data + 3);
+        msg.payload = data + 6;
+        msg.payloadSize = size - 6;
+        return route(family, msg);
+
+    case threeHSManufacturer: // 3HSPlug: 7D 33 48 <cmd> <payload> <checksum>
+        if (size < 5 || data[1] != threeHSSignature1 || data[2] != threeHSSignature2) break;
+        if (!rolandChecksumValid(data, size)) { // 7Dからチェックサムまでの合計の下位7bitが0
+            ++rejectedCount;
+            dump("3HSPlug checksum error", data, size);
+            return false;
+        }
+        family = ThreeHS;
+        msg.address = data[3];
+        msg.payload = data + 4;
+        msg.payloadSize = size - 5;
+        return route(family, msg);
+
+    default:
+        break;
+    }
+
+    ++unroutedCount;
+    dump("Unrouted", data, size);
+    return false;
+}
+
+bool SysExRouter::route(Family family, Message& msg) const {
+    bool addressMatched = false;
+    for (const auto& r : routes[family]) {
+        if (r.model != anyModel && r.model != msg.model) continue;
+        if ((msg.address & r.addressMask) != r.address) continue;
+        addressMatched = true;
+        if (msg.payloadSize < r.minPayload || msg.payloadSize > r.maxPayload) continue;
+        ++dispatchedCount;
+        r.handler(msg);
+        return true;
+    }
+    if (addressMatched) {
+        ++rejectedCount;
+        dump("Invalid length", msg.data, msg.size);
+    } else {
+        ++unroutedCount;
+        dump("Unrouted", msg.data, msg.size);
+    }
+    return false;
+}
+
+void SysExRouter::dump(const char* reason, const uint8_t* data, int size) const {
+    if (!logUnrouted) return;
+    printf("[SysEx] %s: ", reason);
+    for (int i = 0; i < size; ++i) {
+        printf("%02X ", data[i]);
+    }
+    printf("\n");
+}
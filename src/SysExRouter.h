@@ -0,0 +1,88 @@
+// SysExRouter.h
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * SysExディスパッチャ
+ * メーカーID → フォーマット（Universal / Roland / Yamaha / 3HSPlug）→ モデルID・アドレス の順に
+ * テーブルを引き、起動時に登録されたハンドラへ振り分ける。
+ * ヘッダ・ペイロード長・チェックサムはディスパッチ前に検証するので、ハンドラ側での長さチェックは不要。
+ * 1メッセージあたりのコストは、該当フォーマットに登録されたルート数（数個）の比較だけで済む。
+ *
+ * dispatch()に渡すバイト列はJUCEのgetSysExData()と同じく、先頭のF0と末尾のF7を含まない。
+ */
+class SysExRouter {
+public:
+    // 3HSPlug独自SysExのヘッダ（F0 7D 33 48 <cmd> <payload> <checksum> F7）
+    static constexpr uint8_t threeHSManufacturer = 0x7D;
+    static constexpr uint8_t threeHSSignature1 = 0x33;
+    static constexpr uint8_t threeHSSignature2 = 0x48;
+
+    static constexpr uint8_t anyModel = 0xFF;  // Roland/Yamahaルートで全モデルID（例: GS 0x42とSC-55 0x45）に一致
+
+    // ハンドラに渡される検証済みメッセージ
+    struct Message {
+        const uint8_t* data = nullptr;    // F0/F7を除いたSysEx全体
+        int size = 0;
+        uint8_t deviceId = 0;             // デバイスID（3HSPlugは0）
+        uint8_t model = 0;                // モデルID（Universalはサブ ID #1、3HSPlugは0）
+        uint32_t address = 0;             // Roland/Yamaha: 3バイトアドレス、Universal: サブID #2、3HSPlug: コマンド
+        const uint8_t* payload = nullptr; // アドレス（コマンド）の直後からチェックサムの手前まで
+        int payloadSize = 0;
+    };
+    using Handler = std::function<void(const Message&)>;
+
+    // ペイロード長の上限なし
+    static constexpr int unlimited = 0x7FFFFFFF;
+
+    // Universal Non-Real Time SysEx（F0 7E <dev> <sub1> <sub2> ... F7）
+    void addUniversalRoute(uint8_t subId1, uint8_t subId2, int minPayload, int maxPayload, Handler handler);
+    // Roland DT1（F0 41 <dev> <model> 12 <addr 3byte> <data> <sum> F7）。addressMaskで0のビットは任意
+    void addRolandRoute(uint8_t model, uint32_t address, uint32_t addressMask,
+                        int minPayload, int maxPayload, Handler handler);
+    // Yamaha パラメータチェンジ（F0 43 1n <model> <addr 3byte> <data> F7）
+    void addYamahaRoute(uint8_t model, uint32_t address, uint32_t addressMask,
+                        int minPayload, int maxPayload, Handler handler);
+    // 3HSPlug（F0 7D 33 48 <cmd> <payload> <checksum> F7）
+    void add3HSRoute(uint8_t command, int minPayload, int maxPayload, Handler handler);
+
+    // 登録済みのハンドラに振り分ける（処理された場合true）
+    bool dispatch(const uint8_t* data, int size) const;
+
+    // 未登録・不正なメッセージの内容をダンプするか（既定: 有効）
+    void setLogUnrouted(bool enabled) { logUnrouted = enabled; }
+
+    // 統計
+    uint32_t getDispatchedCount() const { return dispatchedCount; }
+    uint32_t getUnroutedCount() const { return unroutedCount; }
+    uint32_t getRejectedCount() const { return rejectedCount; }
+
+private:
+    enum Family { Universal = 0, Roland, Yamaha, ThreeHS, NumFamilies };
+
+    struct Route {
+        uint8_t model = 0;
+        uint32_t address = 0;
+        uint32_t addressMask = 0;
+        int minPayload = 0;
+        int maxPayload = unlimited;
+        Handler handler;
+    };
+
+    void addRoute(Family family, Route route);
+    bool route(Family family, Message& msg) const;
+    void dump(const char* reason, const uint8_t* data, int size) const;
+
+    // Rolandチェックサム: アドレス〜チェックサムの合計の下位7bitが0
+    static bool rolandChecksumValid(const uint8_t* from, int count);
+
+    std::array<std::vector<Route>, NumFamilies> routes;
+    bool logUnrouted = true;
+
+    mutable uint32_t dispatchedCount = 0;
+    mutable uint32_t unroutedCount = 0;
+    mutable uint32_t rejectedCount = 0;
+};
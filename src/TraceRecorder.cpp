@@ -0,0 +1,136 @@
+// TraceRecorder.cpp
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+std::array<TraceRecorder::ThreadBuffer, TRACE_MAX_THREADS> TraceRecorder::pool;
+std::atomic<bool> TraceRecorder::started{false};
+std::atomic<int> TraceRecorder::nextThreadId{1};
+std::mutex TraceRecorder::startMutex;
+
+void TraceRecorder::start() {
+    std::lock_guard<std::mutex> lock(startMutex);
+    if (started.load(std::memory_order_relaxed)) return;
+    for (auto& buffer : pool) {
+        buffer.events.reset(new Event[TRACE_RING_EVENTS]);
+    }
+    now(); // 記録の起点を決めておく
+    started.store(true, std::memory_order_release);
+    printf("[Trace] %d rings of %d events allocated\n", TRACE_MAX_THREADS, TRACE_RING_EVENTS);
+}
+
+uint64_t TraceRecorder::now() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+TraceRecorder::ThreadSlot::~ThreadSlot() {
+    if (buffer) buffer->inUse.store(false, std::memory_order_release);
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::currentThreadBuffer() {
+    // 最初に記録したときにプールから空いているリングを借りる（確保はstart()で済んでいる）
+    thread_local ThreadSlot slot;
+    if (slot.buffer || slot.full) return slot.buffer;
+    if (!started.load(std::memory_order_acquire)) return nullptr; // start()まで記録しない（次の記録で再試行）
+    // 終了したスレッドの記録がなるべく長く残るよう、前回貸し出したリングの次から探す
+    int startIndex = nextThreadId.load(std::memory_order_relaxed);
+    for (int i = 0; i < TRACE_MAX_THREADS; ++i) {
+        ThreadBuffer& buffer = pool[(startIndex + i) % TRACE_MAX_THREADS];
+        bool expected = false;
+        if (!buffer.inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) continue;
+        buffer.firstIndex.store(buffer.writeIndex.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        buffer.name.store(nullptr, std::memory_order_relaxed);
+        buffer.threadId.store(nextThreadId.fetch_add(1), std::memory_order_release);
+        slot.buffer = &buffer;
+        return slot.buffer;
+    }
+    slot.full = true;
+    printf("[Trace] Too many threads, tracing disabled for this thread\n");
+    return nullptr;
+}
+
+void TraceRecorder::record(const char* name, uint64_t beginNs, uint64_t endNs) {
+    ThreadBuffer* buffer = currentThreadBuffer();
+    if (!buffer) return;
+    uint64_t index = buffer->writeIndex.load(std::memory_order_relaxed);
+    Event& e = buffer->events[index % TRACE_RING_EVENTS];
+    e.name = name;
+    e.beginNs = beginNs;
+    e.endNs = endNs;
+    buffer->writeIndex.store(index + 1, std::memory_order_release);
+}
+
+void TraceRecorder::setThreadName(const char* name) {
+    ThreadBuffer* buffer = currentThreadBuffer();
+    if (buffer && buffer->name.load(std::memory_order_relaxed) == nullptr) {
+        buffer->name.store(name, std::memory_order_release);
+    }
+}
+
+// JSON文字列用のエスケープ（名前はリテラルなので通常は何もしない）
+static std::string escapeJson(const char* text) {
+    std::string out;
+    for (const char* p = text; p && *p; ++p) {
+        if (*p == '"' || *p == '\\') out += '\\';
+        out += *p;
+    }
+    return out;
+}
+
+bool TraceRecorder::dumpChromeTrace(const std::string& path, double seconds) {
+    uint64_t endNs = now();
+    uint64_t windowNs = static_cast<uint64_t>(std::max(0.0, seconds) * 1.0e9);
+    uint64_t startNs = endNs > windowNs ? endNs - windowNs : 0;
+
+    std::ofstream fout(path);
+    if (!fout) {
+        printf("[Trace] Failed to open %s\n", path.c_str());
+        return false;
+    }
+    fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    size_t written = 0;
+    std::vector<Event> copy;
+    char buf[256];
+    // 終了したスレッドのリングも、次のスレッドに貸し出されるまでは記録が残っているので書き出す
+    for (auto& pooled : pool) {
+        ThreadBuffer* buffer = &pooled;
+        int threadId = buffer->threadId.load(std::memory_order_acquire);
+        if (!buffer->events || threadId == 0) continue;
+
+        const char* threadName = buffer->name.load(std::memory_order_acquire);
+        std::snprintf(buf, sizeof(buf), "Thread %d", threadId);
+        fout << (first ? "" : ",\n")
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << threadId
+             << ", \"args\": {\"name\": \"" << escapeJson(threadName ? threadName : buf) << "\"}}";
+        first = false;
+
+        // 記録を止めずにコピーし、コピー中に上書きされた分は捨てる
+        uint64_t before = buffer->writeIndex.load(std::memory_order_acquire);
+        uint64_t oldest = before > TRACE_RING_EVENTS ? before - TRACE_RING_EVENTS : 0;
+        oldest = std::max(oldest, std::min(before, buffer->firstIndex.load(std::memory_order_relaxed)));
+        copy.clear();
+        copy.reserve(static_cast<size_t>(before - oldest));
+        for (uint64_t i = oldest; i < before; ++i) {
+            copy.push_back(buffer->events[i % TRACE_RING_EVENTS]);
+        }
+        uint64_t after = buffer->writeIndex.load(std::memory_order_acquire);
+        uint64_t overwritten = after > TRACE_RING_EVENTS ? after - TRACE_RING_EVENTS : 0;
+        size_t skip = overwritten > oldest ? static_cast<size_t>(std::min<uint64_t>(overwritten - oldest, copy.size())) : 0;
+
+        for (size_t i = skip; i < copy.size(); ++i) {
+            const Event& e = copy[i];
+            if (!e.name || e.endNs < startNs) continue;
+            std::snprintf(buf, sizeof(buf), ",\n{\"ph\": \"X\", \"cat\": \"3hs\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"name\": \"",
+                          threadId, e.beginNs / 1000.0, (e.endNs - e.beginNs) / 1000.0);
+            fout << buf << escapeJson(e.name) << "\"}";
+            ++written;
+        }
+    }
+    fout << "\n]}\n";
+    printf("[Trace] %zu events (last %.1f s) written to %s\n", written, seconds, path.c_str());
+    return true;
+}
@@ -0,0 +1,89 @@
+// TraceRecorder.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define ENABLE_TRACE_RECORDER 0 // タイムライントレースを記録するか（1で有効、0で無効。0ならTRACE_SCOPE等は何も生成しない）
+#define TRACE_RING_EVENTS (1 << 17)        // スレッドごとのリングバッファに残すイベント数（古いものから上書き、1本約3MB）
+#define TRACE_MAX_THREADS 16               // 同時に記録できるスレッド数（リングの数。空きが無いスレッドは記録しない）
+#define TRACE_DUMP_SECONDS 10              // 書き出す範囲（直近の秒数）
+#define TRACE_JSON_FILE_NAME "trace.json"  // エディタのTraceボタンで書き出すファイル
+
+/**
+ * 実機で重いプロファイラを使わずに、スレッドをまたいだ処理のタイムラインを見るためのトレース記録
+ *
+ * TRACE_SCOPE("名前") を置いたスコープの開始・終了時刻を、スレッドごとのリングバッファに1イベントとして書き込む。
+ * 書き込むのはそのスレッドだけで、ロックもメモリ確保も無い。リングはstart()でまとめて確保したプールから
+ * スレッドが最初に記録したときに1本借り、スレッドの終了時に返す（start()より前の記録は捨てる）。
+ * dumpChromeTrace() で直近の範囲をChrome Trace Event形式（chrome://tracing / Perfetto で開ける）のJSONに書き出す。
+ * 名前は文字列リテラルなど、プログラムの終了まで有効なポインタであること。
+ */
+class TraceRecorder {
+public:
+    class Scope {
+    public:
+        explicit Scope(const char* name) : name(name), beginNs(now()) {}
+        ~Scope() { record(name, beginNs, now()); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* name;
+        uint64_t beginNs;
+    };
+
+    // リングのプールを確保する（prepareToPlayから呼ぶ。2回目以降は何もしない）
+    static void start();
+    // 記録の起点からの経過時間（ナノ秒）
+    static uint64_t now();
+    static void record(const char* name, uint64_t beginNs, uint64_t endNs);
+    // 呼び出したスレッドの表示名（未設定のときだけ設定する。毎ブロック呼んでもよい）
+    static void setThreadName(const char* name);
+
+    // 直近secondsの範囲を書き出す（他のスレッドの記録は止めない）
+    static bool dumpChromeTrace(const std::string& path, double seconds = TRACE_DUMP_SECONDS);
+
+private:
+    struct Event {
+        const char* name = nullptr;
+        uint64_t beginNs = 0;
+        uint64_t endNs = 0;
+    };
+
+    struct ThreadBuffer {
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> writeIndex{0};
+        std::atomic<uint64_t> firstIndex{0};    // 今のスレッドが借りたときの位置（前のスレッドの記録は書き出さない）
+        std::atomic<const char*> name{nullptr};
+        std::atomic<int> threadId{0};           // 0: まだ一度も使われていない
+        std::atomic<bool> inUse{false};
+    };
+
+    // スレッドが借りているリング（スレッドの終了時にデストラクタでプールへ返す）
+    struct ThreadSlot {
+        ThreadBuffer* buffer = nullptr;
+        bool full = false;
+        ~ThreadSlot();
+    };
+
+    static ThreadBuffer* currentThreadBuffer();
+
+    static std::array<ThreadBuffer, TRACE_MAX_THREADS> pool;
+    static std::atomic<bool> started;
+    static std::atomic<int> nextThreadId;
+    static std::mutex startMutex;
+};
+
+#if ENABLE_TRACE_RECORDER
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceRecorder::Scope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) TraceRecorder::setThreadName(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
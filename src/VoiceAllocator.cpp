@@ -0,0 +1,407 @@
+// VoiceAllocator.cpp
+#include "VoiceAllocator.h"
+#include <algorithm>
+#include <cstdio>
+
+VoiceAllocator::VoiceAllocator() {
+    reset(0);
+}
+
+void VoiceAllocator::reset(int newNumVoices, int newVoicesPerChip) {
+    if (newNumVoices < 0) newNumVoices = 0;
+    if (newNumVoices > maxVoices) newNumVoices = maxVoices;
+    if (newVoicesPerChip < 1) newVoicesPerChip = 1;
+    numVoices = newNumVoices;
+    voicesPerChip = newVoicesPerChip;
+    numChips = (numVoices + voicesPerChip - 1) / voicesPerChip;
+    if (numChips > maxChips) numChips = maxChips;
+    rollingIndex = 0;
+    enabledChips = numChips;
+    enabledVoices = numVoices;
+    drainTopChip = false;
+
+    freeMask.clear();
+    dormantMask.clear();
+    releasingMask.clear();
+    activeMask.clear();
+    for (int v = 0; v < numVoices; ++v) {
+        freeMask.set(v);
+    }
+    for (int ch = 0; ch < numMidiChannels; ++ch) {
+        channelActive[ch].clear();
+        channelOwned[ch].clear();
+    }
+
+    noteHead.fill(-1);
+    noteTail.fill(-1);
+    noteNext.fill(-1);
+    notePrev.fill(-1);
+    voiceKey.fill(-1);
+    voiceOwner.fill(-1);
+    releaseLevel.fill(0.0f);
+    voiceCost.fill(0);
+    chipLoad.fill(0);
+    for (int chip = 0; chip < maxChips; ++chip) {
+        chipVoices[chip].clear();
+    }
+    for (int v = 0; v < numVoices; ++v) {
+        int chip = v / voicesPerChip;
+        if (chip < maxChips) chipVoices[chip].set(v);
+    }
+
+    lruHead = -1;
+    lruTail = -1;
+    lruNext.fill(-1);
+    lruPrev.fill(-1);
+}
+
+int VoiceAllocator::chooseVoice(int midiChannel, int note) {
+    if (numVoices <= 0) return -1;
+
+    if (strategy == Strategy::Rolling) {
+        // ホールド中の同一ノートが鳴っていれば、そのボイスを再利用（ローリングインデックスは進めない）
+        if (isHeld(midiChannel, note)) {
+            int held = firstVoiceFor(midiChannel, note);
+            if (held >= 0 && !dormantMask.test(held)) {
+                printf("[Voice] Rolling allocation: Note %d on channel %d is already held, reusing slot %d\n",
+                       note, midiChannel, held);
+                return held;
+            }
+        }
+
+        // 発音終了したボイスをローリングインデックスから探す
+        int voice = candidateVoices().findFirstCyclic(rollingIndex);
+        if (voice < 0) {
+            voice = quietestReleasingVoice();
+        }
+        if (voice < 0) {
+            voice = oldestStealableVoice();
+            if (voice < 0) voice = rollingIndex;
+            printf("[Voice] Rolling allocation: No free voice slots available, stealing oldest slot %d\n", voice);
+        }
+        rollingIndex = (rollingIndex + 1) % (enabledVoices > 0 ? enabledVoices : numVoices);
+        return voice;
+    }
+
+    if (strategy == Strategy::LoadBalanced) {
+        // ホールド中の同一ノートが鳴っていれば、そのボイスを再利用
+        if (isHeld(midiChannel, note)) {
+            int held = firstVoiceFor(midiChannel, note);
+            if (held >= 0 && !dormantMask.test(held)) {
+                return held;
+            }
+        }
+
+        int voice = chooseBalancedVoice(midiChannel, candidateVoices());
+        if (voice < 0) {
+            voice = quietestReleasingVoice();
+        }
+        if (voice < 0) {
+            voice = oldestStealableVoice();
+            if (voice < 0) voice = 0;
+            printf("[Voice] Load-balanced allocation: No free voice slots available, stealing oldest slot %d\n", voice);
+        }
+        return voice;
+    }
+
+    // OldestFirst: 同一ノートが鳴っていれば再利用
+    int same = firstVoiceFor(midiChannel, note);
+    if (same >= 0 && !dormantMask.test(same)) {
+        if (isHeld(midiChannel, note)) {
+            printf("[Voice] Note %d on channel %d is already held, reusing voice slot %d\n", note, midiChannel, same);
+        } else {
+            printf("[Voice] Note %d on channel %d is already playing, reusing voice slot %d (Did you forget a note-off?)\n",
+                   note, midiChannel, same);
+        }
+        return same;
+    }
+
+    // 発音終了したボイスを探す
+    int freeVoice = candidateVoices().findFirstFrom(0);
+    if (freeVoice >= 0) {
+        return freeVoice;
+    }
+
+    // 次に最も音量の小さいリリース中ボイス
+    int releasing = quietestReleasingVoice();
+    if (releasing >= 0) {
+        return releasing;
+    }
+
+    // 空きが無ければ最も古いボイスを奪う
+    int oldest = oldestStealableVoice();
+    printf("[Voice] No free voice slots, stealing oldest slot %d\n", oldest);
+    return oldest >= 0 ? oldest : 0;
+}
+
+void VoiceAllocator::resize(int newNumVoices) {
+    if (newNumVoices < 0) newNumVoices = 0;
+    if (newNumVoices > maxVoices) newNumVoices = maxVoices;
+    for (int v = newNumVoices; v < numVoices; ++v) {
+        clearOwner(v);
+        freeMask.reset(v);
+    }
+    for (int v = numVoices; v < newNumVoices; ++v) {
+        freeMask.set(v);
+        releasingMask.reset(v);
+        activeMask.reset(v);
+        voiceOwner[v] = -1;
+        releaseLevel[v] = 0.0f;
+        voiceCost[v] = 0;
+    }
+    numVoices = newNumVoices;
+    numChips = (numVoices + voicesPerChip - 1) / voicesPerChip;
+    if (numChips > maxChips) numChips = maxChips;
+    for (int chip = 0; chip < maxChips; ++chip) {
+        chipVoices[chip].clear();
+        if (chip >= numChips) chipLoad[chip] = 0;
+    }
+    for (int v = 0; v < numVoices; ++v) {
+        chipVoices[v / voicesPerChip].set(v);
+    }
+    enabledChips = numChips;
+    enabledVoices = numVoices;
+    drainTopChip = false;
+    dormantMask.clear();
+    if (rollingIndex >= numVoices) rollingIndex = 0;
+}
+
+void VoiceAllocator::setEnabledChips(int chips, bool drainTop) {
+    if (chips < 1) chips = 1;
+    if (chips > numChips) chips = numChips;
+    enabledChips = chips;
+    drainTopChip = drainTop;
+    enabledVoices = std::min(numVoices, chips * voicesPerChip);
+    dormantMask.clear();
+    for (int v = enabledVoices; v < numVoices; ++v) {
+        dormantMask.set(v);
+    }
+    if (rollingIndex >= enabledVoices) rollingIndex = 0;
+}
+
+BitSet128 VoiceAllocator::candidateVoices() const {
+    BitSet128 finished = finishedVoices();
+    if (drainTopChip && enabledChips > 1) {
+        BitSet128 lower = finished.without(chipVoices[enabledChips - 1]);
+        if (lower.any()) return lower;
+    }
+    return finished;
+}
+
+bool VoiceAllocator::isChipIdle(int chip) const {
+    if (chip < 0 || chip >= maxChips) return true;
+    const BitSet128& voices = chipVoices[chip];
+    return ((activeMask.words[0] | releasingMask.words[0]) & voices.words[0]) == 0
+        && ((activeMask.words[1] | releasingMask.words[1]) & voices.words[1]) == 0;
+}
+
+int VoiceAllocator::chooseBalancedVoice(int midiChannel, const BitSet128& finished) const {
+    const BitSet128& channelVoices = activeVoicesOf(midiChannel);
+    int bestChip = -1;
+    int bestRank = 0;
+    int bestLoad = 0;
+    for (int chip = 0; chip < numChips; ++chip) {
+        const BitSet128& voices = chipVoices[chip];
+        bool hasFinished = (finished.words[0] & voices.words[0]) | (finished.words[1] & voices.words[1]);
+        if (!hasFinished) continue;
+
+        // アフィニティ有効時: 同じチャンネルが鳴っているチップ → 稼働中のチップ → 休止中のチップ の順
+        int rank = 0;
+        if (channelAffinity) {
+            bool hasChannel = (channelVoices.words[0] & voices.words[0]) | (channelVoices.words[1] & voices.words[1]);
+            rank = hasChannel ? 0 : (chipLoad[chip] > 0 ? 1 : 2);
+        }
+        if (bestChip < 0 || rank < bestRank || (rank == bestRank && chipLoad[chip] < bestLoad)) {
+            bestChip = chip;
+            bestRank = rank;
+            bestLoad = chipLoad[chip];
+        }
+    }
+    if (bestChip < 0) return -1;
+    return finished.findFirstFrom(bestChip * voicesPerChip);
+}
+
+void VoiceAllocator::uncountVoice(int voice) {
+    int chip = voice / voicesPerChip;
+    if (chip < maxChips) {
+        chipLoad[chip] -= voiceCost[voice];
+    }
+    voiceCost[voice] = 0;
+}
+
+int VoiceAllocator::quietestReleasingVoice() const {
+    int quietest = -1;
+    float minLevel = 2.0f;
+    // 休止中（外す途中）のチップのボイスは奪わない（鳴り終わるのを待っているので）
+    releasingMask.without(dormantMask).forEach([&](int v) {
+        if (releaseLevel[v] < minLevel) {
+            minLevel = releaseLevel[v];
+            quietest = v;
+        }
+    });
+    return quietest;
+}
+
+int VoiceAllocator::oldestStealableVoice() const {
+    for (int v = lruHead; v >= 0; v = lruNext[v]) {
+        if (!dormantMask.test(v)) return v;
+    }
+    return -1;
+}
+
+void VoiceAllocator::updateRelease(int voice, bool finished, float level) {
+    if (voice < 0 || voice >= numVoices || !releasingMask.test(voice)) return;
+    if (finished) {
+        releasingMask.reset(voice);
+        releaseLevel[voice] = 0.0f;
+        uncountVoice(voice);
+    } else {
+        releaseLevel[voice] = level;
+    }
+}
+
+void VoiceAllocator::assign(int voice, int midiChannel, int note, int cost) {
+    if (voice < 0 || voice >= numVoices || !validKey(midiChannel, note)) return;
+
+    if (activeMask.test(voice)) {
+        unlinkNote(voice);
+        unlinkLru(voice);
+        channelActive[voiceOwner[voice]].reset(voice);
+    }
+    if (voiceOwner[voice] >= 0) {
+        channelOwned[voiceOwner[voice]].reset(voice);
+    }
+
+    voiceOwner[voice] = static_cast<int8_t>(midiChannel);
+    channelOwned[midiChannel].set(voice);
+    channelActive[midiChannel].set(voice);
+    activeMask.set(voice);
+    freeMask.reset(voice);
+    releasingMask.reset(voice);
+
+    uncountVoice(voice);
+    int chip = voice / voicesPerChip;
+    if (chip < maxChips) {
+        voiceCost[voice] = static_cast<int16_t>(cost);
+        chipLoad[chip] += cost;
+    }
+
+    linkNote(voice, keyOf(midiChannel, note));
+    linkLru(voice);
+}
+
+void VoiceAllocator::release(int voice) {
+    if (voice < 0 || voice >= numVoices || !activeMask.test(voice)) return;
+
+    unlinkNote(voice);
+    unlinkLru(voice);
+    channelActive[voiceOwner[voice]].reset(voice);
+    activeMask.reset(voice);
+    freeMask.set(voice);
+    releasingMask.set(voice);
+    releaseLevel[voice] = 1.0f; // 次のupdateRelease()までは最大レベルとみなす
+}
+
+void VoiceAllocator::clearOwner(int voice) {
+    if (voice < 0 || voice >= numVoices) return;
+
+    release(voice);
+    releasingMask.reset(voice); // 音量0で即座に無音化されるのでリリースの余韻は無い
+    releaseLevel[voice] = 0.0f;
+    uncountVoice(voice);
+    if (voiceOwner[voice] >= 0) {
+        channelOwned[voiceOwner[voice]].reset(voice);
+        voiceOwner[voice] = -1;
+    }
+}
+
+int VoiceAllocator::firstVoiceFor(int midiChannel, int note) const {
+    if (!validKey(midiChannel, note)) return -1;
+    return noteHead[keyOf(midiChannel, note)];
+}
+
+int VoiceAllocator::lastVoiceFor(int midiChannel, int note) const {
+    if (!validKey(midiChannel, note)) return -1;
+    return noteTail[keyOf(midiChannel, note)];
+}
+
+const BitSet128& VoiceAllocator::activeVoicesOf(int midiChannel) const {
+    return validChannel(midiChannel) ? channelActive[midiChannel] : emptySet;
+}
+
+const BitSet128& VoiceAllocator::ownedVoicesOf(int midiChannel) const {
+    return validChannel(midiChannel) ? channelOwned[midiChannel] : emptySet;
+}
+
+void VoiceAllocator::holdNote(int midiChannel, int note) {
+    if (!validKey(midiChannel, note)) return;
+    heldNotes[midiChannel].set(note);
+}
+
+bool VoiceAllocator::isHeld(int midiChannel, int note) const {
+    if (!validKey(midiChannel, note)) return false;
+    return heldNotes[midiChannel].test(note);
+}
+
+const BitSet128& VoiceAllocator::heldNotesOf(int midiChannel) const {
+    return validChannel(midiChannel) ? heldNotes[midiChannel] : emptySet;
+}
+
+void VoiceAllocator::clearHeld(int midiChannel) {
+    if (!validChannel(midiChannel)) return;
+    heldNotes[midiChannel].clear();
+}
+
+void VoiceAllocator::clearAllHeld() {
+    for (auto& held : heldNotes) {
+        held.clear();
+    }
+}
+
+void VoiceAllocator::linkNote(int voice, int key) {
+    voiceKey[voice] = static_cast<int16_t>(key);
+    notePrev[voice] = noteTail[key];
+    noteNext[voice] = -1;
+    if (noteTail[key] >= 0) {
+        noteNext[noteTail[key]] = static_cast<int16_t>(voice);
+    } else {
+        noteHead[key] = static_cast<int16_t>(voice);
+    }
+    noteTail[key] = static_cast<int16_t>(voice);
+}
+
+void VoiceAllocator::unlinkNote(int voice) {
+    int key = voiceKey[voice];
+    if (key < 0) return;
+    int prev = notePrev[voice];
+    int next = noteNext[voice];
+    if (prev >= 0) noteNext[prev] = static_cast<int16_t>(next);
+    else noteHead[key] = static_cast<int16_t>(next);
+    if (next >= 0) notePrev[next] = static_cast<int16_t>(prev);
+    else noteTail[key] = static_cast<int16_t>(prev);
+    notePrev[voice] = -1;
+    noteNext[voice] = -1;
+    voiceKey[voice] = -1;
+}
+
+void VoiceAllocator::linkLru(int voice) {
+    lruPrev[voice] = lruTail;
+    lruNext[voice] = -1;
+    if (lruTail >= 0) {
+        lruNext[lruTail] = static_cast<int16_t>(voice);
+    } else {
+        lruHead = static_cast<int16_t>(voice);
+    }
+    lruTail = static_cast<int16_t>(voice);
+}
+
+void VoiceAllocator::unlinkLru(int voice) {
+    int prev = lruPrev[voice];
+    int next = lruNext[voice];
+    if (prev >= 0) lruNext[prev] = static_cast<int16_t>(next);
+    else lruHead = static_cast<int16_t>(next);
+    if (next >= 0) lruPrev[next] = static_cast<int16_t>(prev);
+    else lruTail = static_cast<int16_t>(prev);
+    lruPrev[voice] = -1;
+    lruNext[voice] = -1;
+}
@@ -0,0 +1,268 @@
+// VoiceAllocator.h
+#pragma once
+#include <array>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// 64bit値の下位から数えた0の個数（v != 0 前提）
+inline int countTrailingZeros64(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+inline int popCount64(uint64_t v) {
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(v));
+#else
+    return __builtin_popcountll(v);
+#endif
+}
+
+// 128bit固定長ビット集合（最大16チップ x 8ボイス、MIDIノート0-127をカバー）
+struct BitSet128 {
+    uint64_t words[2] = {0, 0};
+
+    void set(int i) { words[i >> 6] |= (uint64_t)1 << (i & 63); }
+    void reset(int i) { words[i >> 6] &= ~((uint64_t)1 << (i & 63)); }
+    bool test(int i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    bool any() const { return (words[0] | words[1]) != 0; }
+    void clear() { words[0] = 0; words[1] = 0; }
+    int count() const { return popCount64(words[0]) + popCount64(words[1]); }
+
+    // this & ~other
+    BitSet128 without(const BitSet128& other) const {
+        BitSet128 result;
+        result.words[0] = words[0] & ~other.words[0];
+        result.words[1] = words[1] & ~other.words[1];
+        return result;
+    }
+
+    // start以降で最初に立っているビット（なければ-1）
+    int findFirstFrom(int start) const {
+        if (start < 0) start = 0;
+        if (start >= 128) return -1;
+        int wi = start >> 6;
+        uint64_t w = words[wi] & (~(uint64_t)0 << (start & 63));
+        while (true) {
+            if (w) return wi * 64 + countTrailingZeros64(w);
+            if (++wi >= 2) return -1;
+            w = words[wi];
+        }
+    }
+
+    // startから循環的に探索（startより後ろに無ければ先頭から）
+    int findFirstCyclic(int start) const {
+        int found = findFirstFrom(start);
+        if (found < 0 && start > 0) {
+            found = findFirstFrom(0);
+        }
+        return found;
+    }
+
+    // 立っているビットを昇順に列挙（呼び出し時点のスナップショットを走査するので、f内で集合を変更してもよい）
+    template <typename F>
+    void forEach(F&& f) const {
+        for (int wi = 0; wi < 2; ++wi) {
+            uint64_t w = words[wi];
+            while (w) {
+                int bit = countTrailingZeros64(w);
+                w &= w - 1;
+                f(wi * 64 + bit);
+            }
+        }
+    }
+};
+
+// モジュレーションモードごとの推定レンダリングコスト（相対値）
+// どのモードも8オペレータを計算するが、直列のFMチェーンほど依存関係が長く重い
+inline constexpr uint8_t modModeRenderCost[13] = {
+     8, //  0: Additive
+     9, //  1: 4x2OP FM
+     9, //  2: 4x2 RingMod
+    10, //  3: 2x4OP FM
+    12, //  4: 8OP FM
+    10, //  5: 4OP FM x2
+     9, //  6: 2OP FM x4
+    10, //  7: 4OP FMxRM x2
+    10, //  8: 2x4 RingMod
+     9, //  9: 2OP FMxRM x4
+     8, // 10: 2OP DirectPhase
+    10, // 11: 4OP DirectPhase
+    12, // 12: 8OP DirectPhase
+};
+inline int getModModeRenderCost(int modmode) {
+    return (modmode >= 0 && modmode < 13) ? modModeRenderCost[modmode] : 12;
+}
+
+/**
+ * FM音源ボイスのアロケータ
+ * (MIDIチャンネル, ノート) → ボイスリストの索引、空きボイス集合、LRU順序を保持し、
+ * ノートON/OFF・サスティン解放・CC更新でボイス全体を走査しなくて済むようにする。
+ * 割り当てコストはチップ数に依存しない（128bit集合のビット探索のみ）。
+ *
+ * 空きボイスは「リリース中（まだ余韻が鳴っている）」と「発音終了」に分けて管理し、
+ * 新規ノートには 発音終了 → 最も音量の小さいリリース中 → 最も古い発音中 の順で割り当てる。
+ * リリース状態は音源側のエンベロープから1ブロックに1回 updateRelease() で更新する。
+ *
+ * LoadBalanced戦略では、チップごとに鳴っているボイス（リリース中を含む）の推定コストを集計し、
+ * 最も負荷の低いチップの発音終了ボイスへ割り当てる。チャンネルアフィニティを有効にすると、
+ * 同じMIDIチャンネルのボイスをなるべく同じチップにまとめ、未使用チップを休ませる。
+ *
+ * setEnabledChips()で先頭から指定数のチップだけを割り当て対象にできる（それ以降のチップは休止中で、
+ * 割り当てられることはない）。伸縮ポリフォニーでは発音終了ボイスが無くなったらチップを増やし、
+ * isChipIdle()になったチップを休止させる。drainTopChipを指定すると、割り当て対象の最後のチップは
+ * 他のチップに発音終了ボイスが無いときだけ使い、負荷が下がったら空になって休止できるようにする。
+ */
+class VoiceAllocator {
+public:
+    static constexpr int maxVoices = 128;       // 16チップ x 8ボイス
+    static constexpr int numMidiChannels = 17;  // 1-16（0は未割当扱い）
+    static constexpr int maxChips = 16;
+
+    enum class Strategy {
+        Rolling = 0,     // ローリング戦略: 常に次のスロットから空きを探す
+        OldestFirst = 1, // 従来戦略: 同一ノート再利用 → 先頭の空き → 最も古いボイス
+        LoadBalanced = 2 // チップ負荷分散: 推定コストが最も低いチップの空きを使う
+    };
+
+    VoiceAllocator();
+
+    // ボイス数（とチップあたりのボイス数）を設定し、全ボイスを空きにする
+    void reset(int numVoices, int voicesPerChip = 8);
+    // ボイス数を変更する（残るボイスの状態は保持し、外れるボイスはclearOwner()して捨てる）。割り当て対象は全チップに戻る
+    void resize(int numVoices);
+    int getNumVoices() const { return numVoices; }
+
+    void setStrategy(Strategy s) { strategy = s; }
+    Strategy getStrategy() const { return strategy; }
+    void resetRollingIndex() { rollingIndex = 0; }
+
+    // 割り当て対象にするチップ数（先頭から。reset()で全チップに戻る）
+    void setEnabledChips(int chips, bool drainTopChip = false);
+    int getEnabledChips() const { return enabledChips; }
+    // 割り当て対象のチップに発音終了ボイス（奪わずに使えるボイス）があるか
+    bool hasFinishedVoice() const { return finishedVoices().any(); }
+    // チップに発音中・リリース中のボイスが無いか
+    bool isChipIdle(int chip) const;
+
+    // LoadBalanced戦略で同じMIDIチャンネルのボイスを同じチップにまとめるか
+    void setChannelAffinity(bool enabled) { channelAffinity = enabled; }
+    bool getChannelAffinity() const { return channelAffinity; }
+
+    // 新規ノートON用のボイスを選択する（割り当て自体はassign()で行う）
+    int chooseVoice(int midiChannel, int note);
+
+    // ボイスを(ch, note)に割り当てる（使用中ボイスの場合は奪い取る）。costは推定レンダリングコスト
+    void assign(int voice, int midiChannel, int note, int cost = 1);
+    // ゲートOFF: 索引から外しリリース中の空きボイスにする（所有チャンネルは保持）
+    void release(int voice);
+    // 無音化: 解放した上で所有チャンネルも解除する
+    void clearOwner(int voice);
+
+    bool isActive(int voice) const { return activeMask.test(voice); }
+    bool isReleasing(int voice) const { return releasingMask.test(voice); }
+
+    // リリース中ボイスの状態更新（finishedなら発音終了扱いにする）
+    void updateRelease(int voice, bool finished, float level);
+
+    // (ch, note)で発音中のボイス（無ければ-1）。first = 最も古い、last = 最も新しい
+    int firstVoiceFor(int midiChannel, int note) const;
+    int lastVoiceFor(int midiChannel, int note) const;
+
+    // (ch, note)で発音中のボイスを古い順に列挙（f内でrelease()してもよい）
+    template <typename F>
+    void forEachVoiceFor(int midiChannel, int note, F&& f) const {
+        if (!validKey(midiChannel, note)) return;
+        int v = noteHead[keyOf(midiChannel, note)];
+        while (v >= 0) {
+            int next = noteNext[v];
+            f(v);
+            v = next;
+        }
+    }
+
+    const BitSet128& activeVoices() const { return activeMask; }
+    const BitSet128& freeVoices() const { return freeMask; }
+    const BitSet128& releasingVoices() const { return releasingMask; }
+    // チップの推定負荷（発音中・リリース中ボイスのコスト合計）
+    int getChipLoad(int chip) const { return (chip >= 0 && chip < maxChips) ? chipLoad[chip] : 0; }
+    const BitSet128& activeVoicesOf(int midiChannel) const;
+    // 解放済み（リリース中）も含め、最後にそのチャンネルへ割り当てられたボイス
+    const BitSet128& ownedVoicesOf(int midiChannel) const;
+
+    // サスティンペダルでホールド中のノート（チャンネルごとの128bit集合）
+    void holdNote(int midiChannel, int note);
+    bool isHeld(int midiChannel, int note) const;
+    const BitSet128& heldNotesOf(int midiChannel) const;
+    void clearHeld(int midiChannel);
+    void clearAllHeld();
+
+private:
+    static int keyOf(int midiChannel, int note) { return midiChannel * 128 + note; }
+    static bool validKey(int midiChannel, int note) {
+        return midiChannel >= 0 && midiChannel < numMidiChannels && note >= 0 && note < 128;
+    }
+    static bool validChannel(int midiChannel) { return midiChannel >= 0 && midiChannel < numMidiChannels; }
+
+    void linkNote(int voice, int key);
+    void unlinkNote(int voice);
+    void linkLru(int voice);
+    void unlinkLru(int voice);
+
+    int numVoices = 0;
+    int voicesPerChip = 8;
+    int numChips = 0;
+    int enabledChips = 0;
+    int enabledVoices = 0;
+    bool drainTopChip = false;
+    Strategy strategy = Strategy::Rolling;
+    int rollingIndex = 0;
+    bool channelAffinity = false;
+
+    // 割り当て対象のチップの発音終了ボイス
+    BitSet128 finishedVoices() const { return freeMask.without(releasingMask).without(dormantMask); }
+    // 新規ノートの割り当て候補（drainTopChip時は最後のチップを後回しにする）
+    BitSet128 candidateVoices() const;
+    // 割り当て対象のチップで最も音量の小さいリリース中ボイス（なければ-1）
+    int quietestReleasingVoice() const;
+    // 割り当て対象のチップで最も古い発音中ボイス（LRUの先頭から休止中のボイスを飛ばす。なければ-1）
+    int oldestStealableVoice() const;
+    // LoadBalanced戦略: 負荷の最も低いチップの発音終了ボイス（なければ-1）
+    int chooseBalancedVoice(int midiChannel, const BitSet128& finished) const;
+    // ボイスのコストをチップ負荷から外す（発音終了・無音化時）
+    void uncountVoice(int voice);
+
+    BitSet128 freeMask;       // ゲートOFFのボイス（リリース中 + 発音終了）
+    BitSet128 releasingMask;  // freeMaskのうち余韻がまだ鳴っているボイス
+    BitSet128 activeMask;
+    BitSet128 dormantMask;    // 休止中のチップのボイス
+    std::array<BitSet128, numMidiChannels> channelActive;
+    std::array<BitSet128, numMidiChannels> channelOwned;
+    std::array<BitSet128, numMidiChannels> heldNotes;
+    BitSet128 emptySet;
+
+    // (ch, note) → ボイスの侵入型双方向リスト（ノートON順）
+    std::array<int16_t, numMidiChannels * 128> noteHead;
+    std::array<int16_t, numMidiChannels * 128> noteTail;
+    std::array<int16_t, maxVoices> noteNext;
+    std::array<int16_t, maxVoices> notePrev;
+    std::array<int16_t, maxVoices> voiceKey;
+    std::array<int8_t, maxVoices> voiceOwner;
+    std::array<float, maxVoices> releaseLevel;  // リリース中ボイスのエンベロープレベル
+    std::array<int16_t, maxVoices> voiceCost;   // 負荷に計上中のコスト（0 = 計上なし）
+    std::array<BitSet128, maxChips> chipVoices; // チップごとのボイス集合
+    std::array<int, maxChips> chipLoad;
+
+    // 使用中ボイスのLRU順序（先頭が最も古い）
+    int16_t lruHead = -1;
+    int16_t lruTail = -1;
+    std::array<int16_t, maxVoices> lruNext;
+    std::array<int16_t, maxVoices> lruPrev;
+};
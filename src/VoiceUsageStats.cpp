@@ -0,0 +1,171 @@
+// VoiceUsageStats.cpp
+#include "VoiceUsageStats.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+void VoiceUsageStats::clear() {
+    for (auto& h : fmHistogram) h.store(0, std::memory_order_relaxed);
+    for (auto& h : pcmHistogram) h.store(0, std::memory_order_relaxed);
+    for (auto& p : peakFm) p.store(0, std::memory_order_relaxed);
+    for (auto& p : peakPcm) p.store(0, std::memory_order_relaxed);
+    for (auto* c : { &totalSamples, &fmNotes, &fmRetriggers, &fmStealsHeld, &fmStealsReleasing, &drumHits,
+                     &drumReuses, &drumSteals, &drumAudibleSteals, &fmAllBusySamples, &pcmAllBusySamples }) {
+        c->store(0, std::memory_order_relaxed);
+    }
+}
+
+void VoiceUsageStats::recordBlock(int numSamples, int fmSounding, int fmCapacity, int pcmInUse, int pcmCapacity,
+                                  const std::array<int, 16>& fmPerChannel, const std::array<int, 16>& pcmPerChannel) {
+    if (resetRequested.exchange(false)) {
+        clear();
+    }
+    if (numSamples <= 0) return;
+    uint64_t samples = static_cast<uint64_t>(numSamples);
+    add(fmHistogram[std::clamp(fmSounding, 0, maxFmVoices)], samples);
+    add(pcmHistogram[std::clamp(pcmInUse, 0, maxPcmChannels)], samples);
+    add(totalSamples, samples);
+    if (fmCapacity > 0 && fmSounding >= fmCapacity) add(fmAllBusySamples, samples);
+    if (pcmCapacity > 0 && pcmInUse >= pcmCapacity) add(pcmAllBusySamples, samples);
+    for (int i = 0; i < 16; ++i) {
+        if (fmPerChannel[i] > peakFm[i].load(std::memory_order_relaxed)) peakFm[i].store(fmPerChannel[i], std::memory_order_relaxed);
+        if (pcmPerChannel[i] > peakPcm[i].load(std::memory_order_relaxed)) peakPcm[i].store(pcmPerChannel[i], std::memory_order_relaxed);
+    }
+}
+
+void VoiceUsageStats::countFmNote(bool retrigger, bool stoleHeld, bool stoleReleasing) {
+    add(fmNotes, 1);
+    if (retrigger) {
+        add(fmRetriggers, 1);
+    } else if (stoleHeld) {
+        add(fmStealsHeld, 1);
+    } else if (stoleReleasing) {
+        add(fmStealsReleasing, 1);
+    }
+}
+
+void VoiceUsageStats::countDrumHit(bool reused, bool stolen, bool audible) {
+    add(drumHits, 1);
+    if (reused) add(drumReuses, 1);
+    if (stolen) {
+        add(drumSteals, 1);
+        if (audible) add(drumAudibleSteals, 1);
+    }
+}
+
+VoiceUsageStats::Occupancy VoiceUsageStats::summarize(const std::atomic<uint64_t>* histogram, int size) {
+    Occupancy o;
+    uint64_t snapshot[maxFmVoices + 1] = {};
+    uint64_t total = 0;
+    double weighted = 0.0;
+    for (int i = 0; i < size; ++i) {
+        snapshot[i] = histogram[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+        weighted += static_cast<double>(i) * snapshot[i];
+        if (snapshot[i] > 0) o.max = i;
+    }
+    if (total == 0) return o;
+    auto percentile = [&](double q) {
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(total) + 0.5));
+        uint64_t cumulative = 0;
+        for (int i = 0; i < size; ++i) {
+            cumulative += snapshot[i];
+            if (cumulative >= target) return i;
+        }
+        return size - 1;
+    };
+    o.samples = total;
+    o.mean = weighted / static_cast<double>(total);
+    o.p50 = percentile(0.50);
+    o.p90 = percentile(0.90);
+    o.p99 = percentile(0.99);
+    return o;
+}
+
+VoiceUsageStats::Counters VoiceUsageStats::getCounters() const {
+    Counters c;
+    c.totalSamples = totalSamples.load(std::memory_order_relaxed);
+    c.fmNotes = fmNotes.load(std::memory_order_relaxed);
+    c.fmRetriggers = fmRetriggers.load(std::memory_order_relaxed);
+    c.fmStealsHeld = fmStealsHeld.load(std::memory_order_relaxed);
+    c.fmStealsReleasing = fmStealsReleasing.load(std::memory_order_relaxed);
+    c.drumHits = drumHits.load(std::memory_order_relaxed);
+    c.drumReuses = drumReuses.load(std::memory_order_relaxed);
+    c.drumSteals = drumSteals.load(std::memory_order_relaxed);
+    c.drumAudibleSteals = drumAudibleSteals.load(std::memory_order_relaxed);
+    c.fmAllBusySamples = fmAllBusySamples.load(std::memory_order_relaxed);
+    c.pcmAllBusySamples = pcmAllBusySamples.load(std::memory_order_relaxed);
+    return c;
+}
+
+int VoiceUsageStats::getRecommendedChips() const {
+    auto fm = summarize(fmHistogram.data(), maxFmVoices + 1);
+    auto pcm = summarize(pcmHistogram.data(), maxPcmChannels + 1);
+    if (fm.samples == 0) return 0;
+    // 全ボイスが埋まっていた時間は実際にはもっと必要だった可能性がある（奪われた分は数に出ない）
+    auto percentile = [](const std::atomic<uint64_t>* histogram, int size, uint64_t total) {
+        uint64_t target = static_cast<uint64_t>(VOICE_STATS_CHIP_PERCENTILE * static_cast<double>(total) + 0.5);
+        uint64_t cumulative = 0;
+        for (int i = 0; i < size; ++i) {
+            cumulative += histogram[i].load(std::memory_order_relaxed);
+            if (cumulative >= target) return i;
+        }
+        return size - 1;
+    };
+    int fmVoices = percentile(fmHistogram.data(), maxFmVoices + 1, fm.samples);
+    int pcmChannels = pcm.samples > 0 ? percentile(pcmHistogram.data(), maxPcmChannels + 1, pcm.samples) : 0;
+    int chips = std::max((fmVoices + fmVoicesPerChip - 1) / fmVoicesPerChip,
+                         (pcmChannels + pcmChannelsPerChip - 1) / pcmChannelsPerChip);
+    return std::max(1, chips);
+}
+
+static std::string occupancyToJson(const VoiceUsageStats::Occupancy& o, const std::atomic<uint64_t>* histogram, int size) {
+    char buf[192];
+    std::snprintf(buf, sizeof(buf), "{\"samples\": %llu, \"mean\": %.2f, \"p50\": %d, \"p90\": %d, \"p99\": %d, \"max\": %d, \"histogram\": [",
+                  static_cast<unsigned long long>(o.samples), o.mean, o.p50, o.p90, o.p99, o.max);
+    std::string json = buf;
+    // 最大値までの発音数ごとのサンプル数
+    for (int i = 0; i <= o.max && i < size; ++i) {
+        json += (i == 0 ? "" : ", ") + std::to_string(histogram[i].load(std::memory_order_relaxed));
+    }
+    return json + "]}";
+}
+
+std::string VoiceUsageStats::toJson() const {
+    auto c = getCounters();
+    std::string json = "{\n";
+    char buf[512];
+    std::snprintf(buf, sizeof(buf),
+                  "  \"totalSamples\": %llu,\n  \"recommendedChips\": %d,\n"
+                  "  \"fmNotes\": %llu,\n  \"fmRetriggers\": %llu,\n  \"fmStealsHeld\": %llu,\n  \"fmStealsReleasing\": %llu,\n"
+                  "  \"drumHits\": %llu,\n  \"drumReuses\": %llu,\n  \"drumSteals\": %llu,\n  \"drumAudibleSteals\": %llu,\n"
+                  "  \"fmAllBusySamples\": %llu,\n  \"pcmAllBusySamples\": %llu,\n",
+                  static_cast<unsigned long long>(c.totalSamples), getRecommendedChips(),
+                  static_cast<unsigned long long>(c.fmNotes), static_cast<unsigned long long>(c.fmRetriggers),
+                  static_cast<unsigned long long>(c.fmStealsHeld), static_cast<unsigned long long>(c.fmStealsReleasing),
+                  static_cast<unsigned long long>(c.drumHits), static_cast<unsigned long long>(c.drumReuses),
+                  static_cast<unsigned long long>(c.drumSteals), static_cast<unsigned long long>(c.drumAudibleSteals),
+                  static_cast<unsigned long long>(c.fmAllBusySamples), static_cast<unsigned long long>(c.pcmAllBusySamples));
+    json += buf;
+    json += "  \"fmOccupancy\": " + occupancyToJson(getFmOccupancy(), fmHistogram.data(), maxFmVoices + 1) + ",\n";
+    json += "  \"pcmOccupancy\": " + occupancyToJson(getPcmOccupancy(), pcmHistogram.data(), maxPcmChannels + 1) + ",\n";
+    json += "  \"peakPerChannel\": [";
+    for (int ch = 1; ch <= 16; ++ch) {
+        std::snprintf(buf, sizeof(buf), "%s\n    {\"channel\": %d, \"fm\": %d, \"pcm\": %d}", ch == 1 ? "" : ",",
+                      ch, getPeakFmVoices(ch), getPeakPcmChannels(ch));
+        json += buf;
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+bool VoiceUsageStats::dumpJson(const std::string& path) const {
+    std::ofstream fout(path);
+    if (!fout) {
+        printf("[Voice] Failed to open %s\n", path.c_str());
+        return false;
+    }
+    fout << toJson();
+    printf("[Voice] Usage stats written to %s (recommended chips: %d)\n", path.c_str(), getRecommendedChips());
+    return true;
+}
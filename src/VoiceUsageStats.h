@@ -0,0 +1,93 @@
+// VoiceUsageStats.h
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define VOICE_STATS_JSON_FILE_NAME "voice_stats.json" // Perf JSONボタンで一緒に書き出すファイル
+#define VOICE_STATS_CHIP_PERCENTILE 0.99              // 推奨チップ数: この割合の時間で発音数が収まるチップ数
+
+/**
+ * ボイス・ドラムPCMチャンネルの使用状況（チップ数を決めるための統計）
+ *
+ * ブロックごとに発音中のFMボイス数（リリース中を含む）と使用中のPCMチャンネル数をサンプル数で重み付けして
+ * ヒストグラムに記録し、MIDIチャンネルごとの最大同時発音数、ボイスを奪った回数（奪ったときにまだ鳴っていたか）、
+ * 同じドラムノートの再打鍵でチャンネルを使い回した回数、全ボイスが埋まっていた時間を数える。
+ *
+ * オーディオスレッドだけが書き込むアトミック変数なので、エディタはprocessLockを取らずに読める。
+ */
+class VoiceUsageStats {
+public:
+    static constexpr int maxFmVoices = 128;    // 16チップ x 8ボイス
+    static constexpr int maxPcmChannels = 64;  // 16チップ x 4チャンネル
+    static constexpr int fmVoicesPerChip = 8;
+    static constexpr int pcmChannelsPerChip = 4;
+
+    struct Occupancy {
+        uint64_t samples = 0;
+        double mean = 0.0;
+        int p50 = 0;
+        int p90 = 0;
+        int p99 = 0;
+        int max = 0;
+    };
+
+    struct Counters {
+        uint64_t totalSamples = 0;
+        uint64_t fmNotes = 0;
+        uint64_t fmRetriggers = 0;          // ホールド中の同じノートを再利用（奪ったわけではない）
+        uint64_t fmStealsHeld = 0;          // ゲートONのボイスを奪った（確実に聞こえていた）
+        uint64_t fmStealsReleasing = 0;     // リリース中（余韻が鳴っている）のボイスを奪った
+        uint64_t drumHits = 0;
+        uint64_t drumReuses = 0;            // 同じMIDIチャンネル・ノートで鳴っているチャンネルを使い回した
+        uint64_t drumSteals = 0;
+        uint64_t drumAudibleSteals = 0;     // 奪ったチャンネルの音量が0でなかった
+        uint64_t fmAllBusySamples = 0;      // 全FMボイスが発音中・リリース中だった時間（サンプル数）
+        uint64_t pcmAllBusySamples = 0;     // 全PCMチャンネルが使用中だった時間
+    };
+
+    // オーディオスレッドから呼ぶ
+    // fmPerChannel / pcmPerChannel はMIDIチャンネル1-16の発音数（添字0がチャンネル1）
+    void recordBlock(int numSamples, int fmSounding, int fmCapacity, int pcmInUse, int pcmCapacity,
+                     const std::array<int, 16>& fmPerChannel, const std::array<int, 16>& pcmPerChannel);
+    void countFmNote(bool retrigger, bool stoleHeld, bool stoleReleasing);
+    void countDrumHit(bool reused, bool stolen, bool audible);
+
+    // 他のスレッドから呼ぶ
+    Occupancy getFmOccupancy() const { return summarize(fmHistogram.data(), maxFmVoices + 1); }
+    Occupancy getPcmOccupancy() const { return summarize(pcmHistogram.data(), maxPcmChannels + 1); }
+    int getPeakFmVoices(int midiChannel) const { return peakFm[midiChannel - 1].load(std::memory_order_relaxed); }
+    int getPeakPcmChannels(int midiChannel) const { return peakPcm[midiChannel - 1].load(std::memory_order_relaxed); }
+    Counters getCounters() const;
+    // FM・PCMともにVOICE_STATS_CHIP_PERCENTILEの時間で足りるチップ数（記録が無ければ0）
+    int getRecommendedChips() const;
+    std::string toJson() const;
+    bool dumpJson(const std::string& path) const;
+    void requestReset() { resetRequested.store(true); } // 次のrecordBlock()で消去する
+
+private:
+    static Occupancy summarize(const std::atomic<uint64_t>* histogram, int size);
+    static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    void clear();
+
+    std::array<std::atomic<uint64_t>, maxFmVoices + 1> fmHistogram{};     // 発音数 → サンプル数
+    std::array<std::atomic<uint64_t>, maxPcmChannels + 1> pcmHistogram{};
+    std::array<std::atomic<int>, 16> peakFm{};
+    std::array<std::atomic<int>, 16> peakPcm{};
+
+    std::atomic<uint64_t> totalSamples{0};
+    std::atomic<uint64_t> fmNotes{0};
+    std::atomic<uint64_t> fmRetriggers{0};
+    std::atomic<uint64_t> fmStealsHeld{0};
+    std::atomic<uint64_t> fmStealsReleasing{0};
+    std::atomic<uint64_t> drumHits{0};
+    std::atomic<uint64_t> drumReuses{0};
+    std::atomic<uint64_t> drumSteals{0};
+    std::atomic<uint64_t> drumAudibleSteals{0};
+    std::atomic<uint64_t> fmAllBusySamples{0};
+    std::atomic<uint64_t> pcmAllBusySamples{0};
+    std::atomic<bool> resetRequested{false};
+};
@@ -7,6 +7,7 @@
   - Envelope Generator (ADSR)
   - FM, RM, iPD, and combination synthesis modes
   - 8-bit PCM Sample Memory (4096 KBytes)
+  - 4-bit ADPCM Sample Playback (Mode 6, 68-byte blocks of 128 samples with per-block header)
   - PCM DAC/ADC With DMA Mode (Currently not implemented)
   - GM Level 1 Support (Melodic 16 Channels, Drums 8 Channels) (with 3SGU2X, Not implemented)
 
@@ -0,0 +1,131 @@
+#ifndef ADPCM_CPP
+#define ADPCM_CPP
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 4bit ADPCM（IMA方式）のブロック形式
+// ブロック: <予測値:int16 BE> <ステップインデックス:u8> <予約:u8> <4bitコード x 128（上位ニブルが先）>
+// 各ブロックの先頭にデコーダの状態を持つので、ループやシークはブロック単位でデコードし直すだけで済む
+#define S3HS_ADPCM_SAMPLES_PER_BLOCK 128
+#define S3HS_ADPCM_HEADER_BYTES 4
+#define S3HS_ADPCM_BLOCK_BYTES (S3HS_ADPCM_HEADER_BYTES + S3HS_ADPCM_SAMPLES_PER_BLOCK / 2)
+#define S3HS_WT_MODE_ADPCM 6 // PCM/WTチャンネルのモードレジスタ（+0x03）の値
+
+inline constexpr int s3hs_adpcm_index_table[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+inline constexpr int s3hs_adpcm_step_table[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+// コード1つ分のデコード（predictor/stepIndexを更新し、新しい予測値を返す）
+inline int s3hs_adpcm_step(int& predictor, int& stepIndex, int code)
+{
+  int step = s3hs_adpcm_step_table[stepIndex];
+  int delta = step >> 3;
+  if (code & 4) delta += step;
+  if (code & 2) delta += step >> 1;
+  if (code & 1) delta += step >> 2;
+  predictor += (code & 8) ? -delta : delta;
+  if (predictor > 32767) predictor = 32767;
+  if (predictor < -32768) predictor = -32768;
+  stepIndex += s3hs_adpcm_index_table[code];
+  if (stepIndex < 0) stepIndex = 0;
+  if (stepIndex > 88) stepIndex = 88;
+  return predictor;
+}
+
+// Raw Unsigned 8bit → ADPCMブロック列（末尾のブロックは最後のサンプルで埋める）
+inline std::vector<unsigned char> s3hs_adpcm_encode(const std::vector<unsigned char>& raw8)
+{
+  std::vector<unsigned char> out;
+  if (raw8.empty()) return out;
+  size_t blocks = (raw8.size() + S3HS_ADPCM_SAMPLES_PER_BLOCK - 1) / S3HS_ADPCM_SAMPLES_PER_BLOCK;
+  out.assign(blocks * S3HS_ADPCM_BLOCK_BYTES, 0);
+  int predictor = ((int)raw8[0] - 128) * 256;
+  // 先頭のアタックが鈍らないよう、最初のステップ幅は先頭付近の変化量に合わせる
+  int maxDiff = 0;
+  for (size_t n = 1; n < raw8.size() && n < 8; ++n) {
+    int d = ((int)raw8[n] - (int)raw8[n - 1]) * 256;
+    maxDiff = d < 0 ? (-d > maxDiff ? -d : maxDiff) : (d > maxDiff ? d : maxDiff);
+  }
+  int stepIndex = 0;
+  while (stepIndex < 88 && s3hs_adpcm_step_table[stepIndex] < maxDiff / 2) stepIndex++;
+  for (size_t b = 0; b < blocks; ++b) {
+    unsigned char* block = out.data() + b * S3HS_ADPCM_BLOCK_BYTES;
+    block[0] = (unsigned char)((predictor >> 8) & 0xFF);
+    block[1] = (unsigned char)(predictor & 0xFF);
+    block[2] = (unsigned char)stepIndex;
+    for (int i = 0; i < S3HS_ADPCM_SAMPLES_PER_BLOCK; ++i) {
+      size_t n = b * S3HS_ADPCM_SAMPLES_PER_BLOCK + i;
+      int sample = ((int)raw8[n < raw8.size() ? n : raw8.size() - 1] - 128) * 256;
+      int diff = sample - predictor;
+      int code = 0;
+      if (diff < 0) {
+        code = 8;
+        diff = -diff;
+      }
+      int step = s3hs_adpcm_step_table[stepIndex];
+      if (diff >= step) { code |= 4; diff -= step; }
+      if (diff >= (step >> 1)) { code |= 2; diff -= step >> 1; }
+      if (diff >= (step >> 2)) { code |= 1; }
+      s3hs_adpcm_step(predictor, stepIndex, code); // デコーダと同じ計算で状態を進める
+      block[S3HS_ADPCM_HEADER_BYTES + i / 2] |= (unsigned char)((i & 1) ? code : (code << 4));
+    }
+  }
+  return out;
+}
+
+// チャンネルごとのデコーダ状態（順方向の連続アクセスは1コードずつ進めるだけ）
+struct S3HS_AdpcmDecoder
+{
+  const unsigned char* stream = nullptr;
+  int position = 0;   // 次にデコードするサンプル位置
+  int current = 0;    // position-1のサンプル値
+  int previous = 0;   // position-2のサンプル値
+  int stepIndex = 0;
+
+  void reset()
+  {
+    stream = nullptr;
+  }
+
+  // streamのindex番目のサンプル（16bit）
+  inline int sample(const unsigned char* src, int index)
+  {
+    if (src == stream) {
+      if (index == position - 1) return current;
+      if (index == position - 2) return previous;
+    }
+    // 後方・別ストリーム・次のブロック以降へのシークは、そのブロックの先頭からデコードし直す
+    if (src != stream || index < position || index / S3HS_ADPCM_SAMPLES_PER_BLOCK > position / S3HS_ADPCM_SAMPLES_PER_BLOCK) {
+      stream = src;
+      position = index - index % S3HS_ADPCM_SAMPLES_PER_BLOCK;
+    }
+    while (position <= index) {
+      const unsigned char* block = stream + (position / S3HS_ADPCM_SAMPLES_PER_BLOCK) * S3HS_ADPCM_BLOCK_BYTES;
+      int offset = position % S3HS_ADPCM_SAMPLES_PER_BLOCK;
+      if (offset == 0) {
+        current = (int16_t)((block[0] << 8) | block[1]);
+        stepIndex = block[2] > 88 ? 88 : block[2];
+      }
+      int code = block[S3HS_ADPCM_HEADER_BYTES + offset / 2];
+      code = (offset & 1) ? (code & 0xF) : (code >> 4);
+      previous = current;
+      current = s3hs_adpcm_step(current, stepIndex, code);
+      position++;
+    }
+    return current;
+  }
+};
+
+#endif
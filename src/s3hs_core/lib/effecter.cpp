@@ -67,10 +67,17 @@ public:
 
   inline std::vector<std::vector<float>> EQ3band(std::vector<float> inL, std::vector<float> inR,int length, float lowgain, float midgain, float highgain)
   {
-    std::vector<float> _out(length, 0);
-    std::vector<std::vector<float>> out(2, _out);
-    // inL[]、inR[]、outL[]、outR[]はそれぞれ入力信号と出力信号のバッファ(左右)
-    // wavelenghtはバッファのサイズ、サンプリング周波数は44100Hzとする
+    std::vector<std::vector<float>> out = {inL, inR};
+    out[0].resize(length, 0);
+    out[1].resize(length, 0);
+    EQ3bandInPlace(out[0].data(), out[1].data(), length, lowgain, midgain, highgain);
+    return out;
+  }
+
+  // EQ3bandのインプレース版（メモリ確保なし）
+  inline void EQ3bandInPlace(float* bufL, float* bufR, int length, float lowgain, float midgain, float highgain)
+  {
+    // bufL[]、bufR[]は入出力兼用のバッファ(左右)
 
     // エフェクターのパラメーター
     float lowfreq = 400.0f; // 低音域の周波数。50Hz～1kHz程度
@@ -82,9 +89,6 @@ public:
     float highfreq = 4000.0f; // 高音域の周波数。1kHz～12kHz程度
     //float highgain = 4.0f;    // 高音域のゲイン(増幅値)。-15～15dB程度
 
-    // 内部変数
-    
-
     // 低音域を持ち上げる(ローシェルフ)フィルタ設定(左右分)
     lowL.LowShelf(lowfreq, 1.0f / sqrt(2.0f), lowgain);
     lowR.LowShelf(lowfreq, 1.0f / sqrt(2.0f), lowgain);
@@ -99,18 +103,24 @@ public:
     for (int i = 0; i < length; i++)
     {
       // 入力信号にフィルタをかける
-      out[0][i] = highL.Process(midL.Process(lowL.Process(inL[i])));
-      out[1][i] = highR.Process(midR.Process(lowR.Process(inR[i])));
+      bufL[i] = highL.Process(midL.Process(lowL.Process(bufL[i])));
+      bufR[i] = highR.Process(midR.Process(lowR.Process(bufR[i])));
     }
-    return out;
   }
 
   inline std::vector<std::vector<float>> Compressor(std::vector<float> inL, std::vector<float> inR, int length, float threshold, float ratio, float volume)
   {
-    std::vector<float> _out(length, 0);
-    std::vector<std::vector<float>> out(2, _out);
-    // inL[]、inR[]、outL[]、outR[]はそれぞれ入力信号と出力信号のバッファ(左右)
-    // wavelenghtはバッファのサイズ、サンプリング周波数は44100Hzとする
+    std::vector<std::vector<float>> out = {inL, inR};
+    out[0].resize(length, 0);
+    out[1].resize(length, 0);
+    CompressorInPlace(out[0].data(), out[1].data(), length, threshold, ratio, volume);
+    return out;
+  }
+
+  // Compressorのインプレース版（メモリ確保なし）
+  inline void CompressorInPlace(float* bufL, float* bufR, int length, float threshold, float ratio, float volume)
+  {
+    // bufL[]、bufR[]は入出力兼用のバッファ(左右)
 
     // エフェクターのパラメーター
     //static float threshold = 0.3; // 圧縮が始まる音圧。0.1～1.0程度
@@ -138,8 +148,8 @@ public:
     for (int i = 0; i < length; i++)
     {
       // 入力信号の絶対値をとったものをローパスフィルタにかけて音圧を検知する
-      float tmpL = envfilterL.Process(abs(inL[i]));
-      float tmpR = envfilterR.Process(abs(inR[i]));
+      float tmpL = envfilterL.Process(abs(bufL[i]));
+      float tmpR = envfilterR.Process(abs(bufR[i]));
 
       // 音圧をもとに音量(ゲイン)を調整(左)
       float gainL = 1.0f;
@@ -170,10 +180,9 @@ public:
       //}
 
       // 入力信号に音量(ゲイン)をかけ、さらに最終的な音量を調整し出力する
-      out[0][i] = volume * gainL * inL[i];
-      out[1][i] = volume * gainR * inR[i];
+      bufL[i] = volume * gainL * bufL[i];
+      bufR[i] = volume * gainR * bufR[i];
     }
-    return out;
   }
 
   /*inline void setSlewRate(float upper, float lower)
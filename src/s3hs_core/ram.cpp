@@ -76,6 +76,15 @@ std::vector<Byte> ram_peek2array(std::vector<Byte>& ram, int addr, int block) {
     return out;
 }
 
+// ram_peek2arrayのバッファ再利用版（outの容量が足りていればメモリ確保しない）
+void ram_peek2buffer(std::vector<Byte>& ram, int addr, int block, std::vector<Byte>& out) {
+    out.resize(block);
+    for (int i = 0; i < block; i++)
+    {
+        out[i] = ram_peek(ram, addr + i);
+    }
+}
+
 void ram_pokefill(std::vector<Byte>& ram, int addr, int block, Byte val) {
     std::fill(ram.begin() + addr, ram.begin() + addr + block, val);
 }
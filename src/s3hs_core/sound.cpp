@@ -3,7 +3,29 @@
 #include <iostream>
 #define M_PI 3.14159265358979323846
 #include "lib/effecter.cpp"
+#include "lib/adpcm.cpp"
 #define Byte unsigned char
+// トレース記録（プラグインではTraceRecorder.hを先にインクルードしている。単体で使うときは何もしない）
+#ifndef TRACE_SCOPE
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+// PCM（モード0）のループが有効か（ループ開始が0xFFFFFFまたは終端以降ならワンショット）
+static constexpr bool s3hsPcmLoops(unsigned int end, unsigned int loopStart) {
+    return loopStart != 0xFFFFFF && loopStart < end;
+}
+// 再生位置posがループ側で折り返すか。終端ちょうど（pos == end - addr）もループ側で扱う
+static constexpr bool s3hsPcmWraps(unsigned int addr, unsigned int end, unsigned int loopStart, int pos) {
+    return addr + pos >= end && s3hsPcmLoops(end, loopStart);
+}
+// ワンショットの終端に達したか（ループするサンプルは終端扱いにしない）
+static constexpr bool s3hsPcmEnded(unsigned int addr, unsigned int end, unsigned int loopStart, int pos) {
+    return addr + pos >= end && !s3hsPcmLoops(end, loopStart);
+}
+// 回帰チェック: ループ長が位相の刻みで割り切れて、位置がちょうど終端に来てもループは止まらない
+static_assert(s3hsPcmWraps(0x1000, 0x1100, 0x1000, 0x100) && !s3hsPcmEnded(0x1000, 0x1100, 0x1000, 0x100),
+              "looping PCM must wrap (not end) when the position lands exactly on the end address");
+static_assert(s3hsPcmEnded(0x1000, 0x1100, 0xFFFFFF, 0x100), "one-shot PCM ends at the end address");
 
 class S3HS_sound {
 public:
@@ -57,6 +79,8 @@ public:
     int frequencyQuantizeFrequency = S3HS_MASTER_CLOCK; // 周波数量子化の基準周波数（0の場合は量子化なし）
     unsigned int pcm_addr[4],pcm_addr_end[4],pcm_loop_start[4],pcm_loop_end[4]={0,0,0,0};
     std::vector<std::vector<Byte>> pcm_ram; 
+    S3HS_AdpcmDecoder adpcm[4]; // ADPCMモード（モード6）のデコーダ状態
+    bool pcmEnded[4] = {false,false,false,false}; // ワンショットのPCMが終端に達した（wtSync()か開始アドレスの変更まで無音で、処理もしない）
 
     S3HS_sound() {
     };
@@ -258,237 +282,280 @@ public:
 
     #define OVERSAMPLE_MULT 1
 
+    // 1サンプル分の各チャンネル出力を計算する（result[0-7]: FM, result[8-11]: PCM/WT）
+    inline void synthesizeSample(float result[12]) {
+    for(int ch=0; ch < 8; ch++) {
+        for (int opNum=0; opNum < 8; opNum++) {
+            applyEnveloveToRegisters(reg,regenvl,opNum,ch,((float)1/(float)S3HS_SAMPLE_FREQ)/OVERSAMPLE_MULT);
+        }
+    }
+    
+    for(int ch=0; ch < 8; ch++) {
+        int addr = 64*ch;
+        double f1 = (double)(quantizeFreqByPeriod((double)reg[addr+0]*256+reg[addr+1]))*PHASE_RESOLUTION/OVERSAMPLE_MULT;
+        t1[ch] = t1[ch] + f1;
+        t2[ch] = t2[ch] + (double)f1*(((double)reg[addr+2]*256+reg[addr+3])/4096);
+        t3[ch] = t3[ch] + (double)f1*(((double)reg[addr+4]*256+reg[addr+5])/4096);
+        t4[ch] = t4[ch] + (double)f1*(((double)reg[addr+6]*256+reg[addr+7])/4096);
+        t5[ch] = t5[ch] + (double)f1*(((double)reg[addr+8]*256+reg[addr+9])/4096);
+        t6[ch] = t6[ch] + (double)f1*(((double)reg[addr+10]*256+reg[addr+11])/4096);
+        t7[ch] = t7[ch] + (double)f1*(((double)reg[addr+12]*256+reg[addr+13])/4096);
+        t8[ch] = t8[ch] + (double)f1*(((double)reg[addr+14]*256+reg[addr+15])/4096);
+        float v1 = (float)(vols[ch*8+0])/32768;
+        float v2 = (float)(vols[ch*8+1])/32768;
+        float v3 = (float)(vols[ch*8+2])/32768;
+        float v4 = (float)(vols[ch*8+3])/32768;
+        float v5 = (float)(vols[ch*8+4])/32768;
+        float v6 = (float)(vols[ch*8+5])/32768;
+        float v7 = (float)(vols[ch*8+6])/32768;
+        float v8 = (float)(vols[ch*8+7])/32768;
+        int w1 = reg[addr+24]>>4;
+        int w2 = reg[addr+24]&0xf;
+        int w3 = reg[addr+25]>>4;
+        int w4 = reg[addr+25]&0xf;
+        int w5 = reg[addr+26]>>4;
+        int w6 = reg[addr+26]&0xf;
+        int w7 = reg[addr+27]>>4;
+        int w8 = reg[addr+27]&0xf;
+        int mode = reg[addr+0x1c];
+        float fb = ((float)(reg[addr+0x1f])/256-0.5)*2;
+        result[ch] += generateHSWave(mode,
+        (t1[ch])/PHASE_RESOLUTION,v1,
+        (t2[ch])/PHASE_RESOLUTION,v2,
+        (t3[ch])/PHASE_RESOLUTION,v3,
+        (t4[ch])/PHASE_RESOLUTION,v4,
+        (t5[ch])/PHASE_RESOLUTION,v5,
+        (t6[ch])/PHASE_RESOLUTION,v6,
+        (t7[ch])/PHASE_RESOLUTION,v7,
+        (t8[ch])/PHASE_RESOLUTION,v8,
+        w1,w2,w3,w4,w5,w6,w7,w8,fb,ch,previous);
+        previous[ch] = result[ch];
+        //std::cout << v1 << std::endl;
+    }
+    for (int ch=0;ch<4;ch++) {
+        if(regwt[48*ch+3] == 0 || regwt[48*ch+3] == S3HS_WT_MODE_ADPCM) {
+            unsigned int addr = regwt[16+48*ch+0]*65536+regwt[16+48*ch+1]*256+regwt[16+48*ch+2];
+            if (addr != pcm_addr[ch]) pcmEnded[ch] = false;
+            pcm_addr[ch] = addr;
+            pcm_addr_end[ch] = regwt[16+48*ch+3]*65536+regwt[16+48*ch+4]*256+regwt[16+48*ch+5];
+            pcm_loop_start[ch] = regwt[16+48*ch+6]*65536+regwt[16+48*ch+7]*256+regwt[16+48*ch+8];
+            //pcm_loop_end[ch] = regwt[12+64*ch+9]*65536+regwt[12+64*ch+10]*256+regwt[12+64*ch+11];
+            //std::cout << pcm_addr[ch] << std::endl;
+            //std::cout << pcm_addr_end[ch] << std::endl;
+        } else {
+            pcmEnded[ch] = false;
+        }
+    }
+    for(int ch=0; ch<4; ch++) {
+        if (pcmEnded[ch]) continue;
+        float ft = quantizeFreqByPeriod(regwt[ch*48+0]*256+regwt[ch*48+1])*PHASE_RESOLUTION/OVERSAMPLE_MULT;
+        twt[ch] = twt[ch] + ft;
+        float vt = ((float)regwt[ch*48+2])/255;
+        int val = 0;
+        float phase = (float)(twt[ch])/PHASE_RESOLUTION/S3HS_SAMPLE_FREQ*32;
+        //std::cout << ch << std::endl;
+        //std::cout << pcm_addr[ch] << std::endl;
+        //std::cout << pcm_addr_end[ch] << std::endl;
+        //std::cout << pcm_loop_start[ch] << std::endl;
+
+        #define fmod(val) ((val) - ((int)(val)))
+
+        if (regwt[ch*48+3] == 4) {
+            val = regwt[16+48*ch+((int)phase%32)];
+        } else if(regwt[ch*48+3] == 2) {
+            val = noise[((int)phase%65536)]*255;
+        } else if(regwt[ch*48+3] == 3) {
+            val = noise[((int)phase%64)]*255;
+        } else if(regwt[ch*48+3] == 5) {
+            if (DMABufferPointer[ch] > 0) {
+                DMA_DAC_Current[ch] = (int)(DMABuffer[ch][0]);
+                val = DMA_DAC_Current[ch];
+                memmove(DMABuffer[ch], &DMABuffer[ch][1], DMA_BUFFER_SIZE-1);  //pop first value
+                DMABufferPointer[ch]--;
+            } else {
+                val = DMA_DAC_Current[ch]; // Return previous value if buffer is empty
+            }
+
+        } else if(regwt[ch*48+3] == 1) {
+            float pre = (float)regwt[16+48*ch+((int)phase%32)];
+            float nxt = (float)regwt[16+48*ch+((int)(phase+1)%32)];
+            val = (int)(pre+(nxt-pre)*fmod((((float)phase))));
+        } else if(regwt[ch*48+3] == 0) {
+            int pre, nxt;
+            if (s3hsPcmWraps(pcm_addr[ch], pcm_addr_end[ch], pcm_loop_start[ch], (int)phase)) {
+                pre = ram_peek(ram,pcm_addr[ch]+((int)phase%(pcm_addr_end[ch]-pcm_loop_start[ch])));
+                nxt = ram_peek(ram,pcm_addr[ch]+((int)(phase+1)%(pcm_addr_end[ch]-pcm_loop_start[ch])));
+            } else if (s3hsPcmEnded(pcm_addr[ch], pcm_addr_end[ch], pcm_loop_start[ch], (int)phase)) {
+                pcmEnded[ch] = true; // ワンショットの終端
+                pre = nxt = 128;
+            } else {
+                pre = ram_peek(ram,std::min(pcm_addr[ch]+(int)phase,pcm_addr_end[ch]));
+                nxt = ram_peek(ram,std::min(pcm_addr[ch]+(int)phase+1,pcm_addr_end[ch]));
+            }
+            val = (int)(pre+((float)(nxt-pre)*fmod((((float)phase)))));
+            //val = pre;
+            //std::cout << phase << std::endl;
+        } else if(regwt[ch*48+3] == S3HS_WT_MODE_ADPCM) {
+            // 4bit ADPCM: アドレスはブロック列のバイト位置、ループ開始はブロック境界のアドレス
+            unsigned int streamEnd = MIN(pcm_addr_end[ch], 0x400000u);
+            int total = pcm_addr[ch] < streamEnd ? (int)((streamEnd - pcm_addr[ch]) / S3HS_ADPCM_BLOCK_BYTES) * S3HS_ADPCM_SAMPLES_PER_BLOCK : 0;
+            int index = (int)phase;
+            if (index >= total && total > 0) {
+                if (pcm_loop_start[ch] != 0xFFFFFF && pcm_loop_start[ch] >= pcm_addr[ch] && pcm_loop_start[ch] < streamEnd) {
+                    int loopIndex = (int)((pcm_loop_start[ch] - pcm_addr[ch]) / S3HS_ADPCM_BLOCK_BYTES) * S3HS_ADPCM_SAMPLES_PER_BLOCK;
+                    if (loopIndex < total) {
+                        index = loopIndex + (index - loopIndex) % (total - loopIndex);
+                    } else {
+                        index = -1; // ループ開始が末尾の半端なブロックにある: ワンショットとして終える
+                        pcmEnded[ch] = true;
+                    }
+                } else {
+                    index = -1; // ワンショットの終端
+                    pcmEnded[ch] = true;
+                }
+            }
+            if (index >= 0 && index < total) {
+                const unsigned char* stream = ram.data() + pcm_addr[ch];
+                float pre = (float)adpcm[ch].sample(stream, index);
+                float nxt = index + 1 < total ? (float)adpcm[ch].sample(stream, index + 1) : pre;
+                val = (int)((pre + (nxt - pre) * fmod(((float)phase))) / 256.0f) + 128;
+            } else {
+                val = 128;
+            }
+        }
+
+        #undef fmod
+        
+        val -= 128;
+        /*float omega, alpha, a0, a1, a2, b0, b1, b2;
+        switch (regwt[ch*48+4])
+        {
+        case 0:
+            omega = 2.0 * 3.14159265 * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
+            alpha = sin(omega) / (2.0 * 0.5+((float)regwt[ch*48+6]+1)/16);
+            a0 =  1.0 + alpha;
+            a1 = -2.0 * cos(omega);
+            a2 =  1.0 - alpha;
+            b0 = (1.0 - cos(omega)) / 2.0;
+            b1 =  1.0 - cos(omega);
+            b2 = (1.0 - cos(omega)) / 2.0;
+            break;
+        case 1:
+            omega = 2.0f * 3.14159265f *  ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
+            alpha = sin(omega) / (2.0f * 0.5+((float)regwt[ch*48+6]+1)/16);
+            a0 =   1.0f + alpha;
+            a1 =  -2.0f * cos(omega);
+            a2 =   1.0f - alpha;
+            b0 =  (1.0f + cos(omega)) / 2.0f;
+            b1 = -(1.0f + cos(omega));
+            b2 =  (1.0f + cos(omega)) / 2.0f;
+            break;
+        case 2:
+            omega = 2.0f * 3.14159265f * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
+            alpha = sin(omega) * sinh(log(2.0f) / 1.0 * ((float)regwt[ch*48+6]+1)/256 * omega / sin(omega));
+            a0 =  1.0f + alpha;
+            a1 = -2.0f * cos(omega);
+            a2 =  1.0f - alpha;
+            b0 =  alpha;
+            b1 =  0.0f;
+            b2 = -alpha;
+            break;
+        case 3:
+            omega = 2.0f * 3.14159265f *  ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
+            alpha = sin(omega) * sinh(log(2.0f) / 1.0 * ((float)regwt[ch*48+6]+1)/256 * omega / sin(omega));
+            a0 =  1.0f + alpha;
+            a1 = -2.0f * cos(omega);
+            a2 =  1.0f - alpha;
+            b0 =  1.0f;
+            b1 = -2.0f * cos(omega);
+            b2 =  1.0f;
+            break;
+        default:
+            omega = 2.0 * 3.14159265 * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
+            alpha = sin(omega) / (2.0 * 0.5+((float)regwt[ch*48+6]+1)/64);
+            a0 =  1.0 + alpha;
+            a1 = -2.0 * cos(omega);
+            a2 =  1.0 - alpha;
+            b0 = (1.0 - cos(omega)) / 2.0;
+            b1 =  1.0 - cos(omega);
+            b2 = (1.0 - cos(omega)) / 2.0;
+            break;
+        }
+        
+        float output = b0/a0*(float)val+b1/a0*in1[ch]+b2/a0*in2[ch]-a1/a0*out1[ch]-a2/a0*out2[ch];
+        in2[ch]  = in1[ch];
+        in1[ch]  = val; 
+        out2[ch] = out1[ch];     
+        out1[ch] = output; */
+        //if (regwt[ch*48+5] == 0) {
+            result[ch+8] += (float)(val)*255*vt;
+        //} else {
+        //    result[ch+8] += std::min(std::max((float)output*255*vt,-32768.0f),32767.0f);
+        //}
+        //result[ch+8] += (float)(val)*255*vt;
+
+        // for 3HSPlug: omitted filter processing
+    }
+    }
+
+    // チャンネルcの左右パン係数（0-15）を取得
+    inline void getChannelPan(int ch, int& panL, int& panR) const {
+        if (ch < 8) {
+            panL = reg[0x1d+64*ch]>>4;
+            panR = reg[0x1d+64*ch]&0xf;
+        } else {
+            panL = regwt[0x07+48*(ch-8)]>>4;
+            panR = regwt[0x07+48*(ch-8)]&0xf;
+        }
+        if (panL == 0 && panR == 0) {
+            panL = 15;
+            panR = 15;
+        }
+    }
+
+    // レジスタのスナップショットを取得（バッファは再利用し、確保済みなら新たなメモリ確保は行わない）
+    void snapshotRegisters() {
+        ram_peek2buffer(ram,0x400000,512,reg);
+        ram_peek2buffer(ram,0x400200,192,regwt);
+        ram_peek2buffer(ram,0x4002C0,0x240,regother);
+    }
+
+    // Master -> EQ -> Compressor（outL/outRをその場で処理）
+    void applyMasterEffects(float* outL, float* outR, int framesize) {
+        TRACE_SCOPE("S3HS::applyMasterEffects");
+        if(regother[0x001] == 1) {
+            float lowgain = (float)(regother[0x005])/8;
+            float midgain = (float)(regother[0x006])/8;
+            float highgain = (float)(regother[0x007])/8;
+            effecter.EQ3bandInPlace(outL,outR,framesize,lowgain,midgain,highgain);
+        }
+        if(regother[0x000] == 1) {
+            float threshold = (float)(regother[0x002])/255;
+            float ratio = (float)(regother[0x003])/255; 
+            float volume = (float)(regother[0x004])/32;
+            effecter.CompressorInPlace(outL,outR,framesize,threshold,ratio,volume);
+        }
+    }
+
     std::vector<std::vector<std::vector<float_t>>> AudioCallBack(int len)
     {
+        TRACE_SCOPE("S3HS::AudioCallBack");
         int i;
         std::vector<float_t> __frames(len,0);
         std::vector<std::vector<float_t>> _frames(13,__frames);
         std::vector<std::vector<std::vector<float_t>>> frames(2,_frames);
         std::vector<float> outL(len,0);
         std::vector<float> outR(len,0);
-        std::vector<float> procL(len,0);
-        std::vector<float> procR(len,0);
         int framesize = len;
-        reg = ram_peek2array(ram,0x400000,512);
-        regwt = ram_peek2array(ram,0x400200,192);
-        regother = ram_peek2array(ram,0x4002C0,0x240);
-
-        /*for (int wf=10; wf<14; wf++) {
-            for (int i=0; i<256; i++) {
-                int val = regwt.at(16+48*(wf-10)+((int)(i/8)%32));
-                if ((int)((i/8)*2)%2 == 0) {
-                    val /= 16;
-                } else {
-                    val %= 16;
-                }
-                val *= 16;
-                val -= 128;
-                sintable.at(wf).at(i) = (signed char)(val);
-            }
-        }*/
-        /*for (int wf=10; wf<14; wf++) {
-            for (int i=0; i<256; i++) {
-                float pre = (float)regwt.at(16+48*(wf-10)+((int)(i/8)%32));
-                float nxt = (float)regwt.at(16+48*(wf-10)+((int)(((float)i/8)+1)%32));
-                int val = (int)(pre+(nxt-pre)*fmod((((float)i)/8),1));
-                val -= 128;
-                sintable.at(wf).at(i) = (signed char)(val);
-            }
-        }*/
+        snapshotRegisters();
+
         for (i = 0; i < framesize * OVERSAMPLE_MULT; i++) {
             float result[12] = {0};
-            for(int ch=0; ch < 8; ch++) {
-                for (int opNum=0; opNum < 8; opNum++) {
-                    applyEnveloveToRegisters(reg,regenvl,opNum,ch,((float)1/(float)S3HS_SAMPLE_FREQ)/OVERSAMPLE_MULT);
-                }
-            }
-            
-            for(int ch=0; ch < 8; ch++) {
-                int addr = 64*ch;
-                double f1 = (double)(quantizeFreqByPeriod((double)reg[addr+0]*256+reg[addr+1]))*PHASE_RESOLUTION/OVERSAMPLE_MULT;
-                t1[ch] = t1[ch] + f1;
-                t2[ch] = t2[ch] + (double)f1*(((double)reg[addr+2]*256+reg[addr+3])/4096);
-                t3[ch] = t3[ch] + (double)f1*(((double)reg[addr+4]*256+reg[addr+5])/4096);
-                t4[ch] = t4[ch] + (double)f1*(((double)reg[addr+6]*256+reg[addr+7])/4096);
-                t5[ch] = t5[ch] + (double)f1*(((double)reg[addr+8]*256+reg[addr+9])/4096);
-                t6[ch] = t6[ch] + (double)f1*(((double)reg[addr+10]*256+reg[addr+11])/4096);
-                t7[ch] = t7[ch] + (double)f1*(((double)reg[addr+12]*256+reg[addr+13])/4096);
-                t8[ch] = t8[ch] + (double)f1*(((double)reg[addr+14]*256+reg[addr+15])/4096);
-                float v1 = (float)(vols[ch*8+0])/32768;
-                float v2 = (float)(vols[ch*8+1])/32768;
-                float v3 = (float)(vols[ch*8+2])/32768;
-                float v4 = (float)(vols[ch*8+3])/32768;
-                float v5 = (float)(vols[ch*8+4])/32768;
-                float v6 = (float)(vols[ch*8+5])/32768;
-                float v7 = (float)(vols[ch*8+6])/32768;
-                float v8 = (float)(vols[ch*8+7])/32768;
-                int w1 = reg[addr+24]>>4;
-                int w2 = reg[addr+24]&0xf;
-                int w3 = reg[addr+25]>>4;
-                int w4 = reg[addr+25]&0xf;
-                int w5 = reg[addr+26]>>4;
-                int w6 = reg[addr+26]&0xf;
-                int w7 = reg[addr+27]>>4;
-                int w8 = reg[addr+27]&0xf;
-                int mode = reg[addr+0x1c];
-                float fb = ((float)(reg[addr+0x1f])/256-0.5)*2;
-                result[ch] += generateHSWave(mode,
-                (t1[ch])/PHASE_RESOLUTION,v1,
-                (t2[ch])/PHASE_RESOLUTION,v2,
-                (t3[ch])/PHASE_RESOLUTION,v3,
-                (t4[ch])/PHASE_RESOLUTION,v4,
-                (t5[ch])/PHASE_RESOLUTION,v5,
-                (t6[ch])/PHASE_RESOLUTION,v6,
-                (t7[ch])/PHASE_RESOLUTION,v7,
-                (t8[ch])/PHASE_RESOLUTION,v8,
-                w1,w2,w3,w4,w5,w6,w7,w8,fb,ch,previous);
-                previous[ch] = result[ch];
-                //std::cout << v1 << std::endl;
-            }
-            for (int ch=0;ch<4;ch++) {
-                if(regwt[48*ch+3] == 0) {
-                    pcm_addr[ch] = regwt[16+48*ch+0]*65536+regwt[16+48*ch+1]*256+regwt[16+48*ch+2];
-                    pcm_addr_end[ch] = regwt[16+48*ch+3]*65536+regwt[16+48*ch+4]*256+regwt[16+48*ch+5];
-                    pcm_loop_start[ch] = regwt[16+48*ch+6]*65536+regwt[16+48*ch+7]*256+regwt[16+48*ch+8];
-                    //pcm_loop_end[ch] = regwt[12+64*ch+9]*65536+regwt[12+64*ch+10]*256+regwt[12+64*ch+11];
-                    //std::cout << pcm_addr[ch] << std::endl;
-                    //std::cout << pcm_addr_end[ch] << std::endl;
-                }
-            }
-            for(int ch=0; ch<4; ch++) {
-                float ft = quantizeFreqByPeriod(regwt[ch*48+0]*256+regwt[ch*48+1])*PHASE_RESOLUTION/OVERSAMPLE_MULT;
-                twt[ch] = twt[ch] + ft;
-                float vt = ((float)regwt[ch*48+2])/255;
-                int val = 0;
-                float phase = (float)(twt[ch])/PHASE_RESOLUTION/S3HS_SAMPLE_FREQ*32;
-                //std::cout << ch << std::endl;
-                //std::cout << pcm_addr[ch] << std::endl;
-                //std::cout << pcm_addr_end[ch] << std::endl;
-                //std::cout << pcm_loop_start[ch] << std::endl;
-
-                #define fmod(val) ((val) - ((int)(val)))
-
-                if (regwt[ch*48+3] == 4) {
-                    val = regwt[16+48*ch+((int)phase%32)];
-                } else if(regwt[ch*48+3] == 2) {
-                    val = noise[((int)phase%65536)]*255;
-                } else if(regwt[ch*48+3] == 3) {
-                    val = noise[((int)phase%64)]*255;
-                } else if(regwt[ch*48+3] == 5) {
-                    if (DMABufferPointer[ch] > 0) {
-                        DMA_DAC_Current[ch] = (int)(DMABuffer[ch][0]);
-                        val = DMA_DAC_Current[ch];
-                        memmove(DMABuffer[ch], &DMABuffer[ch][1], DMA_BUFFER_SIZE-1);  //pop first value
-                        DMABufferPointer[ch]--;
-                    } else {
-                        val = DMA_DAC_Current[ch]; // Return previous value if buffer is empty
-                    }
-
-                } else if(regwt[ch*48+3] == 1) {
-                    float pre = (float)regwt[16+48*ch+((int)phase%32)];
-                    float nxt = (float)regwt[16+48*ch+((int)(phase+1)%32)];
-                    val = (int)(pre+(nxt-pre)*fmod((((float)phase))));
-                } else if(regwt[ch*48+3] == 0) {
-                    int pre, nxt;
-                    if (pcm_addr[ch]+(int)phase > pcm_addr_end[ch] && pcm_loop_start[ch] < pcm_addr_end[ch] && pcm_loop_start[ch] != 0xFFFFFF) {
-                        pre = ram_peek(ram,pcm_addr[ch]+((int)phase%(pcm_addr_end[ch]-pcm_loop_start[ch])));
-                        nxt = ram_peek(ram,pcm_addr[ch]+((int)(phase+1)%(pcm_addr_end[ch]-pcm_loop_start[ch])));
-                    } else {
-                        pre = ram_peek(ram,std::min(pcm_addr[ch]+(int)phase,pcm_addr_end[ch]));
-                        nxt = ram_peek(ram,std::min(pcm_addr[ch]+(int)phase+1,pcm_addr_end[ch]));
-                    }
-                    val = (int)(pre+((float)(nxt-pre)*fmod((((float)phase)))));
-                    //val = pre;
-                    //std::cout << phase << std::endl;
-                }
-
-                #undef fmod
-                
-                val -= 128;
-                /*float omega, alpha, a0, a1, a2, b0, b1, b2;
-                switch (regwt[ch*48+4])
-                {
-                case 0:
-                    omega = 2.0 * 3.14159265 * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
-                    alpha = sin(omega) / (2.0 * 0.5+((float)regwt[ch*48+6]+1)/16);
-                    a0 =  1.0 + alpha;
-                    a1 = -2.0 * cos(omega);
-                    a2 =  1.0 - alpha;
-                    b0 = (1.0 - cos(omega)) / 2.0;
-                    b1 =  1.0 - cos(omega);
-                    b2 = (1.0 - cos(omega)) / 2.0;
-                    break;
-                case 1:
-                    omega = 2.0f * 3.14159265f *  ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
-                    alpha = sin(omega) / (2.0f * 0.5+((float)regwt[ch*48+6]+1)/16);
-                    a0 =   1.0f + alpha;
-                    a1 =  -2.0f * cos(omega);
-                    a2 =   1.0f - alpha;
-                    b0 =  (1.0f + cos(omega)) / 2.0f;
-                    b1 = -(1.0f + cos(omega));
-                    b2 =  (1.0f + cos(omega)) / 2.0f;
-                    break;
-                case 2:
-                    omega = 2.0f * 3.14159265f * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
-                    alpha = sin(omega) * sinh(log(2.0f) / 1.0 * ((float)regwt[ch*48+6]+1)/256 * omega / sin(omega));
-                    a0 =  1.0f + alpha;
-                    a1 = -2.0f * cos(omega);
-                    a2 =  1.0f - alpha;
-                    b0 =  alpha;
-                    b1 =  0.0f;
-                    b2 = -alpha;
-                    break;
-                case 3:
-                    omega = 2.0f * 3.14159265f *  ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
-                    alpha = sin(omega) * sinh(log(2.0f) / 1.0 * ((float)regwt[ch*48+6]+1)/256 * omega / sin(omega));
-                    a0 =  1.0f + alpha;
-                    a1 = -2.0f * cos(omega);
-                    a2 =  1.0f - alpha;
-                    b0 =  1.0f;
-                    b1 = -2.0f * cos(omega);
-                    b2 =  1.0f;
-                    break;
-                default:
-                    omega = 2.0 * 3.14159265 * ((float)regwt[ch*48+5]+1)*8 / S3HS_SAMPLE_FREQ * OVERSAMPLE_MULT;
-                    alpha = sin(omega) / (2.0 * 0.5+((float)regwt[ch*48+6]+1)/64);
-                    a0 =  1.0 + alpha;
-                    a1 = -2.0 * cos(omega);
-                    a2 =  1.0 - alpha;
-                    b0 = (1.0 - cos(omega)) / 2.0;
-                    b1 =  1.0 - cos(omega);
-                    b2 = (1.0 - cos(omega)) / 2.0;
-                    break;
-                }
-                
-                float output = b0/a0*(float)val+b1/a0*in1[ch]+b2/a0*in2[ch]-a1/a0*out1[ch]-a2/a0*out2[ch];
-                in2[ch]  = in1[ch];
-                in1[ch]  = val; 
-                out2[ch] = out1[ch];     
-                out1[ch] = output; */
-                //if (regwt[ch*48+5] == 0) {
-                    result[ch+8] += (float)(val)*255*vt;
-                //} else {
-                //    result[ch+8] += std::min(std::max((float)output*255*vt,-32768.0f),32767.0f);
-                //}
-                //result[ch+8] += (float)(val)*255*vt;
-
-                // for 3HSPlug: omitted filter processing
-            }
-            
+            synthesizeSample(result);
             
             for(int ch=0; ch<12; ch++) {
                 int panL, panR;
-                if (ch < 8) {
-                    panL = reg[0x1d+64*ch]>>4;
-                    panR = reg[0x1d+64*ch]&0xf;
-                } else {
-                    panL = regwt[0x07+48*(ch-8)]>>4;
-                    panR = regwt[0x07+48*(ch-8)]&0xf;
-                }
-                if (panL == 0 && panR == 0) {
-                    panL = 15;
-                    panR = 15;
-                }
+                getChannelPan(ch, panL, panR);
                 if (!regother[0x010+ch] == 1) {
                     frames[0][ch][i/OVERSAMPLE_MULT] += result[ch]*((float)(panL)/15)/OVERSAMPLE_MULT;
                     frames[1][ch][i/OVERSAMPLE_MULT] += result[ch]*((float)(panR)/15)/OVERSAMPLE_MULT;
@@ -503,39 +570,10 @@ public:
             }
 
         }
-        procL = outL;
-        procR = outR;
 
         // Master -> EQ -> Compressor -> Final Output
+        applyMasterEffects(outL.data(), outR.data(), framesize);
 
-        if(regother[0x001] == 1) {
-            float lowgain = (float)(regother[0x005])/8;
-            float midgain = (float)(regother[0x006])/8;
-            float highgain = (float)(regother[0x007])/8;
-            std::vector<std::vector<float>> out = effecter.EQ3band(procL,procR,framesize,lowgain,midgain,highgain);
-            procL = out[0];
-            procR = out[1];
-            //printf("EQ3band %f %f %f\n",lowgain,midgain,highgain);
-        } else {
-            //procL = outL;
-            //procR = outR;
-        }
-        //printf("Register %x %x\n",regother[0x000],regother[0x001]);
-        if(regother[0x000] == 1) {
-            float threshold = (float)(regother[0x002])/255;
-            float ratio = (float)(regother[0x003])/255; 
-            float volume = (float)(regother[0x004])/32;
-            std::vector<std::vector<float>> out = effecter.Compressor(procL,procR,framesize,threshold,ratio,volume);
-            procL = out[0];
-            procR = out[1];
-            //printf("Compressor %f %f %f\n",threshold,ratio,volume);
-        } else {
-            //procL = outL;
-            //procR = outR;
-        }
-       
-        outL = procL;
-        outR = procR;
         for (int i=0;i<framesize*OVERSAMPLE_MULT;i++) {
             float tmpL = outL[i/OVERSAMPLE_MULT]*32767.0/4;
             float tmpR = outR[i/OVERSAMPLE_MULT]*32767.0/4;
@@ -546,13 +584,52 @@ public:
             frames[0][12][i/OVERSAMPLE_MULT] = tmpL;
             frames[1][12][i/OVERSAMPLE_MULT] = tmpR;
         }
-        reg.clear();
-        regenvl.clear();
-        regwt.clear();
         Total_time++;
         return frames;
     }
 
+    // マスター出力のみをレンダリングする（AudioCallBackのframes[.][12]と同じ値）
+    // 呼び出し側のバッファに書き込み、内部でメモリ確保を行わない（lenはreserveRender()以下であること）
+    void renderMaster(float* masterL, float* masterR, int len)
+    {
+        TRACE_SCOPE("S3HS::renderMaster");
+        snapshotRegisters();
+        for (int i = 0; i < len; i++) {
+            float result[12] = {0};
+            synthesizeSample(result);
+
+            float sumL = 0.0f, sumR = 0.0f;
+            for(int ch=0; ch<12; ch++) {
+                if (!regother[0x010+ch] == 1) {
+                    int panL, panR;
+                    getChannelPan(ch, panL, panR);
+                    float gain = ch >= 8 ? 1.3f/32768.0f : 1.0f/32768.0f;
+                    sumL += result[ch]*((float)(panL)/15)*gain;
+                    sumR += result[ch]*((float)(panR)/15)*gain;
+                }
+            }
+            masterL[i] = sumL;
+            masterR[i] = sumR;
+        }
+
+        applyMasterEffects(masterL, masterR, len);
+
+        for (int i = 0; i < len; i++) {
+            float tmpL = masterL[i]*32767.0f/4;
+            float tmpR = masterR[i]*32767.0f/4;
+            masterL[i] = tmpL < -32768.0f ? -32768.0f : (tmpL > 32767.0f ? 32767.0f : tmpL);
+            masterR[i] = tmpR < -32768.0f ? -32768.0f : (tmpR > 32767.0f ? 32767.0f : tmpR);
+        }
+        Total_time++;
+    }
+
+    // renderMaster()の最大長に合わせてレジスタ・エフェクタ用バッファを事前確保
+    void reserveRender() {
+        reg.reserve(512);
+        regwt.reserve(192);
+        regother.reserve(0x240);
+    }
+
     void initSound() {
         mt.seed(0);
         envl.resize(64,_envl);
@@ -606,8 +683,45 @@ public:
         t8[ch] = 0;
     }
 
+    // PCMチャンネルの再生位置（サンプル先頭からのサンプル数、synthesizeSample()のphaseと同じ計算）
+    unsigned int getPcmPosition(int ch) const {
+        return (unsigned int)((float)(twt[ch])/PHASE_RESOLUTION/S3HS_SAMPLE_FREQ*32);
+    }
+
     void wtSync(int ch) {
         twt[ch]=0;
+        adpcm[ch].reset();
+        pcmEnded[ch] = false;
+    }
+
+    // ワンショットのPCM（モード0/6）が終端に達して止まっているか
+    bool isPcmEnded(int ch) const {
+        return pcmEnded[ch];
+    }
+
+    // FMチャンネルのエンベロープレベル（8オペレータ中の最大値, 0.0-1.0）
+    double getChannelEnvLevel(int ch) const {
+        double level = 0.0;
+        for (int i=0;i<8;i++) {
+            level = MAX(level, envl[(size_t)(ch*8+i)].currentLevel());
+        }
+        return level;
+    }
+
+    // FMチャンネルのエンベロープ状態（8オペレータ中で最も進んでいないもの）
+    EnvGenerator::State getChannelEnvState(int ch) const {
+        EnvGenerator::State state = EnvGenerator::State::Release;
+        for (int i=0;i<8;i++) {
+            EnvGenerator::State opState = envl[(size_t)(ch*8+i)].state();
+            if ((int)opState < (int)state) state = opState;
+        }
+        return state;
+    }
+
+    // リリースが終わり、もう音が出ないチャンネルか（vols[]が0に丸められるレベル以下）
+    bool isChannelFinished(int ch) const {
+        return getChannelEnvState(ch) == EnvGenerator::State::Release
+            && getChannelEnvLevel(ch) * 255.0 < 1.0;
     }
 
     int putDMABuffer(int ch, unsigned char* data, size_t dataSize) 
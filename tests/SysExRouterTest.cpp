@@ -0,0 +1,94 @@
+// SysExRouterTest.cpp
+// 3HSPlug PCMアップロードのTable Entryが、format省略時（13バイト）とformat付き（14バイト）の
+// どちらもルーティングされることを確認する
+#include "SysExRouter.h"
+#include "PcmUploadManager.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            printf("[SysExRouterTest] FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (0)
+
+// 7D 33 48 <cmd> <payload> <checksum>（F0/F7なし）を組み立てる
+static std::vector<uint8_t> make3HSMessage(uint8_t command, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> msg = { SysExRouter::threeHSManufacturer, SysExRouter::threeHSSignature1,
+                                 SysExRouter::threeHSSignature2, command };
+    msg.insert(msg.end(), payload.begin(), payload.end());
+    unsigned int sum = 0;
+    for (uint8_t b : msg) sum += b;
+    msg.push_back(static_cast<uint8_t>((0x80 - (sum & 0x7F)) & 0x7F));
+    return msg;
+}
+
+// PluginProcessorと同じ範囲でTable Entryのルートを登録する
+static void addTableEntryRoute(SysExRouter& router, int& received, int& receivedSize) {
+    router.add3HSRoute(PcmUploadManager::TableEntry, PcmUploadManager::tableEntryMinPayload,
+                       PcmUploadManager::tableEntryMaxPayload, [&](const SysExRouter::Message& m) {
+        ++received;
+        receivedSize = m.payloadSize;
+    });
+}
+
+static void testTableEntryWithFormatByte() {
+    SysExRouter router;
+    router.setLogUnrouted(false);
+    int received = 0;
+    int receivedSize = 0;
+    addTableEntryRoute(router, received, receivedSize);
+
+    // note 36, start 0, length 0x100, 22050Hz, format 1 (ADPCM)
+    std::vector<uint8_t> payload = { 36, 0, 0, 0, 0, 0, 0, 0x02, 0x00, 0, 0x01, 0x2C, 0x22, 0x01 };
+    std::vector<uint8_t> msg = make3HSMessage(PcmUploadManager::TableEntry, payload);
+    CHECK(router.dispatch(msg.data(), static_cast<int>(msg.size())));
+    CHECK(received == 1);
+    CHECK(receivedSize == 14);
+    CHECK(router.getRejectedCount() == 0);
+}
+
+static void testTableEntryWithoutFormatByte() {
+    SysExRouter router;
+    router.setLogUnrouted(false);
+    int received = 0;
+    int receivedSize = 0;
+    addTableEntryRoute(router, received, receivedSize);
+
+    std::vector<uint8_t> payload = { 36, 0, 0, 0, 0, 0, 0, 0x02, 0x00, 0, 0x01, 0x2C, 0x22 };
+    std::vector<uint8_t> msg = make3HSMessage(PcmUploadManager::TableEntry, payload);
+    CHECK(router.dispatch(msg.data(), static_cast<int>(msg.size())));
+    CHECK(received == 1);
+    CHECK(receivedSize == 13);
+}
+
+static void testTableEntryTooLongIsRejected() {
+    SysExRouter router;
+    router.setLogUnrouted(false);
+    int received = 0;
+    int receivedSize = 0;
+    addTableEntryRoute(router, received, receivedSize);
+
+    std::vector<uint8_t> payload(15, 0);
+    std::vector<uint8_t> msg = make3HSMessage(PcmUploadManager::TableEntry, payload);
+    CHECK(!router.dispatch(msg.data(), static_cast<int>(msg.size())));
+    CHECK(received == 0);
+    CHECK(router.getRejectedCount() == 1);
+}
+
+int main() {
+    testTableEntryWithFormatByte();
+    testTableEntryWithoutFormatByte();
+    testTableEntryTooLongIsRejected();
+    if (failures == 0) {
+        printf("[SysExRouterTest] All tests passed\n");
+        return EXIT_SUCCESS;
+    }
+    printf("[SysExRouterTest] %d check(s) failed\n", failures);
+    return EXIT_FAILURE;
+}
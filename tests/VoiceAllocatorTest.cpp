@@ -0,0 +1,73 @@
+// VoiceAllocatorTest.cpp
+// チップを外す途中（休止中のチップのボイスが鳴り終わるのを待っている間）に、
+// 新しいノートが休止中のチップのボイスを奪わないことを確認する
+#include "VoiceAllocator.h"
+#include <cstdio>
+#include <cstdlib>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            printf("[VoiceAllocatorTest] FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                          \
+        }                                                                        \
+    } while (0)
+
+static void testDrainKeepsNewNotesOffDormantChip(VoiceAllocator::Strategy strategy, const char* name) {
+    const int voicesPerChip = 8;
+    const int chips = 4;
+    VoiceAllocator allocator;
+    allocator.reset(chips * voicesPerChip, voicesPerChip);
+    allocator.setStrategy(strategy);
+
+    // 全ボイスを鳴らす
+    int note = 0;
+    for (int v = 0; v < chips * voicesPerChip; ++v, ++note) {
+        int voice = allocator.chooseVoice(1, note);
+        allocator.assign(voice, 1, note);
+    }
+
+    // 最後のチップを外し始める（その後チップ上のボイスはリリースに入り、どれよりも小さい音量で鳴っている）
+    allocator.setEnabledChips(chips - 1);
+    const int enabledVoices = (chips - 1) * voicesPerChip;
+    for (int v = enabledVoices; v < chips * voicesPerChip; ++v) {
+        allocator.release(v);
+        allocator.updateRelease(v, false, 0.01f);
+    }
+
+    // 鳴らし続ける: 空きが無いので奪うことになるが、休止中のチップのボイスは選ばれてはならない
+    for (int i = 0; i < 200; ++i, ++note) {
+        int n = note % 128;
+        int voice = allocator.chooseVoice(2, n);
+        CHECK(voice >= 0 && voice < enabledVoices);
+        if (voice < 0 || voice >= enabledVoices) {
+            printf("[VoiceAllocatorTest] %s: note %d got dormant voice %d\n", name, n, voice);
+            return;
+        }
+        allocator.assign(voice, 2, n);
+        if (i % 3 == 0) {
+            allocator.release(voice);
+            allocator.updateRelease(voice, false, 0.5f);
+        }
+    }
+
+    // 休止中のチップはリリースが終われば空になる
+    for (int v = enabledVoices; v < chips * voicesPerChip; ++v) {
+        allocator.updateRelease(v, true, 0.0f);
+    }
+    CHECK(allocator.isChipIdle(chips - 1));
+}
+
+int main() {
+    testDrainKeepsNewNotesOffDormantChip(VoiceAllocator::Strategy::Rolling, "Rolling");
+    testDrainKeepsNewNotesOffDormantChip(VoiceAllocator::Strategy::OldestFirst, "OldestFirst");
+    testDrainKeepsNewNotesOffDormantChip(VoiceAllocator::Strategy::LoadBalanced, "LoadBalanced");
+    if (failures > 0) {
+        printf("[VoiceAllocatorTest] %d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("[VoiceAllocatorTest] All tests passed\n");
+    return EXIT_SUCCESS;
+}
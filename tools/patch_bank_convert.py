@@ -0,0 +1,97 @@
+# パッチバンクのJSON（<bank>.json）とバイナリ（<bank>.3hsb）を相互変換する
+# 使い方:
+#   python patch_bank_convert.py 0.json            -> 0.3hsb を出力
+#   python patch_bank_convert.py 0.3hsb            -> 0.json を出力
+#   python patch_bank_convert.py patches/          -> フォルダ内の全JSONを.3hsbに変換
+# 形式はsrc/PatchBankData.hのPATCH_BINARY_*の説明を参照
+import json
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b"3HSB"
+VERSION = 1
+HEADER_SIZE = 16
+RECORD_SIZE = 72
+PATCH_COUNT = 128
+
+def json_to_binary(patch_data):
+    records = bytearray(RECORD_SIZE * PATCH_COUNT)
+    for patch in patch_data.get("patches", []):
+        program = patch.get("program", 0)
+        if not 0 <= program < PATCH_COUNT:
+            print(f"Warning: Invalid program number {program}, skipped")
+            continue
+        offset = program * RECORD_SIZE
+        struct.pack_into("<BBBb4x", records, offset, 1,
+                         patch.get("modmode", 4) & 0xFF,
+                         patch.get("feedback", 0x80) & 0xFF,
+                         max(-128, min(127, patch.get("keyShift", 0))))
+        operators = patch.get("operators", [])
+        for j in range(8):
+            op = operators[j] if j < len(operators) else {}
+            struct.pack_into("<H6B", records, offset + 8 + j * 8,
+                             op.get("frequency", 0) & 0xFFFF,
+                             op.get("attack", 0) & 0xFF,
+                             op.get("decay", 0) & 0xFF,
+                             op.get("sustain", 0) & 0xFF,
+                             op.get("release", 0) & 0xFF,
+                             op.get("volume", 0) & 0xFF,
+                             op.get("waveform", 0) & 0xFF)
+    header = struct.pack("<4sHHHHI", MAGIC, VERSION, RECORD_SIZE, PATCH_COUNT, 0, zlib.crc32(records) & 0xFFFFFFFF)
+    return header + bytes(records)
+
+def binary_to_json(data):
+    magic, version, record_size, count, _, crc = struct.unpack_from("<4sHHHHI", data, 0)
+    if magic != MAGIC or version != VERSION or record_size != RECORD_SIZE or count != PATCH_COUNT:
+        raise ValueError("Not a supported .3hsb file")
+    records = data[HEADER_SIZE:HEADER_SIZE + RECORD_SIZE * PATCH_COUNT]
+    if len(records) != RECORD_SIZE * PATCH_COUNT or (zlib.crc32(records) & 0xFFFFFFFF) != crc:
+        raise ValueError("Checksum mismatch")
+    patches = []
+    for program in range(PATCH_COUNT):
+        offset = program * RECORD_SIZE
+        defined, modmode, feedback, key_shift = struct.unpack_from("<BBBb4x", records, offset)
+        if not defined:
+            continue
+        operators = []
+        for j in range(8):
+            frequency, attack, decay, sustain, release, volume, waveform = struct.unpack_from("<H6B", records, offset + 8 + j * 8)
+            operators.append({"frequency": frequency, "attack": attack, "decay": decay, "sustain": sustain,
+                              "release": release, "volume": volume, "waveform": waveform})
+        patches.append({"program": program, "modmode": modmode, "feedback": feedback,
+                        "keyShift": key_shift, "operators": operators})
+    return {"patches": patches}
+
+def convert(path):
+    base, ext = os.path.splitext(path)
+    if ext.lower() == ".json":
+        with open(path, "r", encoding="utf-8") as f:
+            data = json_to_binary(json.load(f))
+        with open(base + ".3hsb", "wb") as f:
+            f.write(data)
+        print(f"{path} -> {base}.3hsb")
+    elif ext.lower() == ".3hsb":
+        with open(path, "rb") as f:
+            patch_data = binary_to_json(f.read())
+        with open(base + ".json", "w", encoding="utf-8") as f:
+            json.dump(patch_data, f, indent=2)
+        print(f"{path} -> {base}.json")
+    else:
+        print(f"Skipped: {path}")
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: python patch_bank_convert.py <bank.json | bank.3hsb | directory> ...")
+        sys.exit(1)
+    for arg in sys.argv[1:]:
+        if os.path.isdir(arg):
+            for name in sorted(os.listdir(arg)):
+                if name.lower().endswith(".json"):
+                    convert(os.path.join(arg, name))
+        else:
+            convert(arg)
+
+if __name__ == "__main__":
+    main()
@@ -267,82 +267,86 @@ class PatchEditor:
         print(f"Created SysEx: {[hex(b) for b in [0xF0]+sysex+[0xF7]]}")
         return sysex
 
+    # パッチイメージ（Patch Overrideの相対アドレス0x00～0x40と同じ配置、65バイト）
+    def build_patch_image(self, patch):
+        image = [0] * 0x41
+        operators = patch.get("operators", [])
+        for op_index in range(8):
+            operator = operators[op_index] if op_index < len(operators) else {}
+            frequency = operator.get("frequency", 0) & 0xFFFF
+            image[op_index * 2] = frequency >> 8
+            image[op_index * 2 + 1] = frequency & 0xFF
+            image[0x10 + op_index] = operator.get("volume", 0) & 0xFF
+            waveform = operator.get("waveform", 0) & 0x0F
+            if op_index % 2 == 0:
+                image[0x18 + op_index // 2] |= waveform << 4
+            else:
+                image[0x18 + op_index // 2] |= waveform
+            image[0x20 + op_index * 4 + 0] = operator.get("attack", 0) & 0xFF
+            image[0x20 + op_index * 4 + 1] = operator.get("decay", 0) & 0xFF
+            image[0x20 + op_index * 4 + 2] = operator.get("sustain", 0) & 0xFF
+            image[0x20 + op_index * 4 + 3] = operator.get("release", 0) & 0xFF
+        image[0x1C] = patch.get("modmode", 4) & 0xFF
+        image[0x1F] = patch.get("feedback", 128) & 0xFF
+        image[0x40] = patch.get("keyShift", 0) & 0xFF
+        return image
+
+    @staticmethod
+    def nibblize(data):
+        out = []
+        for b in data:
+            out += [(b & 0xF0) >> 4, b & 0x0F]
+        return out
+
+    @staticmethod
+    def finish_3hs_sysex(sysex):
+        checksum = (-(sum(sysex) & 0x7F)) & 0x7F
+        sysex.append(checksum)
+        return sysex
+
+    # 3HSPlug Bulk Patch Dump (SysEx: F0 7D 33 48 04 <bank#> <patch#> <image 65 bytes, MSB/LSB nibbles> <checksum> F7)
+    def create_bulk_patch_sysex(self, bank_num, patch_num, patch):
+        sysex = [0x7D, 0x33, 0x48, 0x04, bank_num & 0x7F, patch_num & 0x7F]
+        sysex += self.nibblize(self.build_patch_image(patch))
+        return self.finish_3hs_sysex(sysex)
+
+    # 3HSPlug Bulk Bank Dump (SysEx: F0 7D 33 48 05 <bank#> { <defined(00/01)> <image 65 bytes, MSB/LSB nibbles> } x 128 <checksum> F7)
+    def create_bulk_bank_sysex(self, bank_num, patches):
+        by_program = {p.get("program", 0): p for p in patches}
+        sysex = [0x7D, 0x33, 0x48, 0x05, bank_num & 0x7F]
+        for program in range(128):
+            patch = by_program.get(program)
+            if patch is None:
+                sysex += [0x00] + [0x00] * (0x41 * 2)
+            else:
+                sysex += [0x01] + self.nibblize(self.build_patch_image(patch))
+        return self.finish_3hs_sysex(sysex)
+
+    def send_sysex_list(self, sysexes):
+        ports = mido.get_output_names()
+        if not ports:
+            messagebox.showerror("MIDI Error", "No MIDI output ports available")
+            return
+        try:
+            with mido.open_output(ports[0]) as outport:
+                for sysex in sysexes:
+                    outport.send(mido.Message('sysex', data=sysex))  # F0とF7はmidoが自動で追加
+        except (AttributeError, OSError) as e:
+            messagebox.showerror("MIDI Error", f"Failed to send SysEx: No MIDI output port available or rtmidi error.\n{str(e)}")
+
     def send_sysex_message(self, patchnum):
-        sysexes = []
-        for addr in range(0x00, 0x41):
-                if 0x02 <= addr <= 0x0F:  # OP2-8 frequency MSB/LSB
-                    op_index = addr // 2
-                    try:
-                        operator = self.current_patch["operators"][op_index]
-                    except IndexError:
-                        continue # オペレーターが存在しない場合は終了
-                    if addr % 2 == 0: # MSB
-                        frequency = operator.get("frequency", 0) >> 8
-                    else: # LSB
-                        frequency = operator.get("frequency", 0) & 0xFF
-                    sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, frequency))  # 例: bank 0, patch patchnum, relative addr addr, data 0x00
-                if 0x10 <= addr <= 0x17:  # Volume
-                    op_index = addr - 0x10
-                    try:
-                        operator = self.current_patch["operators"][op_index]
-                    except IndexError:
-                        continue # オペレーターが存在しない場合は終了
-                    volume = operator.get("volume", 0)
-                    sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, volume))
-                if 0x18 <= addr <= 0x1B:  # Waveform
-                    op_index = (addr - 0x18) * 2
-                    try:
-                        operator = self.current_patch["operators"][op_index]
-                        operator2 = self.current_patch["operators"][op_index + 1]
-                    except IndexError:
-                        continue # オペレーターが存在しない場合は終了
-                    if addr % 2 == 0:  # MSB
-                        waveform = (operator.get("waveform", 0) & 0x0F) << 4
-                        waveform += operator2.get("waveform", 0) & 0x0F
-                        sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, waveform))
-                if addr == 0x1C:  # Modulation mode
-                    modmode = self.current_patch.get("modmode", 4)
-                    sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, modmode))
-                if addr == 0x1F:  # Feedback
-                    feedback = self.current_patch.get("feedback", 128)
-                    sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, feedback))
-                if 0x20 <= addr <= 0x3F:  # ADSR
-                    op_index = (addr - 0x20) // 4
-                    modulo = (addr - 0x20) % 4
-                    try:
-                        operator = self.current_patch["operators"][op_index]
-                    except IndexError:
-                        continue # オペレーターが存在しない場合は終了
-                    match modulo:
-                        case 0:  # Attack
-                            attack = operator.get("attack", 0)
-                            sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, attack))
-                        case 1:  # Decay
-                            decay = operator.get("decay", 0)
-                            sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, decay))
-                        case 2:  # Sustain
-                            sustain = operator.get("sustain", 0)
-                            sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, sustain))
-                        case 3:  # Release
-                            release = operator.get("release", 0)
-                            sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, release))
-                if addr == 0x40:  # Key Shift
-                    keyshift = self.current_patch.get("keyShift", 0) & 0xFF
-                    sysexes.append(self.create_patch_override_sysex(0, patchnum, addr, keyshift))
-                else:  # その他のアドレスはスキップ
-                    continue
-        for sysex in sysexes:
-            ports = mido.get_output_names()
-            if not ports:
-                messagebox.showerror("MIDI Error", "No MIDI output ports available")
-                return
-            msg = mido.Message('sysex', data=sysex)  # F0とF7はmidoが自動で追加
-            try:
-                with mido.open_output(ports[0]) as outport:
-                    outport.send(msg)
-            except (AttributeError, OSError) as e:
-                messagebox.showerror("MIDI Error", f"Failed to send SysEx: No MIDI output port available or rtmidi error.\n{str(e)}")
-                return
+        # パッチ全体を1メッセージで送信する（従来は相対アドレスごとに65メッセージ）
+        sysex = self.create_bulk_patch_sysex(0, patchnum, self.current_patch)
+        print(f"Created Bulk Patch SysEx: patch {patchnum}, {len(sysex) + 2} bytes")
+        self.send_sysex_list([sysex])
+
+    def send_bank_sysex(self):
+        if not self.patch_data["patches"]:
+            messagebox.showwarning("No Patches", "There are no patches to send")
+            return
+        sysex = self.create_bulk_bank_sysex(0, self.patch_data["patches"])
+        print(f"Created Bulk Bank SysEx: {len(self.patch_data['patches'])} patches, {len(sysex) + 2} bytes")
+        self.send_sysex_list([sysex])
 
     def send_current_patch_sysex(self):
         if not self.current_patch:
@@ -510,6 +514,7 @@ class PatchEditor:
         ttk.Button(button_frame, text="Sort by Program#", command=self.sort_patches_by_program).pack(pady=2)
         ttk.Button(button_frame, text="Duplicate Patch...", command=self.duplicate_patch_dialog).pack(pady=2)
         ttk.Button(button_frame, text="Send SysEx", command=self.send_current_patch_sysex).pack(pady=2)
+        ttk.Button(button_frame, text="Send Bank SysEx", command=self.send_bank_sysex).pack(pady=2)
         ttk.Button(button_frame, text="Import from .fui file...", command=self.import_fui).pack(pady=2)
         
         # 右側パネル: パッチエディター